@@ -716,6 +716,11 @@ static int ethernet_server_connect(struct perftest_comm *comm)
 	int sockfd = -1, connfd;
 	char *src_ip = comm->rdma_params->has_source_ip ? comm->rdma_params->source_ip : NULL;
 
+	if (comm->rdma_params->daemon && comm->listen_fd >= 0) {
+		sockfd = comm->listen_fd;
+		goto accept_client;
+	}
+
 	memset(&hints, 0, sizeof hints);
 	hints.ai_flags    = AI_PASSIVE;
 	hints.ai_family   = AF_INET;
@@ -747,15 +752,21 @@ static int ethernet_server_connect(struct perftest_comm *comm)
 	}
 
 	listen(sockfd, 1);
+	if (comm->rdma_params->daemon)
+		comm->listen_fd = sockfd;
+
+accept_client:
 	connfd = accept(sockfd, NULL, 0);
 
 	if (connfd < 0) {
 		perror("server accept");
 		log_ebt( "accept() failed\n");
-		close(sockfd);
+		if (!comm->rdma_params->daemon)
+			close(sockfd);
 		return 1;
 	}
-	close(sockfd);
+	if (!comm->rdma_params->daemon)
+		close(sockfd);
 	comm->rdma_params->sockfd = connfd;
 	return 0;
 }
@@ -1255,6 +1266,8 @@ int create_comm_struct(struct perftest_comm *comm,
 	comm->rdma_params->use_old_post_send	= user_param->use_old_post_send;
 	comm->rdma_params->source_ip		= user_param->source_ip;
 	comm->rdma_params->has_source_ip	= user_param->has_source_ip;
+	comm->rdma_params->daemon		= user_param->daemon;
+	comm->listen_fd				= -1;
 
 	if (user_param->use_rdma_cm) {
 
@@ -1292,6 +1305,11 @@ int create_comm_struct(struct perftest_comm *comm,
 		return FAILURE;
 	}
 
+	if (user_param->perf_events && cpu_stats_open(&user_param->cpu_stats)) {
+		log_ebt(" Unable to access the CPU performance counters\n");
+		return FAILURE;
+	}
+
 	return SUCCESS;
 }
 
@@ -1345,6 +1363,16 @@ int ctx_hand_shake(struct perftest_comm *comm,
 
 	}
 
+	/* the other side is a thread of this process, take its dest as it is */
+	if (comm->loopback) {
+		if (loopback_xchg(comm->loopback, comm->rdma_params->machine, my_dest, rem_dest, sizeof(struct pingpong_dest))) {
+			log_ebt(" Unable to exchange with the loopback side\n");
+			return 1;
+		}
+		rem_dest->gid_index = my_dest->gid_index;
+		return 0;
+	}
+
 	rem_dest->gid_index = my_dest->gid_index;
 	if (comm->rdma_params->servername) {
 		if ((*write_func_ptr)(my_dest,comm)) {
@@ -1549,7 +1577,10 @@ int ctx_xchg_data( struct perftest_comm *comm,
 		void *my_data,
 		void *rem_data,int size)
 {
-	if (comm->rdma_params->use_rdma_cm || comm->rdma_params->work_rdma_cm) {
+	if (comm->loopback) {
+		if (loopback_xchg(comm->loopback,comm->rdma_params->machine,my_data,rem_data,size))
+			return 1;
+	} else if (comm->rdma_params->use_rdma_cm || comm->rdma_params->work_rdma_cm) {
 		if (ctx_xchg_data_rdma(comm,my_data,rem_data,size))
 			return 1;
 	} else {
@@ -1707,7 +1738,7 @@ int ctx_close_connection(struct perftest_comm *comm,
 		return 1;
 	}
 
-	if (!comm->rdma_params->use_rdma_cm && !comm->rdma_params->work_rdma_cm) {
+	if (!comm->rdma_params->use_rdma_cm && !comm->rdma_params->work_rdma_cm && !comm->loopback) {
 
 		if (write(comm->rdma_params->sockfd,"done",sizeof "done") != sizeof "done") {
 			perror(" Client write");
@@ -1903,6 +1934,36 @@ int check_mtu(struct ibv_context *context,struct perftest_parameters *user_param
 	return SUCCESS;
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+int check_lat_depth(struct perftest_comm *user_comm, struct perftest_parameters *user_param)
+{
+	int m_lat_depth = hton_int(user_param->lat_depth);
+	int rem_lat_depth = 0;
+
+	/* keep the ping-pong flow on the wire as it is, a ping-pong peer
+	 * reads the exchange as the next message of its flow and fails there
+	 */
+	if (user_param->dont_xchg_versions || user_param->lat_depth <= 1)
+		return SUCCESS;
+
+	if (ctx_xchg_data(user_comm,(void*)(&m_lat_depth),(void*)(&rem_lat_depth),sizeof(int))) {
+		log_ebt(" Failed to exchange the latency queue depth between server and client\n");
+		return FAILURE;
+	}
+
+	/* the pipelined and the ping-pong flows can't talk to each other */
+	rem_lat_depth = ntoh_int(rem_lat_depth);
+	if (rem_lat_depth != user_param->lat_depth) {
+		log_ebt(" --lat_depth is %d here and %d on the other side, both sides need the same one\n",
+			user_param->lat_depth, rem_lat_depth);
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
 /******************************************************************************
 *
 ******************************************************************************/
@@ -2162,6 +2223,24 @@ void rdma_cm_connect_error(struct pingpong_context *ctx)
 	ctx->cma_master.connects_left--;
 }
 
+/******************************************************************************
+*
+******************************************************************************/
+int rdma_cm_resolve_next(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param)
+{
+	struct cma_node *cm_node;
+
+	if (ctx->cma_master.resolve_index >= user_param->num_of_qps)
+		return SUCCESS;
+
+	cm_node = &ctx->cma_master.nodes[ctx->cma_master.resolve_index++];
+	cm_node->resolve_start = get_cycles();
+	return rdma_resolve_addr(cm_node->cma_id,
+		ctx->cma_master.rai->ai_src_addr,
+		ctx->cma_master.rai->ai_dst_addr, 2000);
+}
+
 /******************************************************************************
 *
 ******************************************************************************/
@@ -2170,6 +2249,9 @@ int rdma_cm_address_handler(struct pingpong_context *ctx,
 {
 	int rc;
 	char *error_message = "";
+	struct cma_node *cm_node = cma_id->context;
+
+	cm_node->addr_resolved = get_cycles();
 
 	if (user_param->tos != DEF_TOS) {
 		rc = rdma_set_option(cma_id, RDMA_OPTION_ID,
@@ -2204,12 +2286,14 @@ int rdma_cm_route_handler(struct pingpong_context *ctx,
 	int rc, connection_index;
 	char *error_message = "";
 	struct rdma_conn_param conn_param;
+	struct cma_node *cm_node = cma_id->context;
 
+	cm_node->route_resolved = get_cycles();
 	ctx->context = cma_id->verbs;
 	connection_index = ctx->cma_master.connection_index;
 
 	// Initialization of client contexts in case of first connection:
-	if (connection_index == 0) {
+	if (connection_index == 0 && ctx->cma_master.storm_round == 0) {
 		rc = ctx_init(ctx, user_param);
 		if (rc) {
 			error_message = "Failed to initialize RDMA contexts.";
@@ -2223,6 +2307,8 @@ int rdma_cm_route_handler(struct pingpong_context *ctx,
 		error_message = "Failed to create QP.";
 		goto error;
 	}
+	/* the contexts of the first connection are set up here too, keep it out of the connect phase */
+	cm_node->qp_created = get_cycles();
 
 	memset(&conn_param, 0, sizeof conn_param);
 
@@ -2241,6 +2327,7 @@ int rdma_cm_route_handler(struct pingpong_context *ctx,
 		error_message = "Failed to connect through RDMA CM.";
 		goto error;
 	}
+	cm_node->connect_sent = get_cycles();
 
 	ctx->cma_master.nodes[connection_index].connected = 1;
 	ctx->cma_master.connection_index++;
@@ -2276,7 +2363,7 @@ int rdma_cm_connection_request_handler(struct pingpong_context *ctx,
 
 	ctx->context = cma_id->verbs;
 	// Initialization of server contexts in case of first connection:
-	if (connection_index == 0) {
+	if (connection_index == 0 && ctx->cma_master.storm_round == 0) {
 		rc = ctx_init(ctx, user_param);
 		if (rc) {
 			error_message = "Failed to initialize RDMA contexts.";
@@ -2357,8 +2444,16 @@ int rdma_cm_connection_established_handler(struct pingpong_context *ctx,
 	}
 
 	if (user_param->machine == CLIENT) {
+		((struct cma_node*)event->id->context)->established = get_cycles();
 		ctx->cma_master.connects_left--;
 		ctx->cma_master.disconnects_left++;
+
+		/* Keep the in-flight connections window full */
+		rc = rdma_cm_resolve_next(ctx, user_param);
+		if (rc) {
+			error_message = "Failed to resolve RDMA CM address.";
+			goto error;
+		}
 	}
 
 	return rc;
@@ -2585,7 +2680,7 @@ error:
 int _rdma_cm_client_connection(struct pingpong_context *ctx,
 		struct perftest_parameters *user_param, struct rdma_addrinfo *hints)
 {
-	int i, rc;
+	int i, rc, in_flight;
 	char error_message[ERROR_MSG_SIZE] = "";
 
 	rc = rdma_cm_get_rdma_address(user_param, hints, &ctx->cma_master.rai);
@@ -2595,10 +2690,11 @@ int _rdma_cm_client_connection(struct pingpong_context *ctx,
 		goto error;
 	}
 
-	for (i = 0; i < user_param->num_of_qps; i++) {
-		rc = rdma_resolve_addr(ctx->cma_master.nodes[i].cma_id,
-			ctx->cma_master.rai->ai_src_addr,
-			ctx->cma_master.rai->ai_dst_addr, 2000);
+	in_flight = user_param->cm_inflight ? user_param->cm_inflight : user_param->num_of_qps;
+	ctx->cma_master.resolve_index = 0;
+
+	for (i = 0; i < in_flight; i++) {
+		rc = rdma_cm_resolve_next(ctx, user_param);
 		if (rc) {
 			sprintf(error_message, "Failed to resolve RDMA CM address.");
 			rdma_cm_connect_error(ctx);
@@ -2648,6 +2744,141 @@ error:
 	return error_handler(error_message);
 }
 
+/******************************************************************************
+*
+******************************************************************************/
+int rdma_cm_storm_reset(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param, struct rdma_addrinfo *hints)
+{
+	int rc = SUCCESS, i;
+	char *error_message = "";
+	struct rdma_cm_event *event;
+	struct cma_node *cm_node;
+
+	if (user_param->machine == CLIENT) {
+		rc = rdma_cm_disconnect_nodes(ctx, user_param);
+		if (rc) {
+			error_message = "Failed to disconnect RDMA CM nodes.";
+			goto error;
+		}
+	} else {
+		/* The client disconnects, answer every request so it doesn't wait
+		 * for the DREQ timeout.
+		 */
+		ctx->cma_master.disconnects_left = user_param->num_of_qps;
+		while (ctx->cma_master.disconnects_left) {
+			rc = rdma_get_cm_event(ctx->cma_master.channel, &event);
+			if (rc) {
+				error_message = "Failed to get RDMA CM event.";
+				goto error;
+			}
+
+			if (event->event == RDMA_CM_EVENT_DISCONNECTED) {
+				rdma_disconnect(event->id);
+				rdma_cm_disconnect_handler(ctx);
+			}
+
+			rc = rdma_ack_cm_event(event);
+			if (rc) {
+				error_message = "Failed to ACK RDMA CM event after handling.";
+				goto error;
+			}
+		}
+	}
+
+	rdma_cm_destroy_qps(ctx, user_param);
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		cm_node = &ctx->cma_master.nodes[i];
+		rc = rdma_destroy_id(cm_node->cma_id);
+		if (rc) {
+			error_message = "Failed to destroy RDMA CM ID.";
+			goto error;
+		}
+		cm_node->cma_id = NULL;
+		cm_node->connected = 0;
+
+		if (user_param->machine == CLIENT) {
+			rc = rdma_create_id(ctx->cma_master.channel, &cm_node->cma_id,
+				cm_node, hints->ai_port_space);
+			if (rc) {
+				error_message = "Failed to create RDMA CM ID.";
+				goto error;
+			}
+		}
+	}
+
+	rdma_freeaddrinfo(ctx->cma_master.rai);
+	ctx->cma_master.rai = NULL;
+	ctx->cma_master.connection_index = 0;
+	ctx->cma_master.connects_left = user_param->num_of_qps;
+	ctx->cma_master.disconnects_left = 0;
+	ctx->cma_master.storm_round++;
+	return rc;
+
+error:
+	return error_handler(error_message);
+}
+
+/******************************************************************************
+*
+******************************************************************************/
+void rdma_cm_storm_report(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param,
+		struct cm_storm_report_data *rep)
+{
+	int i;
+	cycles_t first = 0, last = 0;
+	struct cma_node *cm_node;
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		cm_node = &ctx->cma_master.nodes[i];
+		rep->phase_cycles[CM_ADDR_RESOLVE][i] = cm_node->addr_resolved - cm_node->resolve_start;
+		rep->phase_cycles[CM_ROUTE_RESOLVE][i] = cm_node->route_resolved - cm_node->addr_resolved;
+		rep->phase_cycles[CM_QP_SETUP][i] = cm_node->qp_created - cm_node->route_resolved;
+		rep->phase_cycles[CM_CONNECT][i] = cm_node->connect_sent - cm_node->qp_created;
+		rep->phase_cycles[CM_ESTABLISH][i] = cm_node->established - cm_node->connect_sent;
+
+		if (!i || cm_node->resolve_start < first)
+			first = cm_node->resolve_start;
+		if (cm_node->established > last)
+			last = cm_node->established;
+	}
+
+	rep->round = ctx->cma_master.storm_round;
+	rep->connections = user_param->num_of_qps;
+	rep->test_cycles = last - first;
+	print_report_cm_storm(user_param, rep);
+}
+
+/******************************************************************************
+*
+******************************************************************************/
+static int check_cm_storm(struct perftest_comm *comm, struct perftest_parameters *user_param)
+{
+	int m_cm_storm = hton_int(user_param->cm_storm);
+	int rem_cm_storm = 0;
+
+	/* as in check_lat_depth, a run without --cm_storm exchanges nothing */
+	if (user_param->dont_xchg_versions || !user_param->cm_storm)
+		return SUCCESS;
+
+	if (ctx_xchg_data(comm,(void*)(&m_cm_storm),(void*)(&rem_cm_storm),sizeof(int))) {
+		log_ebt(" Failed to exchange the number of storm rounds between server and client\n");
+		return FAILURE;
+	}
+
+	/* every round but the last tears the connections down on both sides */
+	rem_cm_storm = ntoh_int(rem_cm_storm);
+	if (rem_cm_storm != user_param->cm_storm) {
+		log_ebt(" --cm_storm is %d here and %d on the other side, both sides need the same one\n",
+			user_param->cm_storm, rem_cm_storm);
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
 /******************************************************************************
 *
 ******************************************************************************/
@@ -2655,11 +2886,14 @@ int create_rdma_cm_connection(struct pingpong_context *ctx,
 		struct perftest_parameters *user_param, struct perftest_comm *comm,
 		struct pingpong_dest *my_dest, struct pingpong_dest *rem_dest)
 {
-	int rc;
+	int rc, p, round;
+	int rounds = user_param->cm_storm ? user_param->cm_storm : 1;
 	char *error_message = "";
 	struct rdma_addrinfo hints;
+	struct cm_storm_report_data rep;
 
 	memset(&hints, 0, sizeof(hints));
+	memset(&rep, 0, sizeof(rep));
 	ctx->cma_master.connects_left = user_param->num_of_qps;
 
 	ctx->cma_master.channel = rdma_create_event_channel();
@@ -2674,31 +2908,61 @@ int create_rdma_cm_connection(struct pingpong_context *ctx,
 		goto error;
 	}
 
-	rc = ctx_hand_shake(comm, &my_dest[0], &rem_dest[0]);
+	rc = check_cm_storm(comm, user_param);
 	if (rc) {
-		error_message = "Failed to sync between client and server "
-			"before creating RDMA CM connection.";
+		error_message = "Failed to agree on the number of storm rounds.";
 		goto error;
 	}
 
-	if (user_param->machine == CLIENT) {
-		rc = rdma_cm_client_connection(ctx, user_param, &hints);
-	} else {
-		rc = rdma_cm_server_connection(ctx, user_param, &hints);
+	if (user_param->cm_storm && user_param->machine == CLIENT) {
+		for (p = 0; p < CM_STORM_PHASES; p++)
+			ALLOCATE(rep.phase_cycles[p], cycles_t, user_param->num_of_qps);
 	}
 
-	if (rc) {
-		error_message = "Failed to create RDMA CM connection.";
-		goto error;
-	}
+	/* Every storm round but the last tears the connections down again,
+	 * the test runs on the QPs of the last round.
+	 */
+	for (round = 0; round < rounds; round++) {
+		if (round) {
+			rc = rdma_cm_storm_reset(ctx, user_param, &hints);
+			if (rc) {
+				error_message = "Failed to reset RDMA CM connection.";
+				goto error;
+			}
+		}
 
-	rc = ctx_hand_shake(comm, &my_dest[0], &rem_dest[0]);
-	if (rc) {
-		error_message = "Failed to sync between client and server "
-			"after creating RDMA CM connection.";
-		goto error;
+		rc = ctx_hand_shake(comm, &my_dest[0], &rem_dest[0]);
+		if (rc) {
+			error_message = "Failed to sync between client and server "
+				"before creating RDMA CM connection.";
+			goto error;
+		}
+
+		if (user_param->machine == CLIENT) {
+			rc = rdma_cm_client_connection(ctx, user_param, &hints);
+		} else {
+			rc = rdma_cm_server_connection(ctx, user_param, &hints);
+		}
+
+		if (rc) {
+			error_message = "Failed to create RDMA CM connection.";
+			goto error;
+		}
+
+		rc = ctx_hand_shake(comm, &my_dest[0], &rem_dest[0]);
+		if (rc) {
+			error_message = "Failed to sync between client and server "
+				"after creating RDMA CM connection.";
+			goto error;
+		}
+
+		if (user_param->cm_storm && user_param->machine == CLIENT)
+			rdma_cm_storm_report(ctx, user_param, &rep);
 	}
 
+	for (p = 0; p < CM_STORM_PHASES; p++)
+		free(rep.phase_cycles[p]);
+
 	return rc;
 
 error:
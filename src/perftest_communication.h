@@ -105,6 +105,10 @@ struct perftest_comm {
 	struct pingpong_context    *rdma_ctx;
 	struct counter_context     *counter_ctx;
 	struct perftest_parameters *rdma_params;
+	/* a --daemon server accepts every client on the same socket */
+	int                        listen_fd;
+	/* the sides of a --loopback test exchange through memory */
+	struct loopback_link       *loopback;
 };
 
 /* bswap_double
@@ -438,6 +442,19 @@ void check_sys_data(struct perftest_comm *user_comm, struct perftest_parameters
  */
 int check_mtu(struct ibv_context *context,struct perftest_parameters *user_param, struct perftest_comm *user_comm);
 
+/* check_lat_depth
+ *
+ * Description : Exchanges --lat_depth when it is above 1, both sides of a latency test
+ *		 must run the same one. The default ping-pong flow exchanges nothing.
+ *
+ * Parameters :
+ *
+ *   user_comm	- user communication struct.
+ *	 user_param - Perftest parameters.
+ * Return Value : SUCCESS, FAILURE.
+ */
+int check_lat_depth(struct perftest_comm *user_comm, struct perftest_parameters *user_param);
+
 int ctx_check_gid_compatibility(struct pingpong_dest *my_dest,
 		struct pingpong_dest *rem_dest);
 
@@ -571,6 +588,26 @@ int rdma_cm_establish_ud_connection(struct pingpong_context *ctx,
 */
 void rdma_cm_connect_error(struct pingpong_context *ctx);
 
+/* rdma_cm_resolve_next:
+*
+* Description:
+*
+*    Starts the connection of the next RDMA CM node by resolving its address.
+*    Called for the first --cm_inflight nodes and again every time a client
+*    connection is established, until all the nodes were started.
+*
+* Parameters:
+*
+*    ctx - Application contexts.
+*    user_param - User parameters from the parser.
+*
+* Return value:
+*    rc - On success: SUCCESS(0), on failure: FAILURE(1).
+*
+*/
+int rdma_cm_resolve_next(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param);
+
 /* rdma_cm_address_handler:
 *
 * Description:
@@ -820,6 +857,49 @@ int _rdma_cm_client_connection(struct pingpong_context *ctx,
 int rdma_cm_client_connection(struct pingpong_context *ctx,
 		struct perftest_parameters *user_param, struct rdma_addrinfo *hints);
 
+/* rdma_cm_storm_reset:
+*
+* Description:
+*
+*    Tears down the RDMA CM connections between two connection storm rounds.
+*    The client disconnects all the nodes, the server answers the disconnects,
+*    then both sides destroy the QPs and the RDMA CM IDs. The client creates
+*    new IDs for the next round.
+*
+* Parameters:
+*
+*    ctx - Application contexts.
+*    user_param - User parameters from the parser.
+*    hints - RDMA address information.
+*
+* Return value:
+*    rc - On success: SUCCESS(0), on failure: FAILURE(1).
+*
+*/
+int rdma_cm_storm_reset(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param, struct rdma_addrinfo *hints);
+
+/* rdma_cm_storm_report:
+*
+* Description:
+*
+*    Collects the phase latencies of all the client RDMA CM nodes and prints
+*    the connection storm report of the current round.
+*
+* Parameters:
+*
+*    ctx - Application contexts.
+*    user_param - User parameters from the parser.
+*    rep - Report data, its phase arrays must hold num_of_qps samples.
+*
+* Return value:
+*    None.
+*
+*/
+void rdma_cm_storm_report(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param,
+		struct cm_storm_report_data *rep);
+
 /* create_rdma_cm_connection:
 *
 * Description:
@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <inttypes.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "perftest_logging.h"
@@ -114,6 +119,27 @@ void counters_print(struct counter_context *ctx)
 	printf("\n");
 }
 
+int counters_sample(struct counter_context *ctx,
+		void (*cb)(const char *name, unsigned long long value, void *arg), void *arg)
+{
+	char read_buf[COUNTER_VALUE_MAX_LEN + 1];
+	ssize_t len;
+
+	/* pread leaves the file offset of counters_read alone */
+	int i;
+	for (i = 0; i < ctx->num_counters; i++) {
+		len = pread(ctx->counters[i].fd, read_buf, COUNTER_VALUE_MAX_LEN, 0);
+		if (len < 0) {
+			return FAILURE;
+		}
+
+		read_buf[len] = '\0';
+		cb(ctx->counters[i].name, strtoull(read_buf, NULL, 10), arg);
+	}
+
+	return SUCCESS;
+}
+
 void counters_close(struct counter_context *ctx)
 {
 	int i;
@@ -124,3 +150,214 @@ void counters_close(struct counter_context *ctx)
 	free(ctx->counter_list);
 	free(ctx);
 }
+
+/*
+ * Counters of a port that explain bandwidth dips: the traffic itself, the
+ * drops, the congestion signals and the retransmits. A device exposes only
+ * some of them, the sampler reads the ones it finds.
+ */
+static const struct {
+	const char *file;
+	const char *name;
+	/* port_xmit_data and port_rcv_data count 4 byte words */
+	unsigned scale;
+} sampled_counters[] = {
+	{"counters/port_xmit_data", "tx_bytes", 4},
+	{"counters/port_rcv_data", "rx_bytes", 4},
+	{"counters/port_xmit_discards", "tx_discards", 1},
+	{"counters/port_rcv_errors", "rx_errors", 1},
+	{"counters/port_xmit_wait", "tx_wait", 1},
+	{"hw_counters/out_of_buffer", "rx_out_of_buffer", 1},
+	{"hw_counters/np_ecn_marked_roce_packets", "ecn_marked", 1},
+	{"hw_counters/np_cnp_sent", "cnp_sent", 1},
+	{"hw_counters/rp_cnp_handled", "cnp_handled", 1},
+	{"hw_counters/packet_seq_err", "packet_seq_err", 1},
+	{"hw_counters/out_of_sequence", "out_of_sequence", 1},
+	{"hw_counters/local_ack_timeout_err", "ack_timeout", 1},
+};
+
+#define NUM_SAMPLED_COUNTERS (sizeof(sampled_counters) / sizeof(sampled_counters[0]))
+#define SAMPLER_INITIAL_SAMPLES (1024)
+
+struct counter_sampler {
+	int fds[NUM_SAMPLED_COUNTERS];
+	unsigned interval_usec;
+	void (*progress)(void *arg, uint64_t *tx_msgs, uint64_t *rx_msgs);
+	void *arg;
+	pthread_t thread;
+	volatile int stop;
+	struct timespec start;
+
+	/* a sample is its time, the message counts and the raw counter values */
+	uint64_t *samples;
+	unsigned num_samples;
+	unsigned max_samples;
+};
+
+#define SAMPLE_WIDTH (3 + NUM_SAMPLED_COUNTERS)
+
+static void sampler_take(struct counter_sampler *sampler)
+{
+	char read_buf[COUNTER_VALUE_MAX_LEN + 1];
+	struct timespec now;
+	uint64_t *sample;
+	ssize_t len;
+	int i;
+
+	if (sampler->num_samples == sampler->max_samples) {
+		uint64_t *samples = realloc(sampler->samples,
+				2 * sampler->max_samples * SAMPLE_WIDTH * sizeof(uint64_t));
+
+		/* keep what was sampled so far */
+		if (!samples)
+			return;
+		sampler->samples = samples;
+		sampler->max_samples *= 2;
+	}
+
+	sample = &sampler->samples[sampler->num_samples * SAMPLE_WIDTH];
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	sample[0] = (now.tv_sec - sampler->start.tv_sec) * 1000000 +
+		(now.tv_nsec - sampler->start.tv_nsec) / 1000;
+	sampler->progress(sampler->arg, &sample[1], &sample[2]);
+
+	for (i = 0; i < NUM_SAMPLED_COUNTERS; i++) {
+		sample[3 + i] = 0;
+		if (sampler->fds[i] < 0)
+			continue;
+
+		len = pread(sampler->fds[i], read_buf, COUNTER_VALUE_MAX_LEN, 0);
+		if (len <= 0)
+			continue;
+		read_buf[len] = '\0';
+		sample[3 + i] = strtoull(read_buf, NULL, 10) * sampled_counters[i].scale;
+	}
+
+	sampler->num_samples++;
+}
+
+static void *sampler_thread(void *arg)
+{
+	struct counter_sampler *sampler = arg;
+	struct timespec next = sampler->start;
+
+	while (!sampler->stop) {
+		sampler_take(sampler);
+
+		/* an absolute deadline, so the sampling time doesn't add up */
+		next.tv_nsec += sampler->interval_usec * 1000UL;
+		next.tv_sec += next.tv_nsec / 1000000000;
+		next.tv_nsec %= 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+			;
+	}
+
+	sampler_take(sampler);
+	return NULL;
+}
+
+struct counter_sampler *counter_sampler_start(const char *dev_name, int port,
+		unsigned interval_usec,
+		void (*progress)(void *arg, uint64_t *tx_msgs, uint64_t *rx_msgs), void *arg)
+{
+	struct counter_sampler *sampler;
+	char *path;
+	int i, found = 0;
+
+	ALLOCATE(sampler, struct counter_sampler, 1);
+	memset(sampler, 0, sizeof(struct counter_sampler));
+	sampler->interval_usec = interval_usec;
+	sampler->progress = progress;
+	sampler->arg = arg;
+	sampler->max_samples = SAMPLER_INITIAL_SAMPLES;
+	ALLOCATE(sampler->samples, uint64_t, sampler->max_samples * SAMPLE_WIDTH);
+
+	for (i = 0; i < NUM_SAMPLED_COUNTERS; i++) {
+		sampler->fds[i] = -1;
+		if (asprintf(&path, COUNTER_PATH, dev_name, port, sampled_counters[i].file) == -1)
+			continue;
+		sampler->fds[i] = open(path, O_RDONLY);
+		if (sampler->fds[i] >= 0)
+			found++;
+		free(path);
+	}
+
+	if (!found)
+		printf(" No port counters of %s port %d to sample, sampling the message counts only\n",
+				dev_name, port);
+
+	clock_gettime(CLOCK_MONOTONIC, &sampler->start);
+	if (pthread_create(&sampler->thread, NULL, sampler_thread, sampler)) {
+		log_ebt("Couldn't create the counter sampler thread\n");
+		/* no thread for counter_sampler_stop to join */
+		sampler->stop = 1;
+		counter_sampler_free(sampler);
+		return NULL;
+	}
+
+	return sampler;
+}
+
+void counter_sampler_stop(struct counter_sampler *sampler)
+{
+	if (sampler->stop)
+		return;
+
+	sampler->stop = 1;
+	pthread_join(sampler->thread, NULL);
+}
+
+/* A counter that went back was reset, count nothing for the interval */
+static inline uint64_t sample_delta(uint64_t cur, uint64_t prev)
+{
+	return cur > prev ? cur - prev : 0;
+}
+
+void counter_sampler_write_json(struct counter_sampler *sampler, int fd, unsigned long msg_size)
+{
+	uint64_t *prev, *cur;
+	uint64_t tx_msgs, rx_msgs;
+	double interval;
+	unsigned s;
+	int i;
+
+	dprintf(fd, "counter_samples: {\n");
+	dprintf(fd, "interval_usec: %u,\n", sampler->interval_usec);
+	dprintf(fd, "samples: [\n");
+
+	for (s = 1; s < sampler->num_samples; s++) {
+		prev = &sampler->samples[(s - 1) * SAMPLE_WIDTH];
+		cur = &sampler->samples[s * SAMPLE_WIDTH];
+		interval = cur[0] > prev[0] ? (cur[0] - prev[0]) / 1e6 : 1e-6;
+
+		tx_msgs = sample_delta(cur[1], prev[1]);
+		rx_msgs = sample_delta(cur[2], prev[2]);
+
+		dprintf(fd, "{t_usec: %" PRIu64 ", tx_msgs: %" PRIu64 ", rx_msgs: %" PRIu64 ", BW_MiBps: %.2lf",
+				cur[0], tx_msgs, rx_msgs, (tx_msgs + rx_msgs) * msg_size / interval / 0x100000);
+		for (i = 0; i < NUM_SAMPLED_COUNTERS; i++) {
+			if (sampler->fds[i] < 0)
+				continue;
+			dprintf(fd, ", %s: %" PRIu64, sampled_counters[i].name,
+					sample_delta(cur[3 + i], prev[3 + i]));
+		}
+		dprintf(fd, "}%s\n", s + 1 < sampler->num_samples ? "," : "");
+	}
+
+	dprintf(fd, "]\n");
+	dprintf(fd, "},\n");
+}
+
+void counter_sampler_free(struct counter_sampler *sampler)
+{
+	int i;
+
+	counter_sampler_stop(sampler);
+	for (i = 0; i < NUM_SAMPLED_COUNTERS; i++) {
+		if (sampler->fds[i] >= 0)
+			close(sampler->fds[i]);
+	}
+
+	free(sampler->samples);
+	free(sampler);
+}
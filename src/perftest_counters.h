@@ -1,7 +1,10 @@
 #ifndef PERFTEST_COUNTERS_H
 #define PERFTEST_COUNTERS_H
 
+#include <stdint.h>
+
 struct counter_context;
+struct counter_sampler;
 
 /*
  * Allocate context for performance counters.
@@ -20,9 +23,40 @@ int counters_open(struct counter_context *ctx,
  */
 void counters_print(struct counter_context *ctx);
 
+/*
+ * Read the current values, without changing the ones counters_print
+ * reports, and pass each of them to cb.
+ */
+int counters_sample(struct counter_context *ctx,
+		void (*cb)(const char *name, unsigned long long value, void *arg), void *arg);
+
 /*
  * Close the handle to the counters.
  */
 void counters_close(struct counter_context *ctx);
 
+/*
+ * Start a thread that reads the congestion related counters of the port
+ * found under counters/ and hw_counters/ every interval_usec, together with
+ * the message counts progress returns, so both make one time series.
+ */
+struct counter_sampler *counter_sampler_start(const char *dev_name, int port,
+		unsigned interval_usec,
+		void (*progress)(void *arg, uint64_t *tx_msgs, uint64_t *rx_msgs), void *arg);
+
+/*
+ * Take a last sample and stop the thread.
+ */
+void counter_sampler_stop(struct counter_sampler *sampler);
+
+/*
+ * Write the per-interval deltas of the samples to the json report.
+ */
+void counter_sampler_write_json(struct counter_sampler *sampler, int fd, unsigned long msg_size);
+
+/*
+ * Stop the sampler if running and free it.
+ */
+void counter_sampler_free(struct counter_sampler *sampler);
+
 #endif
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#endif
+#include "perftest_logging.h"
+#include "perftest_parameters.h"
+#include "perftest_cpu_stats.h"
+
+#define PROC_STAT "/proc/stat"
+#define PROC_STAT_BUF_SIZE (256 * 1024)
+
+enum cpu_stats_event {
+	EV_CYCLES,
+	EV_INSTRUCTIONS,
+	EV_LLC_MISSES,
+	EV_BRANCH_MISSES,
+	EV_TASK_CLOCK,
+	NUM_EVENTS
+};
+
+struct cpu_stats {
+	int		fds[NUM_EVENTS];
+	/* counts of the last measurement, scaled when the PMU was multiplexed */
+	double		values[NUM_EVENTS];
+	int		running;
+
+	/* the cores the process may run on, from its affinity */
+	int		num_cores;
+	int		*cores;
+	unsigned long long *busy[2];
+	unsigned long long *total[2];
+	/* raw /proc/stat of the start and the stop, parsed when reported */
+	char		*proc_buf[2];
+	int		times_parsed;
+};
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+static const struct {
+	uint32_t	type;
+	uint64_t	config;
+	const char	*name;
+} events[NUM_EVENTS] = {
+	[EV_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+	[EV_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+	[EV_LLC_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+			   (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+			   "LLC misses"},
+	[EV_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch misses"},
+	[EV_TASK_CLOCK] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task clock"},
+};
+
+static int event_open(int event, int exclude_kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[event].type;
+	attr.config = events[event].config;
+	attr.disabled = 1;
+	/* count the threads the test creates after the open too */
+	attr.inherit = 1;
+	attr.exclude_kernel = exclude_kernel;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/*
+ * Copy /proc/stat aside. Only async-signal-safe calls, start and stop may
+ * run in the alarm handler.
+ */
+static void read_core_times(struct cpu_stats *stats, int index)
+{
+	ssize_t len = -1;
+	int fd;
+
+	fd = open(PROC_STAT, O_RDONLY);
+	if (fd >= 0) {
+		len = read(fd, stats->proc_buf[index], PROC_STAT_BUF_SIZE - 1);
+		close(fd);
+	}
+	stats->proc_buf[index][len > 0 ? len : 0] = '\0';
+}
+
+/*
+ * Parse the busy and total times of the cores, in ticks, out of a copy of
+ * /proc/stat. The copy is split into lines in place.
+ */
+static void parse_core_times(struct cpu_stats *stats, int index)
+{
+	unsigned long long value, busy, total;
+	char *line, *next, *end;
+	int cpu, field, i;
+
+	for (line = stats->proc_buf[index]; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+
+		/* the per core lines, not the aggregate "cpu " one */
+		if (strncmp(line, "cpu", 3) || line[3] < '0' || line[3] > '9')
+			continue;
+
+		cpu = strtol(line + 3, &end, 10);
+		busy = total = 0;
+		/* user nice system idle iowait irq softirq steal */
+		for (field = 0; field < 8; field++) {
+			value = strtoull(end, &end, 10);
+			total += value;
+			if (field != 3 && field != 4)
+				busy += value;
+		}
+
+		for (i = 0; i < stats->num_cores; i++) {
+			if (stats->cores[i] == cpu) {
+				stats->busy[index][i] = busy;
+				stats->total[index][i] = total;
+				break;
+			}
+		}
+	}
+}
+
+int cpu_stats_open(struct cpu_stats **stats)
+{
+	#ifdef HAVE_LINUX_PERF_EVENT_H
+	struct cpu_stats *new_stats;
+	cpu_set_t allowed;
+	int i, cpu, exclude_kernel = 0;
+
+	ALLOCATE(new_stats, struct cpu_stats, 1);
+	memset(new_stats, 0, sizeof(struct cpu_stats));
+
+	for (i = 0; i < NUM_EVENTS; i++) {
+		new_stats->fds[i] = event_open(i, exclude_kernel);
+		/* kernel counting needs perf_event_paranoid <= 1 */
+		if (new_stats->fds[i] < 0 && (errno == EACCES || errno == EPERM) && !exclude_kernel) {
+			while (i--) {
+				if (new_stats->fds[i] >= 0)
+					close(new_stats->fds[i]);
+			}
+			exclude_kernel = 1;
+			continue;
+		}
+	}
+
+	if (new_stats->fds[EV_TASK_CLOCK] < 0) {
+		log_ebt("Couldn't open perf events - %s\n", strerror(errno));
+		cpu_stats_close(new_stats);
+		return FAILURE;
+	}
+
+	if (new_stats->fds[EV_CYCLES] < 0)
+		printf(" No hardware counters in this system, reporting the CPU time only\n");
+	else if (exclude_kernel)
+		printf(" perf_event_paranoid doesn't allow kernel counting, counting user space only\n");
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		CPU_ZERO(&allowed);
+	ALLOCATE(new_stats->cores, int, CPU_COUNT(&allowed) + 1);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed))
+			new_stats->cores[new_stats->num_cores++] = cpu;
+	}
+
+	for (i = 0; i < 2; i++) {
+		ALLOCATE(new_stats->busy[i], unsigned long long, new_stats->num_cores + 1);
+		ALLOCATE(new_stats->total[i], unsigned long long, new_stats->num_cores + 1);
+		memset(new_stats->busy[i], 0, sizeof(unsigned long long) * (new_stats->num_cores + 1));
+		memset(new_stats->total[i], 0, sizeof(unsigned long long) * (new_stats->num_cores + 1));
+	}
+	for (i = 0; i < 2; i++) {
+		ALLOCATE(new_stats->proc_buf[i], char, PROC_STAT_BUF_SIZE);
+		new_stats->proc_buf[i][0] = '\0';
+	}
+
+	*stats = new_stats;
+	return SUCCESS;
+	#else
+	log_ebt("perf events are not supported in this build\n");
+	return FAILURE;
+	#endif
+}
+
+void cpu_stats_start(struct cpu_stats *stats)
+{
+	#ifdef HAVE_LINUX_PERF_EVENT_H
+	int i;
+
+	read_core_times(stats, 0);
+	for (i = 0; i < NUM_EVENTS; i++) {
+		if (stats->fds[i] < 0)
+			continue;
+		ioctl(stats->fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(stats->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+	stats->running = 1;
+	#endif
+}
+
+void cpu_stats_stop(struct cpu_stats *stats)
+{
+	#ifdef HAVE_LINUX_PERF_EVENT_H
+	/* value, time enabled, time running */
+	uint64_t buf[3];
+	int i;
+
+	if (!stats->running)
+		return;
+
+	for (i = 0; i < NUM_EVENTS; i++) {
+		stats->values[i] = 0;
+		if (stats->fds[i] < 0)
+			continue;
+		ioctl(stats->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(stats->fds[i], buf, sizeof(buf)) != sizeof(buf) || !buf[2])
+			continue;
+		stats->values[i] = (double)buf[0] * buf[1] / buf[2];
+	}
+	read_core_times(stats, 1);
+	stats->times_parsed = 0;
+	stats->running = 0;
+	#endif
+}
+
+static double per_msg(struct cpu_stats *stats, int event, uint64_t msgs)
+{
+	return (stats->fds[event] < 0 || !msgs) ? -1 : stats->values[event] / msgs;
+}
+
+static void update_core_times(struct cpu_stats *stats)
+{
+	if (stats->times_parsed)
+		return;
+	parse_core_times(stats, 0);
+	parse_core_times(stats, 1);
+	stats->times_parsed = 1;
+}
+
+static double core_util(struct cpu_stats *stats, int i)
+{
+	unsigned long long total = stats->total[1][i] - stats->total[0][i];
+
+	return total ? 100.0 * (stats->busy[1][i] - stats->busy[0][i]) / total : 0;
+}
+
+void cpu_stats_print(struct cpu_stats *stats, uint64_t msgs, double cpu_mhz)
+{
+	double cycles = per_msg(stats, EV_CYCLES, msgs);
+	double instructions = per_msg(stats, EV_INSTRUCTIONS, msgs);
+	double task_clock = stats->values[EV_TASK_CLOCK];
+	int i;
+
+	update_core_times(stats);
+	if (cycles >= 0) {
+		printf("\tcycles/msg=%.1f\n", cycles);
+		if (instructions >= 0)
+			printf("\tinstructions/msg=%.1f\n\tIPC=%.2f\n", instructions,
+					stats->values[EV_CYCLES] ? stats->values[EV_INSTRUCTIONS] / stats->values[EV_CYCLES] : 0);
+		if (stats->fds[EV_LLC_MISSES] >= 0)
+			printf("\tLLC_misses/msg=%.3f\n", per_msg(stats, EV_LLC_MISSES, msgs));
+		if (stats->fds[EV_BRANCH_MISSES] >= 0)
+			printf("\tbranch_misses/msg=%.3f\n", per_msg(stats, EV_BRANCH_MISSES, msgs));
+		if (task_clock)
+			printf("\teffective_clock=%.2f GHz (TSC %.2f GHz)\n",
+					stats->values[EV_CYCLES] / task_clock, cpu_mhz / 1000);
+	}
+	if (msgs)
+		printf("\tcpu_time/msg=%.1f nsec\n", task_clock / msgs);
+
+	for (i = 0; i < stats->num_cores; i++)
+		printf("\tcpu%d_util=%.1f%%\n", stats->cores[i], core_util(stats, i));
+	printf("\n");
+}
+
+void cpu_stats_write_json(struct cpu_stats *stats, int fd, uint64_t msgs, double cpu_mhz)
+{
+	double task_clock = stats->values[EV_TASK_CLOCK];
+	int i;
+
+	update_core_times(stats);
+	dprintf(fd, "cpu_stats: {\n");
+	if (stats->fds[EV_CYCLES] >= 0) {
+		dprintf(fd, "cycles_per_msg: %lf,\n", per_msg(stats, EV_CYCLES, msgs));
+		if (stats->fds[EV_INSTRUCTIONS] >= 0)
+			dprintf(fd, "instructions_per_msg: %lf,\nIPC: %lf,\n", per_msg(stats, EV_INSTRUCTIONS, msgs),
+					stats->values[EV_CYCLES] ? stats->values[EV_INSTRUCTIONS] / stats->values[EV_CYCLES] : 0);
+		if (stats->fds[EV_LLC_MISSES] >= 0)
+			dprintf(fd, "LLC_misses_per_msg: %lf,\n", per_msg(stats, EV_LLC_MISSES, msgs));
+		if (stats->fds[EV_BRANCH_MISSES] >= 0)
+			dprintf(fd, "branch_misses_per_msg: %lf,\n", per_msg(stats, EV_BRANCH_MISSES, msgs));
+		if (task_clock)
+			dprintf(fd, "effective_clock_GHz: %lf,\nTSC_GHz: %lf,\n",
+					stats->values[EV_CYCLES] / task_clock, cpu_mhz / 1000);
+	}
+	dprintf(fd, "cpu_time_per_msg_nsec: %lf,\n", msgs ? task_clock / msgs : 0);
+
+	dprintf(fd, "core_util: [");
+	for (i = 0; i < stats->num_cores; i++)
+		dprintf(fd, "%s{cpu: %d, util: %.1f}", i ? ", " : "", stats->cores[i], core_util(stats, i));
+	dprintf(fd, "]\n");
+	dprintf(fd, "},\n");
+}
+
+void cpu_stats_close(struct cpu_stats *stats)
+{
+	int i;
+
+	for (i = 0; i < NUM_EVENTS; i++) {
+		if (stats->fds[i] >= 0)
+			close(stats->fds[i]);
+	}
+
+	for (i = 0; i < 2; i++) {
+		free(stats->busy[i]);
+		free(stats->total[i]);
+		free(stats->proc_buf[i]);
+	}
+	free(stats->cores);
+	free(stats);
+}
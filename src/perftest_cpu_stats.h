@@ -0,0 +1,44 @@
+#ifndef PERFTEST_CPU_STATS_H
+#define PERFTEST_CPU_STATS_H
+
+#include <stdint.h>
+
+struct cpu_stats;
+
+/*
+ * Open the hardware counters of the process (its polling threads included)
+ * and find the cores it may run on. The counters are stopped until
+ * cpu_stats_start.
+ */
+int cpu_stats_open(struct cpu_stats **stats);
+
+/*
+ * Reset and start the counters and copy the per core times aside.
+ * Only async-signal-safe calls, so it can run in the alarm handler of
+ * duration tests. The times are parsed when they are reported.
+ */
+void cpu_stats_start(struct cpu_stats *stats);
+
+/*
+ * Stop the counters and copy the per core times again, with the same
+ * restrictions as cpu_stats_start.
+ */
+void cpu_stats_stop(struct cpu_stats *stats);
+
+/*
+ * Print the CPU cost of a message of the last measurement, msgs is the number
+ * of messages it covered, cpu_mhz the clock the test measures time with.
+ */
+void cpu_stats_print(struct cpu_stats *stats, uint64_t msgs, double cpu_mhz);
+
+/*
+ * Write the same to the json report.
+ */
+void cpu_stats_write_json(struct cpu_stats *stats, int fd, uint64_t msgs, double cpu_mhz);
+
+/*
+ * Close the counters and free the context.
+ */
+void cpu_stats_close(struct cpu_stats *stats);
+
+#endif
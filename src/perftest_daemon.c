@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "perftest_logging.h"
+#include "perftest_parameters.h"
+#include "perftest_resources.h"
+#include "perftest_communication.h"
+#include "perftest_daemon.h"
+
+/* The test a client of a --daemon server runs, in network order */
+struct daemon_session {
+	int32_t		verb;
+	int32_t		connection_type;
+	int32_t		num_of_qps;
+	int32_t		size;
+	int32_t		tx_depth;
+	int32_t		rx_depth;
+	int32_t		flows;
+	int32_t		duplex;
+};
+
+/******************************************************************************
+ * Take the session of a client into the parameters of the daemon, returns why
+ * it can't be served or NULL.
+ ******************************************************************************/
+static const char *daemon_take_session(struct perftest_parameters *user_param, struct daemon_session *session)
+{
+	int verb = ntoh_int(session->verb);
+	int connection_type = ntoh_int(session->connection_type);
+	int num_of_qps = ntoh_int(session->num_of_qps);
+	int size = ntoh_int(session->size);
+	int tx_depth = ntoh_int(session->tx_depth);
+	int rx_depth = ntoh_int(session->rx_depth);
+	int flows = ntoh_int(session->flows);
+
+	if (verb != user_param->verb)
+		return "the client runs a test of another verb";
+	if (ntoh_int(session->duplex))
+		return "the daemon doesn't serve bidirectional tests";
+	if ((connection_type != RC && connection_type != UC) || (verb == READ && connection_type != RC))
+		return "the daemon serves RC, and UC for write";
+	if (num_of_qps < 1 || num_of_qps > MAX_QP_NUM || size < 1 || size > MAX_SIZE ||
+	    tx_depth < MIN_TX || tx_depth > MAX_TX || rx_depth < MIN_RX || rx_depth > MAX_RX ||
+	    flows < 1 || flows > UINT16_MAX)
+		return "the QPs, message size, depths or flows of the client are out of range";
+
+	user_param->connection_type = connection_type;
+	user_param->num_of_qps = num_of_qps;
+	user_param->size = size;
+	user_param->tx_depth = tx_depth;
+	user_param->rx_depth = rx_depth;
+	user_param->flows = flows;
+
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int daemon_session_xchg(struct perftest_comm *comm, struct perftest_parameters *user_param)
+{
+	struct daemon_session my_session, rem_session;
+	const char *refused = NULL;
+	int status = 0, rem_status = 0;
+
+	if (user_param->machine == CLIENT ? !strstr(user_param->rem_version, DAEMON_VERSION_TAG) : !user_param->daemon)
+		return SUCCESS;
+
+	memset(&my_session, 0, sizeof(struct daemon_session));
+	if (user_param->machine == CLIENT) {
+		my_session.verb = hton_int(user_param->verb);
+		my_session.connection_type = hton_int(user_param->connection_type);
+		my_session.num_of_qps = hton_int(user_param->num_of_qps);
+		my_session.size = hton_int(user_param->size);
+		my_session.tx_depth = hton_int(user_param->tx_depth);
+		my_session.rx_depth = hton_int(user_param->rx_depth);
+		my_session.flows = hton_int(user_param->flows);
+		my_session.duplex = hton_int(user_param->duplex);
+	}
+
+	if (ctx_xchg_data(comm, &my_session, &rem_session, sizeof(struct daemon_session))) {
+		log_ebt(" Failed to exchange the session with the daemon\n");
+		return FAILURE;
+	}
+
+	if (user_param->machine == SERVER) {
+		refused = daemon_take_session(user_param, &rem_session);
+		status = hton_int(refused != NULL);
+	}
+
+	if (ctx_xchg_data(comm, &status, &rem_status, sizeof(int))) {
+		log_ebt(" Failed to exchange the session with the daemon\n");
+		return FAILURE;
+	}
+
+	if (refused) {
+		log_ebt(" Refused the session, %s\n", refused);
+		return FAILURE;
+	}
+	if (ntoh_int(rem_status)) {
+		log_ebt(" The daemon server refused the test, see its output\n");
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * Keep what the sessions share, clear the rest of the context for the next one.
+ ******************************************************************************/
+static void daemon_reset_ctx(struct pingpong_context *ctx)
+{
+	struct ibv_context *context = ctx->context;
+	struct ibv_pd *pd = ctx->pd;
+	struct session_pool pool = ctx->pool;
+
+	memset(ctx, 0, sizeof(struct pingpong_context));
+	ctx->context = context;
+	ctx->pd = pd;
+	ctx->pool = pool;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static double elapsed_msec(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/******************************************************************************
+ * One client, like the server of write_bw.c.
+ ******************************************************************************/
+static int daemon_serve(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+			struct perftest_comm *comm, int session)
+{
+	struct pingpong_dest *my_dest = NULL, *rem_dest = NULL;
+	struct bw_report_data my_bw_rep, rem_bw_rep;
+	struct timespec start;
+	int i, ret = FAILURE;
+
+	if (establish_connection(comm)) {
+		log_ebt(" Unable to accept the next client\n");
+		return FAILURE;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* like exchange_versions and check_version_compatibility, without exiting */
+	if (ctx_xchg_data(comm, (void*)(&user_param->version), (void*)(&user_param->rem_version),
+			  sizeof(user_param->rem_version)) || atof(user_param->rem_version) < 5.70) {
+		log_ebt(" The client is not compatible with this version\n");
+		goto out;
+	}
+	check_sys_data(comm, user_param);
+
+	if (check_mtu(ctx->context, user_param, comm)) {
+		log_ebt( " Couldn't agree on the MTU with the client\n");
+		goto out;
+	}
+
+	if (daemon_session_xchg(comm, user_param))
+		goto out;
+
+	ALLOCATE(my_dest, struct pingpong_dest, user_param->num_of_qps);
+	memset(my_dest, 0, sizeof(struct pingpong_dest)*user_param->num_of_qps);
+	ALLOCATE(rem_dest, struct pingpong_dest, user_param->num_of_qps);
+	memset(rem_dest, 0, sizeof(struct pingpong_dest)*user_param->num_of_qps);
+
+	alloc_ctx(ctx, user_param);
+
+	if (ctx_init_session(ctx, user_param)) {
+		log_ebt(" Couldn't create the IB resources of the session\n");
+		goto out;
+	}
+
+	if (set_up_connection(ctx, user_param, my_dest)) {
+		log_ebt(" Unable to set up socket connection\n");
+		goto out;
+	}
+
+	ctx_print_test_info(user_param);
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		if (ctx_hand_shake(comm, &my_dest[i], &rem_dest[i])) {
+			log_ebt(" Failed to exchange data between server and clients\n");
+			goto out;
+		}
+	}
+
+	if (ctx_check_gid_compatibility(&my_dest[0], &rem_dest[0])) {
+		log_ebt("\n Found Incompatibility issue with GID types.\n");
+		goto out;
+	}
+
+	if (ctx_connect(ctx, rem_dest, user_param, my_dest)) {
+		log_ebt(" Unable to Connect the HCA's through the link\n");
+		goto out;
+	}
+
+	for (i = 0; i < user_param->num_of_qps; i++)
+		ctx_print_pingpong_data(&my_dest[i], comm);
+
+	comm->rdma_params->side = REMOTE;
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		if (ctx_hand_shake(comm, &my_dest[i], &rem_dest[i])) {
+			log_ebt(" Failed to exchange data between server and clients\n");
+			goto out;
+		}
+
+		ctx_print_pingpong_data(&rem_dest[i], comm);
+	}
+
+	/* An additional handshake is required after moving qp to RTR. */
+	if (ctx_hand_shake(comm, &my_dest[0], &rem_dest[0])) {
+		log_ebt(" Failed to exchange data between server and clients\n");
+		goto out;
+	}
+
+	if (user_param->output == FULL_VERBOSITY) {
+		printf(" Session %d ready in %.3f msec, %s buffer and %s QPs\n", session, elapsed_msec(&start),
+		       ctx->pool.kept_buf ? "kept" : "new", ctx->pool.kept_qps ? "kept" : "new");
+		printf(RESULT_LINE);
+		printf((user_param->report_fmt == MBS ? RESULT_FMT : RESULT_FMT_G));
+		printf((user_param->cpu_util_data.enable ? RESULT_EXT_CPU_UTIL : RESULT_EXT));
+	}
+
+	/* the client is done */
+	if (ctx_hand_shake(comm, &my_dest[0], &rem_dest[0])) {
+		log_ebt(" Failed to exchange data between server and clients\n");
+		goto out;
+	}
+
+	xchg_bw_reports(comm, &my_bw_rep, &rem_bw_rep, atof(user_param->rem_version));
+	print_full_bw_report(user_param, &rem_bw_rep, NULL);
+
+	if (ctx_close_connection(comm, &my_dest[0], &rem_dest[0])) {
+		log_ebt("Failed to close connection between server and client\n");
+		goto out;
+	}
+	comm->rdma_params->sockfd = -1;
+
+	if (user_param->output == FULL_VERBOSITY)
+		printf(RESULT_LINE);
+
+	ret = SUCCESS;
+
+out:
+	if (comm->rdma_params->sockfd >= 0) {
+		close(comm->rdma_params->sockfd);
+		comm->rdma_params->sockfd = -1;
+	}
+	comm->rdma_params->side = LOCAL;
+
+	if (ctx_end_session(ctx, user_param))
+		ret = FAILURE;
+	free(my_dest);
+	free(rem_dest);
+
+	return ret;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_daemon(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+	       struct perftest_comm *comm)
+{
+	struct perftest_parameters base;
+	int session;
+	int ret = SUCCESS;
+
+	strncat(user_param->version, DAEMON_VERSION_TAG, MAX_VERSION - strlen(user_param->version) - 1);
+	base = *user_param;
+
+	for (session = 1; !base.daemon_sessions || session <= base.daemon_sessions; session++) {
+		if (user_param->output == FULL_VERBOSITY)
+			printf(" Waiting for client %d...\n", session);
+
+		if (daemon_serve(ctx, user_param, comm, session)) {
+			/* nothing to serve the next client on */
+			if (comm->listen_fd < 0) {
+				ret = FAILURE;
+				break;
+			}
+			log_ebt(" Session %d failed, waiting for the next client\n", session);
+		}
+
+		*user_param = base;
+		daemon_reset_ctx(ctx);
+	}
+
+	if (comm->listen_fd >= 0)
+		close(comm->listen_fd);
+
+	if (destroy_session_pool(ctx, user_param))
+		ret = FAILURE;
+
+	return ret;
+}
@@ -0,0 +1,27 @@
+#ifndef PERFTEST_DAEMON_H
+#define PERFTEST_DAEMON_H
+
+struct pingpong_context;
+struct perftest_parameters;
+struct perftest_comm;
+
+/* A --daemon server adds it to the version it sends, its clients send their session */
+#define DAEMON_VERSION_TAG	" daemon"
+
+/*
+ * Called by both sides after the MTU is agreed. The client of a --daemon
+ * server sends it the QPs, message size and depths of its test, the daemon
+ * takes them into user_param or refuses the session.
+ */
+int daemon_session_xchg(struct perftest_comm *comm, struct perftest_parameters *user_param);
+
+/*
+ * The loop of a --daemon write or read BW server, after create_comm_struct:
+ * accept a client, run its session on the resources the earlier sessions
+ * left, report it and wait for the next one. Destroys the context when
+ * --daemon_sessions were served.
+ */
+int run_daemon(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+	       struct perftest_comm *comm);
+
+#endif
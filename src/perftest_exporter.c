@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include "perftest_logging.h"
+#include "perftest_parameters.h"
+#include "perftest_counters.h"
+#include "perftest_exporter.h"
+
+/* The rates are measured once a second, the thread wakes up at least this often */
+#define EXPORTER_POLL_MS (200)
+#define EXPORTER_BACKLOG (8)
+#define EXPORTER_REQUEST_MAX (4096)
+
+static const double lat_bounds_usec[EXPORTER_LAT_BUCKETS - 1] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000
+};
+
+struct metrics_buf {
+	char	*data;
+	size_t	len;
+	size_t	size;
+};
+
+static void buf_printf(struct metrics_buf *buf, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	while (1) {
+		va_start(ap, fmt);
+		len = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+		va_end(ap);
+
+		if (len < 0)
+			return;
+		if (buf->len + len < buf->size)
+			break;
+
+		buf->size *= 2;
+		buf->data = realloc(buf->data, buf->size);
+		if (!buf->data) {
+			fprintf(stderr, "Couldn't allocate the metrics buffer\n");
+			exit(1);
+		}
+	}
+	buf->len += len;
+}
+
+static double process_cpu_time(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+	       usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Current rates over the last second, the peak is kept from the start.
+ */
+static void exporter_sample(struct metrics_exporter *exporter)
+{
+	uint64_t iters = __atomic_load_n(&exporter->user_param->iters, __ATOMIC_RELAXED);
+	cycles_t now = get_cycles();
+	double cpu_time = process_cpu_time();
+	double seconds = (now - exporter->last_cycles) / (exporter->cpu_mhz * 1e6);
+
+	if (seconds <= 0)
+		return;
+
+	exporter->msg_rate = (iters - exporter->last_iters) / seconds;
+	exporter->bw = exporter->msg_rate * exporter->user_param->size;
+	if (exporter->bw > exporter->peak_bw)
+		exporter->peak_bw = exporter->bw;
+	exporter->cpu_util = (cpu_time - exporter->last_cpu_time) / seconds;
+
+	exporter->last_iters = iters;
+	exporter->last_cycles = now;
+	exporter->last_cpu_time = cpu_time;
+}
+
+struct port_counter_arg {
+	struct metrics_buf	*buf;
+	const char		*labels;
+};
+
+static void render_port_counter(const char *name, unsigned long long value, void *arg)
+{
+	struct port_counter_arg *counter_arg = arg;
+
+	buf_printf(counter_arg->buf, "perftest_port_counter{%s,counter=\"%s\"} %llu\n",
+		   counter_arg->labels, name, value);
+}
+
+static void render_metric(struct metrics_buf *buf, const char *name, const char *type,
+			  const char *help, const char *labels, double value)
+{
+	buf_printf(buf, "# HELP %s %s\n# TYPE %s %s\n%s{%s} %.17g\n",
+		   name, help, name, type, name, labels, value);
+}
+
+static void exporter_render(struct metrics_exporter *exporter, struct metrics_buf *buf)
+{
+	struct perftest_parameters *user_param = exporter->user_param;
+	struct exporter_stats *stats = &exporter->stats;
+	struct port_counter_arg counter_arg;
+	uint64_t iters = __atomic_load_n(&user_param->iters, __ATOMIC_RELAXED);
+	uint64_t cumulative = 0;
+	char labels[256];
+	int i;
+
+	snprintf(labels, sizeof(labels), "device=\"%s\",port=\"%d\",role=\"%s\"",
+		 user_param->ib_devname ? user_param->ib_devname : "", user_param->ib_port,
+		 user_param->machine == SERVER ? "server" : "client");
+
+	render_metric(buf, "perftest_messages_total", "counter",
+		      "Messages completed.", labels, iters);
+	render_metric(buf, "perftest_bytes_total", "counter",
+		      "Bytes of the completed messages.", labels, (double)iters * user_param->size);
+	render_metric(buf, "perftest_completions_total", "counter",
+		      "Completions polled.", labels, __atomic_load_n(&stats->completions, __ATOMIC_RELAXED));
+	render_metric(buf, "perftest_errors_total", "counter",
+		      "Completions with an error status.", labels, __atomic_load_n(&stats->errors, __ATOMIC_RELAXED));
+	render_metric(buf, "perftest_bandwidth_bytes_per_second", "gauge",
+		      "Bandwidth over the last second.", labels, exporter->bw);
+	render_metric(buf, "perftest_peak_bandwidth_bytes_per_second", "gauge",
+		      "Highest bandwidth of a second since the start.", labels, exporter->peak_bw);
+	render_metric(buf, "perftest_message_rate", "gauge",
+		      "Messages per second over the last second.", labels, exporter->msg_rate);
+	render_metric(buf, "perftest_cpu_utilization_ratio", "gauge",
+		      "CPU time of the process per second over the last second.", labels, exporter->cpu_util);
+
+	buf_printf(buf, "# HELP perftest_completion_latency_seconds Time from the post of a signaled send to its completion.\n");
+	buf_printf(buf, "# TYPE perftest_completion_latency_seconds histogram\n");
+	for (i = 0; i < EXPORTER_LAT_BUCKETS; i++) {
+		cumulative += __atomic_load_n(&stats->lat_buckets[i], __ATOMIC_RELAXED);
+		if (i < EXPORTER_LAT_BUCKETS - 1)
+			buf_printf(buf, "perftest_completion_latency_seconds_bucket{%s,le=\"%g\"} %lu\n",
+				   labels, lat_bounds_usec[i] / 1e6, cumulative);
+		else
+			buf_printf(buf, "perftest_completion_latency_seconds_bucket{%s,le=\"+Inf\"} %lu\n",
+				   labels, cumulative);
+	}
+	buf_printf(buf, "perftest_completion_latency_seconds_sum{%s} %.9f\n", labels,
+		   __atomic_load_n(&stats->lat_sum, __ATOMIC_RELAXED) / (exporter->cpu_mhz * 1e6));
+	buf_printf(buf, "perftest_completion_latency_seconds_count{%s} %lu\n", labels,
+		   __atomic_load_n(&stats->lat_count, __ATOMIC_RELAXED));
+
+	if (user_param->counter_ctx) {
+		counter_arg.buf = buf;
+		counter_arg.labels = labels;
+		buf_printf(buf, "# HELP perftest_port_counter Port counters of sysfs (--report-counters).\n");
+		buf_printf(buf, "# TYPE perftest_port_counter untyped\n");
+		counters_sample(user_param->counter_ctx, render_port_counter, &counter_arg);
+	}
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+	ssize_t sent;
+
+	while (len) {
+		sent = send(fd, data, len, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return FAILURE;
+		data += sent;
+		len -= sent;
+	}
+
+	return SUCCESS;
+}
+
+static void exporter_serve(struct metrics_exporter *exporter, int fd)
+{
+	struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+	struct metrics_buf body;
+	char request[EXPORTER_REQUEST_MAX];
+	char header[256];
+	ssize_t len, total = 0;
+	int found = 0;
+
+	/* a client that doesn't send its request can't hold the exporter */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	while (total < sizeof(request) - 1) {
+		len = recv(fd, request + total, sizeof(request) - 1 - total, 0);
+		if (len <= 0)
+			break;
+		total += len;
+		request[total] = '\0';
+		if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+			break;
+	}
+	if (total <= 0)
+		return;
+	request[total] = '\0';
+
+	if (!strncmp(request, "GET /metrics ", strlen("GET /metrics ")) ||
+	    !strncmp(request, "GET / ", strlen("GET / ")))
+		found = 1;
+
+	body.size = 16384;
+	body.len = 0;
+	body.data = malloc(body.size);
+	if (!body.data)
+		return;
+	body.data[0] = '\0';
+
+	if (found)
+		exporter_render(exporter, &body);
+	else
+		buf_printf(&body, "Not found, the metrics are at /metrics\n");
+
+	snprintf(header, sizeof(header),
+		 "HTTP/1.1 %s\r\n"
+		 "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+		 "Content-Length: %zu\r\n"
+		 "Connection: close\r\n\r\n",
+		 found ? "200 OK" : "404 Not Found", body.len);
+
+	if (!send_all(fd, header, strlen(header)))
+		send_all(fd, body.data, body.len);
+
+	free(body.data);
+}
+
+static void *exporter_thread(void *arg)
+{
+	struct metrics_exporter *exporter = arg;
+	struct pollfd pfd;
+	int fd, ret;
+
+	while (!exporter->stop) {
+		pfd.fd = exporter->listen_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		ret = poll(&pfd, 1, EXPORTER_POLL_MS);
+
+		if (get_cycles() - exporter->last_cycles >= exporter->cpu_mhz * 1e6)
+			exporter_sample(exporter);
+
+		if (ret <= 0 || !(pfd.revents & POLLIN))
+			continue;
+
+		fd = accept(exporter->listen_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		exporter_serve(exporter, fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+struct metrics_exporter *exporter_start(struct perftest_parameters *user_param,
+					int num_of_qps, int ring_size)
+{
+	struct metrics_exporter *exporter = NULL;
+	struct sockaddr_in addr;
+	int reuse = 1;
+	int i;
+
+	if (posix_memalign((void**)&exporter, sizeof(struct exporter_stats), sizeof(struct metrics_exporter))) {
+		fprintf(stderr," Cannot Allocate\n");
+		exit(1);
+	}
+	memset(exporter, 0, sizeof(struct metrics_exporter));
+	exporter->user_param = user_param;
+	exporter->ring_size = ring_size;
+	exporter->cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	for (i = 0; i < EXPORTER_LAT_BUCKETS - 1; i++)
+		exporter->lat_bounds[i] = lat_bounds_usec[i] * exporter->cpu_mhz;
+
+	ALLOCATE(exporter->post_ring, cycles_t, num_of_qps * ring_size);
+	ALLOCATE(exporter->ring_head, uint64_t, num_of_qps);
+	ALLOCATE(exporter->ring_tail, uint64_t, num_of_qps);
+	memset(exporter->ring_head, 0, sizeof(uint64_t) * num_of_qps);
+	memset(exporter->ring_tail, 0, sizeof(uint64_t) * num_of_qps);
+
+	exporter->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (exporter->listen_fd < 0) {
+		log_ebt("Couldn't create the metrics socket - %s\n", strerror(errno));
+		goto free_exporter;
+	}
+	setsockopt(exporter->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(user_param->metrics_port);
+	if (bind(exporter->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) ||
+	    listen(exporter->listen_fd, EXPORTER_BACKLOG)) {
+		log_ebt("Couldn't listen on metrics port %d - %s\n", user_param->metrics_port, strerror(errno));
+		goto close_socket;
+	}
+
+	exporter->last_iters = __atomic_load_n(&user_param->iters, __ATOMIC_RELAXED);
+	exporter->last_cycles = get_cycles();
+	exporter->last_cpu_time = process_cpu_time();
+
+	if (pthread_create(&exporter->thread, NULL, exporter_thread, exporter)) {
+		log_ebt("Couldn't create the metrics thread\n");
+		goto close_socket;
+	}
+
+	printf(" Metrics at http://127.0.0.1:%d/metrics\n", user_param->metrics_port);
+	return exporter;
+
+close_socket:
+	close(exporter->listen_fd);
+free_exporter:
+	free(exporter->post_ring);
+	free(exporter->ring_head);
+	free(exporter->ring_tail);
+	free(exporter);
+	return NULL;
+}
+
+void exporter_stop(struct metrics_exporter *exporter)
+{
+	if (!exporter)
+		return;
+
+	exporter->stop = 1;
+	pthread_join(exporter->thread, NULL);
+	close(exporter->listen_fd);
+	free(exporter->post_ring);
+	free(exporter->ring_head);
+	free(exporter->ring_tail);
+	free(exporter);
+}
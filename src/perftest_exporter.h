@@ -0,0 +1,104 @@
+#ifndef PERFTEST_EXPORTER_H
+#define PERFTEST_EXPORTER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "get_clock.h"
+
+struct perftest_parameters;
+
+/* Upper bounds of the latency histogram buckets, in usec, the last one is +Inf */
+#define EXPORTER_LAT_BUCKETS (12)
+
+/*
+ * Counters of the test loop. The loop is their only writer and stores them
+ * with relaxed atomics, the exporter thread reads them without locks.
+ */
+struct exporter_stats {
+	uint64_t	completions;
+	uint64_t	errors;
+	uint64_t	lat_count;
+	uint64_t	lat_sum;
+	uint64_t	lat_buckets[EXPORTER_LAT_BUCKETS];
+} __attribute__((aligned(64)));
+
+/*
+ * Serves the live counters of a run_infinitely test in the Prometheus text
+ * format on http://127.0.0.1:<port>/metrics, from its own thread.
+ */
+struct metrics_exporter {
+	struct exporter_stats		stats;
+	struct perftest_parameters	*user_param;
+	cycles_t			lat_bounds[EXPORTER_LAT_BUCKETS];
+	/* post time of every signaled send still in flight, a ring per QP */
+	cycles_t			*post_ring;
+	uint64_t			*ring_head;
+	uint64_t			*ring_tail;
+	int				ring_size;
+	int				listen_fd;
+	pthread_t			thread;
+	volatile int			stop;
+	double				cpu_mhz;
+
+	/* rates the exporter thread measures every second */
+	uint64_t			last_iters;
+	cycles_t			last_cycles;
+	double				last_cpu_time;
+	double				bw;
+	double				peak_bw;
+	double				msg_rate;
+	double				cpu_util;
+};
+
+/*
+ * Listen on the port of --metrics_port and start the exporter thread.
+ * ring_size is the most signaled sends a QP can have in flight.
+ * Returns NULL on failure.
+ */
+struct metrics_exporter *exporter_start(struct perftest_parameters *user_param,
+					int num_of_qps, int ring_size);
+
+/*
+ * Stop the exporter thread, close the socket and free the exporter.
+ */
+void exporter_stop(struct metrics_exporter *exporter);
+
+static inline void exporter_add(uint64_t *counter, uint64_t n)
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/*
+ * A signaled send was posted on a QP.
+ */
+static inline void exporter_post_signaled(struct metrics_exporter *exporter, int qp)
+{
+	uint64_t head = exporter->ring_head[qp]++;
+
+	exporter->post_ring[qp * exporter->ring_size + head % exporter->ring_size] = get_cycles();
+}
+
+/*
+ * A completion of a signaled send on a QP, sends complete in the order they
+ * were posted.
+ */
+static inline void exporter_send_completion(struct metrics_exporter *exporter, int qp)
+{
+	struct exporter_stats *stats = &exporter->stats;
+	cycles_t lat;
+	int i;
+
+	exporter_add(&stats->completions, 1);
+	if (exporter->ring_tail[qp] == exporter->ring_head[qp])
+		return;
+
+	lat = get_cycles() - exporter->post_ring[qp * exporter->ring_size +
+						 exporter->ring_tail[qp]++ % exporter->ring_size];
+	for (i = 0; i < EXPORTER_LAT_BUCKETS - 1 && lat > exporter->lat_bounds[i]; i++)
+		;
+	exporter_add(&stats->lat_buckets[i], 1);
+	exporter_add(&stats->lat_sum, lat);
+	exporter_add(&stats->lat_count, 1);
+}
+
+#endif
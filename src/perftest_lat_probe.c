@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "perftest_logging.h"
+#include "perftest_parameters.h"
+#include "perftest_resources.h"
+#include "perftest_communication.h"
+#include "perftest_lat_probe.h"
+
+/* A control message, inlined when the test inlines it */
+#define LAT_PROBE_SIZE		(8)
+/* The send half of the buffer, then the half the other side writes to */
+#define LAT_PROBE_SLOT		(64)
+/* The last byte of a probe is its sequence, 1 to 254, this one ends the echo */
+#define LAT_PROBE_STOP		(0xff)
+
+/* Log-linear histogram in nsec, 16 buckets per power of two */
+#define LAT_PROBE_SUB_BITS	(4)
+#define LAT_PROBE_SUB_BUCKETS	(1 << LAT_PROBE_SUB_BITS)
+#define LAT_PROBE_BUCKETS	(48 * LAT_PROBE_SUB_BUCKETS)
+
+struct lat_probe {
+	/* the test parameters, as a one QP RC write latency test */
+	struct perftest_parameters	param;
+	struct pingpong_context		ctx;
+	struct ibv_qp			*qp;
+	struct ibv_mr			*mr;
+	struct ibv_cq			*cq;
+	void				*buf;
+	struct pingpong_dest		my_dest;
+	struct pingpong_dest		rem_dest;
+	struct ibv_sge			sge;
+	struct ibv_send_wr		wr;
+	pthread_t			thread;
+	int				running;
+	volatile int			stop;
+	int				error;
+	double				cpu_mhz;
+	cycles_t			gap_cycles;
+
+	/* half the round trip of every probe, like ib_write_lat */
+	uint64_t			samples;
+	uint64_t			sum_ns;
+	uint64_t			min_ns;
+	uint64_t			max_ns;
+	uint64_t			hist[LAT_PROBE_BUCKETS];
+};
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int bucket_of(uint64_t ns)
+{
+	int msb, bucket;
+
+	if (ns < LAT_PROBE_SUB_BUCKETS)
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	bucket = (msb - LAT_PROBE_SUB_BITS + 1) * LAT_PROBE_SUB_BUCKETS +
+		 (int)(ns >> (msb - LAT_PROBE_SUB_BITS)) - LAT_PROBE_SUB_BUCKETS;
+	return bucket < LAT_PROBE_BUCKETS ? bucket : LAT_PROBE_BUCKETS - 1;
+}
+
+static uint64_t bucket_low(int bucket)
+{
+	int group = bucket / LAT_PROBE_SUB_BUCKETS;
+
+	if (!group)
+		return bucket;
+	return (uint64_t)(LAT_PROBE_SUB_BUCKETS + bucket % LAT_PROBE_SUB_BUCKETS) << (group - 1);
+}
+
+static uint64_t bucket_width(int bucket)
+{
+	int group = bucket / LAT_PROBE_SUB_BUCKETS;
+
+	return group ? (uint64_t)1 << (group - 1) : 1;
+}
+
+/* usec, the middle of the bucket holding the percentile, within the min and max */
+static double percentile(struct lat_probe *probe, double pct)
+{
+	uint64_t target = ceil(probe->samples * pct);
+	uint64_t seen = 0, ns = probe->max_ns;
+	int i;
+
+	for (i = 0; i < LAT_PROBE_BUCKETS; i++) {
+		seen += probe->hist[i];
+		if (seen >= target) {
+			ns = bucket_low(i) + bucket_width(i) / 2;
+			break;
+		}
+	}
+	if (ns < probe->min_ns)
+		ns = probe->min_ns;
+	if (ns > probe->max_ns)
+		ns = probe->max_ns;
+	return ns / 1000.0;
+}
+
+static void record(struct lat_probe *probe, cycles_t rtt)
+{
+	uint64_t ns = rtt * 1000 / probe->cpu_mhz / 2;
+
+	if (!probe->samples || ns < probe->min_ns)
+		probe->min_ns = ns;
+	if (ns > probe->max_ns)
+		probe->max_ns = ns;
+	probe->sum_ns += ns;
+	probe->samples++;
+	probe->hist[bucket_of(ns)]++;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int post_probe(struct lat_probe *probe, unsigned char seq)
+{
+	struct ibv_send_wr *bad_wr = NULL;
+	struct ibv_wc wc;
+	int ne;
+
+	((volatile unsigned char*)probe->buf)[LAT_PROBE_SIZE - 1] = seq;
+	if (ibv_post_send(probe->qp, &probe->wr, &bad_wr)) {
+		log_ebt("Couldn't post the latency probe\n");
+		return FAILURE;
+	}
+
+	do {
+		ne = ibv_poll_cq(probe->cq, 1, &wc);
+	} while (ne == 0);
+
+	if (ne < 0 || wc.status != IBV_WC_SUCCESS) {
+		log_ebt("Latency probe completed with error %s\n",
+			ne < 0 ? "on poll" : ibv_wc_status_str(wc.status));
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *probe_client(void *arg)
+{
+	struct lat_probe *probe = arg;
+	volatile unsigned char *reply = (unsigned char*)probe->buf + LAT_PROBE_SLOT + LAT_PROBE_SIZE - 1;
+	struct ibv_send_wr *bad_wr = NULL;
+	struct ibv_wc wc;
+	cycles_t start, end;
+	unsigned char seq = 0;
+	int ne, completed;
+
+	while (!probe->stop) {
+		seq = seq % (LAT_PROBE_STOP - 1) + 1;
+		((volatile unsigned char*)probe->buf)[LAT_PROBE_SIZE - 1] = seq;
+
+		start = get_cycles();
+		if (ibv_post_send(probe->qp, &probe->wr, &bad_wr)) {
+			log_ebt("Couldn't post the latency probe\n");
+			probe->error = 1;
+			return NULL;
+		}
+		/* a write that failed or a server that stopped replying never
+		 * brings the reply, watch the completion and the stop flag too
+		 */
+		completed = 0;
+		ne = 0;
+		while (*reply != seq && !probe->stop) {
+			if (!completed && (ne = ibv_poll_cq(probe->cq, 1, &wc)) != 0) {
+				if (ne < 0 || wc.status != IBV_WC_SUCCESS)
+					break;
+				completed = 1;
+			}
+		}
+		end = get_cycles();
+
+		/* the reply came after the write, its completion is there or close */
+		while (!completed && ne == 0)
+			ne = ibv_poll_cq(probe->cq, 1, &wc);
+		if (ne < 0 || wc.status != IBV_WC_SUCCESS) {
+			log_ebt("Latency probe completed with error %s\n",
+				ne < 0 ? "on poll" : ibv_wc_status_str(wc.status));
+			probe->error = 1;
+			return NULL;
+		}
+
+		if (*reply != seq)
+			break;
+		record(probe, end - start);
+
+		if (probe->gap_cycles) {
+			end += probe->gap_cycles;
+			while (get_cycles() < end && !probe->stop)
+				;
+		}
+	}
+
+	if (post_probe(probe, LAT_PROBE_STOP))
+		probe->error = 1;
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *probe_server(void *arg)
+{
+	struct lat_probe *probe = arg;
+	volatile unsigned char *request = (unsigned char*)probe->buf + LAT_PROBE_SLOT + LAT_PROBE_SIZE - 1;
+	unsigned char last = 0, seq;
+
+	for (;;) {
+		while (*request == last && !probe->stop)
+			;
+		seq = *request;
+		if (seq == last || seq == LAT_PROBE_STOP)
+			break;
+
+		last = seq;
+		if (post_probe(probe, seq)) {
+			probe->error = 1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int lat_probe_create(struct lat_probe **probe_ptr, struct pingpong_context *ctx,
+		     struct perftest_parameters *user_param, struct perftest_comm *comm)
+{
+	struct lat_probe *probe;
+	struct perftest_parameters *param;
+	struct ibv_qp_init_attr attr;
+	int inl = user_param->inline_size >= LAT_PROBE_SIZE;
+
+	FUNCTION_ENTER;
+	ALLOCATE(probe, struct lat_probe, 1);
+	memset(probe, 0, sizeof(*probe));
+	probe->cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	probe->gap_cycles = user_param->lat_probe_gap * probe->cpu_mhz;
+
+	param = &probe->param;
+	*param = *user_param;
+	param->num_of_qps = 1;
+	param->tst = LAT;
+	param->verb = WRITE;
+	param->connection_type = RC;
+	param->duplex = 0;
+	param->dualport = OFF;
+	param->use_xrc = 0;
+	param->use_rss = 0;
+	param->rate_limit_type = DISABLE_RATE_LIMIT;
+
+	probe->buf = memalign(sysconf(_SC_PAGESIZE), 2 * LAT_PROBE_SLOT);
+	if (!probe->buf) {
+		log_ebt("Couldn't allocate the latency probe buffer\n");
+		goto free_probe;
+	}
+	memset(probe->buf, 0, 2 * LAT_PROBE_SLOT);
+
+	probe->mr = ibv_reg_mr(ctx->pd, probe->buf, 2 * LAT_PROBE_SLOT,
+			       IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+	if (!probe->mr) {
+		log_ebt("Couldn't register the latency probe MR\n");
+		goto free_buf;
+	}
+
+	probe->cq = ibv_create_cq(ctx->context, 2, NULL, NULL, 0);
+	if (!probe->cq) {
+		log_ebt("Couldn't create the latency probe CQ\n");
+		goto dereg_mr;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.send_cq = probe->cq;
+	attr.recv_cq = probe->cq;
+	attr.cap.max_send_wr = 2;
+	attr.cap.max_recv_wr = 1;
+	attr.cap.max_send_sge = 1;
+	attr.cap.max_recv_sge = 1;
+	attr.cap.max_inline_data = inl ? LAT_PROBE_SIZE : 0;
+	attr.qp_type = IBV_QPT_RC;
+	probe->qp = ibv_create_qp(ctx->pd, &attr);
+	if (!probe->qp) {
+		log_ebt("Couldn't create the latency probe QP\n");
+		goto destroy_cq;
+	}
+
+	if (ctx_modify_qp_to_init(probe->qp, param, 0)) {
+		log_ebt("Couldn't modify the latency probe QP to INIT\n");
+		goto destroy_qp;
+	}
+
+	probe->my_dest.lid = ctx_get_local_lid(ctx->context, param->ib_port);
+	probe->my_dest.gid_index = param->gid_index;
+	if (param->gid_index != -1 &&
+	    ibv_query_gid(ctx->context, param->ib_port, param->gid_index, &probe->my_dest.gid)) {
+		log_ebt("Couldn't query the GID of the latency probe\n");
+		goto destroy_qp;
+	}
+	probe->my_dest.qpn = probe->qp->qp_num;
+	probe->my_dest.psn = lrand48() & 0xffffff;
+	probe->my_dest.rkey = probe->mr->rkey;
+	probe->my_dest.out_reads = param->out_reads;
+	probe->my_dest.vaddr = (uintptr_t)probe->buf + LAT_PROBE_SLOT;
+
+	if (ctx_hand_shake(comm, &probe->my_dest, &probe->rem_dest)) {
+		log_ebt("Failed to exchange the latency probe data\n");
+		goto destroy_qp;
+	}
+
+	/* the probe goes through the connect of the test, as its only QP */
+	probe->ctx.context = ctx->context;
+	probe->ctx.pd = ctx->pd;
+	probe->ctx.qp = &probe->qp;
+	if (ctx_connect(&probe->ctx, &probe->rem_dest, param, &probe->my_dest)) {
+		log_ebt("Couldn't connect the latency probe QP\n");
+		goto destroy_qp;
+	}
+
+	probe->sge.addr = (uintptr_t)probe->buf;
+	probe->sge.length = LAT_PROBE_SIZE;
+	probe->sge.lkey = probe->mr->lkey;
+	probe->wr.sg_list = &probe->sge;
+	probe->wr.num_sge = 1;
+	probe->wr.opcode = IBV_WR_RDMA_WRITE;
+	probe->wr.send_flags = IBV_SEND_SIGNALED | (inl ? IBV_SEND_INLINE : 0);
+	probe->wr.wr.rdma.remote_addr = probe->rem_dest.vaddr;
+	probe->wr.wr.rdma.rkey = probe->rem_dest.rkey;
+
+	*probe_ptr = probe;
+	return SUCCESS;
+
+destroy_qp:
+	ibv_destroy_qp(probe->qp);
+destroy_cq:
+	ibv_destroy_cq(probe->cq);
+dereg_mr:
+	ibv_dereg_mr(probe->mr);
+free_buf:
+	free(probe->buf);
+free_probe:
+	free(probe);
+	return FAILURE;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int lat_probe_start(struct lat_probe *probe)
+{
+	int ret;
+
+	probe->stop = 0;
+	ret = pthread_create(&probe->thread, NULL,
+			     probe->param.machine == CLIENT ? probe_client : probe_server, probe);
+	if (ret) {
+		log_ebt("Couldn't start the latency probe thread - %s\n", strerror(ret));
+		return FAILURE;
+	}
+	probe->running = 1;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int lat_probe_stop(struct lat_probe *probe)
+{
+	if (!probe->running)
+		return SUCCESS;
+
+	probe->stop = 1;
+	pthread_join(probe->thread, NULL);
+	probe->running = 0;
+	return probe->error ? FAILURE : SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void lat_probe_print(struct lat_probe *probe)
+{
+	if (!probe->samples)
+		return;
+
+	printf(" Latency probe    : %" PRIu64 " writes of %d bytes on their own QP, half the round trip\n",
+	       probe->samples, LAT_PROBE_SIZE);
+	printf(" Probe latency    : min %.2f, median %.2f, avg %.2f, 99%% %.2f, 99.9%% %.2f, max %.2f usec\n",
+	       probe->min_ns / 1000.0, percentile(probe, 0.5),
+	       (double)probe->sum_ns / probe->samples / 1000.0,
+	       percentile(probe, 0.99), percentile(probe, 0.999), probe->max_ns / 1000.0);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void lat_probe_write_json(struct lat_probe *probe, int fd)
+{
+	int i, first = 1;
+
+	if (!probe->samples)
+		return;
+
+	dprintf(fd, "lat_probe: {\n");
+	dprintf(fd, "samples: %" PRIu64 ",\nmsg_size: %d,\n", probe->samples, LAT_PROBE_SIZE);
+	dprintf(fd, "t_min: %lf,\nt_median: %lf,\nt_avg: %lf,\nt_99: %lf,\nt_99_9: %lf,\nt_max: %lf,\n",
+		probe->min_ns / 1000.0, percentile(probe, 0.5),
+		(double)probe->sum_ns / probe->samples / 1000.0,
+		percentile(probe, 0.99), percentile(probe, 0.999), probe->max_ns / 1000.0);
+	dprintf(fd, "histogram_nsec: [");
+	for (i = 0; i < LAT_PROBE_BUCKETS; i++) {
+		if (!probe->hist[i])
+			continue;
+		dprintf(fd, "%s{low: %" PRIu64 ", high: %" PRIu64 ", count: %" PRIu64 "}", first ? "" : ", ",
+			bucket_low(i), bucket_low(i) + bucket_width(i), probe->hist[i]);
+		first = 0;
+	}
+	dprintf(fd, "]\n");
+	dprintf(fd, "},\n");
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void lat_probe_destroy(struct lat_probe *probe)
+{
+	lat_probe_stop(probe);
+
+	if (ibv_destroy_qp(probe->qp))
+		log_ebt("Failed to destroy the latency probe QP - %s\n", strerror(errno));
+	if (ibv_destroy_cq(probe->cq))
+		log_ebt("Failed to destroy the latency probe CQ - %s\n", strerror(errno));
+	if (ibv_dereg_mr(probe->mr))
+		log_ebt("Failed to deregister the latency probe MR - %s\n", strerror(errno));
+	free(probe->buf);
+	free(probe);
+}
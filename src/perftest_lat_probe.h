@@ -0,0 +1,44 @@
+#ifndef PERFTEST_LAT_PROBE_H
+#define PERFTEST_LAT_PROBE_H
+
+#include <stdint.h>
+
+struct lat_probe;
+struct pingpong_context;
+struct perftest_parameters;
+struct perftest_comm;
+
+/*
+ * Create the probe QP, on its own CQ and buffer in the PD of the test, and
+ * connect it to the probe of the other side through the test's handshake.
+ */
+int lat_probe_create(struct lat_probe **probe, struct pingpong_context *ctx,
+		     struct perftest_parameters *user_param, struct perftest_comm *comm);
+
+/*
+ * Start the probe thread. The client sends write ping-pongs and times them,
+ * the server echoes them until the client stops.
+ */
+int lat_probe_start(struct lat_probe *probe);
+
+/*
+ * Stop the probe thread and wait for it, the client tells the server to stop.
+ */
+int lat_probe_stop(struct lat_probe *probe);
+
+/*
+ * Print the latency of the probes, on the side that timed them.
+ */
+void lat_probe_print(struct lat_probe *probe);
+
+/*
+ * Write the same and the histogram to the json report.
+ */
+void lat_probe_write_json(struct lat_probe *probe, int fd);
+
+/*
+ * Destroy the probe QP, CQ and MR and free the probe.
+ */
+void lat_probe_destroy(struct lat_probe *probe);
+
+#endif
@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "perftest_logging.h"
+#include "perftest_parameters.h"
+#include "perftest_resources.h"
+#include "perftest_communication.h"
+#include "perftest_loopback.h"
+
+/* What the two sides of a --loopback test share, in place of the socket */
+struct loopback_link {
+	pthread_mutex_t			lock;
+	pthread_cond_t			cond;
+	int				arrived;
+	unsigned int			round;
+	int				failed;
+	/* what each side exchanges in the current round, by machine */
+	void				*data[2];
+	int				size[2];
+	/* a --loopback_shared client takes the PD and the buffer of the server */
+	struct pingpong_context		*server_ctx;
+};
+
+/* One side of the test and its thread */
+struct loopback_side {
+	struct pingpong_context		*ctx;
+	struct perftest_parameters	user_param;
+	struct perftest_comm		comm;
+	struct loopback_link		*link;
+	int				cpu;
+	int				result;
+	pthread_t			thread;
+};
+
+/******************************************************************************
+ * Wait for the other side to reach the same point, fails once one side failed.
+ ******************************************************************************/
+static int loopback_wait(struct loopback_link *link)
+{
+	unsigned int round;
+	int ret;
+
+	pthread_mutex_lock(&link->lock);
+	round = link->round;
+	if (++link->arrived == 2) {
+		link->arrived = 0;
+		link->round++;
+		pthread_cond_broadcast(&link->cond);
+	} else {
+		while (link->round == round && !link->failed)
+			pthread_cond_wait(&link->cond, &link->lock);
+	}
+	ret = link->failed ? FAILURE : SUCCESS;
+	pthread_mutex_unlock(&link->lock);
+
+	return ret;
+}
+
+/******************************************************************************
+ * Release the other side from its wait, there is nothing more to exchange.
+ ******************************************************************************/
+static void loopback_fail(struct loopback_link *link)
+{
+	pthread_mutex_lock(&link->lock);
+	link->failed = 1;
+	pthread_cond_broadcast(&link->cond);
+	pthread_mutex_unlock(&link->lock);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int loopback_xchg(struct loopback_link *link, int machine, void *my_data, void *rem_data, int size)
+{
+	int me = (machine == CLIENT);
+
+	link->data[me] = my_data;
+	link->size[me] = size;
+	if (loopback_wait(link))
+		return FAILURE;
+
+	if (link->size[!me] != size) {
+		log_ebt(" The loopback sides are out of step, %d and %d bytes\n", size, link->size[!me]);
+		loopback_fail(link);
+		return FAILURE;
+	}
+	memcpy(rem_data, link->data[!me], size);
+
+	/* the other side keeps its data until it was copied */
+	return loopback_wait(link);
+}
+
+/******************************************************************************
+ * One message size of the client.
+ ******************************************************************************/
+static int loopback_measure(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+			    struct pingpong_dest *rem_dest, struct bw_report_data *my_bw_rep)
+{
+	ctx_set_send_wqes(ctx, user_param, rem_dest);
+
+	if (user_param->perform_warm_up && perform_warm_up(ctx, user_param)) {
+		log_ebt( "Problems with warm up\n");
+		return FAILURE;
+	}
+
+	if (run_iter_bw(ctx, user_param)) {
+		log_ebt(" Failed to complete run_iter_bw function successfully\n");
+		return FAILURE;
+	}
+
+	print_report_bw(user_param, my_bw_rep);
+
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * The flow of write_bw.c and read_bw.c, the server only waits for the client,
+ * the client prints the test and the results.
+ ******************************************************************************/
+static int loopback_run_side(struct loopback_side *side)
+{
+	struct pingpong_context *ctx = side->ctx;
+	struct perftest_parameters *user_param = &side->user_param;
+	struct perftest_comm *comm = &side->comm;
+	struct pingpong_dest *my_dest = NULL, *rem_dest = NULL;
+	struct bw_report_data my_bw_rep, rem_bw_rep;
+	int client = (user_param->machine == CLIENT);
+	int i, ret = FAILURE;
+
+	if (check_mtu(ctx->context, user_param, comm)) {
+		log_ebt( " Couldn't get context for the device\n");
+		return FAILURE;
+	}
+
+	ALLOCATE(my_dest, struct pingpong_dest, user_param->num_of_qps);
+	memset(my_dest, 0, sizeof(struct pingpong_dest)*user_param->num_of_qps);
+	ALLOCATE(rem_dest, struct pingpong_dest, user_param->num_of_qps);
+	memset(rem_dest, 0, sizeof(struct pingpong_dest)*user_param->num_of_qps);
+
+	alloc_ctx(ctx, user_param);
+
+	/* the server sets up first, a shared client takes its PD and buffer */
+	if (!client && ctx_init_session(ctx, user_param)) {
+		log_ebt(" Couldn't create IB resources\n");
+		goto out;
+	}
+
+	if (loopback_wait(side->link))
+		goto out;
+
+	if (client) {
+		if (user_param->loopback_shared) {
+			ctx->pd = side->link->server_ctx->pd;
+			ctx->pool.buf = side->link->server_ctx->pool.buf;
+			ctx->pool.mr = side->link->server_ctx->pool.mr;
+			ctx->pool.buf_size = side->link->server_ctx->pool.buf_size;
+		}
+
+		if (ctx_init_session(ctx, user_param)) {
+			log_ebt(" Couldn't create IB resources\n");
+			goto out;
+		}
+	}
+
+	if (set_up_connection(ctx, user_param, my_dest)) {
+		log_ebt(" Unable to set up socket connection\n");
+		goto out;
+	}
+
+	if (client)
+		ctx_print_test_info(user_param);
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		if (ctx_hand_shake(comm, &my_dest[i], &rem_dest[i])) {
+			log_ebt(" Failed to exchange data between server and clients\n");
+			goto out;
+		}
+	}
+
+	if (ctx_check_gid_compatibility(&my_dest[0], &rem_dest[0])) {
+		log_ebt("\n Found Incompatibility issue with GID types.\n");
+		goto out;
+	}
+
+	if (ctx_connect(ctx, rem_dest, user_param, my_dest)) {
+		log_ebt(" Unable to Connect the HCA's through the link\n");
+		goto out;
+	}
+
+	if (client) {
+		for (i = 0; i < user_param->num_of_qps; i++)
+			ctx_print_pingpong_data(&my_dest[i], comm);
+	}
+
+	comm->rdma_params->side = REMOTE;
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		if (ctx_hand_shake(comm, &my_dest[i], &rem_dest[i])) {
+			log_ebt(" Failed to exchange data between server and clients\n");
+			goto out;
+		}
+
+		if (client)
+			ctx_print_pingpong_data(&rem_dest[i], comm);
+	}
+
+	/* An additional handshake is required after moving qp to RTR. */
+	if (ctx_hand_shake(comm, &my_dest[0], &rem_dest[0])) {
+		log_ebt(" Failed to exchange data between server and clients\n");
+		goto out;
+	}
+
+	if (client) {
+		if (user_param->output == FULL_VERBOSITY) {
+			if (user_param->report_per_port) {
+				printf(RESULT_LINE_PER_PORT);
+				printf((user_param->report_fmt == MBS ? RESULT_FMT_PER_PORT : RESULT_FMT_G_PER_PORT));
+			} else {
+				printf(RESULT_LINE);
+				printf((user_param->report_fmt == MBS ? RESULT_FMT : RESULT_FMT_G));
+			}
+
+			printf((user_param->cpu_util_data.enable ? RESULT_EXT_CPU_UTIL : RESULT_EXT));
+		}
+
+		if (user_param->test_method == RUN_ALL) {
+			for (i = 1; i < 24 ; ++i) {
+				user_param->size = (uint64_t)1 << i;
+				if (loopback_measure(ctx, user_param, rem_dest, &my_bw_rep))
+					goto out;
+			}
+		} else if (loopback_measure(ctx, user_param, rem_dest, &my_bw_rep)) {
+			goto out;
+		}
+
+		if (user_param->output == FULL_VERBOSITY) {
+			if (user_param->report_per_port)
+				printf(RESULT_LINE_PER_PORT);
+			else
+				printf(RESULT_LINE);
+		}
+	}
+
+	/* the client is done */
+	if (ctx_hand_shake(comm, &my_dest[0], &rem_dest[0])) {
+		log_ebt(" Failed to exchange data between server and clients\n");
+		goto out;
+	}
+
+	xchg_bw_reports(comm, &my_bw_rep, &rem_bw_rep, atof(user_param->rem_version));
+
+	if (ctx_close_connection(comm, &my_dest[0], &rem_dest[0])) {
+		log_ebt("Failed to close connection between server and client\n");
+		goto out;
+	}
+
+	if (client && !user_param->is_bw_limit_passed && (user_param->is_limit_bw == ON)) {
+		log_ebt("Error: BW result is below bw limit\n");
+		goto out;
+	}
+
+	if (client && !user_param->is_msgrate_limit_passed && (user_param->is_limit_bw == ON)) {
+		log_ebt("Error: Msg rate  is below msg_rate limit\n");
+		goto out;
+	}
+
+	ret = SUCCESS;
+
+out:
+	if (ctx_end_session(ctx, user_param))
+		ret = FAILURE;
+	free(my_dest);
+	free(rem_dest);
+
+	return ret;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *loopback_thread(void *arg)
+{
+	struct loopback_side *side = arg;
+
+	if (pin_thread_to_cpu(side->cpu))
+		log_err("Couldn't pin the %s thread to CPU %d\n",
+			side->user_param.machine == CLIENT ? "client" : "server", side->cpu);
+
+	side->result = loopback_run_side(side);
+	if (side->result != SUCCESS)
+		loopback_fail(side->link);
+
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_loopback(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct loopback_link link;
+	struct loopback_side sides[2];
+	struct loopback_side *server = &sides[SERVER], *client = &sides[CLIENT];
+	struct pingpong_context client_ctx;
+	struct ibv_device *ib_dev;
+	int i, created = 0;
+	int ret = SUCCESS;
+
+	memset(&link, 0, sizeof(struct loopback_link));
+	memset(sides, 0, sizeof(sides));
+	memset(&client_ctx, 0, sizeof(struct pingpong_context));
+	pthread_mutex_init(&link.lock, NULL);
+	pthread_cond_init(&link.cond, NULL);
+	link.server_ctx = ctx;
+
+	/* both sides are this binary, there are no versions or system data to agree on */
+	strncpy(user_param->rem_version, user_param->version, sizeof(user_param->rem_version));
+
+	for (i = SERVER; i <= CLIENT; i++) {
+		sides[i].user_param = *user_param;
+		sides[i].user_param.machine = i;
+		sides[i].link = &link;
+		/* the server runs on the first CPU the process is allowed on and
+		 * the client on the second, use taskset to choose the cores.
+		 */
+		sides[i].cpu = get_nth_allowed_cpu(i);
+	}
+
+	/* the server only waits for the client, the client paces, samples and reports */
+	server->user_param.load_profile = NULL;
+	server->user_param.counter_ctx = NULL;
+	server->user_param.perf_events = OFF;
+
+	server->ctx = ctx;
+	client->ctx = &client_ctx;
+	if (user_param->loopback_shared) {
+		client_ctx.context = ctx->context;
+	} else {
+		ib_dev = ctx_find_dev(&user_param->ib_devname);
+		if (!ib_dev) {
+			log_ebt(" Unable to find the Infiniband/RoCE device\n");
+			return FAILURE;
+		}
+
+		client_ctx.context = ctx_open_device(ib_dev, &client->user_param);
+		if (!client_ctx.context) {
+			log_ebt(" Couldn't get context for the device\n");
+			return FAILURE;
+		}
+	}
+
+	for (i = SERVER; i <= CLIENT; i++) {
+		if (create_comm_struct(&sides[i].comm, &sides[i].user_param)) {
+			log_ebt(" Unable to create RDMA_CM resources\n");
+			return FAILURE;
+		}
+		sides[i].comm.loopback = &link;
+	}
+
+	if (user_param->output == FULL_VERBOSITY)
+		printf(" Loopback in one process, server on CPU %d, client on CPU %d, %s device context, PD and MR\n",
+		       server->cpu, client->cpu, user_param->loopback_shared ? "shared" : "separate");
+
+	for (i = SERVER; i <= CLIENT; i++) {
+		if (pthread_create(&sides[i].thread, NULL, loopback_thread, &sides[i])) {
+			log_ebt("Couldn't create the %s thread\n", i == CLIENT ? "client" : "server");
+			loopback_fail(&link);
+			ret = FAILURE;
+			break;
+		}
+		created++;
+	}
+
+	for (i = 0; i < created; i++) {
+		pthread_join(sides[i].thread, NULL);
+		if (sides[i].result != SUCCESS)
+			ret = FAILURE;
+	}
+
+	/* the client first, a shared one has its QPs on the PD of the server */
+	if (user_param->loopback_shared) {
+		client_ctx.context = NULL;
+		client_ctx.pd = NULL;
+		client_ctx.pool.buf = NULL;
+		client_ctx.pool.mr = NULL;
+		client_ctx.pool.buf_size = 0;
+	}
+
+	if (destroy_session_pool(&client_ctx, &client->user_param))
+		ret = FAILURE;
+
+	if (destroy_session_pool(ctx, &server->user_param))
+		ret = FAILURE;
+
+	pthread_cond_destroy(&link.cond);
+	pthread_mutex_destroy(&link.lock);
+
+	return ret;
+}
@@ -0,0 +1,25 @@
+#ifndef PERFTEST_LOOPBACK_H
+#define PERFTEST_LOOPBACK_H
+
+struct pingpong_context;
+struct perftest_parameters;
+struct loopback_link;
+
+/*
+ * The exchange of ctx_xchg_data and ctx_hand_shake between the two sides of
+ * a --loopback test. Both sides call it with the same size at the same point
+ * of their flow, machine tells which side is calling. Fails when the other
+ * side failed.
+ */
+int loopback_xchg(struct loopback_link *link, int machine, void *my_data, void *rem_data, int size);
+
+/*
+ * Run a --loopback write or read BW test after check_link: the server side
+ * on ctx and the client side on a context of its own, or on the context, PD
+ * and MR of the server with --loopback_shared, each in a thread pinned to
+ * one of the first two CPUs the process is allowed on. Destroys both
+ * contexts.
+ */
+int run_loopback(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+#endif
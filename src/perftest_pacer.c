@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "perftest_logging.h"
+#include "perftest_parameters.h"
+#include "perftest_pacer.h"
+
+#define LOAD_PROFILE_LINE	(256)
+
+/******************************************************************************
+ * Parse up to max numbers separated by sep, returns how many or -1.
+ ******************************************************************************/
+static int parse_numbers(const char *str, char sep, double *v, int max)
+{
+	char *end;
+	int n = 0;
+
+	while (n < max) {
+		v[n++] = strtod(str, &end);
+		if (end == str || v[n - 1] < 0)
+			return -1;
+		if (*end == '\0')
+			return n;
+		if (*end != sep)
+			return -1;
+		str = end + 1;
+	}
+
+	return -1;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int load_profile_read_csv(struct load_profile *profile, const char *path)
+{
+	char line[LOAD_PROFILE_LINE];
+	double v[2];
+	int max = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, " Couldn't open load profile %s\n", path);
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+		if (parse_numbers(line, ',', v, 2) != 2 ||
+		    (profile->num_rates && v[0] < profile->times[profile->num_rates - 1])) {
+			fprintf(stderr, " Bad load profile line \"%s\", expected <sec>,<rate> in time order\n", line);
+			fclose(f);
+			return 1;
+		}
+		if (profile->num_rates == max) {
+			max = max ? max * 2 : 64;
+			profile->times = realloc(profile->times, sizeof(double) * max);
+			profile->rates = realloc(profile->rates, sizeof(double) * max);
+			if (!profile->times || !profile->rates) {
+				fprintf(stderr, " Cannot Allocate\n");
+				exit(1);
+			}
+		}
+		profile->times[profile->num_rates] = v[0];
+		profile->rates[profile->num_rates++] = v[1];
+	}
+	fclose(f);
+
+	if (!profile->num_rates) {
+		fprintf(stderr, " Load profile %s has no rates\n", path);
+		return 1;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int load_profile_parse(const char *spec, struct load_profile **profile)
+{
+	struct load_profile *p;
+	const char *args;
+	double v[4];
+	int n = 0;
+	int err = 0;
+
+	ALLOCATE(p, struct load_profile, 1);
+	memset(p, 0, sizeof(struct load_profile));
+	p->spec = strdup(spec);
+	args = strchr(spec, ':');
+	if (!args) {
+		err = 1;
+		goto out;
+	}
+	args++;
+
+	if (!strncmp(spec, "csv:", 4)) {
+		p->shape = LOAD_CSV;
+		err = load_profile_read_csv(p, args);
+	} else if (!strncmp(spec, "step:", 5)) {
+		p->shape = LOAD_STEP;
+		p->period = strtod(args, (char**)&args);
+		if (*args++ != ':' || p->period <= 0) {
+			err = 1;
+			goto out;
+		}
+		/* one rate more than the commas */
+		p->num_rates = 1;
+		for (n = 0; args[n]; n++)
+			p->num_rates += args[n] == ',';
+		ALLOCATE(p->rates, double, p->num_rates);
+		err = parse_numbers(args, ',', p->rates, p->num_rates) != p->num_rates;
+	} else {
+		n = parse_numbers(args, ':', v, 4);
+		if (!strncmp(spec, "ramp:", 5) && n == 3) {
+			p->shape = LOAD_RAMP;
+		} else if (!strncmp(spec, "square:", 7) && (n == 3 || n == 4) && v[1] > 0 && v[1] <= 100) {
+			p->shape = LOAD_SQUARE;
+			p->duty = v[1] / 100;
+			/* high and low */
+			v[1] = v[2];
+			v[2] = n == 4 ? v[3] : 0;
+		} else if (!strncmp(spec, "sine:", 5) && n == 3) {
+			p->shape = LOAD_SINE;
+		} else {
+			err = 1;
+			goto out;
+		}
+		p->period = v[0];
+		p->num_rates = 2;
+		ALLOCATE(p->rates, double, 2);
+		p->rates[0] = v[1];
+		p->rates[1] = v[2];
+		err = p->period <= 0;
+	}
+
+out:
+	if (err) {
+		fprintf(stderr, " Bad load profile \"%s\", see --load_profile in the usage\n", spec);
+		load_profile_free(p);
+		return 1;
+	}
+
+	*profile = p;
+	return 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+double load_profile_rate(struct load_profile *profile, double sec)
+{
+	double rate;
+	int i;
+
+	switch (profile->shape) {
+		case LOAD_RAMP:
+			if (sec >= profile->period)
+				return profile->rates[1];
+			return profile->rates[0] + (profile->rates[1] - profile->rates[0]) * sec / profile->period;
+		case LOAD_STEP:
+			i = sec / profile->period;
+			return profile->rates[i < profile->num_rates ? i : profile->num_rates - 1];
+		case LOAD_SQUARE:
+			return fmod(sec, profile->period) < profile->period * profile->duty ?
+				profile->rates[0] : profile->rates[1];
+		case LOAD_SINE:
+			rate = profile->rates[0] + profile->rates[1] * sin(2 * M_PI * sec / profile->period);
+			return rate > 0 ? rate : 0;
+		case LOAD_CSV:
+			for (i = 1; i < profile->num_rates && profile->times[i] <= sec; i++)
+				;
+			return profile->rates[i - 1];
+		default:
+			return 0;
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void load_profile_free(struct load_profile *profile)
+{
+	free(profile->spec);
+	free(profile->rates);
+	free(profile->times);
+	free(profile);
+}
+
+/******************************************************************************
+ * Messages per second of one unit of --rate_units.
+ ******************************************************************************/
+static double pacer_pps_per_unit(struct perftest_parameters *user_param)
+{
+	switch (user_param->rate_units) {
+		case MEGA_BYTE_PS:
+			return 1048576.0 / user_param->size;
+		case GIGA_BIT_PS:
+			return 1000000000 / (user_param->size * 8.0);
+		case PACKET_PS:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/******************************************************************************
+ * Set the rate of every bucket, t is now in cycles since the start.
+ ******************************************************************************/
+static void pacer_set_rate(struct pacer *pacer, double pps, double t)
+{
+	double interval;
+	int i;
+
+	if (pps <= 0) {
+		pacer->paused = 1;
+		pacer->target_pps = 0;
+		return;
+	}
+
+	interval = pacer->cpu_mhz * 1000000 / pps;
+	/* what a bucket is ahead at the old rate it is ahead at the new one */
+	if (!pacer->paused && pacer->interval > 0) {
+		for (i = 0; i < pacer->num_buckets; i++) {
+			if (pacer->buckets[i].due > t)
+				pacer->buckets[i].due = t + (pacer->buckets[i].due - t) * interval / pacer->interval;
+		}
+	}
+
+	pacer->paused = 0;
+	pacer->interval = interval;
+	pacer->tolerance = (pacer->burst_size > 1 ? pacer->burst_size - 1 : 0) * interval;
+	pacer->target_pps = pps * pacer->num_buckets;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void pacer_update(struct pacer *pacer, cycles_t now)
+{
+	struct pace_sample *sample;
+	double cycles_per_sec = pacer->cpu_mhz * 1000000;
+	uint64_t msgs = 0;
+	int i;
+
+	for (i = 0; i < pacer->num_buckets; i++)
+		msgs += pacer->buckets[i].msgs;
+
+	if (now > pacer->last_update) {
+		if (pacer->num_samples == pacer->max_samples) {
+			pacer->max_samples = pacer->max_samples ? pacer->max_samples * 2 : 64;
+			pacer->samples = realloc(pacer->samples, sizeof(struct pace_sample) * pacer->max_samples);
+			if (!pacer->samples) {
+				fprintf(stderr, " Cannot Allocate\n");
+				exit(1);
+			}
+		}
+		sample = &pacer->samples[pacer->num_samples++];
+		sample->sec = (pacer->last_update - pacer->start) / cycles_per_sec;
+		sample->target_pps = pacer->target_pps;
+		sample->achieved_pps = (msgs - pacer->last_msgs) * cycles_per_sec / (now - pacer->last_update);
+	}
+
+	pacer_set_rate(pacer, load_profile_rate(pacer->profile, (now - pacer->start) / cycles_per_sec) *
+		       pacer->pps_per_unit, (double)(now - pacer->start));
+	pacer->last_update = now;
+	pacer->last_msgs = msgs;
+	pacer->next_update = now + pacer->update_cycles;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int pacer_create(struct pacer **pacer, struct perftest_parameters *user_param, int num_of_qps)
+{
+	struct pacer *p;
+
+	FUNCTION_ENTER;
+	/* -a and --autotune run the test loop once per measurement */
+	if (*pacer) {
+		pacer_destroy(*pacer);
+		*pacer = NULL;
+	}
+
+	ALLOCATE(p, struct pacer, 1);
+	memset(p, 0, sizeof(struct pacer));
+	p->pps_per_unit = pacer_pps_per_unit(user_param);
+	if (p->pps_per_unit <= 0) {
+		log_ebt(" Failed: Unknown rate limit units\n");
+		free(p);
+		return FAILURE;
+	}
+	p->cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	if (p->cpu_mhz <= 0) {
+		log_ebt("Failed: couldn't acquire cpu frequency for rate limiter.\n");
+		free(p);
+		return FAILURE;
+	}
+
+	p->per_qp = user_param->rate_limit_per_qp;
+	p->num_buckets = p->per_qp ? num_of_qps : 1;
+	p->burst_size = user_param->burst_size;
+	if (posix_memalign((void**)&p->buckets, sizeof(struct pace_bucket),
+			   sizeof(struct pace_bucket) * p->num_buckets)) {
+		fprintf(stderr," Cannot Allocate\n");
+		exit(1);
+	}
+	memset(p->buckets, 0, sizeof(struct pace_bucket) * p->num_buckets);
+	p->start = get_cycles();
+
+	if (user_param->load_profile) {
+		p->profile = user_param->load_profile;
+		p->update_cycles = p->cpu_mhz * 1000 * user_param->load_interval;
+		p->last_update = p->start;
+		pacer_update(p, p->start);
+	} else {
+		p->next_update = (cycles_t)-1;
+		pacer_set_rate(p, user_param->rate_limit * p->pps_per_unit, 0);
+		if (p->paused) {
+			log_ebt(" Failed: rate limit must be positive\n");
+			pacer_destroy(p);
+			return FAILURE;
+		}
+	}
+
+	*pacer = p;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ * The rate a bucket achieved from its first message to its last.
+ ******************************************************************************/
+static double bucket_pps(struct pacer *pacer, struct pace_bucket *bucket)
+{
+	if (bucket->msgs < 2 || bucket->last == bucket->first)
+		return 0;
+
+	return (bucket->msgs - 1) * pacer->cpu_mhz * 1000000 / (bucket->last - bucket->first);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void pacer_summary(struct pacer *pacer, double *target, double *achieved,
+			  double *min_pps, double *max_pps, uint64_t *holds)
+{
+	double pps;
+	int i;
+
+	*target = pacer->target_pps;
+	*achieved = 0;
+	*min_pps = 0;
+	*max_pps = 0;
+	*holds = 0;
+	for (i = 0; i < pacer->num_buckets; i++) {
+		pps = bucket_pps(pacer, &pacer->buckets[i]);
+		*achieved += pps;
+		if (!i || pps < *min_pps)
+			*min_pps = pps;
+		if (pps > *max_pps)
+			*max_pps = pps;
+		*holds += pacer->buckets[i].holds;
+	}
+
+	/* the rate of a profile changes, take the mean of its intervals */
+	if (pacer->num_samples) {
+		*target = 0;
+		*achieved = 0;
+		for (i = 0; i < pacer->num_samples; i++) {
+			*target += pacer->samples[i].target_pps / pacer->num_samples;
+			*achieved += pacer->samples[i].achieved_pps / pacer->num_samples;
+		}
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void pacer_print(struct pacer *pacer)
+{
+	double target, achieved, min_pps, max_pps;
+	uint64_t holds;
+	int i;
+
+	pacer_summary(pacer, &target, &achieved, &min_pps, &max_pps, &holds);
+	printf(" SW rate limit    : target %.6f Mpps, achieved %.6f Mpps (%+.2f%%), %" PRIu64 " holds\n",
+	       target / 1e6, achieved / 1e6, target ? 100 * (achieved - target) / target : 0, holds);
+	if (pacer->per_qp && !pacer->profile)
+		printf(" Per QP rate      : target %.6f Mpps, min %.6f, max %.6f Mpps\n",
+		       target / pacer->num_buckets / 1e6, min_pps / 1e6, max_pps / 1e6);
+	if (pacer->profile) {
+		printf(" Load profile     : %s\n", pacer->profile->spec);
+		printf("   time[sec]   target[Mpps]   achieved[Mpps]\n");
+		for (i = 0; i < pacer->num_samples; i++)
+			printf("   %-9.3f   %-12.6f   %.6f\n", pacer->samples[i].sec,
+			       pacer->samples[i].target_pps / 1e6, pacer->samples[i].achieved_pps / 1e6);
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void pacer_write_json(struct pacer *pacer, int fd)
+{
+	double target, achieved, min_pps, max_pps;
+	uint64_t holds;
+	int i;
+
+	pacer_summary(pacer, &target, &achieved, &min_pps, &max_pps, &holds);
+	dprintf(fd, "sw_rate_limit: {\n");
+	dprintf(fd, "per_qp: %d,\ntarget_mpps: %lf,\nachieved_mpps: %lf,\n",
+		pacer->per_qp, target / 1e6, achieved / 1e6);
+	dprintf(fd, "qp_min_mpps: %lf,\nqp_max_mpps: %lf,\nholds: %" PRIu64 "%s\n",
+		min_pps / 1e6, max_pps / 1e6, holds, pacer->profile ? "," : "");
+	if (pacer->profile) {
+		dprintf(fd, "load_profile: %s,\nintervals: [", pacer->profile->spec);
+		for (i = 0; i < pacer->num_samples; i++)
+			dprintf(fd, "%s{sec: %lf, target_mpps: %lf, achieved_mpps: %lf}", i ? ", " : "",
+				pacer->samples[i].sec, pacer->samples[i].target_pps / 1e6,
+				pacer->samples[i].achieved_pps / 1e6);
+		dprintf(fd, "]\n");
+	}
+	dprintf(fd, "},\n");
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void pacer_destroy(struct pacer *pacer)
+{
+	free(pacer->samples);
+	free(pacer->buckets);
+	free(pacer);
+}
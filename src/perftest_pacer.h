@@ -0,0 +1,146 @@
+#ifndef PERFTEST_PACER_H
+#define PERFTEST_PACER_H
+
+#include <stdint.h>
+#include "get_clock.h"
+
+struct perftest_parameters;
+
+/*
+ * A token bucket of the SW rate limiter, kept as the time its next message
+ * is due: a message may go when that time is at most a burst ahead of now.
+ * The time is in cycles since the pacer started, as a double so the fraction
+ * of a cycle between two messages is not lost at high rates.
+ */
+struct pace_bucket {
+	double		due;
+	uint64_t	msgs;
+	/* the times it held its QP back */
+	uint64_t	holds;
+	cycles_t	first;
+	cycles_t	last;
+} __attribute__((aligned(64)));
+
+enum load_shape {LOAD_RAMP, LOAD_STEP, LOAD_SQUARE, LOAD_SINE, LOAD_CSV};
+
+/*
+ * The offered rate of --load_profile over the seconds of the test, in the
+ * units of --rate_units:
+ *   ramp:<secs>:<from>:<to>		from to to in secs, then to
+ *   step:<secs>:<r1>,<r2>,...		each rate for secs, then the last one
+ *   square:<period>:<duty %>:<high>[:<low>]	high for duty % of every period, else low
+ *   sine:<period>:<mean>:<amplitude>	mean + amplitude * sin(2 pi t / period)
+ *   csv:<file>				lines of <sec>,<rate>, each rate from its second on
+ */
+struct load_profile {
+	enum load_shape	shape;
+	char		*spec;
+	double		period;
+	double		duty;
+	double		*rates;
+	/* the second each rate starts at, csv only */
+	double		*times;
+	int		num_rates;
+};
+
+/* The target and achieved message rate of an interval of a load profile */
+struct pace_sample {
+	double		sec;
+	double		target_pps;
+	double		achieved_pps;
+};
+
+struct pacer {
+	struct pace_bucket	*buckets;
+	int			num_buckets;
+	int			per_qp;
+	int			burst_size;
+	/* cycles between two messages of a bucket, and the burst a bucket may run ahead */
+	double			interval;
+	double			tolerance;
+	/* no message goes, a load profile at rate 0 */
+	int			paused;
+	double			target_pps;
+	double			pps_per_unit;
+	double			cpu_mhz;
+	cycles_t		start;
+
+	/* a load profile sets the rate every update_cycles, next_update is never without one */
+	struct load_profile	*profile;
+	cycles_t		update_cycles;
+	cycles_t		next_update;
+	cycles_t		last_update;
+	uint64_t		last_msgs;
+	struct pace_sample	*samples;
+	int			num_samples;
+	int			max_samples;
+};
+
+/*
+ * Parse the spec of --load_profile, returns 1 on a bad spec.
+ */
+int load_profile_parse(const char *spec, struct load_profile **profile);
+
+/*
+ * The rate of a load profile at a second of the test, in --rate_units.
+ */
+double load_profile_rate(struct load_profile *profile, double sec);
+
+void load_profile_free(struct load_profile *profile);
+
+/*
+ * Create the pacer of a BW test from --rate_limit, --rate_units and
+ * --burst_size, one bucket for all the QPs or with --rate_limit_per_qp one
+ * per QP, each at the full rate. With --load_profile the rate follows the
+ * profile instead of --rate_limit. A pacer of an earlier measurement is
+ * destroyed first.
+ */
+int pacer_create(struct pacer **pacer, struct perftest_parameters *user_param, int num_of_qps);
+
+/*
+ * Set the rate of the load profile at now and sample the interval before it.
+ */
+void pacer_update(struct pacer *pacer, cycles_t now);
+
+/*
+ * Take n messages of the bucket of a QP, returns 0 if they are not due yet.
+ */
+static inline int pacer_take(struct pacer *pacer, int qp, int n)
+{
+	struct pace_bucket *bucket = &pacer->buckets[pacer->per_qp ? qp : 0];
+	cycles_t now = get_cycles();
+	double t;
+
+	if (now >= pacer->next_update)
+		pacer_update(pacer, now);
+
+	t = (double)(now - pacer->start);
+	if (pacer->paused || bucket->due + (n - 1) * pacer->interval > t + pacer->tolerance) {
+		bucket->holds++;
+		return 0;
+	}
+
+	/* an idle bucket fills up to a burst and no more */
+	bucket->due = (bucket->due > t ? bucket->due : t) + n * pacer->interval;
+	if (!bucket->msgs)
+		bucket->first = now;
+	bucket->last = now;
+	bucket->msgs += n;
+
+	return 1;
+}
+
+/*
+ * Print the target rate against the one the buckets achieved, and with a
+ * load profile the same for every interval.
+ */
+void pacer_print(struct pacer *pacer);
+
+/*
+ * Write the same to the json report.
+ */
+void pacer_write_json(struct pacer *pacer, int fd);
+
+void pacer_destroy(struct pacer *pacer);
+
+#endif
@@ -198,11 +198,137 @@ static bool check_pcie_relaxed_ordering_compliant(void) {
 	return cpu_is_RO_compliant;
 }
 #endif
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void usage_reg_mr(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s             measure memory registration cost on the local device\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+
+	printf("  -a, --all ");
+	printf(" Run region sizes from %llu till --size (default %d)\n", MIN_REG_MR_SIZE, DEF_SIZE_REG_MR_ALL);
+
+	printf("  -d, --ib-dev=<dev> ");
+	printf(" Use IB device <dev> (default first device found)\n");
+
+	printf("  -F, --CPU-freq ");
+	printf(" Do not show a warning even if cpufreq_ondemand module is loaded, and cpu-freq is not on max.\n");
+
+	printf("  -h, --help ");
+	printf(" Show this help screen.\n");
+
+	printf("  -n, --iters=<iters> ");
+	printf(" Number of register/deregister pairs per thread (at least %d, default %d)\n", MIN_ITER, DEF_ITERS);
+
+	printf("  -s, --size=<size> ");
+	printf(" Size of the registered region, K/M/G suffixes allowed, %llu till %llu (default %d)\n",
+	       MIN_REG_MR_SIZE, MAX_REG_MR_SIZE, DEF_SIZE_REG_MR);
+
+	printf("  -V, --version ");
+	printf(" Display version number\n");
+
+	putchar('\n');
+
+	#if defined HAVE_EX_ODP
+	printf("      --odp ");
+	printf(" Register the region with On Demand Paging instead of pinning it.\n");
+	#endif
+
+	printf("      --threads=<num> ");
+	printf(" Number of threads registering in parallel, each on its own region (default %d)\n", DEF_NUM_THREADS);
+
+	printf("      --use_hugepages ");
+	printf(" Back the region with hugetlbfs pages.\n");
+
+	printf("      --use_thp ");
+	printf(" Back the region with transparent huge pages.\n");
+
+	#if defined HAVE_RO
+	printf("      --disable_pcie_relaxed");
+	printf(" Disable PCIe relaxed ordering\n");
+	#endif
+	putchar('\n');
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void usage_qp_rate(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s             measure QP create/modify/destroy rate on the local device\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+
+	printf("  -a, --all ");
+	printf(" Run all power of 2 QP counts from --threads till --qp\n");
+
+	printf("  -c, --connection=<RC/UC/UD> ");
+	printf(" Connection type RC/UC/UD (default RC)\n");
+
+	printf("  -d, --ib-dev=<dev> ");
+	printf(" Use IB device <dev> (default first device found)\n");
+
+	printf("  -F, --CPU-freq ");
+	printf(" Do not show a warning even if cpufreq_ondemand module is loaded, and cpu-freq is not on max.\n");
+
+	printf("  -h, --help ");
+	printf(" Show this help screen.\n");
+
+	printf("  -i, --ib-port=<port> ");
+	printf(" Use port <port> of IB device (default %d)\n", DEF_IB_PORT);
+
+	printf("  -m, --mtu=<mtu> ");
+	printf(" MTU size : 256 - 4096 (default port mtu)\n");
+
+	printf("  -n, --iters=<iters> ");
+	printf(" Number of create/modify/destroy rounds over all the QPs (at least %d, default %d)\n", MIN_ITER, DEF_ITERS_QP_RATE);
+
+	printf("  -q, --qp=<num of qp's> ");
+	printf(" Num of QPs created in every round, %d till %d (default %d)\n", MIN_QP_NUM, MAX_QP_RATE_NUM, DEF_QP_RATE_NUM);
+
+	printf("  -r, --rx-depth=<dep> ");
+	printf(" Receive queue depth of the created QPs (default %d)\n", DEF_RX_RDMA);
+
+	printf("  -t, --tx-depth=<dep> ");
+	printf(" Send queue depth of the created QPs (default %d)\n", DEF_TX_BW);
+
+	printf("  -V, --version ");
+	printf(" Display version number\n");
+
+	printf("  -x, --gid-index=<index> ");
+	printf(" Test uses GID with GID index\n");
+
+	putchar('\n');
+
+	printf("      --threads=<num> ");
+	printf(" Number of threads, each creating its own share of the QPs (default %d)\n", DEF_NUM_THREADS);
+
+	#ifdef HAVE_IBV_WR_API
+	printf("      --use_old_post_send ");
+	printf(" Create the QPs with ibv_create_qp instead of ibv_create_qp_ex\n");
+	#endif
+	putchar('\n');
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
 static void usage(const char *argv0, VerbType verb, TestType tst, int connection_type)
 {
+	if (tst == REG_MR) {
+		usage_reg_mr(argv0);
+		return;
+	}
+
+	if (tst == QP_RATE) {
+		usage_qp_rate(argv0);
+		return;
+	}
+
 	printf("Usage:\n");
 
 	if (tst != FS_RATE) {
@@ -272,6 +398,9 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 		printf("  -e, --events ");
 		printf(" Sleep on CQ events (default poll)\n");
 
+		printf("      --event_spin=<usec|auto> ");
+		printf(" With -e, busy poll the CQ for <usec> before sleeping on its event, auto learns it from the completion waits (default 0)\n");
+
 		printf("  -X, --vector=<completion vector> ");
 		printf(" Set <completion vector> used for events\n");
 	}
@@ -349,7 +478,7 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 	printf("  -p, --port=<port> ");
 	printf(" Listen on/connect to port <port> (default %d)\n",DEF_PORT);
 
-	if (tst == BW ) {
+	if (tst == BW || tst == FS_RATE) {
 		printf("  -q, --qp=<num of qp's>  Num of qp's(default %d)\n", DEF_NUM_QPS);
 	}
 
@@ -472,6 +601,12 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 	if (tst == LAT) {
 		printf("      --latency_gap=<delay_time> ");
 		printf(" delay time between each post send\n");
+
+		printf("      --hw_timestamps ");
+		printf(" Also report the latency from the NIC completion timestamps (software timestamps at the CQE read if not supported)\n");
+
+		printf("      --lat_depth=<depth> ");
+		printf(" Keep <depth> requests in flight and time each of them, write, send and read over RC (default 1, ping-pong)\n");
 	}
 
 	if (connection_type != RawEth) {
@@ -524,11 +659,51 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 
 		printf("      --run_infinitely ");
 		printf(" Run test forever, print results every <duration> seconds\n");
+
+		printf("      --metrics_port=<port> ");
+		printf(" With --run_infinitely, serve live Prometheus metrics on http://127.0.0.1:<port>/metrics\n");
+
+		printf("      --sample_counters=<usec> ");
+		printf(" Sample the port congestion counters every <usec> during the test and add the per-interval deltas to the json report\n");
+
+		printf("      --autotune=<seconds> ");
+		printf(" Search for the -q, -t, -l, -Q, -I and post send API that give the highest message rate, the given values are the upper bounds\n");
+
+		printf("      --perf_events ");
+		printf(" Report the CPU cost of a message (cycles, instructions, IPC, LLC and branch misses) and the utilization of the allowed cores\n");
+
+		printf("      --lat_probe=<usec> ");
+		printf(" Measure write ping-pong latency on a separate QP, CQ and thread during the test, <usec> apart (0 back to back)\n");
+	}
+
+	if ((verb == WRITE || verb == READ) && tst == BW) {
+		printf("      --daemon ");
+		printf(" Server only, keep the device, the PD, the buffer and the QPs and serve one client after the other\n");
+
+		printf("      --daemon_sessions=<n> ");
+		printf(" Exit the --daemon server after <n> sessions (default 0, for ever)\n");
+
+		printf("      --loopback ");
+		printf(" Run the server and the client in threads of this process, pinned to the first two allowed CPUs, without a socket\n");
+
+		printf("      --loopback_shared ");
+		printf(" The --loopback client uses the device context, PD and MR of the server\n");
+	}
+
+	if (verb == SEND && tst == BW) {
+		printf("      --bi_threads ");
+		printf(" Run the sends and the receives of -b in their own threads, pinned to the first two allowed CPUs, and report each direction\n");
 	}
 
 	if (connection_type != RawEth) {
 		printf("      --retry_count=<value> ");
 		printf(" Set retry count value in rdma_cm mode\n");
+
+		printf("      --cm_storm=<rounds> ");
+		printf(" Connect the QPs <rounds> times and report the rdma_cm connection rate and phase latencies (RC only for more than 1 round)\n");
+
+		printf("      --cm_inflight=<num> ");
+		printf(" Max connections being resolved/connected at once in rdma_cm mode (default all QPs)\n");
 	}
 
 	if (tst != FS_RATE) {
@@ -549,7 +724,7 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 		#endif
 
 		printf("      --use_hugepages ");
-		printf(" Use Hugepages instead of contig, memalign allocations.\n");
+		printf(" Use Hugepages instead of contig, memalign allocations, for the buffers and the per QP arrays.\n");
 	}
 
 	if (tst == BW || tst == LAT_BY_BW) {
@@ -575,6 +750,17 @@ static void usage(const char *argv0, VerbType verb, TestType tst, int connection
 		printf("        Note (1): pps not supported with HW limit.\n");
 		printf("        Note (2): When using PP rate_units is forced to Kbps.\n");
 
+		printf("      --load_profile=<spec>");
+		printf(" Let the SW rate limiter follow a rate schedule, in --rate_units:\n");
+		printf("        ramp:<secs>:<from>:<to>, step:<secs>:<r1>,<r2>,..., square:<period>:<duty %%>:<high>[:<low>],\n");
+		printf("        sine:<period>:<mean>:<amplitude> or csv:<file> of <sec>,<rate> lines, with -D only\n");
+
+		printf("      --load_interval=<msec>");
+		printf(" Set and sample the rate of --load_profile every <msec> (default %d)\n", DEF_LOAD_INTERVAL_MSEC);
+
+		printf("      --rate_limit_per_qp");
+		printf(" Give every QP the full rate of the SW rate limiter, instead of sharing it between them\n");
+
 		printf("      --rate_limit_type=<type>");
 		printf(" [HW/SW/PP] Limit the QP's by HW, PP or by SW. Disabled by default. When rate_limit is not specified HW limit is Default.\n");
 		printf("        Note: in Latency under load test SW rate limit is forced\n");
@@ -599,7 +785,7 @@ void usage_raw_ethernet(TestType tst)
 	printf(" destination MAC address by this format XX:XX:XX:XX:XX:XX **MUST** be entered \n");
 
 	printf("  -G, --use_rss ");
-	printf(" use RSS on server side. need to open 2^x qps (using -q flag. default is -q 2). open 2^x clients that transmit to this server\n");
+	printf(" use RSS on server side, -q sets the number of receive queues (a power of 2). Every queue has its own CQ and pinned thread\n");
 
 	printf("  -J, --dest_ip ");
 	#ifdef HAVE_IPV6
@@ -646,6 +832,32 @@ void usage_raw_ethernet(TestType tst)
 		printf("      --flows_burst");
 		printf(" set number of burst size per TCP/UDP flow. \n");
 
+		if (tst == BW) {
+			printf("      --flow_tuples=<num> ");
+			printf(" rewrite the source IP/port of every packet from a table of <num> flows (up to %d)\n", MAX_FLOW_TUPLES);
+
+			printf("      --flow_dist=<seq|random|zipf> ");
+			printf(" the order flows are picked from the flow tuples table (default seq)\n");
+
+			printf("      --zipf_theta=<val> ");
+			printf(" skew of the zipf flow distribution, between 0 and 1 (default %.2f)\n", DEF_ZIPF_THETA);
+
+			printf("      --verify_csum ");
+			printf(" server verifies the IPv4 and UDP/TCP checksums of every received packet\n");
+
+			printf("      --pcap=<file> ");
+			printf(" server writes the received frames to a pcap file\n");
+
+			printf("      --pcap_snaplen=<bytes> ");
+			printf(" capture only the first <bytes> of every frame (default %d)\n", DEF_PCAP_SNAPLEN);
+
+			printf("      --pcap_file_size=<MB> ");
+			printf(" size of a capture file, frames that don't fit are dropped (default %d)\n", DEF_PCAP_FILE_SIZE);
+
+			printf("      --pcap_ring=<num> ");
+			printf(" write a ring of <num> capture files <file>.0 .. <file>.<num-1>, overwriting the oldest (default 1)\n");
+		}
+
 		printf("      --promiscuous");
 		printf(" run promiscuous mode.\n");
 
@@ -662,6 +874,14 @@ void usage_raw_ethernet(TestType tst)
 
 	}
 
+	if (tst == FS_RATE) {
+		printf("      --threads=<num> ");
+		printf(" Insert and destroy the flows of the QPs from <num> threads (default 1)\n");
+
+		printf("      --fs_churn ");
+		printf(" Replace every flow once at full table size and report the churn rate\n");
+	}
+
 	printf("      --tcp ");
 	printf(" send TCP Packets. must include IP and Ports information.\n");
 
@@ -744,6 +964,10 @@ static void init_perftest_params(struct perftest_parameters *user_param)
 	user_param->rate_units		= GIGA_BIT_PS;
 	user_param->rate_limit_type	= DISABLE_RATE_LIMIT;
 	user_param->is_rate_limit_type  = 0;
+	user_param->rate_limit_per_qp	= OFF;
+	user_param->pacer		= NULL;
+	user_param->load_profile	= NULL;
+	user_param->load_interval	= DEF_LOAD_INTERVAL_MSEC;
 	user_param->data_enc_keys_number = 1;
 	user_param->log_dci_streams = 0;
 	user_param->log_active_dci_streams = 0;
@@ -815,6 +1039,43 @@ static void init_perftest_params(struct perftest_parameters *user_param)
 	user_param->disable_pcir		= 0;
 	user_param->source_ip		= NULL;
 	user_param->has_source_ip	= 0;
+	user_param->num_threads		= DEF_NUM_THREADS;
+	user_param->use_thp		= 0;
+	user_param->cm_storm		= 0;
+	user_param->cm_inflight		= 0;
+	user_param->fs_churn		= 0;
+	user_param->flow_tuples		= 0;
+	user_param->flow_dist		= FLOW_SEQUENTIAL;
+	user_param->zipf_theta		= DEF_ZIPF_THETA;
+	user_param->verify_csum		= 0;
+	user_param->pcap_file		= NULL;
+	user_param->pcap_snaplen	= DEF_PCAP_SNAPLEN;
+	user_param->pcap_file_size	= DEF_PCAP_FILE_SIZE;
+	user_param->pcap_ring		= 1;
+	user_param->hw_timestamps	= 0;
+	user_param->hw_ts_active	= 0;
+	user_param->metrics_port	= 0;
+	user_param->sample_counters	= 0;
+	user_param->perf_events		= 0;
+	user_param->autotune		= 0;
+	user_param->event_spin		= 0;
+	user_param->lat_depth		= 1;
+	user_param->use_lat_probe	= OFF;
+	user_param->lat_probe_gap	= 0;
+	user_param->bi_threads		= OFF;
+	user_param->daemon		= OFF;
+	user_param->daemon_sessions	= 0;
+	user_param->loopback		= OFF;
+	user_param->loopback_shared	= OFF;
+
+	if (user_param->tst == REG_MR)
+		user_param->size	= DEF_SIZE_REG_MR;
+
+	if (user_param->tst == QP_RATE) {
+		user_param->num_of_qps	= DEF_QP_RATE_NUM;
+		user_param->iters	= DEF_ITERS_QP_RATE;
+		user_param->tx_depth	= DEF_TX_BW;
+	}
 }
 
 static int open_file_write(const char* file_path)
@@ -858,7 +1119,7 @@ static int ctx_chk_pkey_index(struct ibv_context *context,int pkey_idx)
 /******************************************************************************
  *
  ******************************************************************************/
-static void change_conn_type(int *cptr, VerbType verb, const char *optarg)
+static void change_conn_type(int *cptr, VerbType verb, TestType tst, const char *optarg)
 {
 	if (*cptr == RawEth)
 		return;
@@ -875,7 +1136,8 @@ static void change_conn_type(int *cptr, VerbType verb, const char *optarg)
 
 	} else if (strcmp(connStr[2], optarg)==0)  {
 		*cptr = UD;
-		if (verb != SEND) {
+		/* the QP rate test only creates and connects QPs, it posts nothing */
+		if (verb != SEND && tst != QP_RATE) {
 			log_ebt(" UD connection only possible in SEND verb\n");
 			exit(1);
 		}
@@ -993,6 +1255,82 @@ void flow_rules_force_dependecies(struct perftest_parameters *user_param)
 			exit(FAILURE);
 		}
 	}
+
+	if (user_param->flow_tuples) {
+		if (user_param->tst != BW || user_param->machine != CLIENT || user_param->duplex) {
+			log_ebt( " Flow tuples are generated by the unidir raw_ethernet_bw client only\n");
+			exit(FAILURE);
+		}
+		if (user_param->is_server_port == OFF) {
+			log_ebt( " Flow tuples work with UDP/TCP packets only\n");
+			exit(FAILURE);
+		}
+		if (user_param->flows != DEF_FLOWS) {
+			log_ebt( " Please choose either --flows or --flow_tuples\n");
+			exit(FAILURE);
+		}
+		if (user_param->post_list > 1 || user_param->test_method == RUN_INFINITELY) {
+			log_ebt( " Flow tuples are not supported with post list or run_infinitely\n");
+			exit(FAILURE);
+		}
+	} else if (user_param->flow_dist != FLOW_SEQUENTIAL) {
+		log_ebt( " --flow_dist requires --flow_tuples\n");
+		exit(FAILURE);
+	}
+
+	if (user_param->use_rss) {
+		if (user_param->tst != BW || user_param->machine != SERVER || user_param->duplex ||
+		    user_param->mac_fwd || user_param->raw_mcast) {
+			log_ebt( " RSS is supported by the unidir raw_ethernet_bw server only\n");
+			exit(FAILURE);
+		}
+		if (user_param->num_of_qps & (user_param->num_of_qps - 1)) {
+			log_ebt( " RSS needs a power of 2 number of receive queues (-q)\n");
+			exit(FAILURE);
+		}
+		if (!user_param->is_server_ip || !user_param->is_client_ip) {
+			log_ebt( " RSS hashes the IP addresses, please set both of them (-J and -j)\n");
+			exit(FAILURE);
+		}
+		if (user_param->use_event || user_param->use_srq || user_param->recv_post_list > 1 ||
+		    user_param->test_method != RUN_REGULAR || user_param->verify_csum) {
+			log_ebt( " RSS is not supported with events, SRQ, recv post list, run_infinitely or --verify_csum\n");
+			exit(FAILURE);
+		}
+	}
+
+	if (user_param->pcap_file) {
+		if (user_param->tst != BW || user_param->machine != SERVER || user_param->duplex ||
+		    user_param->use_rss || user_param->mac_fwd) {
+			log_ebt( " Capture is supported by the unidir raw_ethernet_bw server only\n");
+			exit(FAILURE);
+		}
+		if (user_param->use_srq || user_param->recv_post_list > 1 || user_param->test_method == RUN_INFINITELY) {
+			log_ebt( " Capture is not supported with SRQ, recv post list or run_infinitely\n");
+			exit(FAILURE);
+		}
+	} else if (user_param->pcap_ring > 1) {
+		log_ebt( " --pcap_ring requires --pcap\n");
+		exit(FAILURE);
+	}
+
+	if (user_param->mac_fwd) {
+		if (user_param->use_event || user_param->use_srq || user_param->recv_post_list > 1) {
+			log_ebt( " MAC forwarding is not supported with events, SRQ or recv post list\n");
+			exit(FAILURE);
+		}
+	}
+
+	if (user_param->verify_csum) {
+		if (user_param->tst != BW || user_param->machine != SERVER || user_param->duplex) {
+			log_ebt( " Checksums are verified by the unidir raw_ethernet_bw server only\n");
+			exit(FAILURE);
+		}
+		if (user_param->use_srq || user_param->recv_post_list > 1 || user_param->test_method == RUN_INFINITELY) {
+			log_ebt( " Checksum validation is not supported with SRQ, recv post list or run_infinitely\n");
+			exit(FAILURE);
+		}
+	}
 	return;
 }
 
@@ -1002,7 +1340,7 @@ void flow_rules_force_dependecies(struct perftest_parameters *user_param)
 static void force_dependecies(struct perftest_parameters *user_param)
 {
 	/*Additional configuration and assignments.*/
-	if (user_param->test_type == ITERATIONS) {
+	if (user_param->test_type == ITERATIONS && user_param->tst != QP_RATE) {
 		if (user_param->tx_depth > user_param->iters) {
 			user_param->tx_depth = user_param->iters;
 		}
@@ -1056,9 +1394,106 @@ static void force_dependecies(struct perftest_parameters *user_param)
 	if (user_param->verb == READ || user_param->verb == ATOMIC)
 		user_param->inline_size = 0;
 
-	if (user_param->test_method == RUN_ALL)
+	if (user_param->tst == REG_MR) {
+		if (user_param->test_type == DURATION) {
+			printf(RESULT_LINE);
+			log_ebt(" Memory registration test supports iterations mode only\n");
+			exit(1);
+		}
+
+		if (user_param->use_event) {
+			printf(RESULT_LINE);
+			log_ebt(" Memory registration test doesn't use events\n");
+			exit(1);
+		}
+
+		if (user_param->use_hugepages && user_param->use_thp) {
+			printf(RESULT_LINE);
+			log_ebt(" Please choose either --use_hugepages or --use_thp\n");
+			exit(1);
+		}
+
+		if (user_param->servername) {
+			printf(RESULT_LINE);
+			log_ebt(" Memory registration test runs on the local device only\n");
+			exit(1);
+		}
+
+		if (user_param->test_method == RUN_ALL && !user_param->req_size)
+			user_param->size = DEF_SIZE_REG_MR_ALL;
+
+	} else if (user_param->tst == QP_RATE) {
+		if (user_param->test_type == DURATION) {
+			printf(RESULT_LINE);
+			log_ebt(" QP rate test supports iterations mode only\n");
+			exit(1);
+		}
+
+		if (user_param->use_event || user_param->use_rdma_cm || user_param->work_rdma_cm) {
+			printf(RESULT_LINE);
+			log_ebt(" QP rate test doesn't use events or RDMA CM\n");
+			exit(1);
+		}
+
+		if (user_param->servername) {
+			printf(RESULT_LINE);
+			log_ebt(" QP rate test runs on the local device only\n");
+			exit(1);
+		}
+
+		if (user_param->connection_type != RC && user_param->connection_type != UC &&
+		    user_param->connection_type != UD) {
+			printf(RESULT_LINE);
+			log_ebt(" QP rate test supports RC, UC and UD QPs only\n");
+			exit(1);
+		}
+
+		if (user_param->use_srq || user_param->use_xrc || user_param->dualport == ON) {
+			printf(RESULT_LINE);
+			log_ebt(" QP rate test doesn't support SRQ, XRC or dual-port\n");
+			exit(1);
+		}
+
+		if (user_param->num_threads > user_param->num_of_qps) {
+			printf(RESULT_LINE);
+			log_ebt(" Number of threads cannot exceed the number of QPs\n");
+			exit(1);
+		}
+
+	} else if (user_param->test_method == RUN_ALL)
 		user_param->size = MAX_SIZE;
 
+	if (user_param->use_thp && user_param->tst != REG_MR) {
+		printf(RESULT_LINE);
+		log_ebt(" --use_thp is supported in memory registration test only\n");
+		exit(1);
+	}
+
+	if (user_param->num_threads > 1 && user_param->tst != REG_MR && user_param->tst != QP_RATE &&
+	    user_param->tst != FS_RATE) {
+		printf(RESULT_LINE);
+		log_ebt(" --threads is supported in memory registration, QP rate and FS rate tests only\n");
+		exit(1);
+	}
+
+	if (user_param->tst == FS_RATE) {
+		if ((user_param->num_threads > 1 || user_param->fs_churn) && user_param->test_type == DURATION) {
+			printf(RESULT_LINE);
+			log_ebt(" --threads and --fs_churn are supported in FS rate iterations mode only\n");
+			exit(1);
+		}
+
+		if (user_param->num_threads > user_param->num_of_qps) {
+			printf(RESULT_LINE);
+			log_ebt(" Every thread inserts flows on its own QPs, open at least --threads QPs\n");
+			exit(1);
+		}
+	} else if (user_param->fs_churn) {
+		printf(RESULT_LINE);
+		log_ebt(" --fs_churn is supported in FS rate test only\n");
+		exit(1);
+	}
+
 	if (user_param->verb == ATOMIC && user_param->size != DEF_SIZE_ATOMIC) {
 		printf(RESULT_LINE);
 		printf("Message size cannot be changed for Atomic tests \n");
@@ -1118,6 +1553,23 @@ static void force_dependecies(struct perftest_parameters *user_param)
 			user_param->link_type2 = user_param->link_type;
 	}
 
+	if (user_param->test_method == RUN_AUTOTUNE) {
+		if (user_param->tst != BW || (user_param->verb != WRITE && user_param->verb != READ) ||
+				user_param->duplex || user_param->test_type != ITERATIONS ||
+				user_param->rate_limit_type != DISABLE_RATE_LIMIT || user_param->use_event) {
+			printf(RESULT_LINE);
+			log_ebt(" --autotune works in unidirectional write and read BW tests, in iterations mode, without rate limit or events\n");
+			exit(1);
+		}
+
+		/* without -l the search goes up to the largest post list */
+		if (user_param->post_list == 1)
+			user_param->post_list = AUTOTUNE_MAX_POST_LIST;
+		user_param->iters = ROUND_UP(user_param->iters, user_param->post_list);
+		/* a block is measured by its message rate only */
+		user_param->noPeak = ON;
+	}
+
 	if (user_param->post_list > 1) {
 		if (user_param->tst == BW || user_param->tst == LAT_BY_BW)
 		{
@@ -1261,6 +1713,9 @@ static void force_dependecies(struct perftest_parameters *user_param)
 			user_param->cq_mod = user_param->rx_depth < user_param->tx_depth ? user_param->rx_depth : user_param->tx_depth;
 			log_ebt(" Changing CQ moderation to min( rx depth , tx depth) = %d.\n",user_param->cq_mod);
 		}
+		/* the forwarding threads time the whole run only */
+		if (user_param->mac_fwd == ON)
+			user_param->noPeak = ON;
 
 		if (user_param->raw_mcast && user_param->duplex) {
 			log_ebt( " Multicast feature works on unidirectional traffic only\n");
@@ -1268,6 +1723,10 @@ static void force_dependecies(struct perftest_parameters *user_param)
 		}
 
 		flow_rules_force_dependecies(user_param);
+	} else if (user_param->flow_tuples || user_param->flow_dist != FLOW_SEQUENTIAL) {
+		printf(RESULT_LINE);
+		log_ebt(" Flow tuples are supported by Raw Ethernet tests only\n");
+		exit(1);
 	}
 
 	if (user_param->use_mcg &&  user_param->gid_index == -1) {
@@ -1294,8 +1753,19 @@ static void force_dependecies(struct perftest_parameters *user_param)
 			exit(1);
 		}
 
+		if (user_param->cm_storm > 1 && user_param->connection_type != RC) {
+			printf(RESULT_LINE);
+			printf(" Reconnect rounds of --cm_storm are supported with RC only\n");
+			exit(1);
+		}
+
 		user_param->use_rdma_cm = ON;
 
+	} else if (user_param->cm_storm || user_param->cm_inflight) {
+		printf(RESULT_LINE);
+		printf(" --cm_storm and --cm_inflight require rdma_cm QPs (-R)\n");
+		exit(1);
+
 	} else if (user_param->tos != DEF_TOS && user_param->connection_type != RawEth) {
 		fprintf(stdout," TOS only valid for rdma_cm based QP and RawEth QP \n");
 		exit(1);
@@ -1366,6 +1836,133 @@ static void force_dependecies(struct perftest_parameters *user_param)
 		}
 	}
 
+	if (user_param->metrics_port && user_param->test_method != RUN_INFINITELY) {
+		printf(RESULT_LINE);
+		log_ebt(" --metrics_port works with --run_infinitely only\n");
+		exit(1);
+	}
+
+	if (user_param->sample_counters) {
+		if (user_param->tst != BW || user_param->test_method == RUN_INFINITELY) {
+			printf(RESULT_LINE);
+			log_ebt(" --sample_counters works in BW tests, without --run_infinitely\n");
+			exit(1);
+		}
+		if (!user_param->out_json) {
+			printf(RESULT_LINE);
+			log_ebt(" --sample_counters reports in the json file, use it with --out_json\n");
+			exit(1);
+		}
+	}
+
+	if (user_param->use_lat_probe) {
+		if (user_param->tst != BW || (user_param->verb != WRITE && user_param->verb != READ) ||
+		    user_param->duplex || user_param->test_method != RUN_REGULAR) {
+			printf(RESULT_LINE);
+			log_ebt(" --lat_probe works in unidirectional write and read BW tests, without -a, --autotune or --run_infinitely\n");
+			exit(1);
+		}
+		/* the probe QP is connected by hand, next to the test QPs */
+		if (user_param->work_rdma_cm) {
+			printf(RESULT_LINE);
+			log_ebt(" --lat_probe doesn't support rdma_cm\n");
+			exit(1);
+		}
+	}
+
+	if (user_param->bi_threads) {
+		if (user_param->tst != BW || user_param->verb != SEND || !user_param->duplex ||
+		    user_param->test_method == RUN_INFINITELY) {
+			printf(RESULT_LINE);
+			log_ebt(" --bi_threads works in bidirectional send BW tests (-b), without --run_infinitely\n");
+			exit(1);
+		}
+		/* the threads would share the completion channel and the per port counters */
+		if (user_param->use_event || user_param->report_per_port || user_param->mac_fwd) {
+			printf(RESULT_LINE);
+			log_ebt(" --bi_threads doesn't support events, --report-per-port or --mac_fwd\n");
+			exit(1);
+		}
+	}
+
+	if (user_param->daemon) {
+		if (user_param->machine != SERVER || user_param->servername || user_param->tst != BW ||
+		    (user_param->verb != WRITE && user_param->verb != READ) || user_param->duplex) {
+			printf(RESULT_LINE);
+			log_ebt(" --daemon is for the server of unidirectional write and read BW tests\n");
+			exit(1);
+		}
+		/* a session brings its own QPs and buffer size, not these */
+		if (user_param->use_rdma_cm || user_param->use_event || user_param->use_xrc ||
+		    (user_param->connection_type != RC && user_param->connection_type != UC) ||
+		    user_param->mr_per_qp || user_param->use_lat_probe || user_param->dont_xchg_versions ||
+		    user_param->mmap_file || user_param->aes_xts
+		    #ifdef HAVE_CUDA
+		    || user_param->use_cuda
+		    #endif
+		    #ifdef HAVE_ROCM
+		    || user_param->use_rocm
+		    #endif
+		    ) {
+			printf(RESULT_LINE);
+			log_ebt(" --daemon supports RC and UC, without rdma_cm, events, --mr_per_qp, --lat_probe,"
+				" --dont_xchg_versions or GPU, mmap and encrypted buffers\n");
+			exit(1);
+		}
+	}
+
+	if (user_param->loopback_shared && !user_param->loopback) {
+		printf(RESULT_LINE);
+		log_ebt(" --loopback_shared requires --loopback\n");
+		exit(1);
+	}
+
+	if (user_param->loopback) {
+		if (user_param->servername || user_param->daemon || user_param->tst != BW ||
+		    (user_param->verb != WRITE && user_param->verb != READ) || user_param->duplex ||
+		    (user_param->test_method != RUN_REGULAR && user_param->test_method != RUN_ALL)) {
+			printf(RESULT_LINE);
+			log_ebt(" --loopback runs unidirectional write and read BW tests, without a server name,"
+				" --daemon, --run_infinitely or --autotune\n");
+			exit(1);
+		}
+		/* the sides are set up like the sessions of a --daemon server */
+		if (user_param->use_rdma_cm || user_param->use_event || user_param->use_xrc ||
+		    (user_param->connection_type != RC && user_param->connection_type != UC) ||
+		    user_param->mr_per_qp || user_param->use_lat_probe || user_param->mmap_file || user_param->aes_xts
+		    #ifdef HAVE_CUDA
+		    || user_param->use_cuda
+		    #endif
+		    #ifdef HAVE_ROCM
+		    || user_param->use_rocm
+		    #endif
+		    ) {
+			printf(RESULT_LINE);
+			log_ebt(" --loopback supports RC and UC, without rdma_cm, events, --mr_per_qp, --lat_probe"
+				" or GPU, mmap and encrypted buffers\n");
+			exit(1);
+		}
+	}
+
+	if (user_param->perf_events && (user_param->tst != BW || user_param->test_method == RUN_INFINITELY)) {
+		printf(RESULT_LINE);
+		log_ebt(" --perf_events works in BW tests, without --run_infinitely\n");
+		exit(1);
+	}
+
+	if (user_param->event_spin && !user_param->use_event) {
+		printf(RESULT_LINE);
+		log_ebt(" --event_spin works in events mode, use it with -e\n");
+		exit(1);
+	}
+
+	/* the event wait polls the plain CQ, not the timestamped one */
+	if (user_param->use_event && user_param->hw_timestamps) {
+		printf(RESULT_LINE);
+		log_ebt(" Completion timestamps are not supported in events mode\n");
+		exit(1);
+	}
+
 	if (user_param->connection_type == DC && !user_param->use_srq)
 		user_param->use_srq = ON;
 
@@ -1526,7 +2123,7 @@ static void force_dependecies(struct perftest_parameters *user_param)
 		user_param->cq_mod = 1;
 	}
 
-	#ifndef HAVE_RSS_EXP
+	#ifndef HAVE_RSS
 	if (user_param->use_rss) {
 		printf(RESULT_LINE);
 		log_ebt(" RSS feature is not available in libibverbs\n");
@@ -1537,6 +2134,27 @@ static void force_dependecies(struct perftest_parameters *user_param)
 	if ((user_param->use_srq && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex == ON)) || user_param->use_xrc)
 		user_param->srq_exists = 1;
 
+	if (user_param->load_profile) {
+		if ((user_param->tst != BW && user_param->tst != LAT_BY_BW) || user_param->test_method == RUN_INFINITELY) {
+			printf(RESULT_LINE);
+			log_ebt(" --load_profile works in BW tests without --run_infinitely\n");
+			exit(1);
+		}
+		/* a profile at rate 0 holds every QP, an iterations test would never end */
+		if (user_param->test_type != DURATION) {
+			printf(RESULT_LINE);
+			log_ebt(" --load_profile works in duration tests only (-D)\n");
+			exit(1);
+		}
+		if (user_param->rate_limit_type == DISABLE_RATE_LIMIT)
+			user_param->rate_limit_type = SW_RATE_LIMIT;
+		if (user_param->rate_limit_type != SW_RATE_LIMIT) {
+			printf(RESULT_LINE);
+			log_ebt(" --load_profile replaces --rate_limit and works with the SW rate limiter only\n");
+			exit(1);
+		}
+	}
+
 	if (user_param->burst_size > 0) {
 		if (user_param->rate_limit_type == DISABLE_RATE_LIMIT && user_param->tst != LAT_BY_BW ) {
 			printf(RESULT_LINE);
@@ -1560,6 +2178,12 @@ static void force_dependecies(struct perftest_parameters *user_param)
 		exit(1);
 	}
 
+	if (user_param->rate_limit_per_qp && user_param->rate_limit_type != SW_RATE_LIMIT) {
+		printf(RESULT_LINE);
+		log_ebt(" --rate_limit_per_qp works with the SW rate limiter only\n");
+		exit(1);
+	}
+
 	if (user_param->rate_limit_type == SW_RATE_LIMIT) {
 		if (user_param->tst != BW || user_param->verb == ATOMIC || (user_param->verb == SEND && user_param->duplex)) {
 			printf(RESULT_LINE);
@@ -1656,6 +2280,50 @@ static void force_dependecies(struct perftest_parameters *user_param)
 		exit(1);
 	}
 
+	if (user_param->hw_timestamps) {
+		if (user_param->tst != LAT || user_param->test_type != ITERATIONS) {
+			printf(RESULT_LINE);
+			log_ebt(" Completion timestamps are supported in latency tests with iterations only\n");
+			exit(1);
+		}
+		/* write_lat sees the reply in memory, not in a completion */
+		if (user_param->verb == WRITE) {
+			printf(RESULT_LINE);
+			log_ebt(" Completion timestamps are not supported in write latency tests\n");
+			exit(1);
+		}
+	}
+
+	if (user_param->lat_depth > 1) {
+		if (user_param->tst != LAT || user_param->verb == ATOMIC ||
+		    user_param->connection_type != RC || user_param->num_of_qps != 1) {
+			printf(RESULT_LINE);
+			log_ebt(" --lat_depth is supported in write, send and read latency tests over RC with one QP\n");
+			exit(1);
+		}
+		if (user_param->test_type != ITERATIONS || user_param->test_method == RUN_ALL) {
+			printf(RESULT_LINE);
+			log_ebt(" --lat_depth works with iterations and a single message size\n");
+			exit(1);
+		}
+		if (user_param->use_event || user_param->hw_timestamps || user_param->latency_gap ||
+		    user_param->use_srq || user_param->flows != DEF_FLOWS) {
+			printf(RESULT_LINE);
+			log_ebt(" --lat_depth doesn't support events, completion timestamps, latency gap, SRQ or flows\n");
+			exit(1);
+		}
+		if ((uint64_t)user_param->lat_depth > user_param->iters) {
+			printf(RESULT_LINE);
+			log_ebt(" --lat_depth can't be more than the number of iterations\n");
+			exit(1);
+		}
+		/* the queues hold all the requests in flight */
+		if (user_param->tx_depth < user_param->lat_depth)
+			user_param->tx_depth = user_param->lat_depth;
+		if (user_param->verb == SEND && user_param->rx_depth < user_param->lat_depth)
+			user_param->rx_depth = user_param->lat_depth;
+	}
+
 	if ( user_param->test_type == DURATION && user_param->margin == DEF_INIT_MARGIN) {
 		user_param->margin = user_param->duration / 4;
 	}
@@ -2107,6 +2775,8 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 	static int latency_gap_flag = 0;
 	static int flow_label_flag = 0;
 	static int retry_count_flag = 0;
+	static int cm_storm_flag = 0;
+	static int cm_inflight_flag = 0;
 	static int dont_xchg_versions_flag = 0;
 #ifdef HAVE_CUDA
 	static int use_cuda_flag = 0;
@@ -2148,6 +2818,33 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 	static int vlan_en = 0;
 	static int vlan_pcp_flag = 0;
 	static int recv_post_list_flag = 0;
+	static int num_threads_flag = 0;
+	static int thp_flag = 0;
+	static int fs_churn_flag = 0;
+	static int flow_tuples_flag = 0;
+	static int flow_dist_flag = 0;
+	static int zipf_theta_flag = 0;
+	static int verify_csum_flag = 0;
+	static int pcap_flag = 0;
+	static int pcap_snaplen_flag = 0;
+	static int pcap_file_size_flag = 0;
+	static int pcap_ring_flag = 0;
+	static int hw_timestamps_flag = 0;
+	static int metrics_port_flag = 0;
+	static int sample_counters_flag = 0;
+	static int perf_events_flag = 0;
+	static int autotune_flag = 0;
+	static int event_spin_flag = 0;
+	static int lat_depth_flag = 0;
+	static int lat_probe_flag = 0;
+	static int bi_threads_flag = 0;
+	static int daemon_flag = 0;
+	static int daemon_sessions_flag = 0;
+	static int loopback_flag = 0;
+	static int loopback_shared_flag = 0;
+	static int rate_limit_per_qp_flag = 0;
+	static int load_profile_flag = 0;
+	static int load_interval_flag = 0;
 	#ifdef HAVE_DCS
 	static int log_dci_streams_flag = 0;
 	static int log_active_dci_streams_flag = 0;
@@ -2256,6 +2953,8 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 			{ .name = "latency_gap",	.has_arg = 1, .flag = &latency_gap_flag, .val = 1},
 			{ .name = "flow_label",		.has_arg = 1, .flag = &flow_label_flag, .val = 1},
 			{ .name = "retry_count",	.has_arg = 1, .flag = &retry_count_flag, .val = 1},
+			{ .name = "cm_storm",		.has_arg = 1, .flag = &cm_storm_flag, .val = 1},
+			{ .name = "cm_inflight",	.has_arg = 1, .flag = &cm_inflight_flag, .val = 1},
 			{ .name = "dont_xchg_versions",	.has_arg = 0, .flag = &dont_xchg_versions_flag, .val = 1},
 			#ifdef HAVE_CUDA
 			{ .name = "use_cuda",		.has_arg = 1, .flag = &use_cuda_flag, .val = 1},
@@ -2291,6 +2990,33 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 			{.name = "vlan_en", .has_arg = 0, .flag = &vlan_en, .val = 1},
 			{.name = "vlan_pcp", .has_arg = 1, .flag = &vlan_pcp_flag, .val = 1},
 			{.name = "recv_post_list", .has_arg = 1, .flag = &recv_post_list_flag, .val = 1},
+			{.name = "threads", .has_arg = 1, .flag = &num_threads_flag, .val = 1},
+			{.name = "use_thp", .has_arg = 0, .flag = &thp_flag, .val = 1},
+			{.name = "fs_churn", .has_arg = 0, .flag = &fs_churn_flag, .val = 1},
+			{.name = "flow_tuples", .has_arg = 1, .flag = &flow_tuples_flag, .val = 1},
+			{.name = "flow_dist", .has_arg = 1, .flag = &flow_dist_flag, .val = 1},
+			{.name = "zipf_theta", .has_arg = 1, .flag = &zipf_theta_flag, .val = 1},
+			{.name = "verify_csum", .has_arg = 0, .flag = &verify_csum_flag, .val = 1},
+			{.name = "hw_timestamps", .has_arg = 0, .flag = &hw_timestamps_flag, .val = 1},
+			{.name = "metrics_port", .has_arg = 1, .flag = &metrics_port_flag, .val = 1},
+			{.name = "sample_counters", .has_arg = 1, .flag = &sample_counters_flag, .val = 1},
+			{.name = "perf_events", .has_arg = 0, .flag = &perf_events_flag, .val = 1},
+			{.name = "autotune", .has_arg = 1, .flag = &autotune_flag, .val = 1},
+			{.name = "event_spin", .has_arg = 1, .flag = &event_spin_flag, .val = 1},
+			{.name = "lat_depth", .has_arg = 1, .flag = &lat_depth_flag, .val = 1},
+			{.name = "lat_probe", .has_arg = 1, .flag = &lat_probe_flag, .val = 1},
+			{.name = "bi_threads", .has_arg = 0, .flag = &bi_threads_flag, .val = 1},
+			{.name = "daemon", .has_arg = 0, .flag = &daemon_flag, .val = 1},
+			{.name = "daemon_sessions", .has_arg = 1, .flag = &daemon_sessions_flag, .val = 1},
+			{.name = "loopback", .has_arg = 0, .flag = &loopback_flag, .val = 1},
+			{.name = "loopback_shared", .has_arg = 0, .flag = &loopback_shared_flag, .val = 1},
+			{.name = "rate_limit_per_qp", .has_arg = 0, .flag = &rate_limit_per_qp_flag, .val = 1},
+			{.name = "load_profile", .has_arg = 1, .flag = &load_profile_flag, .val = 1},
+			{.name = "load_interval", .has_arg = 1, .flag = &load_interval_flag, .val = 1},
+			{.name = "pcap", .has_arg = 1, .flag = &pcap_flag, .val = 1},
+			{.name = "pcap_snaplen", .has_arg = 1, .flag = &pcap_snaplen_flag, .val = 1},
+			{.name = "pcap_file_size", .has_arg = 1, .flag = &pcap_file_size_flag, .val = 1},
+			{.name = "pcap_ring", .has_arg = 1, .flag = &pcap_ring_flag, .val = 1},
 			#if defined HAVE_AES_XTS
 			{.name = "aes_xts", .has_arg=0 , .flag = &aes_xts_flag, .val = 1},
 			{.name = "encrypt_on_tx", .has_arg=0 , .flag = &encrypt_on_tx_flag, .val = 1},
@@ -2344,8 +3070,12 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 				  break;
 			case 'x': CHECK_VALUE_IN_RANGE_UNS(user_param->gid_index,uint8_t,MIN_GID_IX,MAX_GID_IX,"Gid index",not_int_ptr);
 				  user_param->use_gid_user = 1; break;
-			case 'c': change_conn_type(&user_param->connection_type,user_param->verb,optarg); break;
-			case 'q': if (user_param->tst != BW) {
+			case 'c': change_conn_type(&user_param->connection_type,user_param->verb,user_param->tst,optarg); break;
+			case 'q': if (user_param->tst == QP_RATE) {
+					CHECK_VALUE_IN_RANGE(user_param->num_of_qps,int,MIN_QP_NUM,MAX_QP_RATE_NUM,"num of Qps",not_int_ptr);
+					break;
+				  }
+				  if (user_param->tst != BW && user_param->tst != FS_RATE) {
 					log_ebt(" Multiple QPs only available on bw tests\n");
 					return 1;
 				  }
@@ -2420,9 +3150,18 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 					  optarg[size_len-1] = '\0';
 					  size_factor = 1024*1024;
 				  }
+				  if (optarg[size_len-1] == 'G' && user_param->tst == REG_MR) {
+					  optarg[size_len-1] = '\0';
+					  size_factor = 1024*1024*1024;
+				  }
 				  user_param->size = (uint64_t)strtol(optarg, NULL, 0) * size_factor;
 				  user_param->req_size = 1;
-				  if (user_param->size < 1 || user_param->size > (UINT_MAX / 2)) {
+				  if (user_param->tst == REG_MR) {
+					  if (user_param->size < MIN_REG_MR_SIZE || user_param->size > MAX_REG_MR_SIZE) {
+						  log_ebt(" Region Size should be between %llu and %llu\n",MIN_REG_MR_SIZE,MAX_REG_MR_SIZE);
+						  return 1;
+					  }
+				  } else if (user_param->size < 1 || user_param->size > (UINT_MAX / 2)) {
 					  log_ebt(" Message Size should be between %d and %d\n",1,UINT_MAX/2);
 					  return 1;
 				  }
@@ -2652,6 +3391,14 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 					CHECK_VALUE_NON_NEGATIVE(user_param->retry_count,int,"Retry Count",not_int_ptr);
 					retry_count_flag = 0;
 				}
+				if (cm_storm_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->cm_storm,int,MIN_CM_STORM_ROUNDS,MAX_CM_STORM_ROUNDS,"CM storm rounds",not_int_ptr);
+					cm_storm_flag = 0;
+				}
+				if (cm_inflight_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->cm_inflight,int,MIN_QP_NUM,MAX_QP_NUM,"CM in-flight connections",not_int_ptr);
+					cm_inflight_flag = 0;
+				}
 				if (mmap_file_flag) {
 					user_param->mmap_file = strdup(optarg);
 					mmap_file_flag = 0;
@@ -2766,6 +3513,93 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 					CHECK_VALUE(user_param->recv_post_list,int,"Receive Post List size",not_int_ptr);
 					recv_post_list_flag = 0;
 				}
+				if (num_threads_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->num_threads,int,MIN_THREADS_NUM,MAX_THREADS_NUM,"Number of threads",not_int_ptr);
+					num_threads_flag = 0;
+				}
+				if (flow_tuples_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->flow_tuples,int,1,MAX_FLOW_TUPLES,"Flow tuples",not_int_ptr);
+					flow_tuples_flag = 0;
+				}
+				if (flow_dist_flag) {
+					if (strcmp("seq",optarg) == 0) {
+						user_param->flow_dist = FLOW_SEQUENTIAL;
+					} else if (strcmp("random",optarg) == 0) {
+						user_param->flow_dist = FLOW_RANDOM;
+					} else if (strcmp("zipf",optarg) == 0) {
+						user_param->flow_dist = FLOW_ZIPF;
+					} else {
+						log_ebt( " Invalid flow distribution. Please use seq, random or zipf\n");
+						return FAILURE;
+					}
+					flow_dist_flag = 0;
+				}
+				if (zipf_theta_flag) {
+					user_param->zipf_theta = atof(optarg);
+					if (user_param->zipf_theta <= 0 || user_param->zipf_theta >= 1) {
+						log_ebt( " Zipf theta should be between 0 and 1 (exclusive)\n");
+						return FAILURE;
+					}
+					zipf_theta_flag = 0;
+				}
+				if (pcap_flag) {
+					user_param->pcap_file = strdup(optarg);
+					pcap_flag = 0;
+				}
+				if (pcap_snaplen_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->pcap_snaplen,int,1,DEF_PCAP_SNAPLEN,"pcap snaplen",not_int_ptr);
+					pcap_snaplen_flag = 0;
+				}
+				if (pcap_file_size_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->pcap_file_size,int,1,MAX_PCAP_FILE_SIZE,"pcap file size",not_int_ptr);
+					pcap_file_size_flag = 0;
+				}
+				if (pcap_ring_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->pcap_ring,int,1,MAX_PCAP_RING,"pcap ring files",not_int_ptr);
+					pcap_ring_flag = 0;
+				}
+				if (metrics_port_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->metrics_port,int,1,65535,"metrics port",not_int_ptr);
+					metrics_port_flag = 0;
+				}
+				if (sample_counters_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->sample_counters,int,MIN_SAMPLE_COUNTERS_USEC,MAX_SAMPLE_COUNTERS_USEC,"counter sampling interval",not_int_ptr);
+					sample_counters_flag = 0;
+				}
+				if (autotune_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->autotune,int,1,MAX_AUTOTUNE_SEC,"autotune time",not_int_ptr);
+					autotune_flag = 0;
+				}
+				if (event_spin_flag) {
+					if (strcmp("auto",optarg) == 0) {
+						user_param->event_spin = EVENT_SPIN_AUTO;
+					} else {
+						CHECK_VALUE_IN_RANGE(user_param->event_spin,int,0,MAX_EVENT_SPIN_USEC,"event spin time",not_int_ptr);
+					}
+					event_spin_flag = 0;
+				}
+				if (lat_depth_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->lat_depth,int,1,MAX_LAT_DEPTH,"latency queue depth",not_int_ptr);
+					lat_depth_flag = 0;
+				}
+				if (lat_probe_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->lat_probe_gap,int,0,MAX_LAT_PROBE_GAP_USEC,"latency probe gap",not_int_ptr);
+					user_param->use_lat_probe = ON;
+					lat_probe_flag = 0;
+				}
+				if (load_profile_flag) {
+					if (load_profile_parse(optarg, &user_param->load_profile))
+						return 1;
+					load_profile_flag = 0;
+				}
+				if (daemon_sessions_flag) {
+					CHECK_VALUE_NON_NEGATIVE(user_param->daemon_sessions,int,"daemon sessions",not_int_ptr);
+					daemon_sessions_flag = 0;
+				}
+				if (load_interval_flag) {
+					CHECK_VALUE_IN_RANGE(user_param->load_interval,int,1,MAX_LOAD_INTERVAL_MSEC,"load profile interval",not_int_ptr);
+					load_interval_flag = 0;
+				}
 				#ifdef HAVE_AES_XTS
 				if (aes_xts_flag) {
 					user_param->aes_xts = 1;
@@ -2832,6 +3666,15 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 		user_param->test_method = RUN_INFINITELY;
 	}
 
+	if (user_param->autotune) {
+		if (user_param->test_method != RUN_REGULAR) {
+			printf(RESULT_LINE);
+			log_ebt(" --autotune can't run with -a or --run_infinitely\n");
+			return FAILURE;
+		}
+		user_param->test_method = RUN_AUTOTUNE;
+	}
+
 	if (srq_flag) {
 		user_param->use_srq = 1;
 	}
@@ -2868,6 +3711,30 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 		user_param->out_json = 1;
 	}
 
+	if (perf_events_flag) {
+		user_param->perf_events = 1;
+	}
+
+	if (bi_threads_flag) {
+		user_param->bi_threads = ON;
+	}
+
+	if (daemon_flag) {
+		user_param->daemon = ON;
+	}
+
+	if (loopback_flag) {
+		user_param->loopback = ON;
+	}
+
+	if (loopback_shared_flag) {
+		user_param->loopback_shared = ON;
+	}
+
+	if (rate_limit_per_qp_flag) {
+		user_param->rate_limit_per_qp = ON;
+	}
+
 	if (report_per_port_flag) {
 		user_param->report_per_port = 1;
 	}
@@ -2951,6 +3818,22 @@ int parser(struct perftest_parameters *user_param,char *argv[], int argc)
 		user_param->use_hugepages = 1;
 	}
 
+	if (thp_flag) {
+		user_param->use_thp = 1;
+	}
+
+	if (fs_churn_flag) {
+		user_param->fs_churn = 1;
+	}
+
+	if (verify_csum_flag) {
+		user_param->verify_csum = 1;
+	}
+
+	if (hw_timestamps_flag) {
+		user_param->hw_timestamps = 1;
+	}
+
 	if(old_post_send_flag) {
 		user_param->use_old_post_send = 1;
 	}
@@ -3132,6 +4015,33 @@ void ctx_print_test_info(struct perftest_parameters *user_param)
 	if (user_param->output != FULL_VERBOSITY)
 		return;
 
+	if (user_param->tst == REG_MR) {
+		printf(RESULT_LINE);
+		printf("                    Memory Registration Test\n");
+		printf(" Device          : %s\n", user_param->ib_devname);
+		printf(" Threads         : %d\n", user_param->num_threads);
+		printf(" Page backing    : %s\n", user_param->use_hugepages ? "hugetlbfs" :
+		       (user_param->use_thp ? "THP" : "4K"));
+		printf(" Registration    : %s\n", user_param->use_odp ? "ODP" : "Pinned");
+		printf(RESULT_LINE);
+		return;
+	}
+
+	if (user_param->tst == QP_RATE) {
+		printf(RESULT_LINE);
+		printf("                    QP Lifecycle Rate Test\n");
+		printf(" Device          : %s\n", user_param->ib_devname);
+		printf(" Connection type : %s\n", connStr[user_param->connection_type]);
+		printf(" Number of qps   : %d\n", user_param->num_of_qps);
+		printf(" Threads         : %d\n", user_param->num_threads);
+		printf(" TX depth        : %d\n", user_param->tx_depth);
+		printf(" RX depth        : %d\n", user_param->rx_depth);
+		if (user_param->connection_type != UD)
+			printf(" Mtu             : %lu[B]\n", MTU_SIZE(user_param->curr_mtu));
+		printf(RESULT_LINE);
+		return;
+	}
+
 	printf(RESULT_LINE);
 	printf("                    ");
 	printf("%s ",testsStr[user_param->verb]);
@@ -3518,6 +4428,31 @@ static void write_bw_report_to_file(int out_json_fd, struct perftest_parameters
 	dprintf(out_json_fd, "},\n");
 }
 
+static void write_autotune_point_to_file(int out_json_fd, struct autotune_point *point)
+{
+	dprintf(out_json_fd, "{num_of_qps: %d, tx_depth: %d, post_list: %d, cq_mod: %d, inline_size: %d, "
+		"old_post_send: %d, msgRate: %lf, bw: %lf}",
+		point->num_of_qps, point->tx_depth, point->post_list, point->cq_mod, point->inline_size,
+		point->use_old_post_send, point->msg_rate, point->bw);
+}
+
+static void write_autotune_to_file(int out_json_fd, struct autotune_report *report)
+{
+	int i;
+
+	dprintf(out_json_fd, "autotune: {\n");
+	dprintf(out_json_fd, "seconds: %lf,\n", report->seconds);
+	dprintf(out_json_fd, "best: ");
+	write_autotune_point_to_file(out_json_fd, &report->points[report->best]);
+	dprintf(out_json_fd, ",\nexplored: [\n");
+	for (i = 0; i < report->num_points; i++) {
+		write_autotune_point_to_file(out_json_fd, &report->points[i]);
+		dprintf(out_json_fd, "%s\n", i + 1 < report->num_points ? "," : "");
+	}
+	dprintf(out_json_fd, "]\n");
+	dprintf(out_json_fd, "},\n");
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -3565,6 +4500,17 @@ void print_full_bw_report (struct perftest_parameters *user_param, struct bw_rep
 			write_test_info_to_file(out_json_fd, user_param);
 			write_bw_report_to_file(out_json_fd, user_param, inc_accuracy,
 					bw_avg, msgRate_avg, my_bw_rep->size, my_bw_rep->sl, my_bw_rep->iters, bw_peak);
+			if (user_param->counter_sampler)
+				counter_sampler_write_json(user_param->counter_sampler, out_json_fd, my_bw_rep->size);
+			if (user_param->autotune_report)
+				write_autotune_to_file(out_json_fd, user_param->autotune_report);
+			if (user_param->cpu_stats)
+				cpu_stats_write_json(user_param->cpu_stats, out_json_fd, my_bw_rep->iters,
+						get_cpu_mhz(user_param->cpu_freq_f));
+			if (user_param->lat_probe)
+				lat_probe_write_json(user_param->lat_probe, out_json_fd);
+			if (user_param->pacer)
+				pacer_write_json(user_param->pacer, out_json_fd);
 			dprintf(out_json_fd,"}\n");
 			close(out_json_fd);
 		}
@@ -3587,6 +4533,15 @@ void print_full_bw_report (struct perftest_parameters *user_param, struct bw_rep
 	if (user_param->counter_ctx) {
 		counters_print(user_param->counter_ctx);
 	}
+	if (user_param->cpu_stats) {
+		cpu_stats_print(user_param->cpu_stats, my_bw_rep->iters, get_cpu_mhz(user_param->cpu_freq_f));
+	}
+	if (user_param->lat_probe) {
+		lat_probe_print(user_param->lat_probe);
+	}
+	if (user_param->pacer) {
+		pacer_print(user_param->pacer);
+	}
 }
 /******************************************************************************
  *
@@ -3612,6 +4567,19 @@ static int cycles_compare(const void *aptr, const void *bptr)
 	return 0;
 }
 
+/*
+ * Requests per usec of a pipelined latency test, from the first post to the
+ * last reply. The replies come in the order of the requests.
+ */
+static double lat_request_rate(struct perftest_parameters *user_param)
+{
+	cycles_t test_cycles = user_param->tcompleted[user_param->iters - 1] - user_param->tposted[0];
+
+	if (!test_cycles)
+		return 0;
+	return user_param->iters * get_cpu_mhz(user_param->cpu_freq_f) / test_cycles;
+}
+
 void write_report_lat_to_file(int out_json_fd, struct perftest_parameters *user_param,
 		double latency, double stdev, double average_sum, double average, double stdev_sum,
 		int iters_99, int iters_99_9, double cycles_rtt_quotient, cycles_t *delta, int measure_cnt) {
@@ -3633,6 +4601,9 @@ void write_report_lat_to_file(int out_json_fd, struct perftest_parameters *user_
 				delta[iters_99_9] / cycles_rtt_quotient);
 		dprintf(out_json_fd, user_param->cpu_util_data.enable ?
 		REPORT_EXT_CPU_UTIL_JSON : REPORT_EXT_JSON , calc_cpu_util(user_param));
+		if (user_param->lat_depth > 1)
+			dprintf(out_json_fd, "lat_depth: %d,\nrequest_rate_mpps: %lf,\n",
+				user_param->lat_depth, lat_request_rate(user_param));
 	}
 
 	dprintf(out_json_fd, "},\n");
@@ -3642,6 +4613,53 @@ void write_report_lat_to_file(int out_json_fd, struct perftest_parameters *user_
  *
  ******************************************************************************/
 #define LAT_MEASURE_TAIL (2)
+
+/*
+ * Latency from the post to the completion of every iteration, its time taken
+ * from the NIC clock or at the CQE read. The host overhead is what the host
+ * timed latency adds to it: the polling loop and the CQE delivery.
+ */
+static void print_report_lat_comp(struct perftest_parameters *user_param, int measure_cnt,
+				  double cycles_rtt_quotient, const char *units,
+				  double host_median, double host_average)
+{
+	cycles_t *comp = NULL;
+	double average_sum = 0, median, average;
+	int i, n = 0;
+
+	ALLOCATE(comp, cycles_t, measure_cnt);
+	for (i = 0; i < measure_cnt; ++i) {
+		/* an iteration without a completion timestamp */
+		if (!user_param->tcompleted[i])
+			continue;
+		comp[n++] = user_param->tcompleted[i] > user_param->tposted[i] ?
+			    user_param->tcompleted[i] - user_param->tposted[i] : 0;
+	}
+
+	if (n <= LAT_MEASURE_TAIL) {
+		printf(" No completion timestamps to report\n");
+		free(comp);
+		return;
+	}
+
+	qsort(comp, n, sizeof *comp, cycles_compare);
+	n -= LAT_MEASURE_TAIL;
+	median = get_median(n, comp) / cycles_rtt_quotient;
+	for (i = 0; i < n; ++i)
+		average_sum += comp[i] / cycles_rtt_quotient;
+	average = average_sum / n;
+
+	printf(RESULT_LINE);
+	printf(" Completion timestamps  : %s\n", user_param->hw_ts_active ? "NIC clock" : "software, at the CQE read");
+	printf(" Completion latency[%s]: min %.2f, median %.2f, average %.2f, 99%% %.2f\n", units,
+	       comp[0] / cycles_rtt_quotient, median, average,
+	       comp[(int)ceil(n * 0.99)] / cycles_rtt_quotient);
+	printf(" Host overhead[%s]     : median %.2f, average %.2f\n", units,
+	       host_median - median, host_average - average);
+
+	free(comp);
+}
+
 void print_report_lat (struct perftest_parameters *user_param)
 {
 
@@ -3656,7 +4674,13 @@ void print_report_lat (struct perftest_parameters *user_param)
 	int measure_cnt;
 	int out_json_fd = -1;
 
+	/* the server of a pipelined test only replies, the client times the requests */
+	if (user_param->lat_depth > 1 && user_param->machine == SERVER)
+		return;
+
 	measure_cnt = (user_param->tst == LAT) ? user_param->iters - 1 : (user_param->iters) / user_param->reply_every;
+	if (user_param->lat_depth > 1)
+		measure_cnt = user_param->iters;
 	rtt_factor = (user_param->verb == READ || user_param->verb == ATOMIC) ? 1 : 2;
 	ALLOCATE(delta, cycles_t, measure_cnt);
 
@@ -3668,7 +4692,11 @@ void print_report_lat (struct perftest_parameters *user_param)
 		units = "usec";
 	}
 
-	if (user_param->tst == LAT) {
+	if (user_param->tst == LAT && user_param->lat_depth > 1) {
+		for (i = 0; i < measure_cnt; ++i) {
+			delta[i] = user_param->tcompleted[i] - user_param->tposted[i];
+		}
+	} else if (user_param->tst == LAT) {
 		for (i = 0; i < measure_cnt; ++i) {
 			delta[i] = user_param->tposted[i + 1] - user_param->tposted[i];
 		}
@@ -3753,6 +4781,13 @@ void print_report_lat (struct perftest_parameters *user_param)
 		printf( user_param->cpu_util_data.enable ? REPORT_EXT_CPU_UTIL : REPORT_EXT , calc_cpu_util(user_param));
 	}
 
+	if (user_param->lat_depth > 1 && user_param->output == FULL_VERBOSITY)
+		printf(" Queue depth %d : %.3f Mrequests/sec\n", user_param->lat_depth, lat_request_rate(user_param));
+
+	if (user_param->hw_timestamps && user_param->tst == LAT && user_param->output == FULL_VERBOSITY)
+		print_report_lat_comp(user_param, measure_cnt + LAT_MEASURE_TAIL, cycles_rtt_quotient,
+				      units, latency, average);
+
 	if (user_param->counter_ctx) {
 		counters_print(user_param->counter_ctx);
 	}
@@ -3779,6 +4814,41 @@ void write_report_lat_duration_to_file (int out_json_fd, struct perftest_paramet
 
 	dprintf(out_json_fd, "},\n");
 }
+/******************************************************************************
+ *
+ ******************************************************************************/
+static inline cycles_t get_percentile(uint64_t n, cycles_t sorted[], double percent)
+{
+	uint64_t index = (uint64_t)ceil(n * percent);
+
+	return sorted[index ? index - 1 : 0];
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void print_fs_rate_ops(const char *name, cycles_t *samples, uint64_t n,
+			      cycles_t test_time, double cycles_to_units)
+{
+	uint64_t i;
+	double sum = 0;
+
+	qsort(samples, n, sizeof(cycles_t), cycles_compare);
+	for (i = 0; i < n; i++)
+		sum += samples[i];
+
+	printf(REPORT_FMT_FS_RATE_OPS,
+		name,
+		n,
+		samples[0] / cycles_to_units,
+		get_median(n, samples) / cycles_to_units,
+		sum / n / cycles_to_units,
+		get_percentile(n, samples, 0.99) / cycles_to_units,
+		samples[n - 1] / cycles_to_units,
+		test_time ? n / (test_time / (cycles_to_units * 1000000)) : 0);
+	printf(REPORT_EXT);
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -3825,7 +4895,7 @@ void print_report_lat_duration (struct perftest_parameters *user_param)
 	}
 }
 
-void print_report_fs_rate (struct perftest_parameters *user_param)
+void print_report_fs_rate (struct perftest_parameters *user_param, struct fs_rate_report_data *rep)
 {
 
 	int i;
@@ -3836,6 +4906,10 @@ void print_report_fs_rate (struct perftest_parameters *user_param)
 	double latency = 0, average = 0, fps = 0;
 	int measure_cnt = 1;
 	cycles_t test_sample_time;
+	uint64_t growth_size[FS_GROWTH_MAX_BUCKETS], growth_samples[FS_GROWTH_MAX_BUCKETS];
+	double growth[FS_GROWTH_MAX_BUCKETS][5];
+	uint64_t bucket_start, bucket_end;
+	int buckets = 0;
 
 	if (user_param->r_flag->cycles) {
 		cycles_to_units = 1;
@@ -3860,6 +4934,25 @@ void print_report_fs_rate (struct perftest_parameters *user_param)
 				printf("%d, %g\n", i + 1, delta[i] / cycles_to_units);
 		}
 
+		/* The samples are in insertion order, sample i was taken with i
+		 * flows in the table. Sort every power of 2 slice on its own.
+		 */
+		for (bucket_start = 0; bucket_start < measure_cnt && buckets < FS_GROWTH_MAX_BUCKETS; bucket_start = bucket_end) {
+			bucket_end = bucket_start ? bucket_start * 2 : FS_GROWTH_FIRST_BUCKET;
+			if (bucket_end > measure_cnt)
+				bucket_end = measure_cnt;
+
+			qsort(delta + bucket_start, bucket_end - bucket_start, sizeof *delta, cycles_compare);
+			growth_size[buckets] = bucket_end;
+			growth_samples[buckets] = bucket_end - bucket_start;
+			growth[buckets][0] = delta[bucket_start] / cycles_to_units;
+			growth[buckets][1] = get_median(growth_samples[buckets], delta + bucket_start) / cycles_to_units;
+			growth[buckets][2] = get_percentile(growth_samples[buckets], delta + bucket_start, 0.99) / cycles_to_units;
+			growth[buckets][3] = get_percentile(growth_samples[buckets], delta + bucket_start, 0.999) / cycles_to_units;
+			growth[buckets][4] = delta[bucket_end - 1] / cycles_to_units;
+			buckets++;
+		}
+
 		qsort(delta, measure_cnt, sizeof *delta, cycles_compare);
 		median = get_median(measure_cnt, delta);
 
@@ -3896,6 +4989,9 @@ void print_report_fs_rate (struct perftest_parameters *user_param)
 	else {
 		if (user_param->test_type == ITERATIONS) {
 			fps = measure_cnt / (average_sum / (cycles_to_units * units_to_sec));
+			/* Inserts of different threads overlap, count the wall time */
+			if (rep && user_param->num_threads > 1 && rep->insert_time)
+				fps = measure_cnt / (rep->insert_time / (cycles_to_units * units_to_sec));
 			printf(REPORT_FMT_FS_RATE,
 				user_param->iters,
 				delta[0] / cycles_to_units,
@@ -3912,8 +5008,240 @@ void print_report_fs_rate (struct perftest_parameters *user_param)
 		printf(user_param->cpu_util_data.enable ? REPORT_EXT_CPU_UTIL : REPORT_EXT, calc_cpu_util(user_param));
 	}
 
+	if (user_param->test_type == ITERATIONS && user_param->output == FULL_VERBOSITY && rep) {
+		printf(RESULT_LINE);
+		printf("                    Insertion latency by table size\n");
+		printf("%s", RESULT_FMT_FS_RATE_GROWTH);
+		printf(RESULT_EXT);
+		for (i = 0; i < buckets; i++) {
+			printf(REPORT_FMT_FS_RATE_GROWTH,
+				growth_size[i],
+				growth_samples[i],
+				growth[i][0],
+				growth[i][1],
+				growth[i][2],
+				growth[i][3],
+				growth[i][4]);
+			printf(REPORT_EXT);
+		}
+
+		/* The rates are measured on the wall clock of all the threads */
+		printf(RESULT_LINE);
+		printf("%s", RESULT_FMT_FS_RATE_OPS);
+		printf(RESULT_EXT);
+		print_fs_rate_ops("insert", delta, measure_cnt, rep->insert_time, cycles_to_units);
+		if (user_param->fs_churn) {
+			print_fs_rate_ops("churn_destroy", rep->churn_destroy_cycles, measure_cnt, rep->churn_time, cycles_to_units);
+			print_fs_rate_ops("churn_insert", rep->churn_insert_cycles, measure_cnt, rep->churn_time, cycles_to_units);
+		}
+		print_fs_rate_ops("destroy", rep->destroy_cycles, measure_cnt, rep->destroy_time, cycles_to_units);
+	}
+
 	free(delta);
 }
+
+
+void print_report_reg_mr (struct perftest_parameters *user_param, struct reg_mr_report_data *rep)
+{
+	uint64_t i;
+	double cycles_to_units;
+	double reg_sum = 0, test_time, mr_rate, gbps;
+
+	cycles_to_units = get_cpu_mhz(user_param->cpu_freq_f);
+
+	qsort(rep->reg_cycles, rep->samples, sizeof(cycles_t), cycles_compare);
+	qsort(rep->dereg_cycles, rep->samples, sizeof(cycles_t), cycles_compare);
+
+	for (i = 0; i < rep->samples; i++)
+		reg_sum += rep->reg_cycles[i];
+
+	/* The wall time covers register+deregister pairs of all threads */
+	test_time = rep->test_cycles / (cycles_to_units * 1000000);
+	mr_rate = test_time > 0 ? rep->samples / test_time : 0;
+	gbps = mr_rate * rep->size / (1024 * 1024 * 1024);
+
+	printf(REPORT_FMT_REG_MR,
+		rep->size,
+		user_param->num_threads,
+		user_param->iters,
+		rep->reg_cycles[0] / cycles_to_units,
+		get_median((int)rep->samples, rep->reg_cycles) / cycles_to_units,
+		reg_sum / rep->samples / cycles_to_units,
+		get_percentile(rep->samples, rep->reg_cycles, 0.99) / cycles_to_units,
+		get_percentile(rep->samples, rep->reg_cycles, 0.999) / cycles_to_units,
+		rep->reg_cycles[rep->samples - 1] / cycles_to_units,
+		get_median((int)rep->samples, rep->dereg_cycles) / cycles_to_units,
+		get_percentile(rep->samples, rep->dereg_cycles, 0.99) / cycles_to_units,
+		mr_rate,
+		gbps);
+	printf(REPORT_EXT);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_autotune_report (struct perftest_parameters *user_param)
+{
+	struct autotune_report *report = user_param->autotune_report;
+	struct autotune_point *point;
+	int i;
+
+	if (user_param->output != FULL_VERBOSITY)
+		return;
+
+	printf(RESULT_LINE);
+	printf(" Autotune explored %d configurations in %.1f seconds\n", report->num_points, report->seconds);
+	printf("   #qps  tx_depth  post_list  cq_mod  inline  post_send  MsgRate[Mpps]  BW average[%s]\n",
+	       user_param->report_fmt == MBS ? "MB/sec" : "Gb/sec");
+	for (i = 0; i < report->num_points; i++) {
+		point = &report->points[i];
+		printf(" %c %-5d %-9d %-10d %-7d %-7d %-10s %-14.6lf %.2lf\n", i == report->best ? '*' : ' ',
+		       point->num_of_qps, point->tx_depth, point->post_list, point->cq_mod, point->inline_size,
+		       point->use_old_post_send ? "old" : "new", point->msg_rate, point->bw);
+	}
+
+	point = &report->points[report->best];
+	printf(RESULT_LINE);
+	printf(" Best configuration: -q %d -t %d -l %d -Q %d -I %d%s\n", point->num_of_qps, point->tx_depth,
+	       point->post_list, point->cq_mod, point->inline_size,
+	       point->use_old_post_send ? " --use_old_post_send" : "");
+	printf(RESULT_LINE);
+	printf((user_param->report_fmt == MBS ? RESULT_FMT : RESULT_FMT_G));
+	printf((user_param->cpu_util_data.enable ? RESULT_EXT_CPU_UTIL : RESULT_EXT));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_report_qp_rate (struct perftest_parameters *user_param, struct qp_rate_report_data *rep)
+{
+	static const char *verb_str[] = {"create", "to_init", "to_rtr", "to_rts", "destroy"};
+	uint64_t i;
+	int v;
+	double cycles_to_units;
+	double sum[QP_LIFECYCLE_VERBS], lifecycle_sum = 0, test_time;
+	cycles_t *lifecycle;
+
+	cycles_to_units = get_cpu_mhz(user_param->cpu_freq_f);
+
+	/* Sample i of every verb belongs to the same QP, sum them before sorting */
+	ALLOCATE(lifecycle, cycles_t, rep->samples);
+	memset(lifecycle, 0, sizeof(cycles_t) * rep->samples);
+
+	for (v = 0; v < QP_LIFECYCLE_VERBS; v++) {
+		sum[v] = 0;
+		for (i = 0; i < rep->samples; i++) {
+			lifecycle[i] += rep->verb_cycles[v][i];
+			sum[v] += rep->verb_cycles[v][i];
+		}
+		lifecycle_sum += sum[v];
+		qsort(rep->verb_cycles[v], rep->samples, sizeof(cycles_t), cycles_compare);
+	}
+	qsort(lifecycle, rep->samples, sizeof(cycles_t), cycles_compare);
+
+	/* A verb rate assumes all threads keep calling only that verb */
+	for (v = 0; v < QP_LIFECYCLE_VERBS; v++) {
+		printf(REPORT_FMT_QP_RATE,
+			rep->num_qps,
+			user_param->num_threads,
+			user_param->iters,
+			verb_str[v],
+			rep->verb_cycles[v][0] / cycles_to_units,
+			get_median((int)rep->samples, rep->verb_cycles[v]) / cycles_to_units,
+			sum[v] / rep->samples / cycles_to_units,
+			get_percentile(rep->samples, rep->verb_cycles[v], 0.99) / cycles_to_units,
+			rep->verb_cycles[v][rep->samples - 1] / cycles_to_units,
+			lifecycle_sum > 0 ? sum[v] * 100 / lifecycle_sum : 0,
+			sum[v] > 0 ? rep->samples * user_param->num_threads * cycles_to_units * 1000000 / sum[v] : 0);
+		printf(REPORT_EXT);
+	}
+
+	/* The lifecycle rate is measured on the wall clock of all threads */
+	test_time = rep->test_cycles / (cycles_to_units * 1000000);
+	printf(REPORT_FMT_QP_RATE,
+		rep->num_qps,
+		user_param->num_threads,
+		user_param->iters,
+		"lifecycle",
+		lifecycle[0] / cycles_to_units,
+		get_median((int)rep->samples, lifecycle) / cycles_to_units,
+		lifecycle_sum / rep->samples / cycles_to_units,
+		get_percentile(rep->samples, lifecycle, 0.99) / cycles_to_units,
+		lifecycle[rep->samples - 1] / cycles_to_units,
+		100.0,
+		test_time > 0 ? rep->samples / test_time : 0);
+	printf(REPORT_EXT);
+
+	free(lifecycle);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_report_cm_storm (struct perftest_parameters *user_param, struct cm_storm_report_data *rep)
+{
+	static const char *phase_str[] = {"addr", "route", "qp setup", "connect", "established"};
+	int i, p;
+	int in_flight;
+	double cycles_to_units;
+	double sum, total_sum = 0, test_time;
+	cycles_t *total;
+
+	cycles_to_units = get_cpu_mhz(user_param->cpu_freq_f);
+	in_flight = user_param->cm_inflight ? user_param->cm_inflight : user_param->num_of_qps;
+
+	/* Sample i of every phase belongs to the same connection, sum them before sorting */
+	ALLOCATE(total, cycles_t, rep->connections);
+	memset(total, 0, sizeof(cycles_t) * rep->connections);
+
+	if (rep->round == 0) {
+		printf(RESULT_LINE);
+		printf("                    RDMA CM Connection Storm\n");
+		printf(RESULT_LINE);
+		printf("%s", RESULT_FMT_CM_STORM);
+		printf(RESULT_EXT);
+	}
+
+	for (p = 0; p < CM_STORM_PHASES; p++) {
+		sum = 0;
+		for (i = 0; i < rep->connections; i++) {
+			total[i] += rep->phase_cycles[p][i];
+			sum += rep->phase_cycles[p][i];
+		}
+		total_sum += sum;
+		qsort(rep->phase_cycles[p], rep->connections, sizeof(cycles_t), cycles_compare);
+
+		printf(REPORT_FMT_CM_STORM,
+			rep->round,
+			rep->connections,
+			in_flight,
+			phase_str[p],
+			rep->phase_cycles[p][0] / cycles_to_units,
+			get_median(rep->connections, rep->phase_cycles[p]) / cycles_to_units,
+			sum / rep->connections / cycles_to_units,
+			get_percentile(rep->connections, rep->phase_cycles[p], 0.99) / cycles_to_units,
+			rep->phase_cycles[p][rep->connections - 1] / cycles_to_units);
+		printf(REPORT_EXT);
+	}
+	qsort(total, rep->connections, sizeof(cycles_t), cycles_compare);
+
+	/* The connection rate is measured on the wall clock of the whole storm */
+	test_time = rep->test_cycles / (cycles_to_units * 1000000);
+	printf(REPORT_FMT_CM_STORM,
+		rep->round,
+		rep->connections,
+		in_flight,
+		"total",
+		total[0] / cycles_to_units,
+		get_median(rep->connections, total) / cycles_to_units,
+		total_sum / rep->connections / cycles_to_units,
+		get_percentile(rep->connections, total, 0.99) / cycles_to_units,
+		total[rep->connections - 1] / cycles_to_units);
+	printf(" %-10.2f", test_time > 0 ? rep->connections / test_time : 0);
+	printf(REPORT_EXT);
+
+	free(total);
+}
 /******************************************************************************
  * End
  ******************************************************************************/
@@ -61,6 +61,11 @@
 #endif
 #include "get_clock.h"
 #include "perftest_counters.h"
+#include "perftest_cpu_stats.h"
+#include "perftest_lat_probe.h"
+#include "perftest_pacer.h"
+#include "perftest_daemon.h"
+#include "perftest_loopback.h"
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -129,6 +134,11 @@
 #define DEF_CACHE_LINE_SIZE (64)
 #define DEF_PAGE_SIZE (4096)
 #define DEF_FLOWS (1)
+#define DEF_NUM_THREADS (1)
+#define DEF_SIZE_REG_MR (4096)
+#define DEF_SIZE_REG_MR_ALL (1073741824)
+#define DEF_QP_RATE_NUM (1024)
+#define DEF_ITERS_QP_RATE (5)
 #define RATE_VALUES_COUNT (18)
 #define DISABLED_CQ_MOD_VALUE    (1)
 #define MSG_SIZE_CQ_MOD_LIMIT (8192)
@@ -181,6 +191,13 @@
 #define MAX_INLINE_UD (884)
 #define MIN_EQ_NUM    (0)
 #define MAX_EQ_NUM    (2048)
+#define MIN_THREADS_NUM (1)
+#define MAX_THREADS_NUM (512)
+#define MIN_REG_MR_SIZE (4096ULL)
+#define MAX_REG_MR_SIZE (68719476736ULL)
+#define MAX_QP_RATE_NUM (65536)
+#define MIN_CM_STORM_ROUNDS (1)
+#define MAX_CM_STORM_ROUNDS (100000)
 
 /* Raw etherent defines */
 #define RAWETH_MIN_MSG_SIZE	(64)
@@ -188,7 +205,25 @@
 #define MAX_MTU_RAW_ETERNET	(9600)
 #define MIN_FS_PORT		(5000)
 #define MAX_FS_PORT		(65536)
+#define FS_GROWTH_FIRST_BUCKET	(1024)
+#define FS_GROWTH_MAX_BUCKETS	(64)
 #define VLAN_PCP_VARIOUS        (8)
+#define MAX_FLOW_TUPLES		(16777216)
+#define DEF_ZIPF_THETA		(0.99)
+#define DEF_PCAP_SNAPLEN	(65535)
+#define DEF_PCAP_FILE_SIZE	(1024)
+#define MAX_PCAP_FILE_SIZE	(65536)
+#define MAX_PCAP_RING		(1024)
+#define MIN_SAMPLE_COUNTERS_USEC	(100)
+#define MAX_SAMPLE_COUNTERS_USEC	(10000000)
+#define MAX_AUTOTUNE_SEC	(3600)
+#define AUTOTUNE_MAX_POST_LIST	(16)
+#define MAX_EVENT_SPIN_USEC	(1000000)
+#define EVENT_SPIN_AUTO		(-1)
+#define MAX_LAT_DEPTH		(1024)
+#define MAX_LAT_PROBE_GAP_USEC	(1000000)
+#define DEF_LOAD_INTERVAL_MSEC	(100)
+#define MAX_LOAD_INTERVAL_MSEC	(60000)
 
 #define RESULT_LINE "---------------------------------------------------------------------------------------\n"
 
@@ -220,6 +255,16 @@
 
 #define RESULT_FMT_FS_RATE_DUR " #flows		fs_avg_time[usec]    	fps[flow per sec]"
 
+#define RESULT_FMT_FS_RATE_GROWTH " #table_size  #samples   min[usec]  typical[usec]  99""%"" [usec]  99.9""%"" [usec]  max[usec]"
+
+#define RESULT_FMT_FS_RATE_OPS " operation      #flows     min[usec]  typical[usec]  avg[usec]  99""%"" [usec]  max[usec]  ops/sec"
+
+#define RESULT_FMT_QP_RATE " #QPs      #threads  #iterations  verb        min[usec]  typical[usec]  avg[usec]  99""%"" [usec]  max[usec]  time[%]   calls/sec"
+
+#define RESULT_FMT_CM_STORM " #round   #conns    #in-flight  phase       min[usec]  typical[usec]  avg[usec]  99""%"" [usec]  max[usec]  conn/sec"
+
+#define RESULT_FMT_REG_MR " #bytes         #threads  #iterations  reg_min[usec]  reg_typical[usec]  reg_avg[usec]  reg_99""%"" [usec]  reg_99.9""%"" [usec]  reg_max[usec]  dereg_typical[usec]  dereg_99""%"" [usec]  MR/sec      GB/sec"
+
 /* Result print format */
 #define REPORT_FMT " %-7lu    %-10" PRIu64 "       %-7.2lf            %-7.2lf		   %-7.6lf"
 
@@ -255,6 +300,16 @@ t_stdev: %.2f,\npercentile_99: %.2f,\npercentile_99.9: %.2f,\n"
 
 #define REPORT_FMT_FS_RATE_DUR  "%" PRIu64 "               %-7.2f		%-7.2f"
 
+#define REPORT_FMT_FS_RATE_GROWTH " %-13" PRIu64 " %-10" PRIu64 " %-10.2f %-14.2f %-12.2f %-14.2f %-10.2f"
+
+#define REPORT_FMT_FS_RATE_OPS " %-14s %-10" PRIu64 " %-10.2f %-14.2f %-10.2f %-12.2f %-10.2f %-10.2f"
+
+#define REPORT_FMT_QP_RATE " %-9" PRIu64 " %-9d %-12" PRIu64 " %-11s %-10.2f %-14.2f %-10.2f %-12.2f %-10.2f %-9.2f %-10.2f"
+
+#define REPORT_FMT_CM_STORM " %-8d %-9d %-11d %-11s %-10.2f %-14.2f %-10.2f %-12.2f %-10.2f"
+
+#define REPORT_FMT_REG_MR " %-14" PRIu64 " %-9d %-12" PRIu64 " %-14.2f %-18.2f %-14.2f %-15.2f %-17.2f %-14.2f %-20.2f %-17.2f %-11.2f %-7.2f"
+
 #define CHECK_VALUE(arg,type,name,not_int_ptr) {\
         arg = (type)strtol(optarg, &not_int_ptr, 0);\
         if (*not_int_ptr != '\0') /*not integer part is not empty*/ {\
@@ -314,7 +369,16 @@ t_stdev: %.2f,\npercentile_99: %.2f,\npercentile_99.9: %.2f,\n"
 typedef enum { SEND , WRITE, READ, ATOMIC } VerbType;
 
 /* The type of the test */
-typedef enum { LAT , BW , LAT_BY_BW, FS_RATE } TestType;
+typedef enum { LAT , BW , LAT_BY_BW, FS_RATE, REG_MR, QP_RATE } TestType;
+
+/* The verbs timed by the QP lifecycle rate test, in the order they are called. */
+typedef enum { QP_CREATE, QP_TO_INIT, QP_TO_RTR, QP_TO_RTS, QP_DESTROY, QP_LIFECYCLE_VERBS } QPLifecycleVerb;
+
+/* The phases of an RDMA CM client connection, timed by the connection storm report. */
+typedef enum { CM_ADDR_RESOLVE, CM_ROUTE_RESOLVE, CM_QP_SETUP, CM_CONNECT, CM_ESTABLISH, CM_STORM_PHASES } CMStormPhase;
+
+/* The order the packet template engine picks flows from its tuple table. */
+typedef enum { FLOW_SEQUENTIAL, FLOW_RANDOM, FLOW_ZIPF } FlowDistribution;
 
 /* The type of the machine ( server or client actually). */
 typedef enum { SERVER , CLIENT , UNCHOSEN} MachineType;
@@ -335,7 +399,7 @@ typedef enum { START_STATE, SAMPLE_STATE, STOP_SAMPLE_STATE, END_STATE} Duration
 enum ctx_report_fmt { GBS, MBS };
 
 /* Test method */
-enum ctx_test_method {RUN_REGULAR, RUN_ALL, RUN_INFINITELY};
+enum ctx_test_method {RUN_REGULAR, RUN_ALL, RUN_INFINITELY, RUN_AUTOTUNE};
 
 /* The type of the device */
 enum ctx_device {
@@ -562,6 +626,12 @@ struct perftest_parameters {
 	enum 				rate_limiter_units rate_units;
 	enum 				rate_limiter_types rate_limit_type;
 	int				is_rate_limit_type;
+	/* the SW rate limiter gives every QP the full rate */
+	int				rate_limit_per_qp;
+	struct pacer			*pacer;
+	/* the SW rate limiter follows a profile, its rate set every load_interval msec */
+	struct load_profile		*load_profile;
+	int				load_interval;
 	enum verbosity_level 		output;
 	int 				cpu_util;
 	int 				out_json;
@@ -599,8 +669,50 @@ struct perftest_parameters {
 	void 				(*print_eth_func)(void*);
 	int				disable_pcir;
 	struct counter_context		*counter_ctx;
+	struct counter_sampler		*counter_sampler;
+	struct cpu_stats		*cpu_stats;
 	char				*source_ip;
 	int 				has_source_ip;
+	int				num_threads;
+	int				use_thp;
+	int				cm_storm;
+	int				cm_inflight;
+	int				fs_churn;
+	int				flow_tuples;
+	FlowDistribution		flow_dist;
+	double				zipf_theta;
+	int				verify_csum;
+	char				*pcap_file;
+	int				pcap_snaplen;
+	int				pcap_file_size;
+	int				pcap_ring;
+	int				hw_timestamps;
+	/* the device timestamps the completions, otherwise they are taken at the CQE read */
+	int				hw_ts_active;
+	/* port of the Prometheus endpoint of run_infinitely, 0 if disabled */
+	int				metrics_port;
+	int				sample_counters;
+	int				perf_events;
+	int				autotune;
+	struct autotune_report		*autotune_report;
+	/* usec to busy poll before sleeping on a CQ event, EVENT_SPIN_AUTO to learn it */
+	int				event_spin;
+	/* requests in flight of a latency test, 1 is the ping-pong */
+	int				lat_depth;
+	/* write ping-pongs on their own QP during a BW test, lat_probe_gap usec apart */
+	int				use_lat_probe;
+	int				lat_probe_gap;
+	struct lat_probe		*lat_probe;
+	/* -b with the sends and the receives in their own pinned threads */
+	int				bi_threads;
+	/* a write or read BW server that keeps its resources and serves client after client,
+	 * daemon_sessions of them or 0 for ever
+	 */
+	int				daemon;
+	int				daemon_sessions;
+	/* both sides of a write or read BW test in threads of this process, on one PD and MR if shared */
+	int				loopback;
+	int				loopback_shared;
 };
 
 struct report_options {
@@ -622,6 +734,59 @@ struct bw_report_data {
 	int sl;
 };
 
+/* A configuration the autotune measured */
+struct autotune_point {
+	int	num_of_qps;
+	int	tx_depth;
+	int	post_list;
+	int	cq_mod;
+	int	inline_size;
+	int	use_old_post_send;
+	double	msg_rate;
+	double	bw;
+};
+
+struct autotune_report {
+	/* the QPs created, the best configuration may use fewer */
+	int			max_qps;
+	struct autotune_point	*points;
+	int			num_points;
+	int			max_points;
+	int			best;
+	double			seconds;
+};
+
+struct reg_mr_report_data {
+	uint64_t size;
+	uint64_t samples;
+	cycles_t *reg_cycles;
+	cycles_t *dereg_cycles;
+	cycles_t test_cycles;
+};
+
+struct qp_rate_report_data {
+	uint64_t num_qps;
+	uint64_t samples;
+	cycles_t *verb_cycles[QP_LIFECYCLE_VERBS];
+	cycles_t test_cycles;
+};
+
+struct fs_rate_report_data {
+	cycles_t *destroy_cycles;
+	cycles_t *churn_insert_cycles;
+	cycles_t *churn_destroy_cycles;
+	cycles_t insert_time;
+	cycles_t destroy_time;
+	cycles_t churn_time;
+};
+
+struct cm_storm_report_data {
+	int round;
+	int connections;
+	cycles_t *phase_cycles[CM_STORM_PHASES];
+	cycles_t test_cycles;
+};
+
 struct rate_gbps_string {
 	enum ibv_rate rate_gbps_enum;
 	char* rate_gbps_str;
@@ -780,14 +945,68 @@ void print_report_lat_duration (struct perftest_parameters *user_param);
 
 /* print_report_fs_rate
  *
- * Description : Prints the Flow steering rate and avarage latency to create flow
+ * Description : Prints the Flow steering rate and avarage latency to create flow.
+ *				 In iterations mode also prints the insertion latency as the
+ *				 table grows, the deletion rate and the churn rate.
+ *
+ * Parameters :
+ *
+ *   user_param  - the parameters parameters.
+ *   rep         - the deletion and churn samples collected by run_iter_fs.
+ *
+ */
+void print_report_fs_rate (struct perftest_parameters *user_param, struct fs_rate_report_data *rep);
+
+/* print_report_reg_mr
+ *
+ * Description : Prints the registration/deregistration latency percentiles
+ *				 and the aggregated MR rate of one region size.
+ *
+ * Parameters :
+ *
+ *   user_param  - the parameters parameters.
+ *   rep         - the samples collected by run_iter_reg_mr.
+ *
+ */
+void print_report_reg_mr (struct perftest_parameters *user_param, struct reg_mr_report_data *rep);
+
+/* print_autotune_report
+ *
+ * Description : Prints the configurations the autotune explored, their
+ *				 message rate and BW, and the best one as command line flags.
+ *
+ * Parameters :
+ *
+ *   user_param  - the parameters parameters, with the autotune report.
+ *
+ */
+void print_autotune_report (struct perftest_parameters *user_param);
+
+/* print_report_qp_rate
+ *
+ * Description : Prints the latency of every QP lifecycle verb, its share of
+ *				 the lifecycle, and the aggregated QP/sec of one QP count.
+ *
+ * Parameters :
+ *
+ *   user_param  - the parameters parameters.
+ *   rep         - the samples collected by run_iter_qp_rate.
+ *
+ */
+void print_report_qp_rate (struct perftest_parameters *user_param, struct qp_rate_report_data *rep);
+
+/* print_report_cm_storm
+ *
+ * Description : Prints the latency of every RDMA CM connection phase and the
+ *				 connections per second of one connection storm round.
  *
  * Parameters :
  *
  *   user_param  - the parameters parameters.
+ *   rep         - the samples collected from the RDMA CM nodes.
  *
  */
-void print_report_fs_rate (struct perftest_parameters *user_param);
+void print_report_cm_storm (struct perftest_parameters *user_param, struct cm_storm_report_data *rep);
 
 /* set_mtu
  *
@@ -18,6 +18,8 @@
 #if defined(__FreeBSD__)
 #include <sys/stat.h>
 #endif
+#include <poll.h>
+#include <sys/resource.h>
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -29,12 +31,14 @@
 #include "perftest_logging.h"
 #include "perftest_resources.h"
 #include "raw_ethernet_resources.h"
+#include "perftest_exporter.h"
 
 static enum ibv_wr_opcode opcode_verbs_array[] = {IBV_WR_SEND,IBV_WR_RDMA_WRITE,IBV_WR_RDMA_READ};
 static enum ibv_wr_opcode opcode_atomic_array[] = {IBV_WR_ATOMIC_CMP_AND_SWP,IBV_WR_ATOMIC_FETCH_AND_ADD};
 
 #define CPU_UTILITY "/proc/stat"
 #define DC_KEY 0xffeeddcc
+#define HUGEPAGE_ALIGN  (2*1024*1024)
 
 struct perftest_parameters* duration_param;
 struct check_alive_data check_alive_data;
@@ -873,21 +877,13 @@ static int new_post_atomic_cs_sge_xrc(struct pingpong_context *ctx, int index,
 static inline int post_send_method(struct pingpong_context *ctx, int index,
 	struct perftest_parameters *user_param)
 {
-	int rc;
-	long t0, t1, dt;
-
 	FUNCTION_ENTER;
-	t0 = (long)get_cycles();
 	#ifdef HAVE_IBV_WR_API
 	if (!user_param->use_old_post_send)
 		return (*ctx->new_post_send_work_request_func_pointer)(ctx, index, user_param);
 	#endif
 	struct ibv_send_wr 	*bad_wr = NULL;
-	rc = ibv_post_send(ctx->qp[index], &ctx->wr[index*user_param->post_list], &bad_wr);
-	t1 = (long)get_cycles();
-	dt = t1 - t0;
-	printf("======= Time take by [post_send_method]: %ld cycles\n", dt);
-	return rc;
+	return ibv_post_send(ctx->qp[index], &ctx->wr[index*user_param->post_list], &bad_wr);
 }
 
 #ifdef HAVE_XRCD
@@ -1182,6 +1178,155 @@ struct ibv_context* ctx_open_device(struct ibv_device *ib_dev, struct perftest_p
 
 	return context;
 }
+/******************************************************************************
+ * arena_take - the next size bytes of the arena, starting on a cache line of
+ * their own. Without a base it only measures the layout.
+ ******************************************************************************/
+static void *arena_take(struct qp_arena *arena, size_t size)
+{
+	void *ptr = NULL;
+
+	arena->used = ROUND_UP(arena->used, arena->align);
+	if (arena->base)
+		ptr = (char *)arena->base + arena->used;
+	arena->used += size;
+
+	return ptr;
+}
+
+#define ARENA_TAKE(arena, var, type, n) ((var) = (type *)arena_take(arena, sizeof(type) * (n)))
+
+/******************************************************************************
+ * ctx_layout_arena - the per QP arrays of the test, in the arena. The ones the
+ * data path touches on every post and completion come first, the ones of the
+ * setup and the teardown after them.
+ ******************************************************************************/
+static void ctx_layout_arena(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct qp_arena *arena = &ctx->arena;
+	int num_of_qps = user_param->num_of_qps;
+	int is_bw = user_param->tst == BW || user_param->tst == LAT_BY_BW;
+	int bw_sender = is_bw && (user_param->machine == CLIENT || user_param->duplex);
+	int sender = user_param->machine == CLIENT || user_param->tst == LAT || user_param->duplex;
+	int receiver = user_param->verb == SEND &&
+		(user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex);
+
+	arena->used = 0;
+
+	/* hot */
+	if (bw_sender) {
+		ARENA_TAKE(arena, ctx->scnt, uint64_t, num_of_qps);
+		ARENA_TAKE(arena, ctx->ccnt, uint64_t, num_of_qps);
+		ARENA_TAKE(arena, ctx->sig_countdown, uint32_t, num_of_qps);
+	}
+	ARENA_TAKE(arena, ctx->qp, struct ibv_qp*, num_of_qps);
+	#ifdef HAVE_IBV_WR_API
+	ARENA_TAKE(arena, ctx->qpx, struct ibv_qp_ex*, num_of_qps);
+	#ifdef HAVE_MLX5DV
+	ARENA_TAKE(arena, ctx->dv_qp, struct mlx5dv_qp_ex*, num_of_qps);
+	#endif
+	ARENA_TAKE(arena, ctx->r_dctn, uint32_t, num_of_qps);
+	#ifdef HAVE_DCS
+	ARENA_TAKE(arena, ctx->dci_stream_id, uint32_t, num_of_qps);
+	#endif
+	#endif
+	if (sender) {
+		ARENA_TAKE(arena, ctx->wr, struct ibv_send_wr, num_of_qps * user_param->post_list);
+		ARENA_TAKE(arena, ctx->sge_list, struct ibv_sge, num_of_qps * user_param->post_list);
+	}
+	if (receiver) {
+		ARENA_TAKE(arena, ctx->rwr, struct ibv_recv_wr, num_of_qps * user_param->recv_post_list);
+		ARENA_TAKE(arena, ctx->recv_sge_list, struct ibv_sge, num_of_qps * user_param->recv_post_list);
+		ARENA_TAKE(arena, ctx->rx_buffer_addr, uint64_t, num_of_qps);
+	}
+	if (bw_sender || (is_bw && user_param->verb == SEND && user_param->machine == SERVER))
+		ARENA_TAKE(arena, ctx->my_addr, uint64_t, num_of_qps);
+	if (bw_sender)
+		ARENA_TAKE(arena, ctx->rem_addr, uint64_t, num_of_qps);
+
+	/* counters of the worker threads, each on its own cache line */
+	if (user_param->bi_threads)
+		ARENA_TAKE(arena, ctx->bi_stats, struct bi_thread_stats, 2);
+	if (user_param->mac_fwd == ON)
+		ARENA_TAKE(arena, ctx->fwd_queue, struct fwd_queue, num_of_qps);
+	#ifdef HAVE_RSS
+	if (user_param->use_rss) {
+		ARENA_TAKE(arena, ctx->wq, struct ibv_wq*, num_of_qps);
+		ARENA_TAKE(arena, ctx->wq_cq, struct ibv_cq*, num_of_qps);
+		ARENA_TAKE(arena, ctx->rss_stats, struct rss_queue_stats, num_of_qps);
+	}
+	#endif
+
+	/* cold */
+	ARENA_TAKE(arena, user_param->port_by_qp, uint64_t, num_of_qps);
+	ARENA_TAKE(arena, ctx->mr, struct ibv_mr*, num_of_qps);
+	ARENA_TAKE(arena, ctx->buf, void*, num_of_qps);
+	if (sender)
+		ARENA_TAKE(arena, ctx->rem_qpn, uint32_t, num_of_qps);
+	if ((sender && ((user_param->verb == SEND && user_param->connection_type == UD) ||
+			user_param->connection_type == DC || user_param->connection_type == SRD)) ||
+	    (!sender && user_param->verb == READ && user_param->connection_type == SRD))
+		ARENA_TAKE(arena, ctx->ah, struct ibv_ah*, num_of_qps);
+	#if defined(HAVE_IBV_WR_API) && defined(HAVE_AES_XTS)
+	ARENA_TAKE(arena, ctx->dek, struct mlx5dv_dek*, user_param->data_enc_keys_number);
+	ARENA_TAKE(arena, ctx->mkey, struct mlx5dv_mkey*, num_of_qps);
+	#endif
+}
+
+/******************************************************************************
+ * ctx_alloc_arena - lay the per QP arrays out, then allocate them at once,
+ * zeroed, on hugepages with --use_hugepages when the system has them.
+ ******************************************************************************/
+static void ctx_alloc_arena(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct qp_arena *arena = &ctx->arena;
+
+	memset(arena, 0, sizeof(struct qp_arena));
+	arena->align = ctx->cache_line_size;
+	ctx_layout_arena(ctx, user_param);
+	arena->size = ROUND_UP(arena->used, arena->align);
+
+	#ifdef MAP_HUGETLB
+	if (user_param->use_hugepages) {
+		size_t huge_size = ROUND_UP(arena->size, HUGEPAGE_ALIGN);
+		void *base = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+		if (base != MAP_FAILED) {
+			arena->base = base;
+			arena->size = huge_size;
+			arena->hugepages = 1;
+		}
+	}
+	#endif
+	if (!arena->base) {
+		if (posix_memalign(&arena->base, arena->align, arena->size)) {
+			fprintf(stderr," Cannot Allocate\n");
+			exit(1);
+		}
+		memset(arena->base, 0, arena->size);
+	}
+
+	ctx_layout_arena(ctx, user_param);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void ctx_free_arena(struct pingpong_context *ctx)
+{
+	struct qp_arena *arena = &ctx->arena;
+
+	if (!arena->base)
+		return;
+
+	if (arena->hugepages)
+		munmap(arena->base, arena->size);
+	else
+		free(arena->base);
+	arena->base = NULL;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -1191,78 +1336,59 @@ void alloc_ctx(struct pingpong_context *ctx,struct perftest_parameters *user_par
 	int num_of_qps_factor;
 
 	FUNCTION_ENTER;
+	/* The packet template engine rewrites a packet before posting it, the
+	 * checksum validation and the capture read it after it was received,
+	 * keep more packets on the buffer than can be in flight.
+	 */
+	if (user_param->flow_tuples || user_param->verify_csum || user_param->pcap_file) {
+		int depth = user_param->tx_depth > user_param->rx_depth ? user_param->tx_depth : user_param->rx_depth;
+
+		while (user_param->cycle_buffer / INC(user_param->size, user_param->cache_line_size) <= depth)
+			user_param->cycle_buffer *= 2;
+	}
+	/* every request in flight of a pipelined latency test has its own slot */
+	if (user_param->lat_depth > 1) {
+		while (user_param->cycle_buffer / INC(user_param->size, user_param->cache_line_size) < user_param->lat_depth)
+			user_param->cycle_buffer *= 2;
+	}
 	ctx->cycle_buffer = user_param->cycle_buffer;
 	ctx->cache_line_size = user_param->cache_line_size;
 
-	ALLOCATE(user_param->port_by_qp, uint64_t, user_param->num_of_qps);
-
 	tarr_size = (user_param->noPeak) ? 1 : user_param->iters*user_param->num_of_qps;
 	ALLOCATE(user_param->tposted, cycles_t, tarr_size);
 	memset(user_param->tposted, 0, sizeof(cycles_t)*tarr_size);
 	if ((user_param->tst == LAT || user_param->tst == FS_RATE) && user_param->test_type == DURATION)
 		ALLOCATE(user_param->tcompleted, cycles_t, 1);
 
-	ALLOCATE(ctx->qp, struct ibv_qp*, user_param->num_of_qps);
-	#ifdef HAVE_IBV_WR_API
-	ALLOCATE(ctx->qpx, struct ibv_qp_ex*, user_param->num_of_qps);
-	#ifdef HAVE_MLX5DV
-	ALLOCATE(ctx->dv_qp, struct mlx5dv_qp_ex*, user_param->num_of_qps);
-	#endif
-	ALLOCATE(ctx->r_dctn, uint32_t, user_param->num_of_qps);
-	#ifdef HAVE_DCS
-	ALLOCATE(ctx->dci_stream_id, uint32_t, user_param->num_of_qps);
-	#endif
-	#ifdef HAVE_AES_XTS
-	ALLOCATE(ctx->dek, struct mlx5dv_dek*, user_param->data_enc_keys_number);
-	ALLOCATE(ctx->mkey, struct mlx5dv_mkey*, user_param->num_of_qps);
-	#endif
-	#endif
-	ALLOCATE(ctx->mr, struct ibv_mr*, user_param->num_of_qps);
-	ALLOCATE(ctx->buf, void* , user_param->num_of_qps);
+	/* completion time of every latency iteration */
+	if (user_param->hw_timestamps || user_param->lat_depth > 1) {
+		ALLOCATE(user_param->tcompleted, cycles_t, tarr_size);
+		memset(user_param->tcompleted, 0, sizeof(cycles_t) * tarr_size);
+	}
 
 	if ((user_param->tst == BW || user_param->tst == LAT_BY_BW) && (user_param->machine == CLIENT || user_param->duplex)) {
 
 		ALLOCATE(user_param->tcompleted,cycles_t,tarr_size);
 		memset(user_param->tcompleted, 0, sizeof(cycles_t)*tarr_size);
-		ALLOCATE(ctx->my_addr,uint64_t,user_param->num_of_qps);
-		ALLOCATE(ctx->rem_addr,uint64_t,user_param->num_of_qps);
-		ALLOCATE(ctx->scnt,uint64_t,user_param->num_of_qps);
-		ALLOCATE(ctx->ccnt,uint64_t,user_param->num_of_qps);
-		memset(ctx->scnt, 0, user_param->num_of_qps * sizeof (uint64_t));
-		memset(ctx->ccnt, 0, user_param->num_of_qps * sizeof (uint64_t));
 
 	} else if ((user_param->tst == BW || user_param->tst == LAT_BY_BW)
 		   && user_param->verb == SEND && user_param->machine == SERVER) {
 
-		ALLOCATE(ctx->my_addr, uint64_t, user_param->num_of_qps);
 		ALLOCATE(user_param->tcompleted, cycles_t, 1);
 	} else if (user_param->tst == FS_RATE && user_param->test_type == ITERATIONS) {
 		ALLOCATE(user_param->tcompleted, cycles_t, tarr_size);
 		memset(user_param->tcompleted, 0, sizeof(cycles_t) * tarr_size);
 	}
 
-	if (user_param->machine == CLIENT || user_param->tst == LAT || user_param->duplex) {
-
-		ALLOCATE(ctx->sge_list, struct ibv_sge,user_param->num_of_qps * user_param->post_list);
-		ALLOCATE(ctx->wr, struct ibv_send_wr, user_param->num_of_qps * user_param->post_list);
-		ALLOCATE(ctx->rem_qpn, uint32_t, user_param->num_of_qps);
-		if ((user_param->verb == SEND && user_param->connection_type == UD) ||
-				user_param->connection_type == DC || user_param->connection_type == SRD) {
-			ALLOCATE(ctx->ah, struct ibv_ah*, user_param->num_of_qps);
-		}
-	} else if (user_param->verb == READ && user_param->connection_type == SRD) {
-		ALLOCATE(ctx->ah, struct ibv_ah*, user_param->num_of_qps);
-	}
+	/* all the per QP arrays, the counters of the worker threads included */
+	ctx_alloc_arena(ctx, user_param);
 
-	if (user_param->verb == SEND && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex)) {
-		ALLOCATE(ctx->recv_sge_list, struct ibv_sge,
-			 user_param->num_of_qps * user_param->recv_post_list);
-		ALLOCATE(ctx->rwr, struct ibv_recv_wr,
-			 user_param->num_of_qps * user_param->recv_post_list);
-		ALLOCATE(ctx->rx_buffer_addr, uint64_t, user_param->num_of_qps);
+	if (user_param->mac_fwd == ON ) {
+		/* a slot for every receive, a forwarded packet is sent from the
+		 * slot it was received to, and it is reposted only once it was sent.
+		 */
+		ctx->cycle_buffer = INC(user_param->size, ctx->cache_line_size) * user_param->rx_depth;
 	}
-	if (user_param->mac_fwd == ON )
-		ctx->cycle_buffer = user_param->size * user_param->rx_depth;
 
 	ctx->size = user_param->size;
 
@@ -1281,23 +1407,383 @@ void alloc_ctx(struct pingpong_context *ctx,struct perftest_parameters *user_par
 		ctx->buff_size += ctx->cache_line_size;
 }
 
+#ifdef HAVE_RSS
+/******************************************************************************
+ * ctx_rss_create - one CQ and one WQ per receive queue, an indirection table
+ * over all the WQs and the hash QP that spreads the packets on them.
+ * The hash QP is ctx->qp[0], it is the one the flow rules are attached to.
+ ******************************************************************************/
+static int ctx_rss_create(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct ibv_wq_init_attr wq_init_attr;
+	struct ibv_wq_attr wq_attr;
+	struct ibv_rwq_ind_table_init_attr ind_table_attr;
+	struct ibv_qp_init_attr_ex qp_init_attr;
+	int log_ind_table_size = 0;
+	int comp_vectors = ctx->context->num_comp_vectors ? ctx->context->num_comp_vectors : 1;
+	int i;
+
+	FUNCTION_ENTER;
+	while ((1 << log_ind_table_size) < user_param->num_of_qps)
+		log_ind_table_size++;
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		/* spread the queues over the completion vectors as well */
+		ctx->wq_cq[i] = ibv_create_cq(ctx->context, user_param->rx_depth, NULL, NULL, i % comp_vectors);
+		if (!ctx->wq_cq[i]) {
+			log_ebt("Couldn't create CQ of RSS queue %d\n", i);
+			return FAILURE;
+		}
+
+		memset(&wq_init_attr, 0, sizeof(wq_init_attr));
+		wq_init_attr.wq_type = IBV_WQT_RQ;
+		wq_init_attr.max_wr = user_param->rx_depth;
+		wq_init_attr.max_sge = MAX_RECV_SGE;
+		wq_init_attr.pd = ctx->pd;
+		wq_init_attr.cq = ctx->wq_cq[i];
+		ctx->wq[i] = ibv_create_wq(ctx->context, &wq_init_attr);
+		if (!ctx->wq[i]) {
+			log_ebt("Couldn't create WQ of RSS queue %d - %s\n", i, strerror(errno));
+			return FAILURE;
+		}
+
+		memset(&wq_attr, 0, sizeof(wq_attr));
+		wq_attr.attr_mask = IBV_WQ_ATTR_STATE;
+		wq_attr.wq_state = IBV_WQS_RDY;
+		if (ibv_modify_wq(ctx->wq[i], &wq_attr)) {
+			log_ebt("Couldn't modify WQ of RSS queue %d to RDY\n", i);
+			return FAILURE;
+		}
+	}
+
+	memset(&ind_table_attr, 0, sizeof(ind_table_attr));
+	ind_table_attr.log_ind_tbl_size = log_ind_table_size;
+	ind_table_attr.ind_tbl = ctx->wq;
+	ctx->rwq_ind_table = ibv_create_rwq_ind_table(ctx->context, &ind_table_attr);
+	if (!ctx->rwq_ind_table) {
+		log_ebt("Couldn't create RSS indirection table - %s\n", strerror(errno));
+		return FAILURE;
+	}
+
+	memset(&qp_init_attr, 0, sizeof(qp_init_attr));
+	qp_init_attr.qp_type = IBV_QPT_RAW_PACKET;
+	qp_init_attr.comp_mask = IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_IND_TABLE | IBV_QP_INIT_ATTR_RX_HASH;
+	qp_init_attr.pd = ctx->pd;
+	qp_init_attr.rwq_ind_tbl = ctx->rwq_ind_table;
+	qp_init_attr.rx_hash_conf.rx_hash_function = IBV_RX_HASH_FUNC_TOEPLITZ;
+	qp_init_attr.rx_hash_conf.rx_hash_key_len = RSS_HASH_KEY_LEN;
+	qp_init_attr.rx_hash_conf.rx_hash_key = (uint8_t*)rss_hash_key;
+	qp_init_attr.rx_hash_conf.rx_hash_fields_mask = rss_hash_fields(user_param);
+	ctx->qp[0] = ibv_create_qp_ex(ctx->context, &qp_init_attr);
+	if (!ctx->qp[0]) {
+		log_ebt("Couldn't create RSS hash QP - %s\n", strerror(errno));
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int ctx_rss_destroy(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	int i;
+	int test_result = 0;
+
+	FUNCTION_ENTER;
+	if (ctx->qp[0] && ibv_destroy_qp(ctx->qp[0])) {
+		log_ebt("Couldn't destroy RSS hash QP - %s\n", strerror(errno));
+		test_result = 1;
+	}
+
+	if (ctx->rwq_ind_table && ibv_destroy_rwq_ind_table(ctx->rwq_ind_table)) {
+		log_ebt("Couldn't destroy RSS indirection table\n");
+		test_result = 1;
+	}
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		if (ctx->wq[i] && ibv_destroy_wq(ctx->wq[i])) {
+			log_ebt("Couldn't destroy WQ of RSS queue %d\n", i);
+			test_result = 1;
+		}
+
+		if (ctx->wq_cq[i] && ibv_destroy_cq(ctx->wq_cq[i])) {
+			log_ebt("Couldn't destroy CQ of RSS queue %d\n", i);
+			test_result = 1;
+		}
+	}
+
+	return test_result;
+}
+#endif
+
+/* sleep of a completion wait, short enough for duration tests to see their end */
+#define EVENT_WAIT_TIMEOUT_MS	(100)
+#define EVENT_ACK_BATCH		(16)
+/* the learned spin budget is twice the mean wait, if that is below this */
+#define EVENT_SPIN_LEARN_MAX_USEC	(50)
+
+static double process_cpu_time(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+	       usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int event_waiter_create(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct event_waiter *waiter;
+	int flags;
+
+	FUNCTION_ENTER;
+	ALLOCATE(waiter, struct event_waiter, 1);
+	memset(waiter, 0, sizeof(*waiter));
+	waiter->cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	waiter->learn = user_param->event_spin == EVENT_SPIN_AUTO;
+	if (waiter->learn)
+		waiter->max_spin_cycles = EVENT_SPIN_LEARN_MAX_USEC * waiter->cpu_mhz;
+	else
+		waiter->spin_cycles = user_param->event_spin * waiter->cpu_mhz;
+
+	/* the channel is read only after poll reports it */
+	flags = fcntl(ctx->channel->fd, F_GETFL);
+	if (flags < 0 || fcntl(ctx->channel->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		log_ebt("Couldn't make the completion channel non blocking - %s\n", strerror(errno));
+		free(waiter);
+		return FAILURE;
+	}
+
+	ctx->waiter = waiter;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void event_waiter_learn(struct event_waiter *waiter, cycles_t wait)
+{
+	if (!waiter->learn)
+		return;
+
+	/* spinning pays off when a completion usually shows up within the cap,
+	 * otherwise the sleep is cheaper */
+	waiter->wait_avg += ((double)wait - waiter->wait_avg) / 8;
+	if (2 * waiter->wait_avg <= waiter->max_spin_cycles)
+		waiter->spin_cycles = 2 * waiter->wait_avg;
+	else
+		waiter->spin_cycles = 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int event_waiter_drain(struct pingpong_context *ctx)
+{
+	struct event_waiter *waiter = ctx->waiter;
+	struct ibv_cq *ev_cq;
+	void *ev_ctx;
+	int i;
+
+	while (!ibv_get_cq_event(ctx->channel, &ev_cq, &ev_ctx)) {
+		i = ev_cq == ctx->send_cq ? 0 : 1;
+		waiter->armed[i] = 0;
+		if (++waiter->unacked[i] == EVENT_ACK_BATCH) {
+			ibv_ack_cq_events(ev_cq, waiter->unacked[i]);
+			waiter->unacked[i] = 0;
+		}
+	}
+
+	if (errno != EAGAIN) {
+		log_ebt("Failed to get cq_event - %s\n", strerror(errno));
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_event_poll_cq(struct pingpong_context *ctx, struct ibv_cq *cq, int n, struct ibv_wc *wc)
+{
+	struct event_waiter *waiter = ctx->waiter;
+	struct pollfd pfd = { .fd = ctx->channel->fd, .events = POLLIN };
+	cycles_t start, deadline, asleep, woke;
+	int i = cq == ctx->send_cq ? 0 : 1;
+	int ne, rc;
+
+	start = get_cycles();
+	if (!waiter->start_cycles) {
+		waiter->start_cycles = start;
+		waiter->start_cpu_time = process_cpu_time();
+	}
+
+	deadline = start + waiter->spin_cycles;
+	do {
+		ne = ibv_poll_cq(cq, n, wc);
+		if (ne) {
+			if (ne > 0) {
+				waiter->spin_hits++;
+				event_waiter_learn(waiter, get_cycles() - start);
+			}
+			return ne;
+		}
+	} while (get_cycles() < deadline);
+
+	for (;;) {
+		if (!waiter->armed[i]) {
+			if (ibv_req_notify_cq(cq, 0)) {
+				log_ebt("Couldn't request CQ notification\n");
+				return -1;
+			}
+			waiter->armed[i] = 1;
+
+			/* a completion before the arm raises no event */
+			ne = ibv_poll_cq(cq, n, wc);
+			if (ne) {
+				if (ne > 0) {
+					waiter->spin_hits++;
+					event_waiter_learn(waiter, get_cycles() - start);
+				}
+				return ne;
+			}
+		}
+
+		asleep = get_cycles();
+		rc = poll(&pfd, 1, EVENT_WAIT_TIMEOUT_MS);
+		if (rc < 0 && errno != EINTR) {
+			log_ebt("Failed to wait for the completion channel - %s\n", strerror(errno));
+			return -1;
+		}
+		if (rc <= 0) {
+			waiter->timeouts++;
+			return 0;
+		}
+
+		woke = get_cycles();
+		waiter->sleeps++;
+		waiter->sleep_cycles += woke - asleep;
+		if (event_waiter_drain(ctx))
+			return -1;
+
+		/* the event may be of the other CQ, then sleep again */
+		ne = ibv_poll_cq(cq, n, wc);
+		if (ne) {
+			if (ne > 0) {
+				waiter->sleep_hits++;
+				waiter->wake_cycles += get_cycles() - woke;
+				event_waiter_learn(waiter, get_cycles() - start);
+			}
+			return ne;
+		}
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void event_waiter_destroy(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct event_waiter *waiter = ctx->waiter;
+	uint64_t hits = waiter->spin_hits + waiter->sleep_hits;
+	double wall;
+
+	if (waiter->start_cycles && user_param->output == FULL_VERBOSITY) {
+		wall = (get_cycles() - waiter->start_cycles) / waiter->cpu_mhz / 1e6;
+		printf(" Completion wait in events mode\n");
+		if (user_param->event_spin == EVENT_SPIN_AUTO)
+			printf(" Spin policy      : auto, last budget %.2f usec\n",
+			       waiter->spin_cycles / waiter->cpu_mhz);
+		else
+			printf(" Spin policy      : fixed, %d usec\n", user_param->event_spin);
+		printf(" Spin completions : %" PRIu64 " (%.1f%%)\n", waiter->spin_hits,
+		       hits ? 100.0 * waiter->spin_hits / hits : 0);
+		printf(" Wake completions : %" PRIu64 "\n", waiter->sleep_hits);
+		printf(" Sleeps           : %" PRIu64 ", average %.2f usec, %" PRIu64 " timed out\n",
+		       waiter->sleeps, waiter->sleeps ? waiter->sleep_cycles / waiter->cpu_mhz / waiter->sleeps : 0,
+		       waiter->timeouts);
+		printf(" Wake up latency  : %.2f usec from the event to the completion\n",
+		       waiter->sleep_hits ? waiter->wake_cycles / waiter->cpu_mhz / waiter->sleep_hits : 0);
+		printf(" CPU utilization  : %.1f%%\n",
+		       wall > 0 ? 100 * (process_cpu_time() - waiter->start_cpu_time) / wall : 0);
+		printf(RESULT_LINE);
+	}
+
+	/* destroying a CQ waits for the ack of all its events */
+	if (waiter->unacked[0])
+		ibv_ack_cq_events(ctx->send_cq, waiter->unacked[0]);
+	if (waiter->unacked[1])
+		ibv_ack_cq_events(ctx->recv_cq, waiter->unacked[1]);
+
+	free(waiter);
+	ctx->waiter = NULL;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
 int destroy_ctx(struct pingpong_context *ctx,
 		struct perftest_parameters *user_param)
 {
-	int i, first, dereg_counter, rc;
+	int i, dereg_counter, rc;
 	int test_result = 0;
 	int num_of_qps = user_param->num_of_qps;
 
 	FUNCTION_ENTER;
+	/* the autotune may have left fewer QPs in use than it created */
+	if (user_param->autotune_report)
+		num_of_qps = user_param->num_of_qps = user_param->autotune_report->max_qps;
+
 	if (user_param->wait_destroy) {
 		printf(" Waiting %u seconds before releasing resources...\n",
 		       user_param->wait_destroy);
 		sleep(user_param->wait_destroy);
 	}
 
+	if (ctx->waiter)
+		event_waiter_destroy(ctx, user_param);
+
+	if (user_param->lat_probe) {
+		lat_probe_destroy(user_param->lat_probe);
+		user_param->lat_probe = NULL;
+	}
+
+	if (user_param->pacer) {
+		pacer_destroy(user_param->pacer);
+		user_param->pacer = NULL;
+	}
+
+	if (user_param->load_profile) {
+		load_profile_free(user_param->load_profile);
+		user_param->load_profile = NULL;
+	}
+
+	/* Memory registration and QP rate tests hold only the PD and CQ, see ctx_init */
+	if (user_param->tst == REG_MR || user_param->tst == QP_RATE) {
+		if (ctx->send_cq && ibv_destroy_cq(ctx->send_cq)) {
+			log_ebt("Failed to destroy CQ - %s\n", strerror(errno));
+			test_result = 1;
+		}
+
+		if (ibv_dealloc_pd(ctx->pd)) {
+			log_ebt("Failed to deallocate PD - %s\n", strerror(errno));
+			test_result = 1;
+		}
+
+		if (ibv_close_device(ctx->context)) {
+			log_ebt("Failed to close device context\n");
+			test_result = 1;
+		}
+		return test_result;
+	}
+
 	dereg_counter = (user_param->mr_per_qp) ? user_param->num_of_qps : 1;
 
 	if (user_param->work_rdma_cm == ON) {
@@ -1319,12 +1805,13 @@ int destroy_ctx(struct pingpong_context *ctx,
 		num_of_qps /= 2;
 	}
 
-	/* RSS parent should be last */
-	if (user_param->use_rss)
-		first = 1;
-	else
-		first = 0;
-	for (i = first; i < user_param->num_of_qps; i++) {
+	#ifdef HAVE_RSS
+	if (user_param->use_rss) {
+		if (ctx_rss_destroy(ctx, user_param))
+			test_result = 1;
+	} else
+	#endif
+	for (i = 0; i < user_param->num_of_qps; i++) {
 
 		if ((((user_param->connection_type == DC && !((!(user_param->duplex || user_param->tst == LAT) && user_param->machine == SERVER)
 							|| ((user_param->duplex || user_param->tst == LAT) && i >= num_of_qps))) ||
@@ -1344,19 +1831,6 @@ int destroy_ctx(struct pingpong_context *ctx,
 		}
 	}
 
-	if (user_param->use_rss) {
-		if (user_param->connection_type == UD && (user_param->tst == LAT || user_param->machine == CLIENT || user_param->duplex)) {
-			if (ibv_destroy_ah(ctx->ah[0])) {
-				log_ebt("Failed to destroy AH\n");
-				test_result = 1;
-			}
-		}
-
-		if (ibv_destroy_qp(ctx->qp[0])) {
-			log_ebt("Couldn't destroy QP - %s\n", strerror(errno));
-			test_result = 1;
-		}
-	}
 	if (user_param->srq_exists) {
 		if (ibv_destroy_srq(ctx->srq)) {
 			log_ebt("Couldn't destroy SRQ\n");
@@ -1385,6 +1859,16 @@ int destroy_ctx(struct pingpong_context *ctx,
 		test_result = 1;
 	}
 
+	if (ctx->fwd_queue) {
+		for (i = 0; i < user_param->num_of_qps; i++) {
+			if (ibv_destroy_cq(ctx->fwd_queue[i].send_cq) ||
+			    ibv_destroy_cq(ctx->fwd_queue[i].recv_cq)) {
+				log_ebt("Failed to destroy the CQs of forwarding queue %d - %s\n", i, strerror(errno));
+				test_result = 1;
+			}
+		}
+	}
+
 	if (user_param->verb == SEND && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex || (ctx->channel)) ) {
 		if (!(user_param->connection_type == DC && user_param->machine == SERVER)) {
 			if (ibv_destroy_cq(ctx->recv_cq)) {
@@ -1481,55 +1965,44 @@ int destroy_ctx(struct pingpong_context *ctx,
 			}
 		}
 	}
-	free(ctx->qp);
-	#ifdef HAVE_IBV_WR_API
-	free(ctx->qpx);
-	free(ctx->r_dctn);
-	#ifdef HAVE_DCS
-	free(ctx->dci_stream_id);
-	#endif
-	#endif
-	#ifdef HAVE_AES_XTS
-	if(user_param->aes_xts) {
-		free(ctx->dek);
-		free(ctx->mkey);
-	}
-	#endif
-
 	if ((user_param->tst == BW || user_param->tst == LAT_BY_BW ) && (user_param->machine == CLIENT || user_param->duplex)) {
 
 		free(user_param->tposted);
 		free(user_param->tcompleted);
-		free(ctx->my_addr);
-		free(ctx->rem_addr);
-		free(ctx->scnt);
-		free(ctx->ccnt);
 	}
 	else if ((user_param->tst == BW || user_param->tst == LAT_BY_BW ) && user_param->verb == SEND && user_param->machine == SERVER) {
 
 		free(user_param->tposted);
 		free(user_param->tcompleted);
-		free(ctx->my_addr);
 	}
-	if (user_param->machine == CLIENT || user_param->tst == LAT || user_param->duplex) {
+	/* allocated in alloc_ctx under the same condition */
+	if (user_param->hw_timestamps || user_param->lat_depth > 1)
+		free(user_param->tcompleted);
 
-		free(ctx->sge_list);
-		free(ctx->wr);
+	if (user_param->work_rdma_cm == ON) {
+		rdma_cm_destroy_cma(ctx, user_param);
 	}
 
-	if (user_param->verb == SEND && (user_param->tst == LAT || user_param->machine == SERVER || user_param->duplex)) {
+	ctx_free_arena(ctx);
+
+	if (user_param->counter_ctx) {
+		counters_close(user_param->counter_ctx);
+	}
 
-		free(ctx->rx_buffer_addr);
-		free(ctx->recv_sge_list);
-		free(ctx->rwr);
+	if (user_param->counter_sampler) {
+		counter_sampler_free(user_param->counter_sampler);
+		user_param->counter_sampler = NULL;
 	}
 
-	if (user_param->work_rdma_cm == ON) {
-		rdma_cm_destroy_cma(ctx, user_param);
+	if (user_param->cpu_stats) {
+		cpu_stats_close(user_param->cpu_stats);
+		user_param->cpu_stats = NULL;
 	}
 
-	if (user_param->counter_ctx) {
-		counters_close(user_param->counter_ctx);
+	if (user_param->autotune_report) {
+		free(user_param->autotune_report->points);
+		free(user_param->autotune_report);
+		user_param->autotune_report = NULL;
 	}
 
 	return test_result;
@@ -1561,6 +2034,47 @@ static int check_odp_support(struct pingpong_context *ctx)
 }
 #endif
 
+#ifdef HAVE_HW_TIMESTAMP
+/******************************************************************************
+ * create_ts_cqs - extended CQs that report the device time of every completion.
+ * Returns FAILURE if the device doesn't timestamp completions.
+ ******************************************************************************/
+static int create_ts_cqs(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+			 int tx_buffer_depth, int need_recv_cq)
+{
+	struct ibv_device_attr_ex dattr;
+	struct ibv_cq_init_attr_ex cq_attr;
+
+	memset(&dattr, 0, sizeof(dattr));
+	if (ibv_query_device_ex(ctx->context, NULL, &dattr) ||
+	    !dattr.completion_timestamp_mask || !dattr.hca_core_clock)
+		return FAILURE;
+
+	memset(&cq_attr, 0, sizeof(cq_attr));
+	cq_attr.cqe = tx_buffer_depth * user_param->num_of_qps;
+	cq_attr.channel = ctx->channel;
+	cq_attr.comp_vector = user_param->eq_num;
+	cq_attr.wc_flags = IBV_WC_EX_WITH_COMPLETION_TIMESTAMP;
+	ctx->send_cq_ex = ibv_create_cq_ex(ctx->context, &cq_attr);
+	if (!ctx->send_cq_ex)
+		return FAILURE;
+
+	if (need_recv_cq) {
+		cq_attr.cqe = user_param->rx_depth * user_param->num_of_qps;
+		ctx->recv_cq_ex = ibv_create_cq_ex(ctx->context, &cq_attr);
+		if (!ctx->recv_cq_ex) {
+			ibv_destroy_cq(ibv_cq_ex_to_cq(ctx->send_cq_ex));
+			ctx->send_cq_ex = NULL;
+			return FAILURE;
+		}
+		ctx->recv_cq = ibv_cq_ex_to_cq(ctx->recv_cq_ex);
+	}
+	ctx->send_cq = ibv_cq_ex_to_cq(ctx->send_cq_ex);
+
+	return SUCCESS;
+}
+#endif
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -1569,6 +2083,16 @@ int create_reg_cqs(struct pingpong_context *ctx,
 		   int tx_buffer_depth, int need_recv_cq)
 {
 	FUNCTION_ENTER;
+	if (user_param->hw_timestamps) {
+		#ifdef HAVE_HW_TIMESTAMP
+		if (create_ts_cqs(ctx, user_param, tx_buffer_depth, need_recv_cq) == SUCCESS) {
+			user_param->hw_ts_active = 1;
+			return SUCCESS;
+		}
+		#endif
+		printf(" The device doesn't timestamp completions, using software timestamps at the CQE read\n");
+	}
+
 	ctx->send_cq = ibv_create_cq(ctx->context,tx_buffer_depth *
 					user_param->num_of_qps, NULL, ctx->channel, user_param->eq_num);
 	if (!ctx->send_cq) {
@@ -1593,7 +2117,7 @@ int create_reg_cqs(struct pingpong_context *ctx,
  ******************************************************************************/
 int create_cqs(struct pingpong_context *ctx, struct perftest_parameters *user_param)
 {
-	int ret;
+	int ret, i;
 	int dct_only = 0, need_recv_cq = 0;
 	int tx_buffer_depth = user_param->tx_depth;
 
@@ -1609,8 +2133,47 @@ int create_cqs(struct pingpong_context *ctx, struct perftest_parameters *user_pa
 		need_recv_cq = 1;
 
 	ret = create_reg_cqs(ctx, user_param, tx_buffer_depth, need_recv_cq);
+	if (ret || !ctx->fwd_queue)
+		return ret;
 
-	return ret;
+	/* every forwarding queue is polled by its own thread */
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		ctx->fwd_queue[i].send_cq = ibv_create_cq(ctx->context, user_param->tx_depth, NULL, NULL,
+							  i % ctx->context->num_comp_vectors);
+		ctx->fwd_queue[i].recv_cq = ibv_create_cq(ctx->context, user_param->rx_depth, NULL, NULL,
+							  i % ctx->context->num_comp_vectors);
+		if (!ctx->fwd_queue[i].send_cq || !ctx->fwd_queue[i].recv_cq) {
+			log_ebt("Couldn't create the CQs of forwarding queue %d\n", i);
+			return FAILURE;
+		}
+	}
+
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int get_mr_access_flags(struct perftest_parameters *user_param)
+{
+	int flags = 0;
+
+	if (user_param->verb == WRITE) {
+		flags |= IBV_ACCESS_REMOTE_WRITE;
+	} else if (user_param->verb == READ) {
+		flags |= IBV_ACCESS_REMOTE_READ;
+		if (user_param->transport_type == IBV_TRANSPORT_IWARP)
+			flags |= IBV_ACCESS_REMOTE_WRITE;
+	} else if (user_param->verb == ATOMIC) {
+		flags |= IBV_ACCESS_REMOTE_ATOMIC;
+	}
+
+#ifdef HAVE_RO
+	if (user_param->disable_pcir == 0) {
+		flags |= IBV_ACCESS_RELAXED_ORDERING;
+	}
+#endif
+	return flags;
 }
 
 /******************************************************************************
@@ -1726,21 +2289,7 @@ int create_single_mr(struct pingpong_context *ctx, struct perftest_parameters *u
 		}
 	}
 
-	if (user_param->verb == WRITE) {
-		flags |= IBV_ACCESS_REMOTE_WRITE;
-	} else if (user_param->verb == READ) {
-		flags |= IBV_ACCESS_REMOTE_READ;
-		if (user_param->transport_type == IBV_TRANSPORT_IWARP)
-			flags |= IBV_ACCESS_REMOTE_WRITE;
-	} else if (user_param->verb == ATOMIC) {
-		flags |= IBV_ACCESS_REMOTE_ATOMIC;
-	}
-
-#ifdef HAVE_RO
-	if (user_param->disable_pcir == 0) {
-		flags |= IBV_ACCESS_RELAXED_ORDERING;
-	}
-#endif
+	flags |= get_mr_access_flags(user_param);
 
 	/* Allocating Memory region and assigning our buffer to it. */
 	ctx->mr[qp_index] = ibv_reg_mr(ctx->pd, ctx->buf[qp_index], ctx->buff_size, flags);
@@ -1807,7 +2356,6 @@ int create_mr(struct pingpong_context *ctx, struct perftest_parameters *user_par
 /******************************************************************************
  *
  ******************************************************************************/
-#define HUGEPAGE_ALIGN  (2*1024*1024)
 #define SHMAT_ADDR (void *)(0x0UL)
 #define SHMAT_FLAGS (0)
 
@@ -1954,6 +2502,10 @@ int ctx_init(struct pingpong_context *ctx, struct perftest_parameters *user_para
 			log_ebt("Couldn't create completion channel\n");
 			return FAILURE;
 		}
+		if (event_waiter_create(ctx, user_param)) {
+			log_ebt("Couldn't set up the completion wait\n");
+			return FAILURE;
+		}
 	}
 
 	/* Allocating the Protection domain. */
@@ -1962,6 +2514,23 @@ int ctx_init(struct pingpong_context *ctx, struct perftest_parameters *user_para
 		log_ebt("Couldn't allocate PD\n");
 		return FAILURE;
 	}
+
+	/* Memory registration test creates and destroys its MRs per sample. */
+	if (user_param->tst == REG_MR)
+		return SUCCESS;
+
+	/* QP rate test creates and destroys its QPs per round, they all
+	 * share one CQ that is never polled.
+	 */
+	if (user_param->tst == QP_RATE) {
+		ctx->send_cq = ibv_create_cq(ctx->context, user_param->tx_depth, NULL, NULL, user_param->eq_num);
+		if (!ctx->send_cq) {
+			log_ebt("Couldn't create CQ\n");
+			return FAILURE;
+		}
+		ctx->recv_cq = ctx->send_cq;
+		return SUCCESS;
+	}
 	#ifdef HAVE_AES_XTS
 	if(user_param->aes_xts){
 		struct mlx5dv_dek_init_attr dek_attr = {};
@@ -2051,6 +2620,11 @@ int ctx_init(struct pingpong_context *ctx, struct perftest_parameters *user_para
 
 	}
 
+	#ifdef HAVE_RSS
+	if (user_param->use_rss)
+		return ctx_rss_create(ctx, user_param);
+	#endif
+
 	#ifdef HAVE_XRCD
 	if (user_param->use_xrc) {
 
@@ -2129,6 +2703,218 @@ int ctx_init(struct pingpong_context *ctx, struct perftest_parameters *user_para
 	return SUCCESS;
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int session_pool_free_qps(struct session_pool *pool)
+{
+	int i, err = 0;
+
+	for (i = 0; i < pool->num_qps; i++) {
+		if (ibv_destroy_qp(pool->qp[i])) {
+			log_ebt("Couldn't destroy QP - %s\n", strerror(errno));
+			err = 1;
+		}
+	}
+	free(pool->qp);
+	pool->qp = NULL;
+	pool->num_qps = 0;
+
+	if (pool->cq && ibv_destroy_cq(pool->cq)) {
+		log_ebt("Failed to destroy CQ - %s\n", strerror(errno));
+		err = 1;
+	}
+	pool->cq = NULL;
+	pool->cq_size = 0;
+
+	return err;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int session_pool_free_buf(struct session_pool *pool, struct perftest_parameters *user_param)
+{
+	int err = 0;
+
+	if (!pool->mr)
+		return 0;
+
+	if (ibv_dereg_mr(pool->mr)) {
+		log_ebt("Failed to deregister MR\n");
+		err = 1;
+	}
+	#if !defined(__FreeBSD__)
+	if (user_param->use_hugepages)
+		shmdt(pool->buf);
+	else
+	#endif
+		free(pool->buf);
+	pool->mr = NULL;
+	pool->buf = NULL;
+	pool->buf_size = 0;
+
+	return err;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_init_session(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct session_pool *pool = &ctx->pool;
+	int num_of_qps = user_param->num_of_qps / 2;
+	int cq_size = user_param->tx_depth * user_param->num_of_qps;
+	int i;
+
+	FUNCTION_ENTER;
+	ctx->is_contig_supported = FAILURE;
+	if (!ctx->pd) {
+		ctx->pd = ibv_alloc_pd(ctx->context);
+		if (!ctx->pd) {
+			log_ebt("Couldn't allocate PD\n");
+			return FAILURE;
+		}
+	}
+
+	/* a session that needs a bigger buffer or more QPs than the pool has creates them for the next ones too */
+	pool->kept_buf = pool->buf_size >= ctx->buff_size;
+	pool->kept_qps = !(pool->num_qps < user_param->num_of_qps || pool->connection_type != user_param->connection_type ||
+			   pool->tx_depth < user_param->tx_depth || pool->rx_depth < user_param->rx_depth ||
+			   pool->cq_size < cq_size);
+	if (!pool->kept_buf) {
+		if (session_pool_free_buf(pool, user_param))
+			return FAILURE;
+
+		if (create_single_mr(ctx, user_param, 0)) {
+			log_ebt("failed to create mr\n");
+			return FAILURE;
+		}
+		pool->buf = ctx->buf[0];
+		pool->mr = ctx->mr[0];
+		pool->buf_size = ctx->buff_size;
+	}
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		ctx->mr[i] = pool->mr;
+		ctx->buf[i] = pool->buf + (i*BUFF_SIZE(ctx->size, ctx->cycle_buffer));
+	}
+
+	if (!pool->kept_qps) {
+		if (session_pool_free_qps(pool))
+			return FAILURE;
+
+		if (create_cqs(ctx, user_param)) {
+			log_ebt("Failed to create CQs\n");
+			return FAILURE;
+		}
+		pool->cq = ctx->send_cq;
+		pool->cq_size = cq_size;
+		pool->connection_type = user_param->connection_type;
+		pool->tx_depth = user_param->tx_depth;
+		pool->rx_depth = user_param->rx_depth;
+
+		ALLOCATE(pool->qp, struct ibv_qp*, user_param->num_of_qps);
+		for (i = 0; i < user_param->num_of_qps; i++) {
+			if (create_qp_main(ctx, user_param, i, num_of_qps)) {
+				log_ebt("Failed to create QP.\n");
+				return FAILURE;
+			}
+			pool->qp[pool->num_qps++] = ctx->qp[i];
+		}
+	} else {
+		ctx->send_cq = pool->cq;
+		for (i = 0; i < user_param->num_of_qps; i++) {
+			ctx->qp[i] = pool->qp[i];
+			#ifdef HAVE_IBV_WR_API
+			if (!user_param->use_old_post_send)
+				ctx->qpx[i] = ibv_qp_to_qp_ex(ctx->qp[i]);
+			#endif
+		}
+	}
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		if (modify_qp_to_init(ctx, user_param, i, num_of_qps))
+			return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int ctx_end_session(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct ibv_qp_attr attr;
+	int i, err = 0;
+
+	FUNCTION_ENTER;
+	/* the client is gone, nothing is to reach the buffer until the next one connects */
+	memset(&attr, 0, sizeof(attr));
+	attr.qp_state = IBV_QPS_RESET;
+	for (i = 0; i < ctx->pool.num_qps; i++) {
+		if (ibv_modify_qp(ctx->pool.qp[i], &attr, IBV_QP_STATE)) {
+			log_ebt("Failed to reset QP - %s\n", strerror(errno));
+			err = 1;
+		}
+	}
+
+	free(user_param->tposted);
+	user_param->tposted = NULL;
+	free(user_param->tcompleted);
+	user_param->tcompleted = NULL;
+	ctx_free_arena(ctx);
+
+	return err;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int destroy_session_pool(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	int test_result = 0;
+
+	FUNCTION_ENTER;
+	if (user_param->pacer) {
+		pacer_destroy(user_param->pacer);
+		user_param->pacer = NULL;
+	}
+
+	if (user_param->load_profile) {
+		load_profile_free(user_param->load_profile);
+		user_param->load_profile = NULL;
+	}
+
+	if (session_pool_free_qps(&ctx->pool))
+		test_result = 1;
+
+	/* a --loopback_shared client left the buffer, the PD and the device to its server */
+	if (session_pool_free_buf(&ctx->pool, user_param))
+		test_result = 1;
+
+	if (ctx->pd && ibv_dealloc_pd(ctx->pd)) {
+		log_ebt("Failed to deallocate PD - %s\n", strerror(errno));
+		test_result = 1;
+	}
+
+	if (ctx->context && ibv_close_device(ctx->context)) {
+		log_ebt("Failed to close device context\n");
+		test_result = 1;
+	}
+
+	if (user_param->counter_ctx)
+		counters_close(user_param->counter_ctx);
+
+	if (user_param->cpu_stats) {
+		cpu_stats_close(user_param->cpu_stats);
+		user_param->cpu_stats = NULL;
+	}
+
+	return test_result;
+}
+
 int modify_qp_to_init(struct pingpong_context *ctx,
 		struct perftest_parameters *user_param, int qp_index, int num_of_qps)
 {
@@ -2220,6 +3006,10 @@ struct ibv_qp* ctx_qp_create(struct pingpong_context *ctx,
 
 	attr.send_cq = ctx->send_cq;
 	attr.recv_cq = (user_param->verb == SEND) ? ctx->recv_cq : ctx->send_cq;
+	if (ctx->fwd_queue) {
+		attr.send_cq = ctx->fwd_queue[qp_index].send_cq;
+		attr.recv_cq = ctx->fwd_queue[qp_index].recv_cq;
+	}
 
 	is_dc_server_side = ((!(user_param->duplex || user_param->tst == LAT) &&
 						  (user_param->machine == SERVER)) ||
@@ -2621,6 +3411,12 @@ int ctx_connect(struct pingpong_context *ctx,
 	int xrc_offset = 0;
 
 	FUNCTION_ENTER;
+	#ifdef HAVE_RSS
+	/* The RSS hash QP and its WQs are ready once created */
+	if (user_param->use_rss)
+		return SUCCESS;
+	#endif
+
 	if((user_param->use_xrc || user_param->connection_type == DC) && (user_param->duplex || user_param->tst == LAT)) {
 		xrc_offset = user_param->num_of_qps / 2;
 	}
@@ -2923,6 +3719,7 @@ void ctx_set_send_reg_wqes(struct pingpong_context *ctx,
 	int num_of_qps = user_param->num_of_qps;
 	int xrc_offset = 0;
 	uint32_t remote_qkey;
+	uint64_t num_of_slots;
 
 	FUNCTION_ENTER;
 	if((user_param->use_xrc || user_param->connection_type == DC) && (user_param->duplex || user_param->tst == LAT)) {
@@ -2930,6 +3727,17 @@ void ctx_set_send_reg_wqes(struct pingpong_context *ctx,
 		xrc_offset = num_of_qps;
 	}
 
+	/* The send slots of the cycle buffer a QP with post_list 1 walks through,
+	 * the largest power of two of them that fits so the next one is a mask away.
+	 */
+	ctx->send_slot_stride = INC(user_param->size, ctx->cache_line_size);
+	ctx->send_slot_mask = 0;
+	if (user_param->size <= (ctx->cycle_buffer / 2)) {
+		num_of_slots = ctx->cycle_buffer / ctx->send_slot_stride;
+		while (ctx->send_slot_mask * 2 + 1 < num_of_slots)
+			ctx->send_slot_mask = ctx->send_slot_mask * 2 + 1;
+	}
+
 	for (i = 0; i < num_of_qps ; i++) {
 		if (user_param->connection_type == DC)
 		{
@@ -2957,6 +3765,7 @@ void ctx_set_send_reg_wqes(struct pingpong_context *ctx,
 
 			ctx->scnt[i] = 0;
 			ctx->ccnt[i] = 0;
+			ctx->sig_countdown[i] = user_param->cq_mod;
 			ctx->my_addr[i] = (uintptr_t)ctx->buf[i];
 			if (user_param->verb != SEND)
 				ctx->rem_addr[i] = rem_dest[xrc_offset + i].vaddr;
@@ -3085,10 +3894,6 @@ int ctx_set_recv_wqes(struct pingpong_context *ctx,struct perftest_parameters *u
 		size_per_qp /= user_param->num_of_qps;
 	ctx->rposted = size_per_qp * user_param->recv_post_list;
 
-	if (user_param->use_rss) {
-		i = 1;
-		num_of_qps = 1;
-	}
 	for (k = 0; i < user_param->num_of_qps; i++,k++) {
 		if (!user_param->mr_per_qp) {
 			ctx->recv_sge_list[i * user_param->recv_post_list].addr = (uintptr_t)ctx->buf[0] +
@@ -3137,6 +3942,13 @@ int ctx_set_recv_wqes(struct pingpong_context *ctx,struct perftest_parameters *u
 					return 1;
 				}
 
+			} else if (user_param->use_rss) {
+				#ifdef HAVE_RSS
+				if (ibv_post_wq_recv(ctx->wq[i], &ctx->rwr[i * user_param->recv_post_list], &bad_wr_recv)) {
+					log_ebt("Couldn't post recv WQ = %d: counter=%d\n", i, j);
+					return 1;
+				}
+				#endif
 			} else {
 
 				if (ibv_post_recv(ctx->qp[i],&ctx->rwr[i * user_param->recv_post_list],&bad_wr_recv)) {
@@ -3316,52 +4128,207 @@ cleaning:
 	return return_value;
 }
 
+/* The test the counter sampler takes the message counts of */
+static struct {
+	struct pingpong_context	*ctx;
+	int			num_of_qps;
+} sampler_run;
+
 /******************************************************************************
  *
  ******************************************************************************/
-int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+static void sampler_progress(void *arg, uint64_t *tx_msgs, uint64_t *rx_msgs)
 {
-	uint64_t           	totscnt = 0;
-	uint64_t       	   	totccnt = 0;
-	int                	i = 0;
-	int                	index,ne;
-	uint64_t	   	tot_iters;
-	int			err = 0;
-	struct ibv_wc 	   	*wc = NULL;
-	int 			num_of_qps = user_param->num_of_qps;
-	/* Rate Limiter*/
-	int 			rate_limit_pps = 0;
-	double 			gap_time = 0;	/* in usec */
-	cycles_t 		gap_cycles = 0;	/* in cycles */
-	cycles_t 		gap_deadline = 0;
-	unsigned int 		number_of_bursts = 0;
-	int 			burst_iter = 0;
-	int 			is_sending_burst = 0;
-	int 			cpu_mhz = 0;
-	int 			return_value = 0;
-	int			wc_id;
-	int			send_flows_index = 0;
-	uintptr_t		primary_send_addr = ctx->sge_list[0].addr;
-	int			address_offset = 0;
-	int			flows_burst_iter = 0;
-
-	FUNCTION_ENTER;
-	#ifdef HAVE_IBV_WR_API
-	if (user_param->connection_type != RawEth)
-		ctx_post_send_work_request_func_pointer(ctx, user_param);
-	#endif
-
-	ALLOCATE(wc ,struct ibv_wc ,CTX_POLL_BATCH);
-	if (user_param->test_type == DURATION) {
-		duration_param=user_param;
-		duration_param->state = START_STATE;
-		signal(SIGALRM, catch_alarm);
-		if (user_param->margin > 0 )
-			alarm(user_param->margin);
-		else
-			catch_alarm(0); /* move to next state */
+	struct pingpong_context *ctx = sampler_run.ctx;
+	int i;
 
-		user_param->iters = 0;
+	*tx_msgs = 0;
+	if (ctx->ccnt) {
+		for (i = 0; i < sampler_run.num_of_qps; i++)
+			*tx_msgs += __atomic_load_n(&ctx->ccnt[i], __ATOMIC_RELAXED);
+	}
+	*rx_msgs = (unsigned)__atomic_load_n(&check_alive_data.current_totrcnt, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int start_test_stats(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	/* duration tests measure the CPU in the sample state only, see catch_alarm */
+	if (user_param->cpu_stats && user_param->test_type == ITERATIONS)
+		cpu_stats_start(user_param->cpu_stats);
+
+	if (!user_param->sample_counters)
+		return SUCCESS;
+
+	/* the sampler of the previous message size */
+	if (user_param->counter_sampler)
+		counter_sampler_free(user_param->counter_sampler);
+
+	sampler_run.ctx = ctx;
+	sampler_run.num_of_qps = user_param->num_of_qps;
+	check_alive_data.current_totrcnt = 0;
+
+	user_param->counter_sampler = counter_sampler_start(user_param->ib_devname, user_param->ib_port,
+			user_param->sample_counters, sampler_progress, NULL);
+
+	return user_param->counter_sampler ? SUCCESS : FAILURE;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void stop_test_stats(struct perftest_parameters *user_param)
+{
+	if (user_param->cpu_stats && user_param->test_type == ITERATIONS)
+		cpu_stats_stop(user_param->cpu_stats);
+
+	if (user_param->counter_sampler)
+		counter_sampler_stop(user_param->counter_sampler);
+}
+
+/* From this many QPs the send loops visit only the QPs with room in their
+ * send window instead of scanning all of them.
+ */
+#define QP_READY_MIN_QPS (64)
+
+/* A bit per QP that may post, and a summary bit per word of them that has one */
+struct qp_ready_set {
+	uint64_t	*bits;
+	uint64_t	*summary;
+	int		words;
+	int		summary_words;
+	int		num_of_qps;
+};
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void qp_ready_init(struct qp_ready_set *set, int num_of_qps)
+{
+	int i;
+
+	set->num_of_qps = num_of_qps;
+	set->words = (num_of_qps + 63) / 64;
+	set->summary_words = (set->words + 63) / 64;
+	ALLOCATE(set->bits, uint64_t, set->words);
+	ALLOCATE(set->summary, uint64_t, set->summary_words);
+	memset(set->summary, 0, sizeof(uint64_t) * set->summary_words);
+
+	/* every QP starts with an empty send window */
+	for (i = 0; i < set->words; i++) {
+		set->bits[i] = (i == set->words - 1 && num_of_qps % 64) ?
+			(1ULL << (num_of_qps % 64)) - 1 : ~0ULL;
+		set->summary[i / 64] |= 1ULL << (i % 64);
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void qp_ready_free(struct qp_ready_set *set)
+{
+	free(set->bits);
+	free(set->summary);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static inline void qp_ready_add(struct qp_ready_set *set, int qp)
+{
+	int word = qp / 64;
+
+	set->bits[word] |= 1ULL << (qp % 64);
+	set->summary[word / 64] |= 1ULL << (word % 64);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static inline void qp_ready_remove(struct qp_ready_set *set, int qp)
+{
+	int word = qp / 64;
+
+	set->bits[word] &= ~(1ULL << (qp % 64));
+	if (!set->bits[word])
+		set->summary[word / 64] &= ~(1ULL << (word % 64));
+}
+
+/******************************************************************************
+ * qp_ready_next - the first ready QP from qp on, num_of_qps if there is none.
+ ******************************************************************************/
+static inline int qp_ready_next(struct qp_ready_set *set, int qp)
+{
+	uint64_t mask;
+	int word, sword;
+
+	if (qp >= set->num_of_qps)
+		return set->num_of_qps;
+
+	word = qp / 64;
+	mask = set->bits[word] & (~0ULL << (qp % 64));
+	if (mask)
+		return word * 64 + __builtin_ctzll(mask);
+
+	/* the next word that has a ready QP, from the summary */
+	word++;
+	sword = word / 64;
+	if (sword >= set->summary_words)
+		return set->num_of_qps;
+	mask = (word % 64) ? set->summary[sword] & (~0ULL << (word % 64)) : set->summary[sword];
+	while (!mask) {
+		if (++sword == set->summary_words)
+			return set->num_of_qps;
+		mask = set->summary[sword];
+	}
+	word = sword * 64 + __builtin_ctzll(mask);
+
+	return word * 64 + __builtin_ctzll(set->bits[word]);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	uint64_t           	totscnt = 0;
+	uint64_t       	   	totccnt = 0;
+	int                	i = 0;
+	int                	index,ne;
+	uint64_t	   	tot_iters;
+	int			err = 0;
+	struct ibv_wc 	   	*wc = NULL;
+	int 			num_of_qps = user_param->num_of_qps;
+	struct pacer		*pacer = NULL;
+	int 			return_value = 0;
+	int			wc_id;
+	int			send_flows_index = 0;
+	uintptr_t		primary_send_addr = ctx->sge_list[0].addr;
+	int			address_offset = 0;
+	int			flows_burst_iter = 0;
+	cycles_t		build_start;
+	struct qp_ready_set	ready;
+	int			use_ready = 0;
+
+	FUNCTION_ENTER;
+	#ifdef HAVE_IBV_WR_API
+	if (user_param->connection_type != RawEth)
+		ctx_post_send_work_request_func_pointer(ctx, user_param);
+	#endif
+
+	ALLOCATE(wc ,struct ibv_wc ,CTX_POLL_BATCH);
+	if (user_param->test_type == DURATION) {
+		duration_param=user_param;
+		duration_param->state = START_STATE;
+		signal(SIGALRM, catch_alarm);
+		if (user_param->margin > 0 )
+			alarm(user_param->margin);
+		else
+			catch_alarm(0); /* move to next state */
+
+		user_param->iters = 0;
 	}
 
 	if (user_param->duplex && (user_param->use_xrc || user_param->connection_type == DC))
@@ -3377,34 +4344,26 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 		goto cleaning;
 	}
 
+	if (start_test_stats(ctx, user_param)) {
+		return_value = FAILURE;
+		goto cleaning;
+	}
+
 	if (user_param->test_type == ITERATIONS && user_param->noPeak == ON)
 		user_param->tposted[0] = get_cycles();
 
-	/* If using rate limiter, calculate gap time between bursts */
-	if (user_param->rate_limit_type == SW_RATE_LIMIT ) {
-		/* Calculate rate limit in pps */
-		switch (user_param->rate_units) {
-			case MEGA_BYTE_PS:
-				rate_limit_pps = ((double)(user_param->rate_limit) / user_param->size) * 1048576;
-				break;
-			case GIGA_BIT_PS:
-				rate_limit_pps = ((double)(user_param->rate_limit) / (user_param->size * 8)) * 1000000000;
-				break;
-			case PACKET_PS:
-				rate_limit_pps = user_param->rate_limit;
-				break;
-			default:
-				log_ebt(" Failed: Unknown rate limit units\n");
-				return_value = FAILURE;
-				goto cleaning;
-		}
-		cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
-		if (cpu_mhz <= 0) {
-			log_ebt("Failed: couldn't acquire cpu frequency for rate limiter.\n");
+	/* the receive credits of iWARP open a window without a completion */
+	if (num_of_qps >= QP_READY_MIN_QPS && !ctx->send_rcredit) {
+		qp_ready_init(&ready, num_of_qps);
+		use_ready = 1;
+	}
+
+	if (user_param->rate_limit_type == SW_RATE_LIMIT && (user_param->rate_limit > 0 || user_param->load_profile)) {
+		if (pacer_create(&user_param->pacer, user_param, num_of_qps)) {
+			return_value = FAILURE;
+			goto cleaning;
 		}
-		number_of_bursts = rate_limit_pps / user_param->burst_size;
-		gap_time = 1000000 * (1.0 / number_of_bursts);
-		gap_cycles = cpu_mhz * gap_time;
+		pacer = user_param->pacer;
 	}
 
 	/* main loop for posting */
@@ -3412,30 +4371,21 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 		(user_param->test_type == DURATION && user_param->state != END_STATE) ) {
 
 		/* main loop to run over all the qps and post each time n messages */
-		for (index =0 ; index < num_of_qps ; index++) {
-			if (user_param->rate_limit_type == SW_RATE_LIMIT && is_sending_burst == 0) {
-				if (gap_deadline > get_cycles()) {
-					/* Go right to cq polling until gap time is over. */
-					continue;
-				}
-				gap_deadline = get_cycles() + gap_cycles;
-				is_sending_burst = 1;
-				burst_iter = 0;
-			}
+		for (index = use_ready ? qp_ready_next(&ready, 0) : 0; index < num_of_qps;
+		     index = use_ready ? qp_ready_next(&ready, index + 1) : index + 1) {
 			while ((ctx->scnt[index] < user_param->iters || user_param->test_type == DURATION) &&
-					(ctx->scnt[index] - ctx->ccnt[index] + user_param->post_list) <= (user_param->tx_depth) &&
-					!((user_param->rate_limit_type == SW_RATE_LIMIT ) && is_sending_burst == 0)) {
+					(ctx->scnt[index] - ctx->ccnt[index] + user_param->post_list) <= (user_param->tx_depth)) {
 
 				if (ctx->send_rcredit) {
 					uint32_t swindow = ctx->scnt[index] + user_param->post_list - ctx->credit_buf[index];
 					if (swindow >= user_param->rx_depth)
 						break;
 				}
-				if (user_param->post_list == 1 && (ctx->scnt[index] % user_param->cq_mod == 0 && user_param->cq_mod > 1)
-					&& !(ctx->scnt[index] == (user_param->iters - 1) && user_param->test_type == ITERATIONS)) {
-
-					ctx->wr[index].send_flags &= ~IBV_SEND_SIGNALED;
-				}
+				/* not due yet, go on to the next QP and the cq polling */
+				if (pacer && !pacer_take(pacer, index, user_param->post_list))
+					break;
+				if (user_param->post_list == 1)
+					ctx_next_send_slot(ctx, index, address_offset, user_param);
 
 				if (user_param->noPeak == OFF)
 					user_param->tposted[totscnt] = get_cycles();
@@ -3443,6 +4393,14 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 				if (user_param->test_type == DURATION && user_param->state == END_STATE)
 					break;
 
+				/* rewrite the flow of the packet before posting it */
+				if (ctx->pkt_tmpl) {
+					build_start = get_cycles();
+					build_pkt_from_template(ctx->pkt_tmpl, (void*)(uintptr_t)ctx->wr[index].sg_list->addr);
+					ctx->pkt_tmpl->build_cycles += get_cycles() - build_start;
+					ctx->pkt_tmpl->built++;
+				}
+
 				err = post_send_method(ctx, index, user_param);
 				if (err) {
 					log_ebt("Couldn't post send: qp %d scnt=%lu \n",index,ctx->scnt[index]);
@@ -3462,47 +4420,20 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 					}
 				}
 
-				/* in multiple flow scenarios we will go to next cycle buffer address in the main buffer*/
-				if (user_param->post_list == 1 && user_param->size <= (ctx->cycle_buffer / 2)) {
-						increase_loc_addr(ctx->wr[index].sg_list,user_param->size, ctx->scnt[index],
-								ctx->my_addr[index] + address_offset , 0, ctx->cache_line_size,
-								ctx->cycle_buffer);
-
-					if (user_param->verb != SEND) {
-						increase_rem_addr(&ctx->wr[index], user_param->size,
-								ctx->scnt[index], ctx->rem_addr[index], user_param->verb,
-								ctx->cache_line_size, ctx->cycle_buffer);
-					}
-				}
-
 				ctx->scnt[index] += user_param->post_list;
 				totscnt += user_param->post_list;
-
-				/* ask for completion on this wr */
-				if (user_param->post_list == 1 &&
-						(ctx->scnt[index]%user_param->cq_mod == user_param->cq_mod - 1 ||
-							(user_param->test_type == ITERATIONS && ctx->scnt[index] == user_param->iters - 1))) {
-						ctx->wr[index].send_flags |= IBV_SEND_SIGNALED;
-				}
-
-				/* Check if a full burst was sent. */
-				if (user_param->rate_limit_type == SW_RATE_LIMIT) {
-					burst_iter += user_param->post_list;
-					if (burst_iter >= user_param->burst_size) {
-						is_sending_burst = 0;
-					}
-				}
 			}
+
+			/* its completions bring it back */
+			if (use_ready && ((ctx->scnt[index] >= user_param->iters && user_param->test_type == ITERATIONS) ||
+					(ctx->scnt[index] - ctx->ccnt[index] + user_param->post_list) > user_param->tx_depth))
+				qp_ready_remove(&ready, index);
 		}
 		if (totccnt < tot_iters || (user_param->test_type == DURATION &&  totccnt < totscnt)) {
-				if (user_param->use_event) {
-					if (ctx_notify_events(ctx->channel)) {
-						log_ebt("Couldn't request CQ notification\n");
-						return_value = FAILURE;
-						goto cleaning;
-					}
-				}
-				ne = ibv_poll_cq(ctx->send_cq, CTX_POLL_BATCH, wc);
+				if (user_param->use_event)
+					ne = ctx_event_poll_cq(ctx, ctx->send_cq, CTX_POLL_BATCH, wc);
+				else
+					ne = ibv_poll_cq(ctx->send_cq, CTX_POLL_BATCH, wc);
 				if (ne > 0) {
 					for (i = 0; i < ne; i++) {
 						wc_id = (int)wc[i].wr_id;
@@ -3515,6 +4446,8 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 
 						ctx->ccnt[wc_id] += user_param->cq_mod;
 						totccnt += user_param->cq_mod;
+						if (use_ready)
+							qp_ready_add(&ready, wc_id);
 						if (user_param->noPeak == OFF) {
 							if (totccnt > tot_iters)
 								user_param->tcompleted[user_param->iters*num_of_qps - 1] = get_cycles();
@@ -3541,11 +4474,247 @@ int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_pa
 		user_param->tcompleted[0] = get_cycles();
 
 cleaning:
-
+	stop_test_stats(user_param);
+	if (use_ready)
+		qp_ready_free(&ready);
 	free(wc);
 	return return_value;
 }
 
+/* A configuration is measured for about this long */
+#define AUTOTUNE_BLOCK_USEC (50000)
+/* A configuration must be this much faster to become the best one */
+#define AUTOTUNE_MIN_GAIN (1.02)
+#define AUTOTUNE_MAX_CANDIDATES (32)
+#define AUTOTUNE_INITIAL_POINTS (64)
+
+enum autotune_dim {TUNE_QPS, TUNE_POST_LIST, TUNE_CQ_MOD, TUNE_TX_DEPTH, TUNE_INLINE, TUNE_POST_SEND, NUM_TUNE_DIMS};
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int *autotune_value(struct autotune_point *point, int dim)
+{
+	switch (dim) {
+		case TUNE_QPS:		return &point->num_of_qps;
+		case TUNE_POST_LIST:	return &point->post_list;
+		case TUNE_CQ_MOD:	return &point->cq_mod;
+		case TUNE_TX_DEPTH:	return &point->tx_depth;
+		case TUNE_INLINE:	return &point->inline_size;
+		default:		return &point->use_old_post_send;
+	}
+}
+
+/******************************************************************************
+ * The values a dimension can take, the ones of the resources are the largest.
+ ******************************************************************************/
+static int autotune_candidates(struct perftest_parameters *user_param,
+			       struct autotune_point *max, int dim, int *values)
+{
+	int n = 0, v, max_value = *autotune_value(max, dim);
+
+	switch (dim) {
+		case TUNE_INLINE:
+			values[n++] = max_value;
+			if (user_param->verb == WRITE && max_value && user_param->size <= max_value)
+				values[n++] = 0;
+			return n;
+		case TUNE_POST_SEND:
+			values[n++] = max_value;
+			#ifdef HAVE_IBV_WR_API
+			/* QPs of the new API take the old one too, not the other way */
+			if (!max_value)
+				values[n++] = 1;
+			#endif
+			return n;
+		default:
+			for (v = dim == TUNE_TX_DEPTH ? 16 : 1; v < max_value && n < AUTOTUNE_MAX_CANDIDATES - 1; v *= 2)
+				values[n++] = v;
+			values[n++] = max_value;
+			return n;
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int autotune_valid(struct autotune_point *point)
+{
+	if (point->tx_depth < point->post_list || point->cq_mod > point->tx_depth)
+		return 0;
+
+	return point->post_list == 1 || point->post_list % point->cq_mod == 0;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+	while (b) {
+		uint64_t t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static struct autotune_point *autotune_find(struct autotune_report *report, struct autotune_point *point)
+{
+	struct autotune_point *seen;
+	int i;
+
+	for (i = 0; i < report->num_points; i++) {
+		seen = &report->points[i];
+		if (seen->num_of_qps == point->num_of_qps && seen->tx_depth == point->tx_depth &&
+		    seen->post_list == point->post_list && seen->cq_mod == point->cq_mod &&
+		    seen->inline_size == point->inline_size && seen->use_old_post_send == point->use_old_post_send)
+			return seen;
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ * Run one block of the test with the configuration of point and record it.
+ ******************************************************************************/
+static int autotune_measure(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+			    struct pingpong_dest *rem_dest, struct autotune_point *point,
+			    uint64_t block_msgs, uint64_t iters_align, double cpu_mhz)
+{
+	struct autotune_report *report = user_param->autotune_report;
+	double usec;
+
+	user_param->num_of_qps = point->num_of_qps;
+	user_param->tx_depth = point->tx_depth;
+	user_param->post_list = point->post_list;
+	user_param->cq_mod = point->cq_mod;
+	user_param->inline_size = point->inline_size;
+	user_param->use_old_post_send = point->use_old_post_send;
+	user_param->iters = ROUND_UP(block_msgs / point->num_of_qps + 1, iters_align);
+
+	ctx_set_send_wqes(ctx, user_param, rem_dest);
+	if (run_iter_bw(ctx, user_param))
+		return FAILURE;
+
+	usec = (user_param->tcompleted[0] - user_param->tposted[0]) / cpu_mhz;
+	point->msg_rate = usec > 0 ? (double)user_param->iters * point->num_of_qps / usec : 0;
+	point->bw = point->msg_rate * 1000000 * user_param->size /
+		    (user_param->report_fmt == MBS ? 0x100000 : 125000000);
+
+	if (report->num_points == report->max_points) {
+		report->max_points *= 2;
+		report->points = realloc(report->points, report->max_points * sizeof(struct autotune_point));
+		if (!report->points) {
+			fprintf(stderr, " Cannot Allocate\n");
+			exit(1);
+		}
+	}
+	report->points[report->num_points++] = *point;
+
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_autotune(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		 struct pingpong_dest *rem_dest)
+{
+	struct autotune_report *report;
+	struct autotune_point max, best, point, *seen;
+	int values[AUTOTUNE_MAX_CANDIDATES];
+	int dim, n, i, improved = 1;
+	uint64_t user_iters = user_param->iters;
+	uint64_t block_msgs, iters_align = 1;
+	cycles_t start, budget;
+	double cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
+
+	FUNCTION_ENTER;
+	/* the resources were created for these, the search stays below them */
+	max.num_of_qps = user_param->num_of_qps;
+	max.tx_depth = user_param->tx_depth;
+	max.post_list = user_param->post_list;
+	max.cq_mod = user_param->cq_mod;
+	max.inline_size = user_param->inline_size;
+	max.use_old_post_send = user_param->use_old_post_send;
+
+	/* the iterations of a QP must be a multiple of every post list tried */
+	n = autotune_candidates(user_param, &max, TUNE_POST_LIST, values);
+	for (i = 0; i < n; i++)
+		iters_align = iters_align / gcd(iters_align, values[i]) * values[i];
+
+	ALLOCATE(report, struct autotune_report, 1);
+	memset(report, 0, sizeof(struct autotune_report));
+	report->max_qps = max.num_of_qps;
+	report->max_points = AUTOTUNE_INITIAL_POINTS;
+	ALLOCATE(report->points, struct autotune_point, report->max_points);
+	user_param->autotune_report = report;
+
+	start = get_cycles();
+	budget = (cycles_t)(user_param->autotune * cpu_mhz * 1000000);
+
+	/* the first block, with the given iterations, sets the block size */
+	best = max;
+	if (autotune_measure(ctx, user_param, rem_dest, &best, user_iters * max.num_of_qps, iters_align, cpu_mhz))
+		return FAILURE;
+	block_msgs = best.msg_rate * AUTOTUNE_BLOCK_USEC;
+	if (block_msgs < user_iters)
+		block_msgs = user_iters;
+
+	/* coordinate descent: move along one dimension at a time while it helps */
+	while (improved) {
+		improved = 0;
+		for (dim = 0; dim < NUM_TUNE_DIMS; dim++) {
+			n = autotune_candidates(user_param, &max, dim, values);
+			for (i = 0; i < n; i++) {
+				if (get_cycles() - start > budget)
+					goto out;
+
+				point = best;
+				*autotune_value(&point, dim) = values[i];
+				if (!autotune_valid(&point))
+					continue;
+
+				seen = autotune_find(report, &point);
+				if (seen) {
+					point = *seen;
+				} else if (autotune_measure(ctx, user_param, rem_dest, &point,
+							    block_msgs, iters_align, cpu_mhz)) {
+					return FAILURE;
+				}
+
+				if (point.msg_rate > best.msg_rate * AUTOTUNE_MIN_GAIN) {
+					best = point;
+					improved = 1;
+				}
+			}
+		}
+	}
+
+out:
+	report->seconds = (get_cycles() - start) / (cpu_mhz * 1000000);
+	report->best = autotune_find(report, &best) - report->points;
+	print_autotune_report(user_param);
+
+	/* the reported result is a regular run of the best configuration */
+	user_param->num_of_qps = best.num_of_qps;
+	user_param->tx_depth = best.tx_depth;
+	user_param->post_list = best.post_list;
+	user_param->cq_mod = best.cq_mod;
+	user_param->inline_size = best.inline_size;
+	user_param->use_old_post_send = best.use_old_post_send;
+	user_param->iters = ROUND_UP(user_iters, iters_align);
+
+	ctx_set_send_wqes(ctx, user_param, rem_dest);
+	return run_iter_bw(ctx, user_param);
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -3592,6 +4761,9 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 	uintptr_t		primary_recv_addr = ctx->recv_sge_list[0].addr;
 	int			recv_flows_burst = 0;
 	int			address_flows_offset =0;
+	uint64_t		*rx_addr_ring = NULL;
+	uint64_t		ring_index;
+	int			j;
 
 	FUNCTION_ENTER;
 	#ifdef HAVE_IBV_WR_API
@@ -3618,10 +4790,20 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 	for (i = 0; i < user_param->num_of_qps; i++)
 		posted_per_qp[i] = ctx->rposted;
 
-	if (user_param->use_rss)
-		tot_iters = (uint64_t)user_param->iters*(user_param->num_of_qps-1);
-	else
-		tot_iters = (uint64_t)user_param->iters*user_param->num_of_qps;
+	/* Receives complete in the order they were posted on a QP, remember the
+	 * buffer of every posted receive, starting with the ones ctx_set_recv_wqes
+	 * posted, to find the packet of a completion.
+	 */
+	if (ctx->csum_stats || ctx->pcap) {
+		ALLOCATE(rx_addr_ring, uint64_t, user_param->num_of_qps * user_param->rx_depth);
+		for (i = 0; i < user_param->num_of_qps; i++)
+			for (j = 0; j < ctx->rposted; j++)
+				rx_addr_ring[i * user_param->rx_depth + j] = ctx->rx_buffer_addr[i] +
+					(j % (ctx->cycle_buffer / INC(user_param->size, ctx->cache_line_size))) *
+					INC(user_param->size, ctx->cache_line_size);
+	}
+
+	tot_iters = (uint64_t)user_param->iters*user_param->num_of_qps;
 
 	if (user_param->test_type == ITERATIONS) {
 		check_alive_data.is_events = user_param->use_event;
@@ -3631,21 +4813,21 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 
 	check_alive_data.g_total_iters = tot_iters;
 
-	while (rcnt < tot_iters || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
+	if (start_test_stats(ctx, user_param)) {
+		return_value = FAILURE;
+		goto cleaning;
+	}
 
-		if (user_param->use_event) {
-			if (ctx_notify_events(ctx->channel)) {
-				fprintf(stderr ," Failed to notify events to CQ");
-				return_value = FAILURE;
-				goto cleaning;
-			}
-		}
+	while (rcnt < tot_iters || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
 
 		do {
 			if (user_param->test_type == DURATION && user_param->state == END_STATE)
 				break;
 
-			ne = ibv_poll_cq(ctx->recv_cq,CTX_POLL_BATCH,wc);
+			if (user_param->use_event)
+				ne = ctx_event_poll_cq(ctx, ctx->recv_cq, CTX_POLL_BATCH, wc);
+			else
+				ne = ibv_poll_cq(ctx->recv_cq,CTX_POLL_BATCH,wc);
 
 			if (ne > 0) {
 				if (firstRx) {
@@ -3661,6 +4843,14 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 						return_value = FAILURE;
 						goto cleaning;
 					}
+					if (rx_addr_ring) {
+						ring_index = wc_id * user_param->rx_depth + rcnt_for_qp[wc_id] % user_param->rx_depth;
+						if (ctx->csum_stats)
+							csum_validate_pkt(ctx->csum_stats, (void*)(uintptr_t)rx_addr_ring[ring_index],
+									  wc[i].byte_len, !!(wc[i].wc_flags & IBV_WC_IP_CSUM_OK));
+						if (ctx->pcap)
+							pcap_write_pkt(ctx->pcap, (void*)(uintptr_t)rx_addr_ring[ring_index], wc[i].byte_len);
+					}
 					rcnt_for_qp[wc_id]++;
 					rcnt++;
 					unused_recv_for_qp[wc_id]++;
@@ -3682,6 +4872,9 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 							}
 
 						} else {
+							if (rx_addr_ring)
+								rx_addr_ring[wc_id * user_param->rx_depth + posted_per_qp[wc_id] % user_param->rx_depth] =
+									ctx->rwr[wc_id].sg_list->addr;
 							if (ibv_post_recv(ctx->qp[wc_id], &ctx->rwr[wc_id * user_param->recv_post_list], &bad_wr_recv)) {
 								log_ebt("Couldn't post recv Qp=%d rcnt=%ld\n",wc_id,rcnt_for_qp[wc_id]);
 								return_value = 15;
@@ -3771,6 +4964,7 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
 		user_param->tcompleted[0] = get_cycles();
 
 cleaning:
+	stop_test_stats(user_param);
 	if (ctx->send_rcredit) {
 		if (clean_scq_credit(tot_scredit, ctx, user_param))
 			return_value = FAILURE;
@@ -3781,9 +4975,216 @@ cleaning:
 	free(rcnt_for_qp);
 	free(swc);
 	free(scredit_for_qp);
+	free(rx_addr_ring);
+
+	return return_value;
+}
+/******************************************************************************
+ *
+ ******************************************************************************/
+int get_nth_allowed_cpu(int n)
+{
+	cpu_set_t allowed;
+	int num_cpus, cpu;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return -1;
+
+	num_cpus = CPU_COUNT(&allowed);
+	if (!num_cpus)
+		return -1;
+
+	n %= num_cpus;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed) && n-- == 0)
+			return cpu;
+	}
+
+	return -1;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int pin_thread_to_cpu(int cpu)
+{
+	cpu_set_t cpuset;
+
+	if (cpu < 0)
+		return SUCCESS;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+		return FAILURE;
+
+	return SUCCESS;
+}
+
+#ifdef HAVE_RSS
+struct rss_worker {
+	struct pingpong_context		*ctx;
+	struct perftest_parameters	*user_param;
+	struct rss_queue_stats		*stats;
+	int				queue;
+	pthread_t			thread;
+};
+
+/* State shared by the RSS workers of one run */
+static struct {
+	uint64_t		tot_iters;
+	uint64_t		rcnt;
+	int			started;
+	volatile int		stop;
+} rss_run;
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *rss_worker_func(void *arg)
+{
+	struct rss_worker *worker = arg;
+	struct pingpong_context *ctx = worker->ctx;
+	struct perftest_parameters *user_param = worker->user_param;
+	struct rss_queue_stats *stats = worker->stats;
+	struct ibv_recv_wr *bad_wr_recv = NULL;
+	struct ibv_wc wc[CTX_POLL_BATCH];
+	int q = worker->queue;
+	uint64_t posted = ctx->rposted;
+	uint64_t rcnt;
+	int ne, i;
+
+	if (pin_thread_to_cpu(stats->cpu))
+		log_err("Couldn't pin RSS queue %d to CPU %d\n", q, stats->cpu);
+
+	while (!rss_run.stop) {
+		if (user_param->test_type == DURATION && user_param->state == END_STATE)
+			break;
+
+		ne = ibv_poll_cq(ctx->wq_cq[q], CTX_POLL_BATCH, wc);
+		if (ne < 0) {
+			log_ebt("Poll Receive CQ of RSS queue %d failed %d\n", q, ne);
+			stats->result = FAILURE;
+			break;
+		} else if (ne == 0) {
+			if (check_alive_data.to_exit) {
+				user_param->check_alive_exited = 1;
+				stats->result = FAILURE;
+				break;
+			}
+			continue;
+		}
+
+		if (!stats->rcnt)
+			stats->first_rx = get_cycles();
+		if (!rss_run.started && __sync_bool_compare_and_swap(&rss_run.started, 0, 1))
+			set_on_first_rx_packet(user_param);
+
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				NOTIFY_COMP_ERROR_RECV(wc[i], stats->rcnt);
+				stats->result = FAILURE;
+				rss_run.stop = 1;
+				return NULL;
+			}
+
+			if (user_param->test_type == DURATION && user_param->state == SAMPLE_STATE)
+				stats->sampled++;
+
+			if (ibv_post_wq_recv(ctx->wq[q], &ctx->rwr[q], &bad_wr_recv)) {
+				log_ebt("Couldn't post recv WQ = %d: counter=%lu\n", q, stats->rcnt);
+				stats->result = FAILURE;
+				rss_run.stop = 1;
+				return NULL;
+			}
+			posted++;
+
+			if (user_param->size <= (ctx->cycle_buffer / 2))
+				increase_loc_addr(ctx->rwr[q].sg_list, user_param->size, posted,
+						  ctx->rx_buffer_addr[q], user_param->connection_type,
+						  ctx->cache_line_size, ctx->cycle_buffer);
+		}
+		stats->rcnt += ne;
+		stats->last_rx = get_cycles();
+
+		/* the worker that receives the last packet ends the test */
+		rcnt = __sync_add_and_fetch(&rss_run.rcnt, ne);
+		check_alive_data.current_totrcnt = rcnt;
+		if (user_param->test_type == ITERATIONS && rcnt >= rss_run.tot_iters &&
+		    rcnt - ne < rss_run.tot_iters) {
+			user_param->tcompleted[0] = stats->last_rx;
+			rss_run.stop = 1;
+		}
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_iter_rss_server(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct rss_worker *workers = NULL;
+	int i, created = 0;
+	int return_value = SUCCESS;
+
+	FUNCTION_ENTER;
+	memset(&rss_run, 0, sizeof(rss_run));
+	rss_run.tot_iters = (uint64_t)user_param->iters * user_param->num_of_qps;
+
+	if (user_param->test_type == ITERATIONS) {
+		check_alive_data.is_events = user_param->use_event;
+		signal(SIGALRM, check_alive);
+		alarm(60);
+	}
+	check_alive_data.g_total_iters = rss_run.tot_iters;
+
+	if (start_test_stats(ctx, user_param))
+		return FAILURE;
+
+	ALLOCATE(workers, struct rss_worker, user_param->num_of_qps);
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		workers[i].ctx = ctx;
+		workers[i].user_param = user_param;
+		workers[i].stats = &ctx->rss_stats[i];
+		workers[i].queue = i;
+		memset(workers[i].stats, 0, sizeof(struct rss_queue_stats));
+
+		/* queue i runs on the i-th CPU the process is allowed on, use
+		 * taskset to choose the cores.
+		 */
+		workers[i].stats->cpu = get_nth_allowed_cpu(i);
+
+		if (pthread_create(&workers[i].thread, NULL, rss_worker_func, &workers[i])) {
+			log_ebt("Couldn't create the thread of RSS queue %d\n", i);
+			rss_run.stop = 1;
+			return_value = FAILURE;
+			break;
+		}
+		created++;
+	}
+
+	for (i = 0; i < created; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].stats->result != SUCCESS)
+			return_value = FAILURE;
+	}
+	stop_test_stats(user_param);
+
+	if (user_param->test_type == DURATION) {
+		user_param->iters = 0;
+		for (i = 0; i < user_param->num_of_qps; i++)
+			user_param->iters += ctx->rss_stats[i].sampled;
+	}
+
+	check_alive_data.last_totrcnt = 0;
+	free(workers);
 
 	return return_value;
 }
+#endif
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -3799,6 +5200,8 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 	struct ibv_wc 		*wc = NULL;
 	int 			num_of_qps = user_param->num_of_qps;
 	int 			return_value = 0;
+	struct qp_ready_set	ready;
+	int			use_ready = 0;
 
 	FUNCTION_ENTER;
 	#ifdef HAVE_IBV_WR_API
@@ -3825,12 +5228,27 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 	if (user_param->duplex && (user_param->use_xrc || user_param->connection_type == DC))
 		num_of_qps /= 2;
 
+	if (user_param->metrics_port) {
+		ctx->exporter = exporter_start(user_param, num_of_qps, user_param->tx_depth);
+		if (!ctx->exporter) {
+			return_value = FAILURE;
+			goto cleaning;
+		}
+	}
+
+	/* the receive credits of iWARP open a window without a completion */
+	if (num_of_qps >= QP_READY_MIN_QPS && !ctx->send_rcredit) {
+		qp_ready_init(&ready, num_of_qps);
+		use_ready = 1;
+	}
+
 	user_param->tposted[0] = get_cycles();
 
 	/* main loop for posting */
 	while (1) {
 	/* main loop to run over all the qps and post each time n messages */
-		for (index =0 ; index < num_of_qps ; index++) {
+		for (index = use_ready ? qp_ready_next(&ready, 0) : 0; index < num_of_qps;
+		     index = use_ready ? qp_ready_next(&ready, index + 1) : index + 1) {
 
 			while ((ctx->scnt[index] - ctx->ccnt[index] + user_param->post_list) <= user_param->tx_depth) {
 				if (ctx->send_rcredit) {
@@ -3839,9 +5257,12 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 						break;
 				}
 
-				if (user_param->post_list == 1 && (ctx->scnt[index] % user_param->cq_mod == 0 && user_param->cq_mod > 1)) {
-					ctx->wr[index].send_flags &= ~IBV_SEND_SIGNALED;
-				}
+				if (user_param->post_list == 1)
+					ctx_next_send_slot(ctx, index, 0, user_param);
+
+				if (ctx->exporter && user_param->post_list == 1 &&
+						(ctx->wr[index].send_flags & IBV_SEND_SIGNALED))
+					exporter_post_signaled(ctx->exporter, index);
 
 				err = post_send_method(ctx, index, user_param);
 				if (err) {
@@ -3852,14 +5273,11 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 				ctx->scnt[index] += user_param->post_list;
 				scnt_for_qp[index] += user_param->post_list;
 				totscnt += user_param->post_list;
-
-				/* ask for completion on this wr */
-				if (user_param->post_list == 1 &&
-						(ctx->scnt[index]%user_param->cq_mod == user_param->cq_mod - 1 ||
-							(user_param->test_type == ITERATIONS && ctx->scnt[index] == user_param->iters - 1))) {
-					ctx->wr[index].send_flags |= IBV_SEND_SIGNALED;
-				}
 			}
+
+			/* its completions bring it back */
+			if (use_ready)
+				qp_ready_remove(&ready, index);
 		}
 		if (totccnt < totscnt) {
 			ne = ibv_poll_cq(ctx->send_cq,CTX_POLL_BATCH,wc);
@@ -3868,6 +5286,8 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 
 				for (i = 0; i < ne; i++) {
 					if (wc[i].status != IBV_WC_SUCCESS) {
+						if (ctx->exporter)
+							exporter_add(&ctx->exporter->stats.errors, 1);
 						NOTIFY_COMP_ERROR_SEND(wc[i],ctx->scnt[(int)wc[i].wr_id],ctx->scnt[(int)wc[i].wr_id]);
 						return_value = FAILURE;
 						goto cleaning;
@@ -3876,6 +5296,10 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 					user_param->iters += user_param->cq_mod;
 					totccnt += user_param->cq_mod;
 					ctx->ccnt[wc_id] += user_param->cq_mod;
+					if (use_ready)
+						qp_ready_add(&ready, wc_id);
+					if (ctx->exporter)
+						exporter_send_completion(ctx->exporter, wc_id);
 				}
 
 			} else if (ne < 0) {
@@ -3886,6 +5310,12 @@ int run_iter_bw_infinitely(struct pingpong_context *ctx,struct perftest_paramete
 		}
 	}
 cleaning:
+	if (ctx->exporter) {
+		exporter_stop(ctx->exporter);
+		ctx->exporter = NULL;
+	}
+	if (use_ready)
+		qp_ready_free(&ready);
 	free(scnt_for_qp);
 	free(wc);
 	return return_value;
@@ -3940,6 +5370,15 @@ int run_iter_bw_infinitely_server(struct pingpong_context *ctx, struct perftest_
 
 	user_param->iters = 0;
 	user_param->last_iters = 0;
+
+	if (user_param->metrics_port) {
+		ctx->exporter = exporter_start(user_param, user_param->num_of_qps, user_param->tx_depth);
+		if (!ctx->exporter) {
+			return_value = FAILURE;
+			goto cleaning;
+		}
+	}
+
 	user_param->tposted[0] = get_cycles();
 
 	while (1) {
@@ -3947,10 +5386,14 @@ int run_iter_bw_infinitely_server(struct pingpong_context *ctx, struct perftest_
 		ne = ibv_poll_cq(ctx->recv_cq,CTX_POLL_BATCH,wc);
 
 		if (ne > 0) {
+			if (ctx->exporter)
+				exporter_add(&ctx->exporter->stats.completions, ne);
 
 			for (i = 0; i < ne; i++) {
 
 				if (wc[i].status != IBV_WC_SUCCESS) {
+					if (ctx->exporter)
+						exporter_add(&ctx->exporter->stats.errors, 1);
 					log_ebt("A completion with Error in run_infinitely_bw_server function");
 					return_value = FAILURE;
 					goto cleaning;
@@ -3979,57 +5422,383 @@ int run_iter_bw_infinitely_server(struct pingpong_context *ctx, struct perftest_
 					rcnt_for_qp[wc[i].wr_id]++;
 					scredit_for_qp[wc[i].wr_id]++;
 
-					if (scredit_for_qp[wc[i].wr_id] == ctx->credit_cnt) {
-						struct ibv_send_wr *bad_wr = NULL;
-						ctx->ctrl_buf[wc[i].wr_id] = rcnt_for_qp[wc[i].wr_id];
+					if (scredit_for_qp[wc[i].wr_id] == ctx->credit_cnt) {
+						struct ibv_send_wr *bad_wr = NULL;
+						ctx->ctrl_buf[wc[i].wr_id] = rcnt_for_qp[wc[i].wr_id];
+
+						while (ccnt_for_qp[wc[i].wr_id] == user_param->tx_depth) {
+							int sne, j = 0;
+
+							sne = ibv_poll_cq(ctx->send_cq,user_param->tx_depth,swc);
+							if (sne > 0) {
+								for (j = 0; j < sne; j++) {
+									if (swc[j].status != IBV_WC_SUCCESS) {
+										log_ebt("Poll send CQ error status=%u qp %d credit=%lu scredit=%lu\n",
+												swc[j].status,(int)swc[j].wr_id,
+												rcnt_for_qp[swc[j].wr_id],ccnt_for_qp[swc[j].wr_id]);
+										return_value = FAILURE;
+										goto cleaning;
+									}
+									ccnt_for_qp[swc[j].wr_id]--;
+								}
+
+							} else if (sne < 0) {
+								log_ebt("Poll send CQ failed ne=%d\n",sne);
+								return_value = FAILURE;
+								goto cleaning;
+							}
+						}
+						if (ibv_post_send(ctx->qp[wc[i].wr_id],&ctx->ctrl_wr[wc[i].wr_id],&bad_wr)) {
+							log_ebt("Couldn't post send qp %d credit=%lu\n",
+									(int)wc[i].wr_id,rcnt_for_qp[wc[i].wr_id]);
+							return_value = FAILURE;
+							goto cleaning;
+						}
+						ccnt_for_qp[wc[i].wr_id]++;
+						scredit_for_qp[wc[i].wr_id] = 0;
+					}
+				}
+			}
+
+		} else if (ne < 0) {
+			log_ebt("Poll Receive CQ failed %d\n", ne);
+			return_value = FAILURE;
+			goto cleaning;
+		}
+	}
+
+cleaning:
+	if (ctx->exporter) {
+		exporter_stop(ctx->exporter);
+		ctx->exporter = NULL;
+	}
+	free(wc);
+	free(swc);
+	free(rcnt_for_qp);
+	free(ccnt_for_qp);
+	free(scredit_for_qp);
+	return return_value;
+}
+
+struct bi_worker {
+	struct pingpong_context		*ctx;
+	struct perftest_parameters	*user_param;
+	struct bi_thread_stats		*stats;
+	pthread_t			thread;
+};
+
+/* State shared by the TX and RX threads of one --bi_threads run */
+static struct {
+	uint64_t		iters;
+	uint64_t		tot_iters;
+	int			num_of_qps;
+	volatile int		rx_started;
+	volatile int		stop;
+} bi_run;
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *bi_tx_func(void *arg)
+{
+	struct bi_worker *worker = arg;
+	struct pingpong_context *ctx = worker->ctx;
+	struct perftest_parameters *user_param = worker->user_param;
+	struct bi_thread_stats *stats = worker->stats;
+	struct ibv_wc wc[CTX_POLL_BATCH];
+	uint64_t totscnt = 0, totccnt = 0;
+	uint64_t iters = bi_run.iters;
+	int index, ne, i;
+
+	if (pin_thread_to_cpu(stats->cpu))
+		log_err("Couldn't pin the TX thread to CPU %d\n", stats->cpu);
+
+	/* the server sends once the client has started, see run_iter_bi */
+	while (!bi_run.rx_started && !bi_run.stop)
+		;
+
+	while (!bi_run.stop) {
+		if (user_param->test_type == DURATION) {
+			if (user_param->state == END_STATE)
+				break;
+		} else if (totccnt >= bi_run.tot_iters) {
+			break;
+		}
+
+		for (index = 0; index < bi_run.num_of_qps; index++) {
+			while ((ctx->scnt[index] < iters || user_param->test_type == DURATION) &&
+					(ctx->scnt[index] - ctx->ccnt[index] + user_param->post_list) <= user_param->tx_depth) {
+				if (user_param->post_list == 1)
+					ctx_next_send_slot(ctx, index, 0, user_param);
+				if (user_param->noPeak == OFF)
+					user_param->tposted[totscnt] = get_cycles();
+				if (!totscnt)
+					stats->first = get_cycles();
+
+				if (user_param->test_type == DURATION && user_param->state == END_STATE)
+					break;
+
+				if (post_send_method(ctx, index, user_param)) {
+					log_ebt("Couldn't post send: qp %d scnt=%lu \n", index, ctx->scnt[index]);
+					stats->result = FAILURE;
+					bi_run.stop = 1;
+					return NULL;
+				}
+
+				ctx->scnt[index] += user_param->post_list;
+				totscnt += user_param->post_list;
+			}
+		}
+
+		ne = ibv_poll_cq(ctx->send_cq, CTX_POLL_BATCH, wc);
+		if (ne < 0) {
+			log_ebt("Poll send CQ failed %d\n", ne);
+			stats->result = FAILURE;
+			bi_run.stop = 1;
+			break;
+		}
+
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				NOTIFY_COMP_ERROR_SEND(wc[i], totscnt, totccnt);
+				stats->result = FAILURE;
+				bi_run.stop = 1;
+				return NULL;
+			}
+
+			totccnt += user_param->cq_mod;
+			ctx->ccnt[(int)wc[i].wr_id] += user_param->cq_mod;
+
+			if (user_param->noPeak == OFF) {
+				if (user_param->test_type == ITERATIONS && totccnt > bi_run.tot_iters)
+					user_param->tcompleted[bi_run.tot_iters - 1] = get_cycles();
+				else
+					user_param->tcompleted[totccnt - 1] = get_cycles();
+			}
+
+			if (user_param->test_type == DURATION && user_param->state == SAMPLE_STATE)
+				stats->sampled += user_param->cq_mod;
+		}
+		if (ne > 0) {
+			stats->cnt = totccnt;
+			if (user_param->test_type == ITERATIONS && stats->cnt > bi_run.tot_iters)
+				stats->cnt = bi_run.tot_iters;
+			stats->last = get_cycles();
+		}
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *bi_rx_func(void *arg)
+{
+	struct bi_worker *worker = arg;
+	struct pingpong_context *ctx = worker->ctx;
+	struct perftest_parameters *user_param = worker->user_param;
+	struct bi_thread_stats *stats = worker->stats;
+	struct ibv_recv_wr *bad_wr_recv = NULL;
+	struct ibv_wc *wc = NULL;
+	uint64_t *rcnt_for_qp = NULL;
+	uint64_t *unused_recv_for_qp = NULL;
+	uint64_t *posted_per_qp = NULL;
+	uint64_t totrcnt = 0;
+	uint64_t iters = bi_run.iters;
+	int ne, i, qp;
+
+	ALLOCATE(wc, struct ibv_wc, user_param->rx_depth);
+	ALLOCATE(rcnt_for_qp, uint64_t, user_param->num_of_qps);
+	memset(rcnt_for_qp, 0, sizeof(uint64_t) * user_param->num_of_qps);
+	ALLOCATE(unused_recv_for_qp, uint64_t, user_param->num_of_qps);
+	memset(unused_recv_for_qp, 0, sizeof(uint64_t) * user_param->num_of_qps);
+	ALLOCATE(posted_per_qp, uint64_t, user_param->num_of_qps);
+	for (i = 0; i < user_param->num_of_qps; i++)
+		posted_per_qp[i] = ctx->rposted;
+
+	if (pin_thread_to_cpu(stats->cpu))
+		log_err("Couldn't pin the RX thread to CPU %d\n", stats->cpu);
+
+	while (!bi_run.stop) {
+		if (user_param->test_type == DURATION) {
+			if (user_param->state == END_STATE)
+				break;
+		} else if (totrcnt >= bi_run.tot_iters) {
+			break;
+		}
+
+		ne = ibv_poll_cq(ctx->recv_cq, user_param->rx_depth, wc);
+		if (ne < 0) {
+			log_ebt("Poll receive CQ failed %d\n", ne);
+			stats->result = FAILURE;
+			bi_run.stop = 1;
+			break;
+		} else if (ne == 0) {
+			if (check_alive_data.to_exit) {
+				user_param->check_alive_exited = 1;
+				stats->result = FAILURE;
+				bi_run.stop = 1;
+				break;
+			}
+			continue;
+		}
 
-						while (ccnt_for_qp[wc[i].wr_id] == user_param->tx_depth) {
-							int sne, j = 0;
+		if (!totrcnt) {
+			stats->first = get_cycles();
+			if (!bi_run.rx_started) {
+				/* the first receive of the server starts its test */
+				if (user_param->test_type == DURATION) {
+					duration_param = user_param;
+					duration_param->state = START_STATE;
+					signal(SIGALRM, catch_alarm);
+					if (user_param->margin > 0)
+						alarm(user_param->margin);
+					else
+						catch_alarm(0);
+				}
+				bi_run.rx_started = ON;
+			}
+		}
 
-							sne = ibv_poll_cq(ctx->send_cq,user_param->tx_depth,swc);
-							if (sne > 0) {
-								for (j = 0; j < sne; j++) {
-									if (swc[j].status != IBV_WC_SUCCESS) {
-										log_ebt("Poll send CQ error status=%u qp %d credit=%lu scredit=%lu\n",
-												swc[j].status,(int)swc[j].wr_id,
-												rcnt_for_qp[swc[j].wr_id],ccnt_for_qp[swc[j].wr_id]);
-										return_value = FAILURE;
-										goto cleaning;
-									}
-									ccnt_for_qp[swc[j].wr_id]--;
-								}
+		for (i = 0; i < ne; i++) {
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				NOTIFY_COMP_ERROR_RECV(wc[i], totrcnt);
+				stats->result = FAILURE;
+				bi_run.stop = 1;
+				goto cleaning;
+			}
 
-							} else if (sne < 0) {
-								log_ebt("Poll send CQ failed ne=%d\n",sne);
-								return_value = FAILURE;
-								goto cleaning;
-							}
-						}
-						if (ibv_post_send(ctx->qp[wc[i].wr_id],&ctx->ctrl_wr[wc[i].wr_id],&bad_wr)) {
-							log_ebt("Couldn't post send qp %d credit=%lu\n",
-									(int)wc[i].wr_id,rcnt_for_qp[wc[i].wr_id]);
-							return_value = FAILURE;
-							goto cleaning;
-						}
-						ccnt_for_qp[wc[i].wr_id]++;
-						scredit_for_qp[wc[i].wr_id] = 0;
+			qp = (int)wc[i].wr_id;
+			rcnt_for_qp[qp]++;
+			unused_recv_for_qp[qp]++;
+			totrcnt++;
+			check_alive_data.current_totrcnt = totrcnt;
+
+			if (user_param->test_type == DURATION && user_param->state == SAMPLE_STATE)
+				stats->sampled++;
+
+			if ((user_param->test_type == DURATION || posted_per_qp[qp] + user_param->recv_post_list <= iters) &&
+					unused_recv_for_qp[qp] >= user_param->recv_post_list) {
+				if (user_param->use_srq) {
+					if (ibv_post_srq_recv(ctx->srq, &ctx->rwr[qp * user_param->recv_post_list], &bad_wr_recv)) {
+						log_ebt("Couldn't post recv SRQ. QP = %d: counter=%lu\n", qp, totrcnt);
+						stats->result = FAILURE;
+						bi_run.stop = 1;
+						goto cleaning;
 					}
+				} else if (ibv_post_recv(ctx->qp[qp], &ctx->rwr[qp * user_param->recv_post_list], &bad_wr_recv)) {
+					log_ebt("Couldn't post recv Qp=%d rcnt=%lu\n", qp, rcnt_for_qp[qp]);
+					stats->result = FAILURE;
+					bi_run.stop = 1;
+					goto cleaning;
+				}
+				unused_recv_for_qp[qp] -= user_param->recv_post_list;
+				posted_per_qp[qp] += user_param->recv_post_list;
+
+				if (SIZE(user_param->connection_type, user_param->size, !(int)user_param->machine) <= (ctx->cycle_buffer / 2) &&
+						user_param->recv_post_list == 1) {
+					increase_loc_addr(ctx->rwr[qp].sg_list, user_param->size, posted_per_qp[qp],
+							ctx->rx_buffer_addr[qp], user_param->connection_type,
+							ctx->cache_line_size, ctx->cycle_buffer);
 				}
 			}
-
-		} else if (ne < 0) {
-			log_ebt("Poll Receive CQ failed %d\n", ne);
-			return_value = FAILURE;
-			goto cleaning;
 		}
+		stats->cnt = totrcnt;
+		stats->last = get_cycles();
 	}
 
 cleaning:
 	free(wc);
-	free(swc);
 	free(rcnt_for_qp);
-	free(ccnt_for_qp);
-	free(scredit_for_qp);
+	free(unused_recv_for_qp);
+	free(posted_per_qp);
+
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int run_iter_bi_threads(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct bi_worker workers[2];
+	void *(*funcs[2])(void *) = { bi_tx_func, bi_rx_func };
+	int i, created = 0;
+	int return_value = SUCCESS;
+
+	FUNCTION_ENTER;
+	memset(&bi_run, 0, sizeof(bi_run));
+	bi_run.num_of_qps = user_param->num_of_qps;
+	if (user_param->use_xrc || user_param->connection_type == DC)
+		bi_run.num_of_qps /= 2;
+	bi_run.iters = user_param->iters;
+	bi_run.tot_iters = (uint64_t)user_param->iters * bi_run.num_of_qps;
+	check_alive_data.g_total_iters = bi_run.tot_iters;
+
+	if (start_test_stats(ctx, user_param))
+		return FAILURE;
+
+	if (user_param->noPeak == ON)
+		user_param->tposted[0] = get_cycles();
+
+	/* The client starts sending right away, the server when it has
+	 * received from the client (RX comes first to avoid depleting the
+	 * receive WQEs of UC/UD).
+	 */
+	if (user_param->machine == CLIENT) {
+		if (user_param->test_type == DURATION) {
+			duration_param = user_param;
+			duration_param->state = START_STATE;
+			signal(SIGALRM, catch_alarm);
+			if (user_param->margin > 0)
+				alarm(user_param->margin);
+			else
+				catch_alarm(0);
+		}
+		bi_run.rx_started = ON;
+	}
+
+	if (user_param->test_type == ITERATIONS) {
+		check_alive_data.is_events = user_param->use_event;
+		signal(SIGALRM, check_alive);
+		alarm(60);
+	}
+
+	memset(ctx->bi_stats, 0, sizeof(struct bi_thread_stats) * 2);
+	for (i = 0; i < 2; i++) {
+		workers[i].ctx = ctx;
+		workers[i].user_param = user_param;
+		workers[i].stats = &ctx->bi_stats[i];
+
+		/* TX runs on the first CPU the process is allowed on and RX on
+		 * the second, use taskset to choose the cores.
+		 */
+		workers[i].stats->cpu = get_nth_allowed_cpu(i);
+
+		if (pthread_create(&workers[i].thread, NULL, funcs[i], &workers[i])) {
+			log_ebt("Couldn't create the %s thread\n", i == BI_TX ? "TX" : "RX");
+			bi_run.stop = 1;
+			return_value = FAILURE;
+			break;
+		}
+		created++;
+	}
+
+	for (i = 0; i < created; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].stats->result != SUCCESS)
+			return_value = FAILURE;
+	}
+	stop_test_stats(user_param);
+
+	if (user_param->test_type == DURATION)
+		user_param->iters = ctx->bi_stats[BI_TX].sampled + ctx->bi_stats[BI_RX].sampled;
+	else if (user_param->noPeak == ON)
+		user_param->tcompleted[0] = get_cycles();
+
+	check_alive_data.last_totrcnt = 0;
+
 	return return_value;
 }
 
@@ -4065,6 +5834,9 @@ int run_iter_bi(struct pingpong_context *ctx,
 		ctx_post_send_work_request_func_pointer(ctx, user_param);
 	#endif
 
+	if (user_param->bi_threads)
+		return run_iter_bi_threads(ctx, user_param);
+
 	ALLOCATE(wc_tx,struct ibv_wc,CTX_POLL_BATCH);
 	ALLOCATE(rcnt_for_qp,uint64_t,user_param->num_of_qps);
 	ALLOCATE(scredit_for_qp,int,user_param->num_of_qps);
@@ -4083,6 +5855,11 @@ int run_iter_bi(struct pingpong_context *ctx,
 	for (i = 0; i < user_param->num_of_qps; i++)
 		posted_per_qp[i] = ctx->rposted;
 
+	if (start_test_stats(ctx, user_param)) {
+		return_value = FAILURE;
+		goto cleaning;
+	}
+
 	if (user_param->noPeak == ON)
 		user_param->tposted[0] = get_cycles();
 
@@ -4130,10 +5907,8 @@ int run_iter_bi(struct pingpong_context *ctx,
 					if (swindow >= user_param->rx_depth)
 						break;
 				}
-				if (user_param->post_list == 1 && (ctx->scnt[index] % user_param->cq_mod == 0 && user_param->cq_mod > 1)
-					&& !(ctx->scnt[index] == (user_param->iters - 1) && user_param->test_type == ITERATIONS)) {
-					ctx->wr[index].send_flags &= ~IBV_SEND_SIGNALED;
-				}
+				if (user_param->post_list == 1)
+					ctx_next_send_slot(ctx, index, 0, user_param);
 				if (user_param->noPeak == OFF)
 					user_param->tposted[totscnt] = get_cycles();
 
@@ -4148,32 +5923,14 @@ int run_iter_bi(struct pingpong_context *ctx,
 					goto cleaning;
 				}
 
-				if (user_param->post_list == 1 && user_param->size <= (ctx->cycle_buffer / 2)) {
-					increase_loc_addr(ctx->wr[index].sg_list,user_param->size,ctx->scnt[index],
-						ctx->my_addr[index],0,ctx->cache_line_size,ctx->cycle_buffer);
-				}
-
 				ctx->scnt[index] += user_param->post_list;
 				totscnt += user_param->post_list;
-
-				if (user_param->post_list == 1 &&
-					(ctx->scnt[index]%user_param->cq_mod == user_param->cq_mod - 1 ||
-						(user_param->test_type == ITERATIONS && ctx->scnt[index] == iters-1))) {
-
-					ctx->wr[index].send_flags |= IBV_SEND_SIGNALED;
-				}
-			}
-		}
-		if (user_param->use_event) {
-
-			if (ctx_notify_events(ctx->channel)) {
-				log_ebt("Failed to notify events to CQ");
-				return_value = FAILURE;
-				goto cleaning;
 			}
 		}
-
-		ne = ibv_poll_cq(ctx->recv_cq,user_param->rx_depth,wc);
+		if (user_param->use_event)
+			ne = ctx_event_poll_cq(ctx, ctx->recv_cq, user_param->rx_depth, wc);
+		else
+			ne = ibv_poll_cq(ctx->recv_cq,user_param->rx_depth,wc);
 		if (ne > 0) {
 
 			if (user_param->machine == SERVER && before_first_rx == ON) {
@@ -4362,6 +6119,7 @@ int run_iter_bi(struct pingpong_context *ctx,
 	}
 
 cleaning:
+	stop_test_stats(user_param);
 	check_alive_data.last_totrcnt=0;
 	free(rcnt_for_qp);
 	free(scredit_for_qp);
@@ -4370,6 +6128,283 @@ cleaning:
 	return return_value;
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_bi_threads_report(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	static const char *dir_name[2] = { "TX", "RX" };
+	struct bi_thread_stats *stats = ctx->bi_stats;
+	double cpu_mhz, format_factor, msg_rate;
+	uint64_t msgs;
+	cycles_t cycles;
+	int i;
+
+	if (!user_param->bi_threads || user_param->output == OUTPUT_BW || user_param->output == OUTPUT_MR)
+		return;
+
+	cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
+	format_factor = (user_param->report_fmt == MBS) ? 0x100000 : 125000000;
+
+	printf(" Direction  CPU    #messages    BW average[%s]  MsgRate[Mpps]\n",
+	       (user_param->report_fmt == MBS) ? "MiB/sec" : "Gb/sec");
+	for (i = BI_TX; i <= BI_RX; i++) {
+		/* duration tests count the sample window of the alarm, iterations
+		 * from the first to the last completion of the direction
+		 */
+		if (user_param->test_type == DURATION) {
+			msgs = stats[i].sampled;
+			cycles = user_param->tcompleted[0] - user_param->tposted[0];
+		} else {
+			msgs = stats[i].cnt;
+			cycles = stats[i].last - stats[i].first;
+		}
+
+		msg_rate = cycles ? msgs * cpu_mhz / cycles : 0;
+		printf(" %-10s %-6d %-12" PRIu64 " %-19.2f %.6f\n", dir_name[i], stats[i].cpu, msgs,
+		       msg_rate * 1000000 * user_param->size / format_factor, msg_rate);
+	}
+}
+
+/* Device clock samples taken this many times, the fastest query is kept */
+#define HW_CLOCK_SAMPLES (8)
+
+/* The device clock and the host cycles at the start and the end of a test */
+struct hw_clock_ref {
+	uint64_t	hw_start;
+	uint64_t	hw_end;
+	cycles_t	host_start;
+	cycles_t	host_end;
+};
+
+/******************************************************************************
+ * poll_cq_ts - poll one completion and when it completed: the device
+ * timestamp on CQs that report it, otherwise the cycles right after the read.
+ ******************************************************************************/
+static inline int poll_cq_ts(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+			     struct ibv_cq *cq, struct ibv_wc *wc, cycles_t *comp_ts)
+{
+	int ne;
+
+	#ifdef HAVE_HW_TIMESTAMP
+	if (user_param->hw_ts_active) {
+		struct ibv_cq_ex *cq_ex = (cq == ctx->send_cq) ? ctx->send_cq_ex : ctx->recv_cq_ex;
+		struct ibv_poll_cq_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		ne = ibv_start_poll(cq_ex, &attr);
+		if (ne == ENOENT)
+			return 0;
+		if (ne)
+			return -ne;
+
+		wc->wr_id = cq_ex->wr_id;
+		wc->status = cq_ex->status;
+		wc->opcode = ibv_wc_read_opcode(cq_ex);
+		wc->vendor_err = ibv_wc_read_vendor_err(cq_ex);
+		*comp_ts = ibv_wc_read_completion_ts(cq_ex);
+		ibv_end_poll(cq_ex);
+		return 1;
+	}
+	#endif
+
+	ne = ibv_poll_cq(cq, 1, wc);
+	if (ne > 0)
+		*comp_ts = get_cycles();
+
+	return ne;
+}
+
+/******************************************************************************
+ * sample_hw_clock - read the device clock and the host cycles at the same time.
+ ******************************************************************************/
+static int sample_hw_clock(struct pingpong_context *ctx, uint64_t *hw_clock, cycles_t *host)
+{
+	#ifdef HAVE_HW_TIMESTAMP
+	struct ibv_values_ex values;
+	cycles_t before, after, best = 0;
+	int i;
+
+	for (i = 0; i < HW_CLOCK_SAMPLES; i++) {
+		memset(&values, 0, sizeof(values));
+		values.comp_mask = IBV_VALUES_MASK_RAW_CLOCK;
+
+		before = get_cycles();
+		if (ibv_query_rt_values_ex(ctx->context, &values))
+			return FAILURE;
+		after = get_cycles();
+
+		if (!i || after - before < best) {
+			best = after - before;
+			*hw_clock = (uint64_t)values.raw_clock.tv_sec * 1000000000ULL + values.raw_clock.tv_nsec;
+			*host = before + best / 2;
+		}
+	}
+
+	return SUCCESS;
+	#else
+	return FAILURE;
+	#endif
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void hw_ts_start(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+			struct hw_clock_ref *ref)
+{
+	memset(user_param->tcompleted, 0, sizeof(cycles_t) * user_param->iters);
+
+	if (user_param->hw_ts_active && sample_hw_clock(ctx, &ref->hw_start, &ref->host_start)) {
+		printf(" Couldn't read the device clock, using software timestamps at the CQE read\n");
+		user_param->hw_ts_active = 0;
+	}
+}
+
+/******************************************************************************
+ * hw_ts_finish - move the device timestamps of the completions to host cycles,
+ * by the clocks sampled at the start and at the end of the test.
+ ******************************************************************************/
+static void hw_ts_finish(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+			 struct hw_clock_ref *ref)
+{
+	double cycles_per_tick;
+	uint64_t i;
+
+	if (!user_param->hw_ts_active)
+		return;
+
+	if (sample_hw_clock(ctx, &ref->hw_end, &ref->host_end) || ref->hw_end <= ref->hw_start) {
+		printf(" Couldn't read the device clock, no completion timestamps\n");
+		memset(user_param->tcompleted, 0, sizeof(cycles_t) * user_param->iters);
+		return;
+	}
+
+	cycles_per_tick = (double)(ref->host_end - ref->host_start) / (ref->hw_end - ref->hw_start);
+	for (i = 0; i < user_param->iters; i++) {
+		if (user_param->tcompleted[i])
+			user_param->tcompleted[i] = ref->host_start +
+				(cycles_t)((double)(int64_t)(user_param->tcompleted[i] - ref->hw_start) * cycles_per_tick);
+	}
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_iter_lat_pipelined(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	uint64_t		scnt = 0; /* requests or replies posted */
+	uint64_t		ccnt = 0; /* send completions */
+	uint64_t		rcnt = 0; /* requests or replies received */
+	uint64_t		iters = user_param->iters;
+	uint64_t		post_limit;
+	int			depth = user_param->lat_depth;
+	int			is_client = user_param->machine == CLIENT;
+	uint64_t		stride = INC(user_param->size, ctx->cache_line_size);
+	uintptr_t		send_base = ctx->sge_list[0].addr;
+	uint64_t		remote_base = ctx->wr[0].wr.rdma.remote_addr;
+	volatile char		*rx_base = (char*)ctx->buf[0] + BUFF_SIZE(ctx->size, ctx->cycle_buffer);
+	struct ibv_wc		wc[CTX_POLL_BATCH];
+	struct ibv_recv_wr	*bad_wr_recv;
+	cycles_t		now;
+	int			i, ne, slot;
+
+	FUNCTION_ENTER;
+	#ifdef HAVE_IBV_WR_API
+	ctx_post_send_work_request_func_pointer(ctx, user_param);
+	#endif
+
+	ctx->wr[0].sg_list->length = user_param->size;
+	ctx->wr[0].send_flags = IBV_SEND_SIGNALED;
+	if (user_param->verb != READ && user_param->size <= user_param->inline_size)
+		ctx->wr[0].send_flags |= IBV_SEND_INLINE;
+
+	while (rcnt < iters || ccnt < scnt) {
+
+		/* the client keeps depth requests in flight, the server replies
+		 * to every request it got */
+		post_limit = is_client ? rcnt + depth : rcnt;
+		if (post_limit > iters)
+			post_limit = iters;
+
+		while (scnt < post_limit && scnt - ccnt < (uint64_t)user_param->tx_depth) {
+			slot = scnt % depth;
+			if (user_param->verb != SEND) {
+				ctx->wr[0].sg_list->addr = send_base + slot * stride;
+				ctx->wr[0].wr.rdma.remote_addr = remote_base + slot * stride;
+			}
+			/* a slot is reused only after the reply of its last request */
+			if (user_param->verb == WRITE)
+				*((volatile char*)send_base + slot * stride + user_param->size - 1) = (char)(scnt / depth + 1);
+
+			if (is_client)
+				user_param->tposted[scnt] = get_cycles();
+
+			if (post_send_method(ctx, 0, user_param)) {
+				log_ebt("Couldn't post send: scnt=%lu\n", scnt);
+				return FAILURE;
+			}
+			scnt++;
+		}
+
+		if (user_param->verb == WRITE && rcnt < iters) {
+			slot = rcnt % depth;
+			if (rx_base[slot * stride + user_param->size - 1] == (char)(rcnt / depth + 1)) {
+				if (is_client)
+					user_param->tcompleted[rcnt] = get_cycles();
+				rcnt++;
+			}
+		} else if (user_param->verb == SEND && rcnt < iters) {
+			ne = ibv_poll_cq(ctx->recv_cq, CTX_POLL_BATCH, wc);
+			if (ne < 0) {
+				log_ebt("poll CQ failed %d\n", ne);
+				return FAILURE;
+			}
+			now = get_cycles();
+			for (i = 0; i < ne; i++) {
+				if (wc[i].status != IBV_WC_SUCCESS) {
+					NOTIFY_COMP_ERROR_RECV(wc[i], rcnt);
+					return FAILURE;
+				}
+				if (is_client)
+					user_param->tcompleted[rcnt] = now;
+				rcnt++;
+
+				if (rcnt + user_param->rx_depth <= iters &&
+				    ibv_post_recv(ctx->qp[0], &ctx->rwr[0], &bad_wr_recv)) {
+					log_ebt("Couldn't post recv: rcnt=%lu\n", rcnt);
+					return FAILURE;
+				}
+			}
+		}
+
+		/* send completions free the send queue, a read completion is its reply */
+		if (ccnt < scnt) {
+			ne = ibv_poll_cq(ctx->send_cq, CTX_POLL_BATCH, wc);
+			if (ne < 0) {
+				log_ebt("poll CQ failed %d\n", ne);
+				return FAILURE;
+			}
+			now = get_cycles();
+			for (i = 0; i < ne; i++) {
+				if (wc[i].status != IBV_WC_SUCCESS) {
+					NOTIFY_COMP_ERROR_SEND(wc[i], scnt, ccnt);
+					return FAILURE;
+				}
+				if (user_param->verb == READ)
+					user_param->tcompleted[ccnt] = now;
+				ccnt++;
+			}
+			if (user_param->verb == READ)
+				rcnt = ccnt;
+		}
+	}
+
+	ctx->wr[0].sg_list->addr = send_base;
+	ctx->wr[0].wr.rdma.remote_addr = remote_base;
+	return 0;
+}
+
 /******************************************************************************
  *
  ******************************************************************************/
@@ -4391,6 +6426,9 @@ int run_iter_lat_write(struct pingpong_context *ctx,struct perftest_parameters *
 	cycles_t 		end_cycle, start_gap=0;
 
 	FUNCTION_ENTER;
+	if (user_param->lat_depth > 1)
+		return run_iter_lat_pipelined(ctx, user_param);
+
 	#ifdef HAVE_IBV_WR_API
 	if (user_param->connection_type != RawEth)
 		ctx_post_send_work_request_func_pointer(ctx, user_param);
@@ -4495,8 +6533,13 @@ int run_iter_lat(struct pingpong_context *ctx,struct perftest_parameters *user_p
 	int 		cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
 	int 		total_gap_cycles = user_param->latency_gap * cpu_mhz;
 	cycles_t 	end_cycle, start_gap=0;
+	cycles_t	comp_ts = 0;
+	struct hw_clock_ref clock_ref;
 
 	FUNCTION_ENTER;
+	if (user_param->lat_depth > 1)
+		return run_iter_lat_pipelined(ctx, user_param);
+
 	#ifdef HAVE_IBV_WR_API
 	if (user_param->connection_type != RawEth)
 		ctx_post_send_work_request_func_pointer(ctx, user_param);
@@ -4516,6 +6559,10 @@ int run_iter_lat(struct pingpong_context *ctx,struct perftest_parameters *user_p
 		else
 			catch_alarm(0);
 	}
+
+	if (user_param->hw_timestamps)
+		hw_ts_start(ctx, user_param, &clock_ref);
+
 	while (scnt < user_param->iters || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
 		if (user_param->latency_gap) {
 			start_gap = get_cycles();
@@ -4537,15 +6584,13 @@ int run_iter_lat(struct pingpong_context *ctx,struct perftest_parameters *user_p
 		if (user_param->test_type == DURATION && user_param->state == END_STATE)
 			break;
 
-		if (user_param->use_event) {
-			if (ctx_notify_events(ctx->channel)) {
-				log_ebt("Couldn't request CQ notification\n");
-				return 1;
-			}
-		}
-
 		do {
-			ne = ibv_poll_cq(ctx->send_cq, 1, &wc);
+			if (user_param->use_event)
+				ne = ctx_event_poll_cq(ctx, ctx->send_cq, 1, &wc);
+			else if (user_param->hw_timestamps)
+				ne = poll_cq_ts(ctx, user_param, ctx->send_cq, &wc, &comp_ts);
+			else
+				ne = ibv_poll_cq(ctx->send_cq, 1, &wc);
 			if(ne > 0) {
 				if (wc.status != IBV_WC_SUCCESS) {
 					NOTIFY_COMP_ERROR_SEND(wc,scnt,scnt);
@@ -4553,15 +6598,20 @@ int run_iter_lat(struct pingpong_context *ctx,struct perftest_parameters *user_p
 				}
 				if (user_param->test_type==DURATION && user_param->state == SAMPLE_STATE)
 					user_param->iters++;
+				if (user_param->hw_timestamps)
+					user_param->tcompleted[scnt - 1] = comp_ts;
 
 			} else if (ne < 0) {
 				log_ebt("poll CQ failed %d\n", ne);
 				return FAILURE;
 			}
 
-		} while (!user_param->use_event && ne == 0);
+		} while (ne == 0);
 	}
 
+	if (user_param->hw_timestamps)
+		hw_ts_finish(ctx, user_param, &clock_ref);
+
 	return 0;
 }
 
@@ -4588,8 +6638,13 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 	cycles_t 		end_cycle, start_gap=0;
 	uintptr_t		primary_send_addr = ctx->sge_list[0].addr;
 	uintptr_t		primary_recv_addr = ctx->recv_sge_list[0].addr;
+	cycles_t		comp_ts = 0;
+	struct hw_clock_ref	clock_ref;
 
 	FUNCTION_ENTER;
+	if (user_param->lat_depth > 1)
+		return run_iter_lat_pipelined(ctx, user_param);
+
 	#ifdef HAVE_IBV_WR_API
 	if (user_param->connection_type != RawEth)
 		ctx_post_send_work_request_func_pointer(ctx, user_param);
@@ -4602,6 +6657,10 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 	if (user_param->size <= user_param->inline_size) {
 		ctx->wr[0].send_flags |= IBV_SEND_INLINE;
 	}
+
+	if (user_param->hw_timestamps)
+		hw_ts_start(ctx, user_param, &clock_ref);
+
 	while (scnt < user_param->iters || rcnt < user_param->iters ||
 			( (user_param->test_type == DURATION && user_param->state != END_STATE))) {
 
@@ -4611,14 +6670,13 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 		 * server will enter here first and wait for a packet to arrive (from the client)
 		 */
 		if ((rcnt < user_param->iters || user_param->test_type == DURATION) && !(scnt < 1 && user_param->machine == CLIENT)) {
-			if (user_param->use_event) {
-				if (ctx_notify_events(ctx->channel)) {
-					fprintf(stderr , " Failed to notify events to CQ");
-					return 1;
-				}
-			}
 			do {
-				ne = ibv_poll_cq(ctx->recv_cq,1,&wc);
+				if (user_param->use_event)
+					ne = ctx_event_poll_cq(ctx, ctx->recv_cq, 1, &wc);
+				else if (user_param->hw_timestamps)
+					ne = poll_cq_ts(ctx, user_param, ctx->recv_cq, &wc, &comp_ts);
+				else
+					ne = ibv_poll_cq(ctx->recv_cq,1,&wc);
 				if (user_param->test_type == DURATION && user_param->state == END_STATE)
 					break;
 
@@ -4633,6 +6691,12 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 						return 1;
 					}
 
+					/* the client's receive ends the iteration of the same
+					 * index, the server's ends the one of its last reply.
+					 */
+					if (user_param->hw_timestamps && (user_param->machine == CLIENT || rcnt > 0))
+						user_param->tcompleted[user_param->machine == CLIENT ? rcnt : rcnt - 1] = comp_ts;
+
 					rcnt++;
 
 					if (user_param->test_type == DURATION && user_param->state == SAMPLE_STATE)
@@ -4668,7 +6732,7 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 					log_ebt("poll CQ failed %d\n", ne);
 					return 1;
 				}
-			} while (!user_param->use_event && ne == 0);
+			} while (ne == 0);
 		}
 
 		if (scnt < user_param->iters || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
@@ -4715,17 +6779,13 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 				struct ibv_wc s_wc;
 				int s_ne;
 
-				if (user_param->use_event) {
-					if (ctx_notify_events(ctx->channel)) {
-						fprintf(stderr , " Failed to notify events to CQ");
-						return FAILURE;
-					}
-				}
-
 				/* wait until you get a cq for the last packet */
 				do {
-					s_ne = ibv_poll_cq(ctx->send_cq, 1, &s_wc);
-				} while (!user_param->use_event && s_ne == 0);
+					if (user_param->use_event)
+						s_ne = ctx_event_poll_cq(ctx, ctx->send_cq, 1, &s_wc);
+					else
+						s_ne = ibv_poll_cq(ctx->send_cq, 1, &s_wc);
+				} while (s_ne == 0);
 
 				if (s_ne < 0) {
 					log_ebt("poll on Send CQ failed %d\n", s_ne);
@@ -4742,6 +6802,9 @@ int run_iter_lat_send(struct pingpong_context *ctx,struct perftest_parameters *u
 		}
 	}
 
+	if (user_param->hw_timestamps)
+		hw_ts_finish(ctx, user_param, &clock_ref);
+
 	return 0;
 }
 /******************************************************************************
@@ -4832,16 +6895,9 @@ int run_iter_lat_burst(struct pingpong_context *ctx, struct perftest_parameters
 	int			wc_id;
 	struct ibv_wc		*wc;
 	struct ibv_send_wr	*bad_wr;
-	int			cpu_mhz;
 	int			return_value = 0;
-	/* Rate Limiter*/
-	int			rate_limit_pps = 0;
-	double			gap_time = 0;   /* in usec */
-	cycles_t		gap_cycles = 0; /* in cycles */
-	cycles_t		gap_deadline = 0;
-	unsigned int		number_of_bursts = 0;
-	int			burst_iter = 0;
-	int			is_sending_burst = 0;
+	int			burst_iter;
+	struct pacer		*pacer = NULL;
 	struct ibv_recv_wr      *bad_wr_recv = NULL;
 
 	FUNCTION_ENTER;
@@ -4854,51 +6910,27 @@ int run_iter_lat_burst(struct pingpong_context *ctx, struct perftest_parameters
 
 	tot_iters = (uint64_t)user_param->iters;
 
-	/* If using rate limiter, calculate gap time between bursts */
-	cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
-	if (cpu_mhz <= 0) {
-		log_ebt("Failed: couldn't acquire cpu frequency for rate limiter.\n");
-		return_value = FAILURE;
-		goto cleaning;
-	}
-	if (user_param->rate_limit > 0 ) {
-		if (user_param->rate_limit_type == SW_RATE_LIMIT) {
-			switch (user_param->rate_units) {
-				case MEGA_BYTE_PS:
-					rate_limit_pps = ((double)(user_param->rate_limit) / user_param->size) * 1048576;
-					break;
-				case GIGA_BIT_PS:
-					rate_limit_pps = ((double)(user_param->rate_limit) / (user_param->size * 8)) * 1000000000;
-					break;
-				case PACKET_PS:
-					rate_limit_pps = user_param->rate_limit;
-					break;
-				default:
-					log_ebt(" Failed: Unknown rate limit units\n");
-					return_value = FAILURE;
-					goto cleaning;
-			}
-			number_of_bursts = rate_limit_pps / user_param->burst_size;
-			gap_time = 1000000 * (1.0 / number_of_bursts);
+	if (user_param->rate_limit_type == SW_RATE_LIMIT && (user_param->rate_limit > 0 || user_param->load_profile)) {
+		if (pacer_create(&user_param->pacer, user_param, 1)) {
+			return_value = FAILURE;
+			goto cleaning;
 		}
+		pacer = user_param->pacer;
 	}
 
-	gap_cycles = cpu_mhz * gap_time;
-
 	/* main loop for posting */
 	while (totrcnt < (totscnt / user_param->reply_every) || totccnt < tot_iters) {
 
-		if (is_sending_burst == 0) {
-			if (gap_deadline > get_cycles() && user_param->rate_limit_type == SW_RATE_LIMIT) {
-				/* Go right to cq polling until gap time is over. */
-				goto polling;
-			}
-			gap_deadline = get_cycles() + gap_cycles;
-			is_sending_burst = 1;
-			burst_iter = 0;
-		}
-		while ((totscnt < user_param->iters)
-			&& (totscnt - totccnt) < (user_param->tx_depth) && !(is_sending_burst == 0 )) {
+		/* at most a burst between two polls, the pacer spaces the bursts */
+		for (burst_iter = 0; burst_iter < user_param->burst_size && totscnt < user_param->iters
+			&& (totscnt - totccnt) < (user_param->tx_depth); burst_iter++) {
+
+			if (pacer && !pacer_take(pacer, 0, user_param->post_list))
+				break;
+
+			if (user_param->post_list == 1)
+				ctx->wr[0].sg_list->addr = ctx->my_addr[0] +
+					(totscnt & ctx->send_slot_mask) * ctx->send_slot_stride;
 
 			err = ibv_post_send(ctx->qp[0],&ctx->wr[0],&bad_wr);
 
@@ -4906,20 +6938,13 @@ int run_iter_lat_burst(struct pingpong_context *ctx, struct perftest_parameters
 				log_ebt("Couldn't post send: scnt=%lu\n", totscnt);
 				return 1;
 			}
-			if (user_param->post_list == 1 && user_param->size <= (ctx->cycle_buffer / 2)) {
-				increase_loc_addr(ctx->wr[0].sg_list, user_param->size, totscnt,
-					ctx->my_addr[0], 0, ctx->cache_line_size, ctx->cycle_buffer);
-			}
 			totscnt += user_param->post_list;
 			if (totscnt % user_param->reply_every == 0 && totscnt != 0) {
 				user_param->tposted[pong_cnt] = get_cycles();
 				pong_cnt++;
 			}
-			if (++burst_iter == user_param->burst_size) {
-				is_sending_burst = 0;
-			}
 		}
-polling:
+
 		do {
 			ne = ibv_poll_cq(ctx->recv_cq, CTX_POLL_BATCH, wc);
 			if (ne > 0) {
@@ -4990,6 +7015,8 @@ void catch_alarm(int sig)
 		case START_STATE:
 			duration_param->state = SAMPLE_STATE;
 			get_cpu_stats(duration_param,1);
+			if (duration_param->cpu_stats)
+				cpu_stats_start(duration_param->cpu_stats);
 			duration_param->tposted[0] = get_cycles();
 			alarm(duration_param->duration - 2*(duration_param->margin));
 			break;
@@ -4997,6 +7024,8 @@ void catch_alarm(int sig)
 			duration_param->state = STOP_SAMPLE_STATE;
 			duration_param->tcompleted[0] = get_cycles();
 			get_cpu_stats(duration_param,2);
+			if (duration_param->cpu_stats)
+				cpu_stats_stop(duration_param->cpu_stats);
 			if (duration_param->margin > 0)
 				alarm(duration_param->margin);
 			else
@@ -5077,19 +7106,155 @@ int check_packet_pacing_support(struct pingpong_context *ctx)
 }
 #endif
 
-int run_iter_fs(struct pingpong_context *ctx, struct perftest_parameters *user_param) {
+struct fs_rate_thread {
+	pthread_t			thread;
+	struct pingpong_context		*ctx;
+	struct perftest_parameters	*user_param;
+	struct fs_rate_report_data	*rep;
+	struct ibv_flow			**flows;
+	struct ibv_flow_attr		**flow_rules;
+	volatile int			*ready;
+	volatile int			*start;
+	volatile uint64_t		*slot;
+	uint64_t			first_flow;
+	uint64_t			last_flow;
+	uint64_t			flows_per_qp;
+	int				phase;
+	int				result;
+};
+
+enum fs_rate_phase { FS_INSERT, FS_CHURN, FS_DESTROY };
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *fs_rate_thread_func(void *arg)
+{
+	struct fs_rate_thread *t = arg;
+	struct perftest_parameters *user_param = t->user_param;
+	struct ibv_qp *qp;
+	cycles_t start;
+	uint64_t i, slot;
+
+	__sync_fetch_and_add(t->ready, 1);
+	while (*t->start == 0);
+	if (*t->start < 0)
+		return NULL;
+
+	/* The sample slot is taken from a shared counter, so the samples
+	 * stay ordered by the number of flows in the table.
+	 */
+	for (i = t->first_flow; i < t->last_flow; i++) {
+		qp = t->ctx->qp[i / t->flows_per_qp];
+		slot = __sync_fetch_and_add(t->slot, 1);
+
+		switch (t->phase) {
+		case FS_INSERT:
+			user_param->tposted[slot] = get_cycles();
+			t->flows[i] = ibv_create_flow(qp, t->flow_rules[i]);
+			user_param->tcompleted[slot] = get_cycles();
+			if (!t->flows[i]) {
+				log_ebt("Couldn't attach QP\n");
+				t->result = FAILURE;
+				return NULL;
+			}
+			break;
+		case FS_CHURN:
+			start = get_cycles();
+			if (ibv_destroy_flow(t->flows[i])) {
+				log_ebt("Couldn't destroy flow\n");
+				t->result = FAILURE;
+				return NULL;
+			}
+			t->flows[i] = NULL;
+			t->rep->churn_destroy_cycles[slot] = get_cycles() - start;
+
+			start = get_cycles();
+			t->flows[i] = ibv_create_flow(qp, t->flow_rules[i]);
+			t->rep->churn_insert_cycles[slot] = get_cycles() - start;
+			if (!t->flows[i]) {
+				log_ebt("Couldn't attach QP\n");
+				t->result = FAILURE;
+				return NULL;
+			}
+			break;
+		case FS_DESTROY:
+			start = get_cycles();
+			if (ibv_destroy_flow(t->flows[i])) {
+				log_ebt("Couldn't destroy flow\n");
+				t->result = FAILURE;
+				return NULL;
+			}
+			t->rep->destroy_cycles[slot] = get_cycles() - start;
+			t->flows[i] = NULL;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static int run_fs_rate_phase(struct fs_rate_thread *threads, int num_threads,
+			     int phase, cycles_t *wall_time)
+{
+	volatile int ready = 0, start_flag = 0;
+	volatile uint64_t slot = 0;
+	cycles_t start_time = 0;
+	int i, created = 0, retval = SUCCESS;
+
+	for (i = 0; i < num_threads; i++) {
+		threads[i].ready = &ready;
+		threads[i].start = &start_flag;
+		threads[i].slot = &slot;
+		threads[i].phase = phase;
+		threads[i].result = SUCCESS;
+		if (pthread_create(&threads[i].thread, NULL, fs_rate_thread_func, &threads[i])) {
+			log_ebt("Failed to create thread %d\n", i);
+			start_flag = -1;
+			retval = FAILURE;
+			goto cleaning;
+		}
+		created++;
+	}
+
+	while (ready < created);
+	start_time = get_cycles();
+	start_flag = 1;
+
+cleaning:
+	for (i = 0; i < created; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].result != SUCCESS)
+			retval = FAILURE;
+	}
+	if (retval == SUCCESS)
+		*wall_time = get_cycles() - start_time;
+
+	return retval;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_iter_fs(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		struct fs_rate_report_data *rep) {
 
 	struct raw_ethernet_info	*my_dest_info = NULL;
 	struct raw_ethernet_info	*rem_dest_info = NULL;
 
 	struct ibv_flow			**flow_create_result;
 	struct ibv_flow_attr		**flow_rules;
+	struct fs_rate_thread		*threads = NULL;
 	int 				flow_index = 0;
 	int				qp_index = 0;
+	int				i, qps_per_thread, extra_qps, first_qp;
 	int				retval = SUCCESS;
 	uint64_t			tot_fs_cnt    = 0;
 	uint64_t			allocated_flows = 0;
-	uint64_t			tot_iters = 0;
+	uint64_t			tot_flows;
 
 	/* Allocate user input dependable structs */
 	ALLOCATE(my_dest_info, struct raw_ethernet_info, user_param->num_of_qps);
@@ -5104,65 +7269,103 @@ int run_iter_fs(struct pingpong_context *ctx, struct perftest_parameters *user_p
 		allocated_flows = (2 * MAX_FS_PORT) - (user_param->server_port + user_param->client_port);
 	}
 
+	tot_flows = allocated_flows * user_param->num_of_qps;
+	ALLOCATE(flow_create_result, struct ibv_flow*, tot_flows);
+	memset(flow_create_result, 0, sizeof(struct ibv_flow*) * tot_flows);
+	ALLOCATE(flow_rules, struct ibv_flow_attr*, tot_flows);
+	memset(flow_rules, 0, sizeof(struct ibv_flow_attr*) * tot_flows);
 
-	ALLOCATE(flow_create_result, struct ibv_flow*, allocated_flows * user_param->num_of_qps);
-	ALLOCATE(flow_rules, struct ibv_flow_attr*, allocated_flows * user_param->num_of_qps);
-
-	if(user_param->test_type == DURATION) {
-		duration_param = user_param;
-		user_param->iters = 0;
-		duration_param->state = START_STATE;
-		signal(SIGALRM, catch_alarm);
-		alarm(user_param->margin);
-		if (user_param->margin > 0)
-			alarm(user_param->margin);
-		else
-			catch_alarm(0); /* move to next state */
-	}
 	if (set_up_fs_rules(flow_rules, ctx, user_param, allocated_flows)) {
 			log_ebt("Unable to set up flow rules\n");
 			retval = FAILURE;
 			goto cleaning;
 	}
 
-	do {/* This loop runs once in Iteration mode */
+	if (user_param->test_type == ITERATIONS) {
+		/* Every thread owns a contiguous range of QPs and their flows */
+		ALLOCATE(threads, struct fs_rate_thread, user_param->num_threads);
+		memset(threads, 0, sizeof(struct fs_rate_thread) * user_param->num_threads);
+		qps_per_thread = user_param->num_of_qps / user_param->num_threads;
+		extra_qps = user_param->num_of_qps % user_param->num_threads;
+
+		for (i = 0, first_qp = 0; i < user_param->num_threads; i++) {
+			threads[i].ctx = ctx;
+			threads[i].user_param = user_param;
+			threads[i].rep = rep;
+			threads[i].flows = flow_create_result;
+			threads[i].flow_rules = flow_rules;
+			threads[i].flows_per_qp = allocated_flows;
+			threads[i].first_flow = first_qp * allocated_flows;
+			first_qp += qps_per_thread + (i < extra_qps);
+			threads[i].last_flow = first_qp * allocated_flows;
+		}
+
+		if (run_fs_rate_phase(threads, user_param->num_threads, FS_INSERT, &rep->insert_time)) {
+			retval = FAILURE;
+			goto cleaning;
+		}
+
+		if (user_param->fs_churn &&
+		    run_fs_rate_phase(threads, user_param->num_threads, FS_CHURN, &rep->churn_time)) {
+			retval = FAILURE;
+			goto cleaning;
+		}
+
+		if (run_fs_rate_phase(threads, user_param->num_threads, FS_DESTROY, &rep->destroy_time))
+			retval = FAILURE;
+
+		goto cleaning;
+	}
+
+	duration_param = user_param;
+	user_param->iters = 0;
+	duration_param->state = START_STATE;
+	signal(SIGALRM, catch_alarm);
+	if (user_param->margin > 0)
+		alarm(user_param->margin);
+	else
+		catch_alarm(0); /* move to next state */
+
+	do {
 		for (qp_index = 0; qp_index < user_param->num_of_qps; qp_index++) {
 
 			for (flow_index = 0; flow_index < allocated_flows; flow_index++) {
 
-				if (user_param->test_type == ITERATIONS)
-					user_param->tposted[tot_fs_cnt] = get_cycles();
-				else if (user_param->test_type == DURATION && duration_param->state == END_STATE)
+				if (duration_param->state == END_STATE)
 					break;
-				flow_create_result[flow_index] =
+				/* Rules from the previous pass are still attached */
+				if (flow_create_result[(qp_index * allocated_flows) + flow_index] &&
+				    ibv_destroy_flow(flow_create_result[(qp_index * allocated_flows) + flow_index])) {
+					log_ebt("Couldn't destroy flow\n");
+					retval = FAILURE;
+					goto cleaning;
+				}
+				flow_create_result[(qp_index * allocated_flows) + flow_index] =
 					ibv_create_flow(ctx->qp[qp_index], flow_rules[(qp_index * allocated_flows) + flow_index]);
-				if (user_param->test_type == ITERATIONS)
-					user_param->tcompleted[tot_fs_cnt] = get_cycles();
-				if (!flow_create_result[flow_index]) {
+				if (!flow_create_result[(qp_index * allocated_flows) + flow_index]) {
 					perror("error");
 					log_ebt("Couldn't attach QP\n");
 					retval = FAILURE;
 					goto cleaning;
 				}
-				if (user_param->test_type == ITERATIONS ||
-				   (user_param->test_type == DURATION && duration_param->state == SAMPLE_STATE))
+				if (duration_param->state == SAMPLE_STATE)
 					tot_fs_cnt++;
-				tot_iters++;
 			}
 		}
-	} while (user_param->test_type == DURATION && duration_param->state != END_STATE);
+	} while (duration_param->state != END_STATE);
 
-	if (user_param->test_type == DURATION && user_param->state == END_STATE)
-		user_param->iters = tot_fs_cnt;
+	user_param->iters = tot_fs_cnt;
 
 cleaning:
 	/* destroy open flows */
-	for (flow_index = 0; flow_index < tot_iters; flow_index++) {
-		if (ibv_destroy_flow(flow_create_result[flow_index])) {
+	for (i = 0; i < tot_flows; i++) {
+		if (flow_create_result[i] && ibv_destroy_flow(flow_create_result[i])) {
 			perror("error");
 			log_ebt("Couldn't destroy flow\n");
 		}
+		free(flow_rules[i]);
 	}
+	free(threads);
 	free(flow_rules);
 	free(flow_create_result);
 	free(my_dest_info);
@@ -5171,6 +7374,392 @@ cleaning:
 	return retval;
 }
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+struct reg_mr_thread {
+	pthread_t			thread;
+	struct pingpong_context		*ctx;
+	struct perftest_parameters	*user_param;
+	volatile int			*ready;
+	volatile int			*start;
+	cycles_t			*reg_cycles;
+	cycles_t			*dereg_cycles;
+	int				flags;
+	int				result;
+};
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *reg_mr_alloc_region(struct perftest_parameters *user_param, uint64_t *alloc_size)
+{
+	void *buf = NULL;
+
+	*alloc_size = ROUND_UP(user_param->size, user_param->cycle_buffer);
+
+	if (user_param->use_hugepages) {
+		#ifdef MAP_HUGETLB
+		*alloc_size = ROUND_UP(*alloc_size, HUGEPAGE_ALIGN);
+		buf = mmap(NULL, *alloc_size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (buf == MAP_FAILED) {
+			log_ebt("Failed to allocate hugepages. Please configure hugepages\n");
+			return NULL;
+		}
+		#else
+		log_ebt("hugetlbfs backing is not supported on this platform\n");
+		return NULL;
+		#endif
+	} else if (user_param->use_thp) {
+		#ifdef MADV_HUGEPAGE
+		*alloc_size = ROUND_UP(*alloc_size, HUGEPAGE_ALIGN);
+		if (posix_memalign(&buf, HUGEPAGE_ALIGN, *alloc_size))
+			return NULL;
+		if (madvise(buf, *alloc_size, MADV_HUGEPAGE))
+			log_err("madvise(MADV_HUGEPAGE) failed, region may use base pages\n");
+		#else
+		log_ebt("Transparent huge pages are not supported on this platform\n");
+		return NULL;
+		#endif
+	} else {
+		if (posix_memalign(&buf, user_param->cycle_buffer, *alloc_size))
+			return NULL;
+	}
+
+	/* Fault the pages in so registration measures pinning, not page faults */
+	memset(buf, 0, *alloc_size);
+	return buf;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void reg_mr_free_region(struct perftest_parameters *user_param, void *buf, uint64_t alloc_size)
+{
+	#ifdef MAP_HUGETLB
+	if (user_param->use_hugepages) {
+		munmap(buf, alloc_size);
+		return;
+	}
+	#endif
+	free(buf);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *reg_mr_thread_func(void *arg)
+{
+	struct reg_mr_thread *thread = arg;
+	struct perftest_parameters *user_param = thread->user_param;
+	struct ibv_mr *mr;
+	uint64_t alloc_size = 0;
+	uint64_t i;
+	cycles_t start, end;
+	void *buf;
+
+	buf = reg_mr_alloc_region(user_param, &alloc_size);
+	if (!buf) {
+		log_ebt("Couldn't allocate region of %" PRIu64 " bytes\n", user_param->size);
+		thread->result = FAILURE;
+	}
+
+	/* Start all the threads together, the main thread opens the gate */
+	__sync_fetch_and_add(thread->ready, 1);
+	while (*thread->start == 0)
+		;
+
+	if (thread->result || *thread->start < 0) {
+		if (buf)
+			reg_mr_free_region(user_param, buf, alloc_size);
+		return NULL;
+	}
+
+	for (i = 0; i < user_param->iters; i++) {
+		start = get_cycles();
+		mr = ibv_reg_mr(thread->ctx->pd, buf, user_param->size, thread->flags);
+		end = get_cycles();
+		if (!mr) {
+			log_ebt("Couldn't register MR of %" PRIu64 " bytes - %s\n",
+				user_param->size, strerror(errno));
+			thread->result = FAILURE;
+			break;
+		}
+		thread->reg_cycles[i] = end - start;
+
+		start = get_cycles();
+		if (ibv_dereg_mr(mr)) {
+			log_ebt("Failed to deregister MR\n");
+			thread->result = FAILURE;
+			break;
+		}
+		thread->dereg_cycles[i] = get_cycles() - start;
+	}
+
+	reg_mr_free_region(user_param, buf, alloc_size);
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_iter_reg_mr(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		    struct reg_mr_report_data *rep)
+{
+	struct reg_mr_thread	*threads;
+	volatile int		ready = 0;
+	volatile int		start_flag = 0;
+	cycles_t		start = 0;
+	int			flags = IBV_ACCESS_LOCAL_WRITE;
+	int			i, created = 0;
+	int			return_value = SUCCESS;
+
+	FUNCTION_ENTER;
+	#ifdef HAVE_EX_ODP
+	if (user_param->use_odp) {
+		if (!check_odp_support(ctx))
+			return FAILURE;
+		flags |= IBV_ACCESS_ON_DEMAND;
+	}
+	#endif
+	flags |= get_mr_access_flags(user_param);
+
+	ALLOCATE(threads, struct reg_mr_thread, user_param->num_threads);
+	memset(threads, 0, sizeof(struct reg_mr_thread) * user_param->num_threads);
+
+	/* Each thread reports into its own slice of the samples arrays */
+	rep->size = user_param->size;
+	rep->samples = user_param->iters * user_param->num_threads;
+
+	for (i = 0; i < user_param->num_threads; i++) {
+		threads[i].ctx = ctx;
+		threads[i].user_param = user_param;
+		threads[i].ready = &ready;
+		threads[i].start = &start_flag;
+		threads[i].reg_cycles = rep->reg_cycles + i * user_param->iters;
+		threads[i].dereg_cycles = rep->dereg_cycles + i * user_param->iters;
+		threads[i].flags = flags;
+
+		if (pthread_create(&threads[i].thread, NULL, reg_mr_thread_func, &threads[i])) {
+			log_ebt("Failed to create thread %d\n", i);
+			return_value = FAILURE;
+			break;
+		}
+		created++;
+	}
+
+	/* let the created threads exit if not all of them could start */
+	if (return_value != SUCCESS) {
+		start_flag = -1;
+		goto cleaning;
+	}
+
+	while (ready < created)
+		;
+
+	start = get_cycles();
+	start_flag = 1;
+
+cleaning:
+	for (i = 0; i < created; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].result)
+			return_value = FAILURE;
+	}
+	if (return_value == SUCCESS)
+		rep->test_cycles = get_cycles() - start;
+
+	free(threads);
+	return return_value;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+struct qp_rate_thread {
+	pthread_t			thread;
+	struct pingpong_context		*ctx;
+	struct perftest_parameters	user_param;
+	struct pingpong_dest		dest;
+	volatile int			*ready;
+	volatile int			*start;
+	cycles_t			*verb_cycles[QP_LIFECYCLE_VERBS];
+	struct ibv_qp			**qp;
+	int				first_qp;
+	int				num_of_qps;
+	int				result;
+};
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+static void *qp_rate_thread_func(void *arg)
+{
+	struct qp_rate_thread *thread = arg;
+	struct perftest_parameters *user_param = &thread->user_param;
+	struct ibv_qp_attr attr;
+	cycles_t start, *cycles;
+	uint64_t round;
+	int i, created = 0;
+
+	/* Start all the threads together, the main thread opens the gate */
+	__sync_fetch_and_add(thread->ready, 1);
+	while (*thread->start == 0)
+		;
+
+	if (*thread->start < 0)
+		return NULL;
+
+	for (round = 0; round < user_param->iters; round++) {
+		/* QP i of this thread reports into sample first_qp + i of the round */
+		cycles = thread->verb_cycles[QP_CREATE] + round * user_param->num_of_qps + thread->first_qp;
+		for (created = 0; created < thread->num_of_qps; created++) {
+			start = get_cycles();
+			thread->qp[created] = ctx_qp_create(thread->ctx, user_param, created);
+			cycles[created] = get_cycles() - start;
+			if (!thread->qp[created]) {
+				log_ebt("Couldn't create QP - %s\n", strerror(errno));
+				goto error;
+			}
+		}
+
+		cycles = thread->verb_cycles[QP_TO_INIT] + round * user_param->num_of_qps + thread->first_qp;
+		for (i = 0; i < thread->num_of_qps; i++) {
+			start = get_cycles();
+			if (ctx_modify_qp_to_init(thread->qp[i], user_param, i))
+				goto error;
+			cycles[i] = get_cycles() - start;
+		}
+
+		/* Every QP is connected to itself, the test is local */
+		cycles = thread->verb_cycles[QP_TO_RTR] + round * user_param->num_of_qps + thread->first_qp;
+		for (i = 0; i < thread->num_of_qps; i++) {
+			memset(&attr, 0, sizeof(struct ibv_qp_attr));
+			thread->dest.qpn = thread->qp[i]->qp_num;
+			start = get_cycles();
+			if (ctx_modify_qp_to_rtr(thread->qp[i], &attr, user_param, &thread->dest, &thread->dest, i)) {
+				log_ebt("Failed to modify QP %d to RTR\n", thread->qp[i]->qp_num);
+				goto error;
+			}
+			cycles[i] = get_cycles() - start;
+		}
+
+		cycles = thread->verb_cycles[QP_TO_RTS] + round * user_param->num_of_qps + thread->first_qp;
+		for (i = 0; i < thread->num_of_qps; i++) {
+			memset(&attr, 0, sizeof(struct ibv_qp_attr));
+			start = get_cycles();
+			if (ctx_modify_qp_to_rts(thread->qp[i], &attr, user_param, &thread->dest, &thread->dest)) {
+				log_ebt("Failed to modify QP %d to RTS\n", thread->qp[i]->qp_num);
+				goto error;
+			}
+			cycles[i] = get_cycles() - start;
+		}
+
+		cycles = thread->verb_cycles[QP_DESTROY] + round * user_param->num_of_qps + thread->first_qp;
+		for (i = 0; i < thread->num_of_qps; i++) {
+			start = get_cycles();
+			if (ibv_destroy_qp(thread->qp[i])) {
+				log_ebt("Failed to destroy QP - %s\n", strerror(errno));
+				thread->result = FAILURE;
+			}
+			cycles[i] = get_cycles() - start;
+		}
+
+		if (thread->result)
+			return NULL;
+	}
+
+	return NULL;
+
+error:
+	thread->result = FAILURE;
+	for (i = 0; i < created; i++)
+		ibv_destroy_qp(thread->qp[i]);
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_iter_qp_rate(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		     struct qp_rate_report_data *rep)
+{
+	struct qp_rate_thread	*threads;
+	struct pingpong_dest	dest;
+	volatile int		ready = 0;
+	volatile int		start_flag = 0;
+	cycles_t		start = 0;
+	int			i, v, created = 0;
+	int			return_value = SUCCESS;
+
+	FUNCTION_ENTER;
+	/* All the QPs are looped back to the local port */
+	memset(&dest, 0, sizeof(struct pingpong_dest));
+	dest.lid = ctx_get_local_lid(ctx->context, user_param->ib_port);
+	dest.out_reads = user_param->out_reads;
+	if (user_param->gid_index != -1) {
+		if (ibv_query_gid(ctx->context, user_param->ib_port, user_param->gid_index, &dest.gid)) {
+			log_ebt("Couldn't read GID index %d\n", user_param->gid_index);
+			return FAILURE;
+		}
+	}
+
+	ALLOCATE(threads, struct qp_rate_thread, user_param->num_threads);
+	memset(threads, 0, sizeof(struct qp_rate_thread) * user_param->num_threads);
+
+	rep->num_qps = user_param->num_of_qps;
+	rep->samples = user_param->iters * user_param->num_of_qps;
+
+	for (i = 0; i < user_param->num_threads; i++) {
+		/* ctx_qp_create may update the parameters, keep a copy per thread */
+		threads[i].ctx = ctx;
+		memcpy(&threads[i].user_param, user_param, sizeof(struct perftest_parameters));
+		threads[i].dest = dest;
+		threads[i].ready = &ready;
+		threads[i].start = &start_flag;
+		for (v = 0; v < QP_LIFECYCLE_VERBS; v++)
+			threads[i].verb_cycles[v] = rep->verb_cycles[v];
+		threads[i].first_qp = (int)((long)user_param->num_of_qps * i / user_param->num_threads);
+		threads[i].num_of_qps = (int)((long)user_param->num_of_qps * (i + 1) / user_param->num_threads) -
+					threads[i].first_qp;
+		ALLOCATE(threads[i].qp, struct ibv_qp*, threads[i].num_of_qps);
+
+		if (pthread_create(&threads[i].thread, NULL, qp_rate_thread_func, &threads[i])) {
+			log_ebt("Failed to create thread %d\n", i);
+			free(threads[i].qp);
+			return_value = FAILURE;
+			break;
+		}
+		created++;
+	}
+
+	/* let the created threads exit if not all of them could start */
+	if (return_value != SUCCESS) {
+		start_flag = -1;
+		goto cleaning;
+	}
+
+	while (ready < created)
+		;
+
+	start = get_cycles();
+	start_flag = 1;
+
+cleaning:
+	for (i = 0; i < created; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].result)
+			return_value = FAILURE;
+		free(threads[i].qp);
+	}
+	if (return_value == SUCCESS)
+		rep->test_cycles = get_cycles() - start;
+
+	free(threads);
+	return return_value;
+}
+
 
 /******************************************************************************
 *
@@ -5201,7 +7790,8 @@ int rdma_cm_allocate_nodes(struct pingpong_context *ctx,
 		ctx->cma_master.nodes[i].id = i;
 		if (user_param->machine == CLIENT) {
 			rc = rdma_create_id(ctx->cma_master.channel,
-				&ctx->cma_master.nodes[i].cma_id, NULL, hints->ai_port_space);
+				&ctx->cma_master.nodes[i].cma_id, &ctx->cma_master.nodes[i],
+				hints->ai_port_space);
 			if (rc) {
 				error_message = "Failed to create RDMA CM ID.";
 				goto error;
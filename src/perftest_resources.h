@@ -143,6 +143,13 @@ struct cma_node {
 	uint32_t remote_qkey;
 	int id;
 	int connected;
+	/* client side timestamps of the connection phases */
+	cycles_t resolve_start;
+	cycles_t addr_resolved;
+	cycles_t route_resolved;
+	cycles_t qp_created;
+	cycles_t connect_sent;
+	cycles_t established;
 };
 
 /* Represents RDMA CM management needed information */
@@ -153,6 +160,107 @@ struct cma {
 	int connection_index;
 	int connects_left;
 	int disconnects_left;
+	int resolve_index;
+	int storm_round;
+};
+
+/* Raw Ethernet packet template engine, see raw_ethernet_resources.h */
+struct pkt_template;
+/* Raw Ethernet receive checksum counters, see raw_ethernet_checksum.h */
+struct csum_stats;
+/* Raw Ethernet capture file writer, see raw_ethernet_pcap.h */
+struct pcap_writer;
+struct metrics_exporter;
+
+/* Counters of one RSS receive queue, written only by the queue's worker thread */
+struct rss_queue_stats {
+	uint64_t	rcnt;
+	uint64_t	sampled;
+	cycles_t	first_rx;
+	cycles_t	last_rx;
+	int		cpu;
+	int		result;
+} __attribute__((aligned(64)));
+
+/* Counters of one direction of --bi_threads, written only by its thread */
+struct bi_thread_stats {
+	uint64_t	cnt;
+	uint64_t	sampled;
+	cycles_t	first;
+	cycles_t	last;
+	int		cpu;
+	int		result;
+} __attribute__((aligned(64)));
+
+/* The per QP arrays of a test, carved from one allocation by alloc_ctx */
+struct qp_arena {
+	void		*base;
+	size_t		size;
+	size_t		used;
+	size_t		align;
+	int		hugepages;
+};
+
+/* What a --daemon server keeps between the sessions it serves: the buffer
+ * and its MR, and the QPs and their CQ, reset until a session fits them.
+ */
+struct session_pool {
+	void		*buf;
+	struct ibv_mr	*mr;
+	uint64_t	buf_size;
+	struct ibv_cq	*cq;
+	int		cq_size;
+	struct ibv_qp	**qp;
+	int		num_qps;
+	int		connection_type;
+	int		tx_depth;
+	int		rx_depth;
+	/* what the last ctx_init_session took from the pool */
+	int		kept_buf;
+	int		kept_qps;
+};
+
+#define BI_TX	(0)
+#define BI_RX	(1)
+
+/* One forwarding queue of --mac_fwd: a QP with its own CQs and the counters
+ * of the thread that drives it.
+ */
+struct fwd_queue {
+	struct ibv_cq	*send_cq;
+	struct ibv_cq	*recv_cq;
+	uint64_t	rcnt;
+	uint64_t	forwarded;
+	uint64_t	dropped;
+	uint64_t	sampled;
+	/* cycles from the receive completion to the send completion */
+	cycles_t	lat_sum;
+	cycles_t	lat_max;
+	cycles_t	first_rx;
+	cycles_t	last_tx;
+	int		cpu;
+	int		result;
+} __attribute__((aligned(64)));
+
+/* Completion wait of events mode, the first slot is the send CQ */
+struct event_waiter {
+	int		learn;
+	/* current spin budget and the learned mean time to a completion */
+	cycles_t	spin_cycles;
+	cycles_t	max_spin_cycles;
+	double		wait_avg;
+	double		cpu_mhz;
+	int		armed[2];
+	unsigned int	unacked[2];
+	uint64_t	spin_hits;
+	uint64_t	sleep_hits;
+	uint64_t	sleeps;
+	uint64_t	timeouts;
+	cycles_t	sleep_cycles;
+	cycles_t	wake_cycles;
+	/* process CPU time and clock at the first wait */
+	cycles_t	start_cycles;
+	double		start_cpu_time;
 };
 
 struct pingpong_context {
@@ -170,6 +278,10 @@ struct pingpong_context {
 	struct ibv_mr				**mr;
 	struct ibv_cq				*send_cq;
 	struct ibv_cq				*recv_cq;
+	#ifdef HAVE_HW_TIMESTAMP
+	struct ibv_cq_ex			*send_cq_ex;
+	struct ibv_cq_ex			*recv_cq_ex;
+	#endif
 	void					**buf;
 	struct ibv_ah				**ah;
 	struct ibv_qp				**qp;
@@ -212,6 +324,25 @@ struct pingpong_context {
 	int					cache_line_size;
 	int					cycle_buffer;
 	int					rposted;
+	struct pkt_template			*pkt_tmpl;
+	struct csum_stats			*csum_stats;
+	struct pcap_writer			*pcap;
+	struct fwd_queue			*fwd_queue;
+	struct metrics_exporter			*exporter;
+	struct event_waiter			*waiter;
+	struct bi_thread_stats			*bi_stats;
+	struct qp_arena				arena;
+	struct session_pool			pool;
+	/* send slots of the cycle buffer, see ctx_next_send_slot */
+	uint64_t				send_slot_mask;
+	uint64_t				send_slot_stride;
+	uint32_t				*sig_countdown;
+	#ifdef HAVE_RSS
+	struct ibv_wq				**wq;
+	struct ibv_cq				**wq_cq;
+	struct ibv_rwq_ind_table		*rwq_ind_table;
+	struct rss_queue_stats			*rss_stats;
+	#endif
 	#ifdef HAVE_XRCD
 	struct ibv_xrcd				*xrc_domain;
 	int 					fd;
@@ -345,6 +476,41 @@ int verify_params_with_device_context(struct ibv_context *ctx,
 				      struct perftest_parameters *user_param);
 
 
+/* ctx_init_session
+ *
+ * Description :
+ *		Creates the test resources of a session of a --daemon server, taking
+ *		the buffer, the CQ and the QPs from the pool of the earlier sessions
+ *		when they fit, and moves the QPs to INIT. alloc_ctx comes first.
+ *
+ * Parameters :
+ *	ctx - The resources of the daemon, its device context and PD are kept.
+ * 	user_param - the perftest parameters of the session.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int ctx_init_session(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* ctx_end_session
+ *
+ * Description :
+ *		Resets the QPs of a session back to the pool and frees what
+ *		alloc_ctx allocated for it.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int ctx_end_session(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* destroy_session_pool
+ *
+ * Description :
+ *		Destroys the pool, the PD and the device context of a --daemon server
+ *		or of a side of a --loopback test.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int destroy_session_pool(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
 /* ctx_init
  *
  * Description :
@@ -544,6 +710,27 @@ int ctx_set_credit_wqes(struct pingpong_context *ctx,
  */
 int run_iter_bw(struct pingpong_context *ctx,struct perftest_parameters *user_param);
 
+/* run_autotune
+ *
+ * Description :
+ *
+ *	Searches the QPs, TX depth, post list, CQ moderation, inline size and
+ *	post send API for the highest message rate, by coordinate descent over
+ *	short blocks of run_iter_bw on the same connection, within the
+ *	--autotune time. The resources were created with the largest values,
+ *	so each block only rebuilds the WQEs. Ends with a regular run of the
+ *	best configuration, to be reported by print_report_bw.
+ *
+ * Parameters :
+ *
+ *	ctx     - Test Context.
+ *	user_param  - user_parameters struct for this test.
+ *	rem_dest  - The remote destinations, to rebuild the WQEs.
+ *
+ */
+int run_autotune(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		 struct pingpong_dest *rem_dest);
+
 /* run_iter_bw_infinitely
  *
  * Description :
@@ -586,6 +773,23 @@ int run_iter_bw_infinitely_server(struct pingpong_context *ctx, struct perftest_
  */
 int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters *user_param);
 
+/* run_iter_rss_server.
+ *
+ * Description :
+ *
+ *	Receiver of a raw Ethernet RSS test. Every receive queue has its own CQ
+ *	and is drained by its own thread, pinned to one of the CPUs the process
+ *	may run on. In iterations mode the test ends after iters * num_of_qps
+ *	packets were received on all the queues together.
+ *
+ * Parameters :
+ *
+ *	ctx     - Test Context.
+ *	user_param  - user_parameters struct for this test.
+ *
+ */
+int run_iter_rss_server(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
 /* run_iter_bi.
  *
  * Description :
@@ -600,6 +804,33 @@ int run_iter_bw_server(struct pingpong_context *ctx, struct perftest_parameters
  */
 int run_iter_bi(struct pingpong_context *ctx,struct perftest_parameters *user_param);
 
+/* print_bi_threads_report.
+ *
+ * Description :
+ *
+ *	Prints the BW and message rate of the sends and the receives of a
+ *	--bi_threads test, each measured by its own thread.
+ *
+ */
+void print_bi_threads_report(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* run_iter_lat_pipelined
+ *
+ * Description :
+ *
+ *  Latency test of write, send and read with --lat_depth requests in flight.
+ *  Request k uses slot k % depth of the buffers and, for write, the sequence
+ *  byte k / depth + 1 in the last byte of the slot. The server replies to the
+ *  requests in their order and the client times every request from its post
+ *  to its reply.
+ *
+ * Parameters :
+ *
+ *	ctx     - Test Context.
+ *	user_param  - user_parameters struct for this test.
+ */
+int run_iter_lat_pipelined(struct pingpong_context *ctx,struct perftest_parameters *user_param);
+
 /* run_iter_lat_write
  *
  * Description :
@@ -667,6 +898,32 @@ int run_iter_lat_burst(struct pingpong_context *ctx, struct perftest_parameters
 
 int run_iter_lat_burst_server(struct pingpong_context *ctx, struct perftest_parameters *user_param);
 
+/* event_waiter_create
+ *
+ * Description : Sets up the completion wait of events mode on the channel of
+ *	the context.
+ *
+ * Parameters :
+ *
+ *  ctx     - Test Context.
+ *  user_param  - user_parameters struct for this test.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int event_waiter_create(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* event_waiter_destroy
+ *
+ * Description : Prints how the completions were waited for, acks the events
+ *	left and frees the waiter. Must run before the CQs are destroyed.
+ *
+ * Parameters :
+ *
+ *  ctx     - Test Context.
+ *  user_param  - user_parameters struct for this test.
+ */
+void event_waiter_destroy(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
 /* ctx_get_local_lid .
  *
  * Description :
@@ -683,35 +940,23 @@ int run_iter_lat_burst_server(struct pingpong_context *ctx, struct perftest_para
  */
 uint16_t ctx_get_local_lid(struct ibv_context *context, int ib_port);
 
-/* ctx_notify_events
+/* ctx_event_poll_cq
  *
- * Description : Prepare the test to work with events instead of polling the CQ.
- *	This is the way to work in un interipted mode.
+ * Description : Polls a CQ in events mode. Busy polls it for the spin budget
+ *	of --event_spin, then arms it and sleeps on the completion channel until
+ *	its event. The events are acked in batches. Returns 0 when the sleep times
+ *	out or is interrupted, so duration tests see their end.
  *
  * Parameters :
- *  channel - (Mandotory) the created event channel.
  *
- * Return Value : SUCCESS, FAILURE.
+ *  ctx     - Test Context.
+ *  cq      - The send or receive CQ of the context.
+ *  n       - Max completions to return.
+ *  wc      - Array of at least n work completions.
+ *
+ * Return Value : The number of completions, negative on failure.
  */
-static __inline int ctx_notify_events(struct ibv_comp_channel *channel)
-{
-
-	struct ibv_cq       *ev_cq;
-	void                *ev_ctx;
-
-	if (ibv_get_cq_event(channel,&ev_cq,&ev_ctx)) {
-		fprintf(stderr, "Failed to get cq_event\n");
-		return 1;
-	}
-
-	ibv_ack_cq_events(ev_cq,1);
-
-	if (ibv_req_notify_cq(ev_cq, 0)) {
-		fprintf(stderr, "Couldn't request CQ notification\n");
-		return 1;
-	}
-	return 0;
-}
+int ctx_event_poll_cq(struct pingpong_context *ctx, struct ibv_cq *cq, int n, struct ibv_wc *wc);
 
 static __inline void increase_rem_addr(struct ibv_send_wr *wr,int size,uint64_t scnt,uint64_t prim_addr,VerbType verb, int cache_line_size, int cycle_buffer)
 {
@@ -754,6 +999,42 @@ static __inline void increase_loc_addr(struct ibv_sge *sg,int size,uint64_t rcnt
 
 }
 
+/* ctx_next_send_slot.
+ *
+ * Description :
+ *	Prepares the WR of a QP with post_list 1 for its next post: points it at
+ *	the next send slot of the cycle buffer, local and remote, and asks for a
+ *	completion on every cq_mod-th post and on the last one. The slots are a
+ *	power of two laid out by ctx_set_send_wqes, walked with a mask, so there
+ *	is no division on the way.
+ *
+ * Parameters :
+ *		ctx - Test Context.
+ *		index - The QP.
+ *		loc_offset - Offset of the local slots, of the flow of raw ethernet.
+ *		user_param - user_parameters struct for this test.
+ */
+static __inline void ctx_next_send_slot(struct pingpong_context *ctx, int index, uint64_t loc_offset,
+					struct perftest_parameters *user_param)
+{
+	struct ibv_send_wr *wr = &ctx->wr[index];
+	uint64_t slot = (ctx->scnt[index] & ctx->send_slot_mask) * ctx->send_slot_stride;
+
+	wr->sg_list->addr = ctx->my_addr[index] + loc_offset + slot;
+	if (user_param->verb == ATOMIC)
+		wr->wr.atomic.remote_addr = ctx->rem_addr[index] + slot;
+	else if (user_param->verb != SEND)
+		wr->wr.rdma.remote_addr = ctx->rem_addr[index] + slot;
+
+	if (--ctx->sig_countdown[index] == 0 ||
+	    (user_param->test_type == ITERATIONS && ctx->scnt[index] == user_param->iters - 1)) {
+		wr->send_flags |= IBV_SEND_SIGNALED;
+		ctx->sig_countdown[index] = user_param->cq_mod;
+	} else {
+		wr->send_flags &= ~IBV_SEND_SIGNALED;
+	}
+}
+
 /* catch_alarm.
  *
  * Description :
@@ -765,6 +1046,22 @@ static __inline void increase_loc_addr(struct ibv_sge *sg,int size,uint64_t rcnt
  */
 void catch_alarm(int sig);
 
+/* get_nth_allowed_cpu.
+ *
+ * Description :
+ *	Returns the n-th (modulo their number) CPU the process is allowed to run
+ *	on, so the worker threads of a test can be placed with taskset.
+ *	Returns -1 if the affinity mask can't be read.
+ */
+int get_nth_allowed_cpu(int n);
+
+/* pin_thread_to_cpu.
+ *
+ * Description :
+ *	Binds the calling thread to one CPU, does nothing for cpu < 0.
+ */
+int pin_thread_to_cpu(int cpu);
+
 void check_alive(int sig);
 
 void print_bw_infinite_mode();
@@ -844,15 +1141,66 @@ int alloc_hugepage_region (struct pingpong_context *ctx, int qp_index);
  *
  * Description :
  *
- *	The main testing method for Flow steering creation
+ *	The main testing method for Flow steering creation.
+ *	In iterations mode the QPs are split between user_param->num_threads
+ *	threads. The flows are inserted, optionally deleted and re-inserted one by
+ *	one at full table size (--fs_churn), and then deleted. Every phase is timed
+ *	on its own, the insertion samples are kept in insertion order.
  *
  * Parameters :
  *
  *	ctx		- Test Context.
  *	user_param	- user_parameters struct for this test.
+ *	rep		- Deletion and churn samples, every array must hold
+ *			  iters * num_of_qps samples. Not used in duration mode.
+ *
+ */
+int run_iter_fs(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		struct fs_rate_report_data *rep);
+
+/* run_iter_reg_mr
+ *
+ * Description :
+ *
+ *	The main testing method for memory registration cost.
+ *	Every thread allocates its own region of user_param->size bytes, with the
+ *	requested page backing, and registers/deregisters it user_param->iters times.
+ *	rep->reg_cycles and rep->dereg_cycles must hold iters * num_threads samples.
+ *
+ * Parameters :
+ *
+ *	ctx		- Test Context.
+ *	user_param	- user_parameters struct for this test.
+ *	rep		- Report data, filled with the samples and the total test time.
+ *
+ * Return Value : SUCCESS, FAILURE.
+ *
+ */
+int run_iter_reg_mr(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		    struct reg_mr_report_data *rep);
+
+/* run_iter_qp_rate
+ *
+ * Description :
+ *
+ *	The main testing method for the QP lifecycle rate.
+ *	Every round creates user_param->num_of_qps QPs, split between the threads,
+ *	moves them to INIT, RTR and RTS (each QP is connected to itself) and
+ *	destroys them. Every verb is timed on its own, a verb is called on all the
+ *	QPs of a thread before the next one starts.
+ *	Every rep->verb_cycles array must hold iters * num_of_qps samples.
+ *
+ * Parameters :
+ *
+ *	ctx		- Test Context.
+ *	user_param	- user_parameters struct for this test.
+ *	rep		- Report data, filled with the samples and the total test time.
+ *
+ * Return Value : SUCCESS, FAILURE.
  *
  */
-int run_iter_fs(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+int run_iter_qp_rate(struct pingpong_context *ctx, struct perftest_parameters *user_param,
+		     struct qp_rate_report_data *rep);
 
 /* rdma_cm_allocate_nodes:
 *
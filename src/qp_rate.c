@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2005 Mellanox Technologies Ltd.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "get_clock.h"
+#include "perftest_logging.h"
+#include "perftest_parameters.h"
+#include "perftest_resources.h"
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+int main(int argc, char *argv[])
+{
+	struct ibv_device		*ib_dev = NULL;
+	struct pingpong_context		ctx;
+	struct perftest_parameters	user_param;
+	struct report_options		report;
+	struct qp_rate_report_data	rep;
+	int				max_num_of_qps;
+	int				ret_parser, v;
+
+	/* init default values to user's parameters */
+	memset(&ctx, 0, sizeof(struct pingpong_context));
+	memset(&user_param, 0, sizeof(struct perftest_parameters));
+	memset(&report, 0, sizeof(struct report_options));
+	memset(&rep, 0, sizeof(struct qp_rate_report_data));
+
+	user_param.tst     = QP_RATE;
+	user_param.verb    = WRITE;
+	strncpy(user_param.version, VERSION, sizeof(user_param.version));
+	user_param.r_flag  = &report;
+
+	ret_parser = parser(&user_param, argv, argc);
+
+	if (ret_parser) {
+		if (ret_parser != VERSION_EXIT && ret_parser != HELP_EXIT) {
+			log_ebt( " Parser function exited with Error\n");
+		}
+		return FAILURE;
+	}
+
+	/* Finding the IB device selected (or default if no selected). */
+	ib_dev = ctx_find_dev(&user_param.ib_devname);
+	if (!ib_dev) {
+		log_ebt( "Unable to find the Infiniband/RoCE device\n");
+		return FAILURE;
+	}
+
+	/* Getting the relevant context from the device */
+	ctx.context = ibv_open_device(ib_dev);
+	if (!ctx.context) {
+		log_ebt( "Couldn't get context for the device\n");
+		return FAILURE;
+	}
+
+	/* Verify user parameters that require the device context,
+	 * the MTU and GID are needed to move the QPs to RTR.
+	 */
+	if (check_link_and_mtu(ctx.context, &user_param)) {
+		log_ebt( "Couldn't get context for the device\n");
+		return FAILURE;
+	}
+
+	/* create the PD and CQ, the QPs are created by the test itself */
+	if (ctx_init(&ctx, &user_param)) {
+		log_ebt( "Couldn't create IB resources\n");
+		return FAILURE;
+	}
+
+	/* Print basic test information. */
+	ctx_print_test_info(&user_param);
+
+	for (v = 0; v < QP_LIFECYCLE_VERBS; v++)
+		ALLOCATE(rep.verb_cycles[v], cycles_t, user_param.iters * user_param.num_of_qps);
+
+	if (user_param.output == FULL_VERBOSITY) {
+		printf("%s", RESULT_FMT_QP_RATE);
+		printf(RESULT_EXT);
+	}
+
+	max_num_of_qps = user_param.num_of_qps;
+	if (user_param.test_method == RUN_ALL)
+		user_param.num_of_qps = user_param.num_threads;
+
+	while (1) {
+		if (run_iter_qp_rate(&ctx, &user_param, &rep)) {
+			log_ebt( "QP rate test exited with Error\n");
+			return FAILURE;
+		}
+
+		print_report_qp_rate(&user_param, &rep);
+
+		if (user_param.num_of_qps == max_num_of_qps)
+			break;
+		/* the last step of the sweep is the requested number of QPs */
+		user_param.num_of_qps <<= 1;
+		if (user_param.num_of_qps > max_num_of_qps)
+			user_param.num_of_qps = max_num_of_qps;
+	}
+
+	for (v = 0; v < QP_LIFECYCLE_VERBS; v++)
+		free(rep.verb_cycles[v]);
+
+	if (destroy_ctx(&ctx, &user_param)) {
+		log_ebt( "Failed to destroy_ctx\n");
+		return FAILURE;
+	}
+
+	if (user_param.output == FULL_VERBOSITY)
+		printf(RESULT_LINE);
+
+	return SUCCESS;
+}
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include "raw_ethernet_resources.h"
+#include "raw_ethernet_checksum.h"
+
+/* SIMD blocks summed into the 32 bit lanes before they are flushed,
+ * every lane gets two 16 bit words per block so it can't overflow.
+ */
+#define CSUM_FLUSH_BLOCKS (4096)
+
+#define UDP_CSUM_OFFSET (6)
+#define TCP_CSUM_OFFSET (16)
+
+static uint32_t csum_partial_resolve(const void *buf, size_t len, uint32_t sum);
+
+static uint32_t (*csum_partial_func)(const void *buf, size_t len, uint32_t sum) = csum_partial_resolve;
+static const char *csum_impl = "scalar";
+
+static uint32_t csum_fold64(uint64_t sum)
+{
+	while (sum >> 32)
+		sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+
+	return (uint32_t)sum;
+}
+
+/*
+ * One's complement addition is independent of the word size and the byte
+ * order (RFC 1071), so 32 bit words are summed into a 64 bit accumulator.
+ */
+static uint32_t csum_partial_scalar(const void *buf, size_t len, uint32_t sum)
+{
+	const uint8_t *p = buf;
+	uint64_t total = sum;
+	uint32_t word;
+	uint16_t half = 0;
+
+	while (len >= 4) {
+		memcpy(&word, p, 4);
+		total += word;
+		p += 4;
+		len -= 4;
+	}
+	if (len >= 2) {
+		memcpy(&half, p, 2);
+		total += half;
+		p += 2;
+		len -= 2;
+	}
+	if (len) {
+		half = 0;
+		memcpy(&half, p, 1);
+		total += half;
+	}
+
+	return csum_fold64(total);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1")))
+static uint32_t csum_partial_sse41(const void *buf, size_t len, uint32_t sum)
+{
+	const uint8_t *p = buf;
+	uint64_t total = sum;
+	uint32_t lanes[4];
+	size_t blocks, i;
+	__m128i acc, v;
+
+	while (len >= 16) {
+		blocks = len / 16;
+		if (blocks > CSUM_FLUSH_BLOCKS)
+			blocks = CSUM_FLUSH_BLOCKS;
+
+		acc = _mm_setzero_si128();
+		for (i = 0; i < blocks; i++, p += 16) {
+			v = _mm_loadu_si128((const __m128i*)p);
+			acc = _mm_add_epi32(acc, _mm_cvtepu16_epi32(v));
+			acc = _mm_add_epi32(acc, _mm_cvtepu16_epi32(_mm_srli_si128(v, 8)));
+		}
+		len -= blocks * 16;
+
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		for (i = 0; i < 4; i++)
+			total += lanes[i];
+	}
+
+	return csum_partial_scalar(p, len, csum_fold64(total));
+}
+
+__attribute__((target("avx2")))
+static uint32_t csum_partial_avx2(const void *buf, size_t len, uint32_t sum)
+{
+	const uint8_t *p = buf;
+	uint64_t total = sum;
+	uint32_t lanes[8];
+	size_t blocks, i;
+	__m256i acc, v;
+
+	while (len >= 32) {
+		blocks = len / 32;
+		if (blocks > CSUM_FLUSH_BLOCKS)
+			blocks = CSUM_FLUSH_BLOCKS;
+
+		acc = _mm256_setzero_si256();
+		for (i = 0; i < blocks; i++, p += 32) {
+			v = _mm256_loadu_si256((const __m256i*)p);
+			acc = _mm256_add_epi32(acc, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)));
+			acc = _mm256_add_epi32(acc, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)));
+		}
+		len -= blocks * 32;
+
+		_mm256_storeu_si256((__m256i*)lanes, acc);
+		for (i = 0; i < 8; i++)
+			total += lanes[i];
+	}
+
+	return csum_partial_sse41(p, len, csum_fold64(total));
+}
+#elif defined(__aarch64__)
+static uint32_t csum_partial_neon(const void *buf, size_t len, uint32_t sum)
+{
+	const uint8_t *p = buf;
+	uint64_t total = sum;
+	size_t blocks, i;
+	uint32x4_t acc;
+
+	while (len >= 16) {
+		blocks = len / 16;
+		if (blocks > CSUM_FLUSH_BLOCKS)
+			blocks = CSUM_FLUSH_BLOCKS;
+
+		acc = vdupq_n_u32(0);
+		for (i = 0; i < blocks; i++, p += 16)
+			acc = vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(p)));
+		len -= blocks * 16;
+
+		total += vaddlvq_u32(acc);
+	}
+
+	return csum_partial_scalar(p, len, csum_fold64(total));
+}
+#endif
+
+static void csum_select(void)
+{
+	csum_partial_func = csum_partial_scalar;
+	csum_impl = "scalar";
+
+	#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		csum_partial_func = csum_partial_avx2;
+		csum_impl = "avx2";
+	} else if (__builtin_cpu_supports("sse4.1")) {
+		csum_partial_func = csum_partial_sse41;
+		csum_impl = "sse4.1";
+	}
+	#elif defined(__aarch64__)
+	csum_partial_func = csum_partial_neon;
+	csum_impl = "neon";
+	#endif
+}
+
+static uint32_t csum_partial_resolve(const void *buf, size_t len, uint32_t sum)
+{
+	csum_select();
+
+	return csum_partial_func(buf, len, sum);
+}
+
+uint32_t csum_partial(const void *buf, size_t len, uint32_t sum)
+{
+	return csum_partial_func(buf, len, sum);
+}
+
+const char *csum_impl_name(void)
+{
+	if (csum_partial_func == csum_partial_resolve)
+		csum_select();
+
+	return csum_impl;
+}
+
+/*
+ * Sum of the pseudo header of the L4 segment that follows ip_header.
+ * Returns the L4 protocol, or 0 if the packet is not UDP/TCP.
+ */
+static uint8_t csum_pseudo_header(const uint8_t *ip_header, int is_ipv6, uint32_t ip_len,
+				  uint32_t *l4_offset, uint32_t *l4_len, uint32_t *sum)
+{
+	uint16_t pseudo[2];
+	uint8_t proto;
+
+	if (is_ipv6) {
+		const struct IP_V6_header *ip6 = (const struct IP_V6_header*)ip_header;
+
+		proto = ip6->nexthdr;
+		*l4_offset = sizeof(struct IP_V6_header);
+		*l4_len = ntohs(ip6->payload_len);
+		*sum = csum_partial(ip_header + offsetof(struct IP_V6_header, saddr), 32, 0);
+	} else {
+		const struct IP_V4_header *ip4 = (const struct IP_V4_header*)ip_header;
+
+		proto = ip4->protocol;
+		*l4_offset = ip4->ihl * 4;
+		*l4_len = ntohs(ip4->tot_len) - *l4_offset;
+		*sum = csum_partial(ip_header + offsetof(struct IP_V4_header, saddr), 8, 0);
+	}
+
+	if (proto != UDP_PROTOCOL && proto != TCP_PROTOCOL)
+		return 0;
+	if (*l4_offset + *l4_len > ip_len ||
+	    *l4_len < (proto == UDP_PROTOCOL ? sizeof(struct UDP_header) : sizeof(struct TCP_header)))
+		return 0;
+
+	pseudo[0] = htons(proto);
+	pseudo[1] = htons(*l4_len);
+	*sum = csum_partial(pseudo, sizeof(pseudo), *sum);
+
+	return proto;
+}
+
+void csum_set_l4(void *ip_header, int is_ipv6)
+{
+	uint32_t l4_offset, l4_len, sum;
+	uint16_t check = 0;
+	uint8_t *l4;
+	int check_offset;
+	uint8_t proto;
+
+	proto = csum_pseudo_header(ip_header, is_ipv6, UINT32_MAX, &l4_offset, &l4_len, &sum);
+	if (!proto)
+		return;
+
+	l4 = (uint8_t*)ip_header + l4_offset;
+	check_offset = (proto == UDP_PROTOCOL) ? UDP_CSUM_OFFSET : TCP_CSUM_OFFSET;
+	memcpy(l4 + check_offset, &check, sizeof(check));
+
+	check = csum_fold(csum_partial(l4, l4_len, sum));
+	/* zero means no checksum in UDP */
+	if (proto == UDP_PROTOCOL && !check)
+		check = 0xFFFF;
+	memcpy(l4 + check_offset, &check, sizeof(check));
+}
+
+void csum_validate_pkt(struct csum_stats *stats, const void *pkt,
+		uint32_t byte_len, int hw_csum_ok)
+{
+	const uint8_t *p = pkt;
+	uint32_t offset = sizeof(struct ETH_header);
+	uint32_t ip_len, l4_offset, l4_len, sum;
+	uint16_t eth_type, check;
+	int is_ipv6, bad = 0;
+	uint8_t proto;
+
+	if (byte_len < offset) {
+		stats->truncated++;
+		return;
+	}
+
+	memcpy(&eth_type, p + offsetof(struct ETH_header, eth_type), sizeof(eth_type));
+	if (eth_type == htons(VLAN_TPID)) {
+		offset = sizeof(struct ETH_vlan_header);
+		if (byte_len < offset) {
+			stats->truncated++;
+			return;
+		}
+		memcpy(&eth_type, p + offsetof(struct ETH_vlan_header, eth_type), sizeof(eth_type));
+	}
+
+	if (eth_type == htons(IP_ETHER_TYPE)) {
+		is_ipv6 = 0;
+	} else if (eth_type == htons(IP6_ETHER_TYPE)) {
+		is_ipv6 = 1;
+	} else {
+		stats->skipped++;
+		return;
+	}
+
+	stats->checked++;
+	p += offset;
+	ip_len = byte_len - offset;
+
+	if (is_ipv6) {
+		if (ip_len < sizeof(struct IP_V6_header) ||
+		    ntohs(((const struct IP_V6_header*)p)->payload_len) > ip_len - sizeof(struct IP_V6_header)) {
+			stats->truncated++;
+			return;
+		}
+	} else {
+		const struct IP_V4_header *ip4 = (const struct IP_V4_header*)p;
+
+		if (ip_len < sizeof(struct IP_V4_header) || ip4->ihl < 5 ||
+		    ip4->ihl * 4 > ip_len || ntohs(ip4->tot_len) > ip_len ||
+		    ntohs(ip4->tot_len) < ip4->ihl * 4) {
+			stats->truncated++;
+			return;
+		}
+		if (csum_compute(p, ip4->ihl * 4)) {
+			stats->bad_l3++;
+			bad = 1;
+		}
+	}
+
+	proto = csum_pseudo_header(p, is_ipv6, ip_len, &l4_offset, &l4_len, &sum);
+	if (proto) {
+		memcpy(&check, p + l4_offset + (proto == UDP_PROTOCOL ? UDP_CSUM_OFFSET : TCP_CSUM_OFFSET), sizeof(check));
+		if (proto == UDP_PROTOCOL && !check) {
+			stats->no_l4_csum++;
+		} else if (csum_fold(csum_partial(p + l4_offset, l4_len, sum))) {
+			stats->bad_l4++;
+			bad = 1;
+		}
+	}
+
+	if (bad && hw_csum_ok)
+		stats->hw_ok_sw_bad++;
+}
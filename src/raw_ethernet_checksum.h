@@ -0,0 +1,80 @@
+#ifndef RAW_ETHERNET_CHECKSUM_H
+#define RAW_ETHERNET_CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Receive side checksum validation counters.
+ */
+struct csum_stats {
+	uint64_t checked;
+	uint64_t bad_l3;
+	uint64_t bad_l4;
+	uint64_t truncated;
+	uint64_t no_l4_csum;
+	uint64_t skipped;
+	/* the HW reported a good checksum on a packet that failed validation */
+	uint64_t hw_ok_sw_bad;
+};
+
+/*
+ * Add the 16 bit words of buf to a 32 bit partial one's complement sum.
+ * Uses AVX2/SSE4.1 (selected at run time) or NEON when available.
+ */
+uint32_t csum_partial(const void *buf, size_t len, uint32_t sum);
+
+/*
+ * Fold a partial sum to 16 bits and complement it, in network order.
+ */
+static inline uint16_t csum_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return (uint16_t)~sum;
+}
+
+/*
+ * Update a checksum in network order after replacing words of the data
+ * it covers (RFC 1624).
+ */
+static inline void csum_replace(uint16_t *check, const uint16_t *old, const uint16_t *new, int words)
+{
+	uint32_t sum = (uint16_t)~*check;
+	int i;
+
+	for (i = 0; i < words; i++)
+		sum += (uint16_t)~old[i] + new[i];
+
+	*check = csum_fold(sum);
+}
+
+/*
+ * The Internet checksum of buf (RFC 1071).
+ */
+static inline uint16_t csum_compute(const void *buf, size_t len)
+{
+	return csum_fold(csum_partial(buf, len, 0));
+}
+
+/*
+ * Fill the UDP/TCP checksum of a packet that starts with ip_header,
+ * including the IPv4/IPv6 pseudo header.
+ * The L4 length is taken from the IP header.
+ */
+void csum_set_l4(void *ip_header, int is_ipv6);
+
+/*
+ * Verify the L3 and L4 checksums of a received Ethernet frame of byte_len
+ * bytes and update the counters. hw_csum_ok is the IBV_WC_IP_CSUM_OK flag.
+ */
+void csum_validate_pkt(struct csum_stats *stats, const void *pkt,
+		uint32_t byte_len, int hw_csum_ok);
+
+/*
+ * Name of the checksum implementation in use.
+ */
+const char *csum_impl_name(void);
+
+#endif
@@ -65,10 +65,12 @@ int main(int argc, char *argv[])
 	int				ret_parser;
 	struct perftest_parameters	user_param;
 	struct report_options		report;
+	struct fs_rate_report_data	rep;
 
 	/* init default values to user's parameters */
 	memset(&ctx, 0, sizeof(struct pingpong_context));
 	memset(&user_param, 0, sizeof(struct perftest_parameters));
+	memset(&rep, 0, sizeof(struct fs_rate_report_data));
 
 	user_param.tst     = FS_RATE;
 	user_param.verb    = SEND;
@@ -132,12 +134,25 @@ int main(int argc, char *argv[])
 	/* Print basic test information. */
 	ctx_print_test_info(&user_param);
 
-	if(run_iter_fs(&ctx, &user_param)){
+	/* Per flow deletion and churn samples, insertion uses tposted/tcompleted */
+	if (user_param.test_type == ITERATIONS) {
+		ALLOCATE(rep.destroy_cycles, cycles_t, user_param.iters * user_param.num_of_qps);
+		if (user_param.fs_churn) {
+			ALLOCATE(rep.churn_insert_cycles, cycles_t, user_param.iters * user_param.num_of_qps);
+			ALLOCATE(rep.churn_destroy_cycles, cycles_t, user_param.iters * user_param.num_of_qps);
+		}
+	}
+
+	if(run_iter_fs(&ctx, &user_param, &rep)){
 		log_ebt( "Unable to run iter fs rate\n");
 		return FAILURE;
 	}
 
-	print_report_fs_rate(&user_param);
+	print_report_fs_rate(&user_param, &rep);
+
+	free(rep.destroy_cycles);
+	free(rep.churn_insert_cycles);
+	free(rep.churn_destroy_cycles);
 
 	if (destroy_ctx(&ctx, &user_param)) {
 		log_ebt( "Failed to destroy_ctx\n");
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "perftest_logging.h"
+#include "raw_ethernet_pcap.h"
+
+#define PCAP_MAGIC_NSEC (0xa1b23c4d)
+#define PCAP_VERSION_MAJOR (2)
+#define PCAP_VERSION_MINOR (4)
+#define PCAP_LINKTYPE_ETHERNET (1)
+
+/* Written pages are handed to the kernel for writeback in batches of this size */
+#define PCAP_FLUSH_BATCH (4 * 1024 * 1024)
+/* A flush or file switch that holds the receive loop longer is a stall */
+#define PCAP_STALL_USEC (10)
+
+#ifdef __linux__
+#define PCAP_MMAP_FLAGS (MAP_SHARED | MAP_POPULATE)
+#else
+#define PCAP_MMAP_FLAGS (MAP_SHARED)
+#endif
+
+struct pcap_file_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_record_header {
+	uint32_t ts_sec;
+	uint32_t ts_nsec;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+static int pcap_file_open(struct pcap_writer *writer)
+{
+	struct pcap_file_header header;
+	char name[4096];
+
+	if (writer->ring_files > 1)
+		snprintf(name, sizeof(name), "%s.%d", writer->path, writer->file_index);
+	else
+		snprintf(name, sizeof(name), "%s", writer->path);
+
+	writer->fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (writer->fd < 0) {
+		log_ebt("Couldn't create %s - %s\n", name, strerror(errno));
+		return 1;
+	}
+
+	if (ftruncate(writer->fd, writer->map_size)) {
+		log_ebt("Couldn't resize %s - %s\n", name, strerror(errno));
+		close(writer->fd);
+		return 1;
+	}
+
+	/* populate the mapping up front, not on the first write of every page */
+	writer->map = mmap(NULL, writer->map_size, PROT_READ | PROT_WRITE, PCAP_MMAP_FLAGS, writer->fd, 0);
+	if (writer->map == MAP_FAILED) {
+		log_ebt("Couldn't map %s - %s\n", name, strerror(errno));
+		writer->map = NULL;
+		close(writer->fd);
+		return 1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = PCAP_MAGIC_NSEC;
+	header.version_major = PCAP_VERSION_MAJOR;
+	header.version_minor = PCAP_VERSION_MINOR;
+	header.snaplen = writer->snaplen;
+	header.linktype = PCAP_LINKTYPE_ETHERNET;
+	memcpy(writer->map, &header, sizeof(header));
+
+	writer->offset = sizeof(header);
+	writer->flushed = 0;
+	writer->files++;
+
+	return 0;
+}
+
+static int pcap_file_close(struct pcap_writer *writer)
+{
+	int ret = 0;
+
+	if (!writer->map)
+		return 0;
+
+	if (munmap(writer->map, writer->map_size))
+		ret = 1;
+	writer->map = NULL;
+
+	if (ftruncate(writer->fd, writer->offset))
+		ret = 1;
+	if (close(writer->fd))
+		ret = 1;
+
+	return ret;
+}
+
+static void pcap_account_stall(struct pcap_writer *writer, cycles_t start)
+{
+	cycles_t delta = get_cycles() - start;
+
+	writer->stall_cycles += delta;
+	if (delta > writer->max_stall_cycles)
+		writer->max_stall_cycles = delta;
+	if (delta > PCAP_STALL_USEC * writer->cpu_mhz)
+		writer->stalls++;
+}
+
+/*
+ * Start the writeback of the last batch without waiting for it.
+ */
+static void pcap_flush(struct pcap_writer *writer)
+{
+	uint64_t start = writer->flushed;
+	uint64_t end = writer->offset & ~((uint64_t)sysconf(_SC_PAGESIZE) - 1);
+
+	if (end <= start)
+		return;
+
+	#ifdef __linux__
+	sync_file_range(writer->fd, start, end - start, SYNC_FILE_RANGE_WRITE);
+	#else
+	msync(writer->map + start, end - start, MS_ASYNC);
+	#endif
+	writer->flushed = end;
+}
+
+static int pcap_next_file(struct pcap_writer *writer)
+{
+	cycles_t start = get_cycles();
+	int ret;
+
+	ret = pcap_file_close(writer);
+	writer->file_index = (writer->file_index + 1) % writer->ring_files;
+	ret |= pcap_file_open(writer);
+	pcap_account_stall(writer, start);
+
+	return ret;
+}
+
+int pcap_writer_open(struct pcap_writer *writer, const char *path, uint32_t snaplen,
+		uint64_t file_size, int ring_files, double cpu_mhz)
+{
+	memset(writer, 0, sizeof(struct pcap_writer));
+	writer->path = strdup(path);
+	writer->snaplen = snaplen;
+	writer->map_size = file_size;
+	writer->ring_files = ring_files;
+	writer->cpu_mhz = cpu_mhz;
+
+	if (pcap_file_open(writer))
+		return 1;
+
+	clock_gettime(CLOCK_REALTIME, &writer->base_time);
+	writer->base_cycles = get_cycles();
+
+	return 0;
+}
+
+void pcap_write_pkt(struct pcap_writer *writer, const void *pkt, uint32_t len)
+{
+	struct pcap_record_header record;
+	uint32_t caplen = len < writer->snaplen ? len : writer->snaplen;
+	uint64_t nsec;
+
+	if (writer->offset + sizeof(record) + caplen > writer->map_size) {
+		if (writer->ring_files == 1 || !writer->map || pcap_next_file(writer)) {
+			writer->dropped++;
+			return;
+		}
+	}
+
+	nsec = writer->base_time.tv_nsec + (uint64_t)((get_cycles() - writer->base_cycles) * 1000 / writer->cpu_mhz);
+	record.ts_sec = writer->base_time.tv_sec + nsec / 1000000000;
+	record.ts_nsec = nsec % 1000000000;
+	record.caplen = caplen;
+	record.len = len;
+
+	memcpy(writer->map + writer->offset, &record, sizeof(record));
+	memcpy(writer->map + writer->offset + sizeof(record), pkt, caplen);
+	writer->offset += sizeof(record) + caplen;
+
+	writer->packets++;
+	writer->bytes += caplen;
+	if (caplen < len)
+		writer->truncated++;
+
+	if (writer->offset - writer->flushed >= PCAP_FLUSH_BATCH) {
+		cycles_t start = get_cycles();
+
+		pcap_flush(writer);
+		pcap_account_stall(writer, start);
+	}
+}
+
+int pcap_writer_close(struct pcap_writer *writer)
+{
+	int ret = pcap_file_close(writer);
+
+	free(writer->path);
+	return ret;
+}
@@ -0,0 +1,57 @@
+#ifndef RAW_ETHERNET_PCAP_H
+#define RAW_ETHERNET_PCAP_H
+
+#include <stdint.h>
+#include <time.h>
+#include "get_clock.h"
+
+/*
+ * Writes received frames to a pcap file (nanosecond timestamps) that is
+ * mapped in memory, so a packet costs one copy and no system call.
+ * With more than one ring file the writer moves to the next file
+ * (<path>.<index>) when one is full and overwrites the oldest, otherwise
+ * packets that don't fit are dropped.
+ */
+struct pcap_writer {
+	char		*path;
+	int		fd;
+	uint8_t		*map;
+	uint64_t	map_size;
+	uint64_t	offset;
+	/* bytes already handed to the kernel for writeback */
+	uint64_t	flushed;
+	uint32_t	snaplen;
+	int		ring_files;
+	int		file_index;
+	double		cpu_mhz;
+	cycles_t	base_cycles;
+	struct timespec	base_time;
+
+	uint64_t	packets;
+	uint64_t	bytes;
+	uint64_t	truncated;
+	uint64_t	dropped;
+	uint64_t	files;
+	/* flushes and file switches that held the receive loop too long */
+	uint64_t	stalls;
+	cycles_t	stall_cycles;
+	cycles_t	max_stall_cycles;
+};
+
+/*
+ * Create the first capture file of file_size bytes and map it.
+ */
+int pcap_writer_open(struct pcap_writer *writer, const char *path, uint32_t snaplen,
+		uint64_t file_size, int ring_files, double cpu_mhz);
+
+/*
+ * Append a frame of len bytes, truncated to the snaplen.
+ */
+void pcap_write_pkt(struct pcap_writer *writer, const void *pkt, uint32_t len);
+
+/*
+ * Unmap the current file and trim it to the written size.
+ */
+int pcap_writer_close(struct pcap_writer *writer);
+
+#endif
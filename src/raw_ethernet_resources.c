@@ -44,8 +44,12 @@
 #include <signal.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <time.h>
+#include <math.h>
 #include <netinet/ip.h>
 #include <poll.h>
+#include <pthread.h>
 #include "perftest_logging.h"
 #include "perftest_parameters.h"
 #include "perftest_resources.h"
@@ -57,6 +61,7 @@
 #endif
 
 extern struct perftest_parameters* duration_param;
+extern struct check_alive_data check_alive_data;
 
 int check_flow_steering_support(char *dev_name)
 {
@@ -98,29 +103,8 @@ static void mac_from_user(uint8_t   *mac, uint8_t *gid,int size )
 	memcpy(mac,gid,size);
 }
 
-/******************************************************************************
- *
- ******************************************************************************/
-static uint16_t ip_checksum	(void * buf,size_t 	  hdr_len)
-{
-	unsigned long sum = 0;
-	const uint16_t *ip1;
-	ip1 = buf;
-	while (hdr_len > 1) {
-		sum += *ip1++;
-		if (sum & 0x80000000)
-			sum = (sum & 0xFFFF) + (sum >> 16);
-		hdr_len -= 2;
-	}
-	while (sum >> 16)
-		sum = (sum & 0xFFFF) + (sum >> 16);
-
-	return(~sum);
-}
-
 void gen_ipv6_header(void* ip_header_buffer, uint8_t* saddr, uint8_t* daddr,
-		     uint8_t protocol, int pkt_size, int hop_limit, int tos, int is_l4,
-		     int is_tcp)
+		     uint8_t protocol, int pkt_size, int hop_limit, int tos)
 {
 	struct IP_V6_header ip_header;
 
@@ -129,13 +113,8 @@ void gen_ipv6_header(void* ip_header_buffer, uint8_t* saddr, uint8_t* daddr,
 	ip_header.version = 6;
 	ip_header.nexthdr = protocol ? protocol : DEFAULT_IPV6_NEXT_HDR;
 	ip_header.hop_limit = hop_limit;
+	/* the payload length covers the UDP/TCP header as well */
 	ip_header.payload_len = htons(pkt_size - sizeof(struct IP_V6_header));
-	if (is_l4) {
-		if (is_tcp)
-			ip_header.payload_len -= sizeof(struct TCP_header);
-		else
-			ip_header.payload_len -= sizeof(struct UDP_header);
-	}
 	memcpy(&ip_header.saddr, saddr, sizeof(ip_header.saddr));
 	memcpy(&ip_header.daddr, daddr, sizeof(ip_header.daddr));
 
@@ -162,7 +141,7 @@ void gen_ipv4_header(void* ip_header_buffer, uint32_t* saddr, uint32_t* daddr,
 	ip_header.protocol = protocol;
 	ip_header.saddr = *saddr;
 	ip_header.daddr = *daddr;
-	ip_header.check = ip_checksum((void*)&ip_header,sizeof(struct IP_V4_header));
+	ip_header.check = csum_compute(&ip_header, sizeof(struct IP_V4_header));
 
 	memcpy(ip_header_buffer, &ip_header, sizeof(struct IP_V4_header));
 }
@@ -170,7 +149,7 @@ void gen_ipv4_header(void* ip_header_buffer, uint32_t* saddr, uint32_t* daddr,
 /******************************************************************************
  *
  ******************************************************************************/
-void gen_udp_header(void* UDP_header_buffer, int src_port, int dst_port, int pkt_size)
+void gen_udp_header(void* UDP_header_buffer, int src_port, int dst_port, int udp_size)
 {
 	struct UDP_header udp_header;
 
@@ -178,7 +157,7 @@ void gen_udp_header(void* UDP_header_buffer, int src_port, int dst_port, int pkt
 
 	udp_header.uh_sport = htons(src_port);
 	udp_header.uh_dport = htons(dst_port);
-	udp_header.uh_ulen = htons(pkt_size - sizeof(struct IP_V4_header));
+	udp_header.uh_ulen = htons(udp_size);
 	udp_header.uh_sum = 0;
 
 	memcpy(UDP_header_buffer, &udp_header, sizeof(struct UDP_header));
@@ -533,6 +512,7 @@ void build_pkt_on_buffer(struct ETH_header* eth_header,
 			 int print_flag, int pkt_size, int flows_offset)
 {
 	void* header_buff = NULL;
+	void* ip_header_buff = NULL;
 	int have_ip_header = user_param->is_client_ip || user_param->is_server_ip;
 	int is_udp_or_tcp = user_param->is_client_port && user_param->is_server_port;
 	int eth_header_size = sizeof(struct ETH_header);
@@ -559,28 +539,29 @@ void build_pkt_on_buffer(struct ETH_header* eth_header,
 		int offset = is_udp_or_tcp ? 0 : flows_offset;
 
 		header_buff = (void*)eth_header + eth_header_size;
+		ip_header_buff = header_buff;
 		if (user_param->raw_ipv6)
 			gen_ipv6_header(header_buff, my_dest_info->ip6,
 					rem_dest_info->ip6, ip_next_protocol,
-					pkt_size, user_param->hop_limit, user_param->tos,
-					is_udp_or_tcp, user_param->tcp);
+					pkt_size, user_param->hop_limit, user_param->tos);
 		else
 			gen_ipv4_header(header_buff, &my_dest_info->ip, &rem_dest_info->ip,
 					ip_next_protocol, pkt_size, user_param->hop_limit, user_param->tos, offset);
 	}
 
 	if(is_udp_or_tcp) {
-		if (user_param->raw_ipv6)
-			header_buff = header_buff + sizeof(struct IP_V6_header);
-		else
-			header_buff = header_buff + sizeof(struct IP_V4_header);
+		int ip_header_size = user_param->raw_ipv6 ? sizeof(struct IP_V6_header) : sizeof(struct IP_V4_header);
+
+		header_buff = header_buff + ip_header_size;
 		if (user_param->tcp)
 			gen_tcp_header(header_buff, my_dest_info->port + flows_offset,
 				       rem_dest_info->port + flows_offset);
 		else
 			gen_udp_header(header_buff, my_dest_info->port + flows_offset,
-				       rem_dest_info->port+ flows_offset, pkt_size);
+				       rem_dest_info->port+ flows_offset, pkt_size - ip_header_size);
 
+		/* the payload is already on the buffer, sum it with the pseudo header */
+		csum_set_l4(ip_header_buff, user_param->raw_ipv6);
 	}
 
 	if(print_flag == PRINT_ON) {
@@ -821,31 +802,351 @@ int set_up_fs_rules(
 
 	int				local_port = 0;
 	int				remote_port = 0;
-	int				last_local_index = 0;
 	int 				flow_index = 0;
 	int				qp_index = 0;
-	int				allowed_server_ports = MAX_FS_PORT - user_param->server_port;
+	int				local_span = MAX_FS_PORT - user_param->local_port;
 
+	if (local_span <= 0)
+		local_span = 1;
+
+	/* Sweep the local port first and step the remote port on every wrap,
+	 * so every rule of a QP matches a unique port pair.
+	 */
 	for (qp_index = 0; qp_index < user_param->num_of_qps; qp_index++) {
 		for (flow_index = 0; flow_index < allocated_flows; flow_index++) {
+			local_port = user_param->local_port + flow_index % local_span;
+			remote_port = user_param->remote_port + flow_index / local_span;
 			if (set_up_flow_rules(&flow_rules[(qp_index * allocated_flows) + flow_index],
 					      ctx, user_param, local_port, remote_port)) {
 				log_ebt( "Unable to set up flow rules\n");
 	                        return FAILURE;
 			}
-			if (flow_index <= allowed_server_ports) {
-				local_port = user_param->local_port + flow_index;
-				remote_port = user_param->remote_port;
-				last_local_index = flow_index;
-			} else {
-				local_port = user_param->local_port;
-				remote_port = user_param->remote_port + flow_index - last_local_index;
-			}
 		}
 	}
 	return SUCCESS;
 }
 
+/******************************************************************************
+ *pkt_template_schedule - pre draw the random/zipf flow order
+ ******************************************************************************/
+static void pkt_template_schedule(struct pkt_template *tmpl, double theta)
+{
+	uint64_t i, n = tmpl->num_tuples;
+	double zetan = 0, zeta2, alpha, eta, u, uz;
+
+	srand48(getpid() * time(NULL));
+
+	if (tmpl->dist == FLOW_RANDOM) {
+		for (i = 0; i <= tmpl->schedule_mask; i++)
+			tmpl->schedule[i] = (uint32_t)(lrand48() % n);
+		return;
+	}
+
+	/* Zipf by Gray et al., "Quickly generating billion-record synthetic databases" */
+	for (i = 1; i <= n; i++)
+		zetan += 1.0 / pow((double)i, theta);
+	zeta2 = 1.0 + pow(0.5, theta);
+	alpha = 1.0 / (1.0 - theta);
+	eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+
+	for (i = 0; i <= tmpl->schedule_mask; i++) {
+		u = drand48();
+		uz = u * zetan;
+		if (uz < 1.0)
+			tmpl->schedule[i] = 0;
+		else if (uz < zeta2)
+			tmpl->schedule[i] = n > 1 ? 1 : 0;
+		else
+			tmpl->schedule[i] = (uint32_t)(n * pow(eta * u - eta + 1.0, alpha));
+		if (tmpl->schedule[i] >= n)
+			tmpl->schedule[i] = n - 1;
+	}
+}
+
+/******************************************************************************
+ *pkt_template_init - build the tuple table of the packet template engine
+ ******************************************************************************/
+int pkt_template_init(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param,
+		struct raw_ethernet_info *my_dest_info,
+		struct raw_ethernet_info *rem_dest_info)
+{
+	struct pkt_template *tmpl;
+	uint32_t saddr, daddr;
+	uint64_t i, port_span, schedule_size = FLOW_SCHEDULE_MIN;
+	int eth_header_size = user_param->vlan_en ? sizeof(struct ETH_vlan_header) : sizeof(struct ETH_header);
+
+	ALLOCATE(tmpl, struct pkt_template, 1);
+	memset(tmpl, 0, sizeof(struct pkt_template));
+	tmpl->num_tuples = user_param->flow_tuples;
+	tmpl->dist = user_param->flow_dist;
+	tmpl->is_ipv6 = user_param->raw_ipv6;
+
+	if (tmpl->is_ipv6) {
+		tmpl->saddr_offset = eth_header_size + offsetof(struct IP_V6_header, saddr) + 12;
+		tmpl->daddr_offset = eth_header_size + offsetof(struct IP_V6_header, daddr) + 12;
+		tmpl->l4_offset = eth_header_size + sizeof(struct IP_V6_header);
+		memcpy(&saddr, &my_dest_info->ip6[12], sizeof(saddr));
+		memcpy(&daddr, &rem_dest_info->ip6[12], sizeof(daddr));
+	} else {
+		tmpl->ip_check_offset = eth_header_size + offsetof(struct IP_V4_header, check);
+		tmpl->saddr_offset = eth_header_size + offsetof(struct IP_V4_header, saddr);
+		tmpl->daddr_offset = eth_header_size + offsetof(struct IP_V4_header, daddr);
+		tmpl->l4_offset = eth_header_size + sizeof(struct IP_V4_header);
+		saddr = my_dest_info->ip;
+		daddr = rem_dest_info->ip;
+	}
+	tmpl->l4_check_offset = tmpl->l4_offset +
+		(user_param->tcp ? offsetof(struct TCP_header, th_check) : offsetof(struct UDP_header, uh_sum));
+	/* create_raw_eth_pkt fills the checksum of every UDP/TCP packet */
+	tmpl->has_l4_check = 1;
+	tmpl->is_udp = !user_param->tcp;
+
+	ALLOCATE(tmpl->tuples, struct flow_tuple, tmpl->num_tuples);
+	port_span = 0x10000 - my_dest_info->port;
+	for (i = 0; i < tmpl->num_tuples; i++) {
+		tmpl->tuples[i].saddr = htonl(ntohl(saddr) + i / port_span);
+		tmpl->tuples[i].daddr = daddr;
+		tmpl->tuples[i].sport = htons(my_dest_info->port + i % port_span);
+		tmpl->tuples[i].dport = htons(rem_dest_info->port);
+	}
+
+	if (tmpl->dist != FLOW_SEQUENTIAL) {
+		while (schedule_size < tmpl->num_tuples)
+			schedule_size <<= 1;
+		tmpl->schedule_mask = schedule_size - 1;
+		ALLOCATE(tmpl->schedule, uint32_t, schedule_size);
+		pkt_template_schedule(tmpl, user_param->zipf_theta);
+	}
+
+	ctx->pkt_tmpl = tmpl;
+	return SUCCESS;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void pkt_template_destroy(struct pingpong_context *ctx)
+{
+	if (!ctx->pkt_tmpl)
+		return;
+
+	free(ctx->pkt_tmpl->schedule);
+	free(ctx->pkt_tmpl->tuples);
+	free(ctx->pkt_tmpl);
+	ctx->pkt_tmpl = NULL;
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_pkt_template_report(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	const char *dist_str[] = {"sequential", "random", "zipf"};
+	struct pkt_template *tmpl = ctx->pkt_tmpl;
+	double cycles = 0;
+
+	if (!tmpl || user_param->output != FULL_VERBOSITY)
+		return;
+
+	if (tmpl->built)
+		cycles = (double)tmpl->build_cycles / tmpl->built;
+
+	printf(RESULT_LINE);
+	printf(" Packet template  : %" PRIu64 " flows, %s", tmpl->num_tuples, dist_str[tmpl->dist]);
+	if (tmpl->dist == FLOW_ZIPF)
+		printf(" (theta %.2f)", user_param->zipf_theta);
+	printf("\n Packets built    : %" PRIu64 "\n", tmpl->built);
+	printf(" Build cost       : %.1f cycles, %.2f nsec per message\n",
+	       cycles, cycles * 1000 / get_cpu_mhz(user_param->cpu_freq_f));
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_csum_report(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct csum_stats *stats = ctx->csum_stats;
+
+	if (!stats || user_param->output != FULL_VERBOSITY)
+		return;
+
+	printf(RESULT_LINE);
+	printf(" Checksum validation (%s)\n", csum_impl_name());
+	printf(" IP packets checked    : %" PRIu64 "\n", stats->checked);
+	printf(" Bad IPv4 checksum     : %" PRIu64 "\n", stats->bad_l3);
+	printf(" Bad UDP/TCP checksum  : %" PRIu64 "\n", stats->bad_l4);
+	printf(" Truncated             : %" PRIu64 "\n", stats->truncated);
+	printf(" UDP without checksum  : %" PRIu64 "\n", stats->no_l4_csum);
+	printf(" Non IP (skipped)      : %" PRIu64 "\n", stats->skipped);
+	printf(" Bad but HW reported OK: %" PRIu64 "\n", stats->hw_ok_sw_bad);
+}
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_pcap_report(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct pcap_writer *pcap = ctx->pcap;
+
+	if (!pcap || user_param->output != FULL_VERBOSITY)
+		return;
+
+	printf(RESULT_LINE);
+	if (pcap->ring_files > 1)
+		printf(" Capture to %s.<0-%d> (%" PRIu64 " files written)\n",
+		       pcap->path, pcap->ring_files - 1, pcap->files);
+	else
+		printf(" Capture to %s\n", pcap->path);
+	printf(" Packets written       : %" PRIu64 "\n", pcap->packets);
+	printf(" Bytes written         : %" PRIu64 "\n", pcap->bytes);
+	printf(" Truncated to snaplen  : %" PRIu64 "\n", pcap->truncated);
+	printf(" Dropped (file full)   : %" PRIu64 "\n", pcap->dropped);
+	printf(" Writer stalls         : %" PRIu64 " (max %.2f usec, total %.2f msec)\n",
+	       pcap->stalls, pcap->max_stall_cycles / pcap->cpu_mhz,
+	       pcap->stall_cycles / pcap->cpu_mhz / 1000);
+}
+
+#ifdef HAVE_RSS
+/* The key of the Microsoft RSS verification suite */
+const uint8_t rss_hash_key[RSS_HASH_KEY_LEN] = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+uint64_t rss_hash_fields(struct perftest_parameters *user_param)
+{
+	uint64_t fields;
+
+	if (user_param->raw_ipv6)
+		fields = IBV_RX_HASH_SRC_IPV6 | IBV_RX_HASH_DST_IPV6;
+	else
+		fields = IBV_RX_HASH_SRC_IPV4 | IBV_RX_HASH_DST_IPV4;
+
+	if (user_param->is_client_port && user_param->is_server_port) {
+		if (user_param->tcp)
+			fields |= IBV_RX_HASH_SRC_PORT_TCP | IBV_RX_HASH_DST_PORT_TCP;
+		else
+			fields |= IBV_RX_HASH_SRC_PORT_UDP | IBV_RX_HASH_DST_PORT_UDP;
+	}
+
+	return fields;
+}
+
+/******************************************************************************
+ * rss_toeplitz_hash - the hash the NIC computes over the source and
+ * destination IPs and ports (in this order) with rss_hash_key.
+ ******************************************************************************/
+static uint32_t rss_toeplitz_hash(const uint8_t *input, int len)
+{
+	uint32_t window = (uint32_t)rss_hash_key[0] << 24 | rss_hash_key[1] << 16 |
+			  rss_hash_key[2] << 8 | rss_hash_key[3];
+	uint32_t hash = 0;
+	int i, bit;
+
+	for (i = 0; i < len; i++) {
+		for (bit = 7; bit >= 0; bit--) {
+			if (input[i] & (1 << bit))
+				hash ^= window;
+			window <<= 1;
+			if (rss_hash_key[i + 4] & (1 << bit))
+				window |= 1;
+		}
+	}
+
+	return hash;
+}
+
+/******************************************************************************
+ * rss_flows_per_queue - count the flows the hash sends to every queue, flow i
+ * is sent from client_port + i to server_port + i (see build_pkt_on_buffer).
+ ******************************************************************************/
+static void rss_flows_per_queue(struct perftest_parameters *user_param, uint64_t *flows_per_queue)
+{
+	uint8_t input[2 * 16 + 2 * sizeof(uint16_t)];
+	int ip_len = user_param->raw_ipv6 ? 16 : 4;
+	uint16_t port;
+	int i, len;
+
+	if (user_param->raw_ipv6) {
+		memcpy(input, user_param->client_ip6, ip_len);
+		memcpy(input + ip_len, user_param->server_ip6, ip_len);
+	} else {
+		memcpy(input, &user_param->client_ip, ip_len);
+		memcpy(input + ip_len, &user_param->server_ip, ip_len);
+	}
+
+	for (i = 0; i < user_param->flows; i++) {
+		len = 2 * ip_len;
+		if (user_param->is_client_port && user_param->is_server_port) {
+			port = htons(user_param->client_port + i);
+			memcpy(input + len, &port, sizeof(port));
+			port = htons(user_param->server_port + i);
+			memcpy(input + len + sizeof(port), &port, sizeof(port));
+			len += 2 * sizeof(port);
+		}
+		/* the indirection table holds the queues in order */
+		flows_per_queue[rss_toeplitz_hash(input, len) & (user_param->num_of_qps - 1)]++;
+	}
+}
+#endif
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_rss_report(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	#ifdef HAVE_RSS
+	struct rss_queue_stats *stats = ctx->rss_stats;
+	uint64_t *flows_per_queue;
+	uint64_t rcnt = 0, max_rcnt = 0, max_flows = 0;
+	double cpu_mhz, msg_rate;
+	int i;
+
+	if (!user_param->use_rss || user_param->output != FULL_VERBOSITY)
+		return;
+
+	ALLOCATE(flows_per_queue, uint64_t, user_param->num_of_qps);
+	memset(flows_per_queue, 0, sizeof(uint64_t) * user_param->num_of_qps);
+	rss_flows_per_queue(user_param, flows_per_queue);
+
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		rcnt += stats[i].rcnt;
+		if (stats[i].rcnt > max_rcnt)
+			max_rcnt = stats[i].rcnt;
+		if (flows_per_queue[i] > max_flows)
+			max_flows = flows_per_queue[i];
+	}
+
+	cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
+
+	printf(RESULT_LINE);
+	printf(" RSS queue  CPU    Flows     #packets      Share[%%]   MsgRate[Mpps]\n");
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		msg_rate = 0;
+		if (stats[i].last_rx > stats[i].first_rx)
+			msg_rate = stats[i].rcnt * cpu_mhz / (stats[i].last_rx - stats[i].first_rx);
+
+		printf(" %-10d %-6d %-9" PRIu64 " %-13" PRIu64 " %-10.2f  %.6f\n",
+		       i, stats[i].cpu, flows_per_queue[i], stats[i].rcnt,
+		       rcnt ? 100.0 * stats[i].rcnt / rcnt : 0, msg_rate);
+	}
+
+	/* 1.00 is an even spread, num_of_qps means a single queue got everything */
+	printf(" Max/avg per queue: flows %.2f, packets %.2f\n",
+	       (double)max_flows * user_param->num_of_qps / user_param->flows,
+	       rcnt ? (double)max_rcnt * user_param->num_of_qps / rcnt : 0);
+
+	free(flows_per_queue);
+	#endif
+}
+
 /******************************************************************************2
  *send_set_up_connection - init raw_ethernet_info and ibv_flow_spec to user args
  ******************************************************************************/
@@ -917,191 +1218,373 @@ int send_set_up_connection(
 	return 0;
 }
 
+struct fwd_worker {
+	struct pingpong_context		*ctx;
+	struct perftest_parameters	*user_param;
+	struct fwd_queue		*queue;
+	int				index;
+	pthread_t			thread;
+};
+
+/* A forwarded packet that waits for its send completion */
+struct fwd_slot {
+	uint64_t	addr;
+	cycles_t	rx_time;
+};
+
+/* State shared by the forwarding threads of one run, completed counts the
+ * packets whose send completed and the dropped ones.
+ */
+static struct {
+	uint64_t		tot_iters;
+	uint64_t		completed;
+	uint64_t		rcnt;
+	int			started;
+	volatile int		stop;
+} fwd_run;
+
 /******************************************************************************
  *
  ******************************************************************************/
-int run_iter_fw(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+static void fwd_on_first_rx(struct perftest_parameters *user_param, cycles_t now)
 {
-	uint64_t		totscnt    = 0;
-	uint64_t		totccnt    = 0;
-	uint64_t		totrcnt    = 0;
-	int			i;
-	int			index      = 0;
-	int			ne = 0;
-	int			err = 0;
-	uint64_t		*rcnt_for_qp = NULL;
-	uint64_t		tot_iters = 0;
-	uint64_t		iters = 0;
-	struct ibv_wc		*wc = NULL;
-	struct ibv_wc		*wc_tx = NULL;
-	struct ibv_recv_wr	*bad_wr_recv = NULL;
-	struct ibv_send_wr	*bad_wr = NULL;
-	int			firstRx = 1;
-	int 			rwqe_sent = user_param->rx_depth;
-	int			return_value = 0;
-	int			wc_id;
-	ALLOCATE(wc, struct ibv_wc, CTX_POLL_BATCH);
-	ALLOCATE(wc_tx, struct ibv_wc, CTX_POLL_BATCH);
-	ALLOCATE(rcnt_for_qp,uint64_t,user_param->num_of_qps);
-
-	memset(wc, 0, sizeof(struct ibv_wc));
-	memset(wc_tx, 0, sizeof(struct ibv_wc));
-	memset(rcnt_for_qp, 0, sizeof(uint64_t) * user_param->num_of_qps);
-
-	tot_iters = (uint64_t)user_param->iters * user_param->num_of_qps;
-	iters = user_param->iters;
-
-	if (user_param->noPeak == ON)
-		user_param->tposted[0] = get_cycles();
-
-	if(user_param->test_type == DURATION && user_param->machine == CLIENT && firstRx) {
-		firstRx = OFF;
+	if (user_param->test_type == DURATION) {
 		duration_param = user_param;
 		user_param->iters = 0;
 		duration_param->state = START_STATE;
 		signal(SIGALRM, catch_alarm);
-		alarm(user_param->margin);
+		if (user_param->margin > 0)
+			alarm(user_param->margin);
+		else
+			catch_alarm(0);
+	} else {
+		user_param->tposted[0] = now;
+	}
+}
+
+/******************************************************************************
+ * fwd_on_completed - account for packets that left the forwarder.
+ *
+ * The thread that accounts for the last of the tot_iters packets ends an
+ * iterations test, all of them were received by then and the sends of the
+ * forwarded ones completed.
+ ******************************************************************************/
+static void fwd_on_completed(struct perftest_parameters *user_param, uint64_t count, cycles_t now)
+{
+	uint64_t completed = __sync_add_and_fetch(&fwd_run.completed, count);
+
+	if (user_param->test_type == ITERATIONS && completed >= fwd_run.tot_iters) {
+		if (__sync_bool_compare_and_swap(&fwd_run.stop, 0, 1))
+			user_param->tcompleted[0] = now;
 	}
+}
 
-	while ((user_param->test_type == DURATION && user_param->state != END_STATE) || totccnt < tot_iters || totrcnt < tot_iters) {
+/******************************************************************************
+ * fwd_worker_func - forward the packets of one queue.
+ *
+ * Receives and sends complete in the order they were posted on a QP, so the
+ * buffers of the posted receives and of the posted sends are kept in two
+ * FIFO rings. A received packet is sent from the buffer it was received to
+ * and the buffer is posted again to the receive queue after its send
+ * completion. Sends and receives are posted in chains, and only the last
+ * send of a chain is signaled, its wr_id is the number of sends posted so far.
+ ******************************************************************************/
+static void *fwd_worker_func(void *arg)
+{
+	struct fwd_worker *worker = arg;
+	struct pingpong_context *ctx = worker->ctx;
+	struct perftest_parameters *user_param = worker->user_param;
+	struct fwd_queue *queue = worker->queue;
+	int q = worker->index;
+	int rx_depth = user_param->rx_depth;
+	int tx_depth = user_param->tx_depth;
+	int slot_size = INC(user_param->size, ctx->cache_line_size);
+	uint32_t lkey = ctx->mr[q]->lkey;
+	unsigned int send_flags = ctx->wr[q * user_param->post_list].send_flags &
+				  ~(IBV_SEND_SIGNALED | IBV_SEND_INLINE);
+	struct ibv_wc wc[CTX_POLL_BATCH];
+	struct ibv_send_wr swr[CTX_POLL_BATCH];
+	struct ibv_sge ssge[CTX_POLL_BATCH];
+	struct ibv_send_wr *bad_swr = NULL;
+	struct ibv_recv_wr *rwr = NULL, *bad_rwr = NULL;
+	struct ibv_sge *rsge = NULL;
+	struct fwd_slot *tx_ring = NULL, *slot;
+	uint64_t *rx_ring = NULL;
+	uint64_t rx_head = 0, rx_tail = ctx->rposted;
+	uint64_t tx_head = 0, tx_tail = 0;
+	uint64_t addr, completed, dropped;
+	cycles_t now, lat;
+	int ne, i, j, nsend, nrecv;
+
+	if (pin_thread_to_cpu(queue->cpu))
+		log_err("Couldn't pin forwarding queue %d to CPU %d\n", q, queue->cpu);
+
+	ALLOCATE(rx_ring, uint64_t, rx_depth);
+	ALLOCATE(tx_ring, struct fwd_slot, tx_depth);
+	ALLOCATE(rwr, struct ibv_recv_wr, rx_depth);
+	ALLOCATE(rsge, struct ibv_sge, rx_depth);
+	memset(rwr, 0, sizeof(struct ibv_recv_wr) * rx_depth);
+	memset(swr, 0, sizeof(swr));
+
+	/* the receives ctx_set_recv_wqes posted */
+	for (j = 0; j < ctx->rposted; j++)
+		rx_ring[j] = ctx->rx_buffer_addr[q] + (j % (ctx->cycle_buffer / slot_size)) * slot_size;
+
+	for (j = 0; j < rx_depth; j++) {
+		rsge[j].length = ctx->recv_sge_list[q * user_param->recv_post_list].length;
+		rsge[j].lkey = lkey;
+		rwr[j].sg_list = &rsge[j];
+		rwr[j].num_sge = 1;
+		rwr[j].wr_id = q;
+		rwr[j].next = (j < rx_depth - 1) ? &rwr[j + 1] : NULL;
+	}
 
-		for (index = 0; index < user_param->num_of_qps; index++) {
+	for (j = 0; j < CTX_POLL_BATCH; j++) {
+		ssge[j].lkey = lkey;
+		swr[j].sg_list = &ssge[j];
+		swr[j].num_sge = 1;
+		swr[j].opcode = IBV_WR_SEND;
+		swr[j].next = &swr[j + 1];
+	}
 
-			while (((ctx->scnt[index] < iters) || ((firstRx == OFF) && (user_param->test_type == DURATION))) &&
-					((ctx->scnt[index] - ctx->ccnt[index] + user_param->post_list) <= user_param->tx_depth) && (rcnt_for_qp[index] - ctx->scnt[index] > 0)) {
+	while (!fwd_run.stop) {
+		if (user_param->test_type == DURATION && user_param->state == END_STATE)
+			break;
 
-				if (user_param->post_list == 1 && (ctx->scnt[index] % user_param->cq_mod == 0 && user_param->cq_mod > 1)) {
-						ctx->wr[index].send_flags &= ~IBV_SEND_SIGNALED;
-				}
+		if (check_alive_data.to_exit) {
+			user_param->check_alive_exited = 1;
+			queue->result = FAILURE;
+			fwd_run.stop = 1;
+			break;
+		}
 
-				if (user_param->noPeak == OFF)
-					user_param->tposted[totscnt] = get_cycles();
+		nrecv = 0;
 
-				if (user_param->test_type == DURATION && duration_param->state == END_STATE)
-					break;
-				switch_smac_dmac(ctx->wr[index*user_param->post_list].sg_list);
+		/* sent packets give their buffers back to the receive queue */
+		ne = ibv_poll_cq(queue->send_cq, CTX_POLL_BATCH, wc);
+		if (ne < 0) {
+			log_ebt("Poll Send CQ of forwarding queue %d failed %d\n", q, ne);
+			queue->result = FAILURE;
+			fwd_run.stop = 1;
+			break;
+		}
 
-				err = ibv_post_send(ctx->qp[index], &ctx->wr[index*user_param->post_list], &bad_wr);
+		if (ne > 0) {
+			now = get_cycles();
+			completed = 0;
 
-				if(err) {
-					log_ebt( "Couldn't post send: qp %d scnt=%lu \n", index, ctx->scnt[index]);
-					return_value = FAILURE;
+			for (i = 0; i < ne; i++) {
+				if (wc[i].status != IBV_WC_SUCCESS) {
+					NOTIFY_COMP_ERROR_SEND(wc[i], tx_tail, tx_head);
+					queue->result = FAILURE;
+					fwd_run.stop = 1;
 					goto cleaning;
 				}
 
-				if (user_param->post_list == 1 && user_param->size <= (ctx->cycle_buffer / 2)) {
-						increase_loc_addr(ctx->wr[index].sg_list, user_param->size,
-								  ctx->scnt[index], ctx->my_addr[index], 0,
-								  ctx->cache_line_size, ctx->cycle_buffer);
-				}
-				ctx->scnt[index] += user_param->post_list;
-				totscnt += user_param->post_list;
+				for (; tx_head < wc[i].wr_id; tx_head++, completed++) {
+					slot = &tx_ring[tx_head % tx_depth];
+					lat = now - slot->rx_time;
+					queue->lat_sum += lat;
+					if (lat > queue->lat_max)
+						queue->lat_max = lat;
 
-				if (user_param->post_list == 1 &&
-					(ctx->scnt[index]%user_param->cq_mod == (user_param->cq_mod - 1) ||
-						(user_param->test_type == ITERATIONS && ctx->scnt[index] == (iters - 1)))) {
-							ctx->wr[index].send_flags |= IBV_SEND_SIGNALED;
+					rsge[nrecv++].addr = slot->addr;
+					rx_ring[rx_tail++ % rx_depth] = slot->addr;
 				}
 			}
+			queue->last_tx = now;
+			fwd_on_completed(user_param, completed, now);
 		}
 
-		if (user_param->use_event) {
-
-			if (ctx_notify_events(ctx->channel)) {
-				log_ebt( "Failed to notify events to CQ");
-				return_value = FAILURE;
-				goto cleaning;
-			}
+		ne = ibv_poll_cq(queue->recv_cq, CTX_POLL_BATCH, wc);
+		if (ne < 0) {
+			log_ebt("Poll Receive CQ of forwarding queue %d failed %d\n", q, ne);
+			queue->result = FAILURE;
+			fwd_run.stop = 1;
+			break;
 		}
 
-		if ((user_param->test_type == ITERATIONS && (totrcnt < tot_iters)) ||
-			(user_param->test_type == DURATION && user_param->state != END_STATE)) {
-				ne = ibv_poll_cq(ctx->recv_cq, CTX_POLL_BATCH, wc);
-
-			if (ne > 0) {
-				if (user_param->machine == SERVER && firstRx && user_param->test_type == DURATION) {
-					firstRx = OFF;
-					duration_param = user_param;
-					user_param->iters = 0;
-					duration_param->state = START_STATE;
-					signal(SIGALRM, catch_alarm);
-					alarm(user_param->margin);
+		if (ne > 0) {
+			now = get_cycles();
+			if (!queue->rcnt)
+				queue->first_rx = now;
+			if (!fwd_run.started && __sync_bool_compare_and_swap(&fwd_run.started, 0, 1))
+				fwd_on_first_rx(user_param, now);
+
+			nsend = 0;
+			dropped = 0;
+			for (i = 0; i < ne; i++) {
+				if (wc[i].status != IBV_WC_SUCCESS) {
+					NOTIFY_COMP_ERROR_RECV(wc[i], queue->rcnt);
+					queue->result = FAILURE;
+					fwd_run.stop = 1;
+					goto cleaning;
 				}
 
-				for (i = 0; i < ne; i++) {
-					wc_id = (int)wc[i].wr_id;
+				addr = rx_ring[rx_head++ % rx_depth];
+				queue->rcnt++;
 
-					if (wc[i].status != IBV_WC_SUCCESS) {
-						NOTIFY_COMP_ERROR_RECV(wc[i], totrcnt);
-					}
-
-					rcnt_for_qp[wc_id]++;
-					totrcnt++;
+				/* no room in the send queue, the packet is dropped */
+				if (tx_tail - tx_head >= tx_depth) {
+					queue->dropped++;
+					dropped++;
+					rsge[nrecv++].addr = addr;
+					rx_ring[rx_tail++ % rx_depth] = addr;
+					continue;
 				}
-			} else if (ne < 0) {
-				log_ebt( "poll CQ failed %d\n", ne);
-				return_value = FAILURE;
-				goto cleaning;
-			}
-		}
-		if ((totccnt < tot_iters) || (user_param->test_type == DURATION && user_param->state != END_STATE)) {
-			ne = ibv_poll_cq(ctx->send_cq, CTX_POLL_BATCH, wc_tx);
-			if (ne > 0) {
-				for (i = 0; i < ne; i++) {
-					wc_id = (int)wc[i].wr_id;
 
-					if (wc_tx[i].status != IBV_WC_SUCCESS)
-						NOTIFY_COMP_ERROR_SEND(wc_tx[i], totscnt, totccnt);
+				ssge[nsend].addr = addr;
+				ssge[nsend].length = wc[i].byte_len;
+				switch_smac_dmac(&ssge[nsend]);
+				swr[nsend].send_flags = send_flags;
 
-					totccnt += user_param->cq_mod;
-					ctx->ccnt[wc_id] += user_param->cq_mod;
+				slot = &tx_ring[tx_tail++ % tx_depth];
+				slot->addr = addr;
+				slot->rx_time = now;
+				nsend++;
 
-					if (user_param->noPeak == OFF) {
+				if (user_param->test_type == DURATION && user_param->state == SAMPLE_STATE)
+					queue->sampled++;
+			}
 
-						if ((user_param->test_type == ITERATIONS && (totccnt > tot_iters)))
-							user_param->tcompleted[tot_iters - 1] = get_cycles();
-						else
-							user_param->tcompleted[totccnt - 1] = get_cycles();
-					}
+			if (nsend) {
+				swr[nsend - 1].next = NULL;
+				swr[nsend - 1].send_flags |= IBV_SEND_SIGNALED;
+				swr[nsend - 1].wr_id = tx_tail;
 
-					if (user_param->test_type == DURATION && user_param->state == SAMPLE_STATE)
-						user_param->iters += user_param->cq_mod;
+				if (ibv_post_send(ctx->qp[q], swr, &bad_swr)) {
+					log_ebt("Couldn't post send: forwarding queue %d, sent=%lu\n", q, queue->forwarded);
+					queue->result = FAILURE;
+					fwd_run.stop = 1;
+					break;
 				}
-			} else if (ne < 0) {
-				log_ebt( "poll CQ failed %d\n", ne);
-				return_value = FAILURE;
-				goto cleaning;
+				swr[nsend - 1].next = &swr[nsend];
+				queue->forwarded += nsend;
 			}
-			while (rwqe_sent - totccnt < user_param->rx_depth) {    /* Post more than buffer_size */
-				if (user_param->test_type==DURATION ||
-					rcnt_for_qp[0] + user_param->rx_depth <= user_param->iters) {
-						if (ibv_post_recv(ctx->qp[0], &ctx->rwr[0], &bad_wr_recv)) {
-							log_ebt( "Couldn't post recv Qp=%d rcnt=%lu\n", 0, rcnt_for_qp[0]);
-							return_value = 15;
-							goto cleaning;
-						}
-
-					if (SIZE(user_param->connection_type, user_param->size, !(int)user_param->machine) <= (ctx->cycle_buffer / 2)) {
-						increase_loc_addr(ctx->rwr[0].sg_list,
-								user_param->size,
-								rwqe_sent,
-								ctx->rx_buffer_addr[0],user_param->connection_type,
-								ctx->cache_line_size,ctx->cycle_buffer);
-					}
-				}
-				rwqe_sent++;
+
+			check_alive_data.current_totrcnt = __sync_add_and_fetch(&fwd_run.rcnt, ne);
+			/* a dropped packet gets no send completion */
+			if (dropped)
+				fwd_on_completed(user_param, dropped, now);
+		}
+
+		if (nrecv) {
+			rwr[nrecv - 1].next = NULL;
+			if (ibv_post_recv(ctx->qp[q], rwr, &bad_rwr)) {
+				log_ebt("Couldn't post recv: forwarding queue %d, rcnt=%lu\n", q, queue->rcnt);
+				queue->result = FAILURE;
+				fwd_run.stop = 1;
+				break;
 			}
+			if (nrecv < rx_depth)
+				rwr[nrecv - 1].next = &rwr[nrecv];
+		}
+	}
 
+cleaning:
+	free(rx_ring);
+	free(tx_ring);
+	free(rwr);
+	free(rsge);
+	return NULL;
+}
 
+/******************************************************************************
+ *
+ ******************************************************************************/
+int run_iter_fw(struct pingpong_context *ctx,struct perftest_parameters *user_param)
+{
+	struct fwd_worker *workers = NULL;
+	int i, created = 0;
+	int return_value = SUCCESS;
+
+	FUNCTION_ENTER;
+	memset(&fwd_run, 0, sizeof(fwd_run));
+	fwd_run.tot_iters = (uint64_t)user_param->iters * user_param->num_of_qps;
+
+	if (user_param->test_type == ITERATIONS) {
+		check_alive_data.is_events = user_param->use_event;
+		signal(SIGALRM, check_alive);
+		alarm(60);
+	}
+	check_alive_data.g_total_iters = fwd_run.tot_iters;
+
+	ALLOCATE(workers, struct fwd_worker, user_param->num_of_qps);
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		workers[i].ctx = ctx;
+		workers[i].user_param = user_param;
+		workers[i].queue = &ctx->fwd_queue[i];
+		workers[i].index = i;
+
+		/* queue i runs on the i-th CPU the process is allowed on */
+		workers[i].queue->cpu = get_nth_allowed_cpu(i);
+		workers[i].queue->result = SUCCESS;
+
+		if (pthread_create(&workers[i].thread, NULL, fwd_worker_func, &workers[i])) {
+			log_ebt("Couldn't create the thread of forwarding queue %d\n", i);
+			fwd_run.stop = 1;
+			return_value = FAILURE;
+			break;
 		}
+		created++;
 	}
 
-	if (user_param->noPeak == ON && user_param->test_type == ITERATIONS)
-		user_param->tcompleted[0] = get_cycles();
+	for (i = 0; i < created; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].queue->result != SUCCESS)
+			return_value = FAILURE;
+	}
+
+	if (user_param->test_type == DURATION) {
+		user_param->iters = 0;
+		for (i = 0; i < user_param->num_of_qps; i++)
+			user_param->iters += ctx->fwd_queue[i].sampled;
+	}
+
+	check_alive_data.last_totrcnt = 0;
+	free(workers);
 
-cleaning:
-	free(rcnt_for_qp);
-	free(wc);
-	free(wc_tx);
 	return return_value;
 }
+
+/******************************************************************************
+ *
+ ******************************************************************************/
+void print_fwd_report(struct pingpong_context *ctx, struct perftest_parameters *user_param)
+{
+	struct fwd_queue *queue = ctx->fwd_queue;
+	uint64_t rcnt = 0, forwarded = 0, dropped = 0;
+	cycles_t lat_sum = 0, lat_max = 0;
+	double cpu_mhz, msg_rate;
+	int i;
+
+	if (!user_param->mac_fwd || user_param->output != FULL_VERBOSITY)
+		return;
+
+	cpu_mhz = get_cpu_mhz(user_param->cpu_freq_f);
+
+	printf(RESULT_LINE);
+	printf(" Fwd queue  CPU    #received     #forwarded    #dropped    MsgRate[Mpps]  Lat avg[usec]  Lat max[usec]\n");
+	for (i = 0; i < user_param->num_of_qps; i++) {
+		msg_rate = 0;
+		if (queue[i].last_tx > queue[i].first_rx)
+			msg_rate = queue[i].forwarded * cpu_mhz / (queue[i].last_tx - queue[i].first_rx);
+
+		printf(" %-10d %-6d %-13" PRIu64 " %-13" PRIu64 " %-11" PRIu64 " %-14.6f %-14.3f %.3f\n",
+		       i, queue[i].cpu, queue[i].rcnt, queue[i].forwarded, queue[i].dropped, msg_rate,
+		       queue[i].forwarded ? queue[i].lat_sum / cpu_mhz / queue[i].forwarded : 0,
+		       queue[i].lat_max / cpu_mhz);
+
+		rcnt += queue[i].rcnt;
+		forwarded += queue[i].forwarded;
+		dropped += queue[i].dropped;
+		lat_sum += queue[i].lat_sum;
+		if (queue[i].lat_max > lat_max)
+			lat_max = queue[i].lat_max;
+	}
+
+	printf(" Total: received %" PRIu64 ", forwarded %" PRIu64 ", dropped %" PRIu64
+	       ", latency avg %.3f usec, max %.3f usec\n",
+	       rcnt, forwarded, dropped,
+	       forwarded ? lat_sum / cpu_mhz / forwarded : 0, lat_max / cpu_mhz);
+}
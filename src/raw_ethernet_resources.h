@@ -18,6 +18,8 @@
 #include "perftest_resources.h"
 #include "multicast_resources.h"
 #include "perftest_communication.h"
+#include "raw_ethernet_checksum.h"
+#include "raw_ethernet_pcap.h"
 
 #undef __LITTLE_ENDIAN
 #if defined(__FreeBSD__)
@@ -45,6 +47,7 @@
 #define TCP_PROTOCOL (0x06)
 #define IP_HEADER_LEN (20)
 #define DEFAULT_IPV6_NEXT_HDR (0x3b)
+#define FLOW_SCHEDULE_MIN (1 << 20)
 
 struct raw_ethernet_info {
 	uint8_t mac[6];
@@ -152,6 +155,40 @@ struct TCP_header {
 	uint16_t        th_urgptr;
 }__attribute__((packed));
 
+/* One flow of the packet template engine, all fields in network order.
+ * For IPv6 the addresses are the low 32 bits of the source/destination.
+ */
+struct flow_tuple {
+	uint32_t saddr;
+	uint32_t daddr;
+	uint16_t sport;
+	uint16_t dport;
+};
+
+/* Packet template engine.
+ * The packets on the send buffer are built once by create_raw_eth_pkt, the
+ * engine rewrites the addresses and ports of a packet from the tuple table
+ * just before it is posted, and patches the checksums incrementally.
+ */
+struct pkt_template {
+	struct flow_tuple	*tuples;
+	uint32_t		*schedule;
+	uint64_t		num_tuples;
+	uint64_t		schedule_mask;
+	uint64_t		next;
+	int			ip_check_offset;
+	int			saddr_offset;
+	int			daddr_offset;
+	int			l4_offset;
+	int			l4_check_offset;
+	int			has_l4_check;
+	int			is_udp;
+	int			is_ipv6;
+	FlowDistribution	dist;
+	cycles_t		build_cycles;
+	uint64_t		built;
+};
+
 void gen_eth_header(struct ETH_header* eth_header,uint8_t* src_mac,uint8_t* dst_mac, uint16_t eth_type);
 void print_spec(struct ibv_flow_attr* flow_rules,struct perftest_parameters* user_param);
 //void print_ethernet_header(struct ETH_header* p_ethernet_header);
@@ -251,15 +288,15 @@ void gen_ip_header(void* ip_header_buff, uint32_t* saddr, uint32_t* daddr,
 
 /* gen_udp_header .
 
- * Description :create UDP header on buffer
+ * Description :create UDP header on buffer, the checksum is set later by csum_set_l4
  *
  * Parameters :
  * 		UDP_header_buffer - Pointer to output
  *		src_port - source UDP port of the packet
  *		dst_port -destination UDP port of the packet
- *		pkt_size - size of the packet
+ *		udp_size - size of the UDP header and payload
  */
-void gen_udp_header(void* UDP_header_buffer, int src_port, int dst_port, int pkt_size);
+void gen_udp_header(void* UDP_header_buffer, int src_port, int dst_port, int udp_size);
 
 /* gen_tcp_header .
 
@@ -278,6 +315,9 @@ void gen_tcp_header(void* TCP_header_buffer,int src_port ,int dst_port);
  *
  *  In this method we receive packets and "turn them around"
  *  this is done by changing the dmac with the smac
+ *  Every QP is served by its own thread and CQs, a packet is sent back from
+ *  the buffer it was received to. In iterations mode the test ends after
+ *  iters * num_of_qps packets were forwarded on all the QPs together.
  *
  * Parameters :
  *
@@ -338,4 +378,148 @@ int set_up_fs_rules(
 		struct perftest_parameters *user_param,
 		uint64_t allocated_flows);
 
+/* pkt_template_init
+ * Description: build the tuple table and the flow schedule of the packet template engine.
+ *		The source port walks from my port to 65535 and the source address is
+ *		incremented on every wrap, the destination stays the same for all flows.
+ *
+ *	Parameters:
+ *				ctx 		- Test Context, ctx->pkt_tmpl is set on success.
+ *				user_param 	- user_parameters struct for this test
+ *				my_dest_info	- ethernet information of me
+ *				rem_dest_info	- ethernet information of the remote
+ *
+ * Return Value : SUCCESS, FAILURE.
+ */
+int pkt_template_init(struct pingpong_context *ctx,
+		struct perftest_parameters *user_param,
+		struct raw_ethernet_info *my_dest_info,
+		struct raw_ethernet_info *rem_dest_info);
+
+/* pkt_template_destroy
+ * Description: free the packet template engine of the context, if any.
+ *
+ *	Parameters:
+ *				ctx 		- Test Context.
+ */
+void pkt_template_destroy(struct pingpong_context *ctx);
+
+/* print_pkt_template_report
+ * Description: print the number of packets built by the template engine
+ *		and the average build cost per message.
+ *
+ *	Parameters:
+ *				ctx 		- Test Context.
+ *				user_param 	- user_parameters struct for this test
+ */
+void print_pkt_template_report(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* print_csum_report
+ * Description: print the receive side checksum validation counters.
+ *
+ *	Parameters:
+ *				ctx 		- Test Context.
+ *				user_param 	- user_parameters struct for this test
+ */
+void print_csum_report(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+#ifdef HAVE_RSS
+#define RSS_HASH_KEY_LEN (40)
+
+/* Toeplitz key of the RSS hash QP */
+extern const uint8_t rss_hash_key[RSS_HASH_KEY_LEN];
+
+/* rss_hash_fields
+ * Description: the packet fields the RSS hash QP hashes, the IP addresses
+ *		and the UDP/TCP ports if the test uses them.
+ *
+ *	Parameters:
+ *				user_param 	- user_parameters struct for this test
+ */
+uint64_t rss_hash_fields(struct perftest_parameters *user_param);
+#endif
+
+/* print_pcap_report
+ * Description: print the capture counters, written, truncated and dropped
+ *		packets and the time the receive loop waited for the writer.
+ *
+ *	Parameters:
+ *				ctx 		- Test Context.
+ *				user_param 	- user_parameters struct for this test
+ */
+void print_pcap_report(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* print_fwd_report
+ * Description: print the received, forwarded and dropped packets of every
+ *		forwarding queue, its message rate and the time a packet spent
+ *		in the forwarder, from its receive to its send completion.
+ *
+ *	Parameters:
+ *				ctx 		- Test Context.
+ *				user_param 	- user_parameters struct for this test
+ */
+void print_fwd_report(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* print_rss_report
+ * Description: print the packets and message rate of every RSS receive queue,
+ *		and how many of the --flows the Toeplitz hash sends to each queue.
+ *
+ *	Parameters:
+ *				ctx 		- Test Context.
+ *				user_param 	- user_parameters struct for this test
+ */
+void print_rss_report(struct pingpong_context *ctx, struct perftest_parameters *user_param);
+
+/* build_pkt_from_template
+ *
+ * Description : Rewrite the packet with the next flow of the template engine.
+ *		 The IPv4 header checksum and, when the template has one, the
+ *		 UDP/TCP checksum are updated incrementally instead of being
+ *		 computed again.
+ *
+ * Parameters :
+ *
+ *  tmpl    - the packet template engine.
+ *  pkt     - the packet, as built by create_raw_eth_pkt.
+ */
+static __inline void build_pkt_from_template(struct pkt_template *tmpl, void *pkt)
+{
+	struct flow_tuple *tuple;
+	uint16_t old[6], check;
+	uint64_t index;
+
+	if (tmpl->dist == FLOW_SEQUENTIAL) {
+		index = tmpl->next++;
+		if (tmpl->next == tmpl->num_tuples)
+			tmpl->next = 0;
+	} else {
+		index = tmpl->schedule[tmpl->next++ & tmpl->schedule_mask];
+	}
+	tuple = &tmpl->tuples[index];
+
+	/* The headers are not aligned, access them through memcpy */
+	memcpy(old, pkt + tmpl->saddr_offset, sizeof(uint32_t));
+	memcpy(&old[2], pkt + tmpl->daddr_offset, sizeof(uint32_t));
+	memcpy(&old[4], pkt + tmpl->l4_offset, 2 * sizeof(uint16_t));
+
+	if (!tmpl->is_ipv6) {
+		memcpy(&check, pkt + tmpl->ip_check_offset, sizeof(check));
+		csum_replace(&check, old, (const uint16_t*)tuple, 4);
+		memcpy(pkt + tmpl->ip_check_offset, &check, sizeof(check));
+	}
+
+	if (tmpl->has_l4_check) {
+		memcpy(&check, pkt + tmpl->l4_check_offset, sizeof(check));
+		csum_replace(&check, old, (const uint16_t*)tuple, 6);
+		/* zero means no checksum in UDP */
+		if (tmpl->is_udp && !check)
+			check = 0xFFFF;
+		memcpy(pkt + tmpl->l4_check_offset, &check, sizeof(check));
+	}
+
+	memcpy(pkt + tmpl->saddr_offset, &tuple->saddr, sizeof(uint32_t));
+	memcpy(pkt + tmpl->daddr_offset, &tuple->daddr, sizeof(uint32_t));
+	memcpy(pkt + tmpl->l4_offset, &tuple->sport, 2 * sizeof(uint16_t));
+}
+
 #endif /* RAW_ETHERNET_RESOURCES_H */
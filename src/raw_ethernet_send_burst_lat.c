@@ -225,8 +225,11 @@ int main(int argc, char *argv[])
 	/* print report (like print_report_bw) in the correct format
 	 * (as set before: FMT_LAT or FMT_LAT_DUR)
 	 */
-	if (user_param.machine == CLIENT)
+	if (user_param.machine == CLIENT) {
 		print_report_lat(&user_param);
+		if (user_param.pacer)
+			pacer_print(user_param.pacer);
+	}
 
 	/* destroy promisc flow */
 	if (user_param.use_promiscuous) {
@@ -74,6 +74,7 @@ int main(int argc, char *argv[])
 	struct ibv_flow 		**flow_sniffer = NULL;
 	#endif
 	int 				flow_index, qp_index;
+	int				num_of_rule_qps;
 	union ibv_gid mgid;
 
 	/* init default values to user's parameters */
@@ -126,14 +127,8 @@ int main(int argc, char *argv[])
 
 	}
 
-	if (user_param.use_rss) {
-		/* if num_of_qps is not even, set it to 2. */
-		if (user_param.num_of_qps % 2)
-			user_param.num_of_qps = 2;
-
-		/* add another one for rss parent QP */
-		user_param.num_of_qps += 1;
-	}
+	/* with RSS the flow rules steer the packets to the hash QP only */
+	num_of_rule_qps = user_param.use_rss ? 1 : user_param.num_of_qps;
 
 	/* Finding the IB device selected (or default if no selected). */
 	ib_dev = ctx_find_dev(&user_param.ib_devname);
@@ -199,13 +194,19 @@ int main(int argc, char *argv[])
 		for (qp_index = 0; qp_index < user_param.num_of_qps; qp_index++) {
 			create_raw_eth_pkt(&user_param, &ctx, (void*)ctx.buf[qp_index], &my_dest_info[qp_index], &rem_dest_info[qp_index]);
 		}
+
+		if (user_param.flow_tuples &&
+		    pkt_template_init(&ctx, &user_param, &my_dest_info[0], &rem_dest_info[0])) {
+			log_ebt( " Unable to build the flow tuples table\n");
+			return FAILURE;
+		}
 	}
 
 	/* create flow rules for servers/duplex clients ,  that not test raw_mcast */
 	if (!user_param.raw_mcast && (user_param.machine == SERVER || user_param.duplex)) {
 
 		/* attaching the qp to the spec */
-		for (qp_index = 0; qp_index < user_param.num_of_qps; qp_index++) {
+		for (qp_index = 0; qp_index < num_of_rule_qps; qp_index++) {
 			for (flow_index = 0; flow_index < user_param.flows; flow_index++) {
 				flow_create_result[flow_index + qp_index * user_param.flows] =
 					ibv_create_flow(ctx.qp[qp_index], flow_rules[(qp_index * user_param.flows) + flow_index]);
@@ -226,7 +227,7 @@ int main(int argc, char *argv[])
 				.flags = 0
 			};
 
-			for (qp_index = 0; qp_index < user_param.num_of_qps; qp_index++) {
+			for (qp_index = 0; qp_index < num_of_rule_qps; qp_index++) {
 				if ((flow_promisc[qp_index] = ibv_create_flow(ctx.qp[qp_index], &attr)) == NULL) {
 					perror("error");
 					log_ebt( "Couldn't attach promiscuous rule QP\n");
@@ -242,7 +243,7 @@ int main(int argc, char *argv[])
 				.flags = 0
 			};
 
-			for (qp_index = 0; qp_index < user_param.num_of_qps; qp_index++) {
+			for (qp_index = 0; qp_index < num_of_rule_qps; qp_index++) {
 				if ((flow_sniffer[qp_index] = ibv_create_flow(ctx.qp[qp_index], &attr)) == NULL) {
 					perror("error");
 					log_ebt( "Couldn't attach SNIFFER rule QP\n");
@@ -252,6 +253,22 @@ int main(int argc, char *argv[])
 		#endif /* HAVE_SNIFFER */
 	}
 
+	if (user_param.verify_csum) {
+		ALLOCATE(ctx.csum_stats, struct csum_stats, 1);
+		memset(ctx.csum_stats, 0, sizeof(struct csum_stats));
+	}
+
+	if (user_param.pcap_file) {
+		ALLOCATE(ctx.pcap, struct pcap_writer, 1);
+		if (pcap_writer_open(ctx.pcap, user_param.pcap_file, user_param.pcap_snaplen,
+				     (uint64_t)user_param.pcap_file_size * 1024 * 1024,
+				     user_param.pcap_ring, get_cpu_mhz(user_param.cpu_freq_f))) {
+			log_ebt( " Unable to open the capture file\n");
+			DEBUG_LOG(TRACE, "<<<<<<%s", __FUNCTION__);
+			return FAILURE;
+		}
+	}
+
 	/* Prepare IB resources for rtr/rts. */
 	if (ctx_connect(&ctx, NULL, &user_param, NULL)) {
 		log_ebt( " Unable to Connect the HCA's through the link\n");
@@ -320,6 +337,14 @@ int main(int argc, char *argv[])
 				return FAILURE;
 			}
 
+		#ifdef HAVE_RSS
+		} else if (user_param.use_rss) {
+
+			if(run_iter_rss_server(&ctx, &user_param)) {
+				DEBUG_LOG(TRACE, "<<<<<<%s", __FUNCTION__);
+				return FAILURE;
+			}
+		#endif
 		} else {
 
 			if(run_iter_bw_server(&ctx, &user_param)) {
@@ -329,6 +354,12 @@ int main(int argc, char *argv[])
 		}
 
 		print_report_bw(&user_param, NULL);
+		print_pkt_template_report(&ctx, &user_param);
+		print_csum_report(&ctx, &user_param);
+		print_rss_report(&ctx, &user_param);
+		print_fwd_report(&ctx, &user_param);
+		print_bi_threads_report(&ctx, &user_param);
+		print_pcap_report(&ctx, &user_param);
 	} else if (user_param.test_method == RUN_INFINITELY) {
 
 		if (user_param.machine == CLIENT)
@@ -361,7 +392,7 @@ int main(int argc, char *argv[])
 	if(user_param.machine == SERVER || user_param.duplex) {
 		/* destroy open flows */
 		for (flow_index = 0; flow_index < user_param.flows; flow_index++) {
-			for (qp_index = 0; qp_index < user_param.num_of_qps; qp_index++) {
+			for (qp_index = 0; qp_index < num_of_rule_qps; qp_index++) {
 				if (ibv_destroy_flow(flow_create_result[flow_index + qp_index * user_param.flows])) {
 					perror("error");
 					log_ebt( "Couldn't destroy flow\n");
@@ -372,7 +403,7 @@ int main(int argc, char *argv[])
 		free(flow_rules);
 
 		if (user_param.use_promiscuous) {
-			for (qp_index = 0; qp_index < user_param.num_of_qps; qp_index++) {
+			for (qp_index = 0; qp_index < num_of_rule_qps; qp_index++) {
 				if (ibv_destroy_flow(flow_promisc[qp_index])) {
 					perror("error");
 					log_ebt( "Couldn't destroy flow\n");
@@ -384,7 +415,7 @@ int main(int argc, char *argv[])
 
 		#if defined HAVE_SNIFFER
 		if (user_param.use_sniffer) {
-			for (qp_index = 0; qp_index < user_param.num_of_qps; qp_index++) {
+			for (qp_index = 0; qp_index < num_of_rule_qps; qp_index++) {
 				if (ibv_destroy_flow(flow_sniffer[qp_index])) {
 					perror("error");
 					log_ebt( "Couldn't destroy sniffer flow\n");
@@ -405,6 +436,14 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	pkt_template_destroy(&ctx);
+	free(ctx.csum_stats);
+	if (ctx.pcap) {
+		if (pcap_writer_close(ctx.pcap))
+			log_err("Failed to close the capture file\n");
+		free(ctx.pcap);
+	}
+
 	if (destroy_ctx(&ctx, &user_param)) {
 		log_ebt( "Failed to destroy_ctx\n");
 		DEBUG_LOG(TRACE, "<<<<<<%s", __FUNCTION__);
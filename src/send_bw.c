@@ -252,8 +252,14 @@ int main(int argc, char *argv[])
 	ALLOCATE(rem_dest, struct pingpong_dest, user_param.num_of_qps);
 	memset(rem_dest, 0, sizeof(struct pingpong_dest)*user_param.num_of_qps);
 
-	if (user_param.transport_type == IBV_TRANSPORT_IWARP)
+	if (user_param.transport_type == IBV_TRANSPORT_IWARP) {
 		ctx.send_rcredit = 1;
+		/* the receive credits tie the two directions, they stay in one loop */
+		if (user_param.bi_threads) {
+			printf(" --bi_threads isn't supported over iWARP, running TX and RX in one thread\n");
+			user_param.bi_threads = OFF;
+		}
+	}
 
 	/* Allocating arrays needed for the test. */
 	alloc_ctx(&ctx,&user_param);
@@ -450,6 +456,7 @@ int main(int argc, char *argv[])
 				xchg_bw_reports(&user_comm, &my_bw_rep,&rem_bw_rep,atof(user_param.rem_version));
 				print_full_bw_report(&user_param, &my_bw_rep, &rem_bw_rep);
 			}
+			print_bi_threads_report(&ctx, &user_param);
 			if (ctx_hand_shake(&user_comm,&my_dest[0],&rem_dest[0])) {
 				log_ebt("Failed to exchange data between server and clients\n");
 				return FAILURE;
@@ -500,6 +507,7 @@ int main(int argc, char *argv[])
 			xchg_bw_reports(&user_comm, &my_bw_rep,&rem_bw_rep,atof(user_param.rem_version));
 			print_full_bw_report(&user_param, &my_bw_rep, &rem_bw_rep);
 		}
+		print_bi_threads_report(&ctx, &user_param);
 
 		if (user_param.report_both && user_param.duplex) {
 			printf(RESULT_LINE);
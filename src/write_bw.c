@@ -105,12 +105,20 @@ int main(int argc, char *argv[])
 		return FAILURE;
 	}
 
+	/* the server and the client run in threads of this process */
+	if (user_param.loopback)
+		return run_loopback(&ctx, &user_param);
+
 	/* copy the relevant user parameters to the comm struct + creating rdma_cm resources. */
 	if (create_comm_struct(&user_comm,&user_param)) {
 		log_ebt(" Unable to create RDMA_CM resources\n");
 		return FAILURE;
 	}
 
+	/* the daemon accepts one client after the other on these resources */
+	if (user_param.daemon)
+		return run_daemon(&ctx, &user_param, &user_comm);
+
 	if (user_param.output == FULL_VERBOSITY && user_param.machine == SERVER) {
 		printf("\n************************************\n");
 		printf("* Waiting for client to connect... *\n");
@@ -133,6 +141,11 @@ int main(int argc, char *argv[])
 		return FAILURE;
 	}
 
+	if (daemon_session_xchg(&user_comm, &user_param)) {
+		log_ebt(" Failed to agree on the test with the daemon server\n");
+		return FAILURE;
+	}
+
 	ALLOCATE(my_dest , struct pingpong_dest , user_param.num_of_qps);
 	memset(my_dest, 0, sizeof(struct pingpong_dest)*user_param.num_of_qps);
 	ALLOCATE(rem_dest , struct pingpong_dest , user_param.num_of_qps);
@@ -222,6 +235,13 @@ int main(int argc, char *argv[])
 		return FAILURE;
 	}
 
+	if (user_param.use_lat_probe) {
+		if (lat_probe_create(&user_param.lat_probe, &ctx, &user_param, &user_comm)) {
+			log_ebt(" Failed to create the latency probe\n");
+			return FAILURE;
+		}
+	}
+
 	if (user_param.output == FULL_VERBOSITY) {
 		if (user_param.report_per_port) {
 			printf(RESULT_LINE_PER_PORT);
@@ -238,11 +258,20 @@ int main(int argc, char *argv[])
 	/* For half duplex tests, server just waits for client to exit */
 	if (user_param.machine == SERVER && !user_param.duplex) {
 
+		/* the server echoes the probes until the client is done */
+		if (user_param.lat_probe && lat_probe_start(user_param.lat_probe))
+			return FAILURE;
+
 		if (ctx_hand_shake(&user_comm,&my_dest[0],&rem_dest[0])) {
 			log_ebt(" Failed to exchange data between server and clients\n");
 			return FAILURE;
 		}
 
+		if (user_param.lat_probe && lat_probe_stop(user_param.lat_probe)) {
+			log_ebt(" The latency probe failed\n");
+			return FAILURE;
+		}
+
 		xchg_bw_reports(&user_comm, &my_bw_rep,&rem_bw_rep,atof(user_param.rem_version));
 		print_full_bw_report(&user_param, &rem_bw_rep, NULL);
 
@@ -333,11 +362,19 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		if (user_param.lat_probe && lat_probe_start(user_param.lat_probe))
+			return FAILURE;
+
 		if(run_iter_bw(&ctx,&user_param)) {
 			log_ebt(" Failed to complete run_iter_bw function successfully\n");
 			return FAILURE;
 		}
 
+		if (user_param.lat_probe && lat_probe_stop(user_param.lat_probe)) {
+			log_ebt(" The latency probe failed\n");
+			return FAILURE;
+		}
+
 		print_report_bw(&user_param,&my_bw_rep);
 
 		if (user_param.duplex) {
@@ -360,6 +397,23 @@ int main(int argc, char *argv[])
 			printf((user_param.cpu_util_data.enable ? RESULT_EXT_CPU_UTIL : RESULT_EXT));
 			print_full_bw_report(&user_param, &rem_bw_rep, NULL);
 		}
+	} else if (user_param.test_method == RUN_AUTOTUNE) {
+
+		ctx_set_send_wqes(&ctx,&user_param,rem_dest);
+
+		if (user_param.perform_warm_up) {
+			if(perform_warm_up(&ctx, &user_param)) {
+				log_ebt( "Problems with warm up\n");
+				return FAILURE;
+			}
+		}
+
+		if(run_autotune(&ctx,&user_param,rem_dest)) {
+			log_ebt(" Failed to complete run_autotune function successfully\n");
+			return FAILURE;
+		}
+
+		print_report_bw(&user_param,&my_bw_rep);
 	} else if (user_param.test_method == RUN_INFINITELY) {
 
 		ctx_set_send_wqes(&ctx,&user_param,rem_dest);
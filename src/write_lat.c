@@ -147,6 +147,11 @@ int main(int argc, char *argv[])
 		return FAILURE;
 	}
 
+	if (check_lat_depth(&user_comm, &user_param)) {
+		log_ebt(" Failed to agree on the latency queue depth\n");
+		return FAILURE;
+	}
+
 	ALLOCATE(my_dest , struct pingpong_dest , user_param.num_of_qps);
 	memset(my_dest, 0, sizeof(struct pingpong_dest)*user_param.num_of_qps);
 	ALLOCATE(rem_dest , struct pingpong_dest , user_param.num_of_qps);